@@ -140,6 +140,20 @@ void KVDKHashIteratorGetKey(KVDKHashIterator* iter, char** field_data,
   *field_len = buffer.size();
 }
 
+void KVDKHashIteratorGetValueView(KVDKHashIterator* iter,
+                                  const char** value_data, size_t* value_len) {
+  StringView view = iter->rep->ValueView();
+  *value_data = view.data();
+  *value_len = view.size();
+}
+
+void KVDKHashIteratorGetKeyView(KVDKHashIterator* iter,
+                                const char** field_data, size_t* field_len) {
+  StringView view = iter->rep->KeyView();
+  *field_data = view.data();
+  *field_len = view.size();
+}
+
 int KVDKHashIteratorMatchKey(KVDKHashIterator* iter, KVDKRegex const* re) {
   return iter->rep->MatchKey(re->rep) ? 1 : 0;
 }
@@ -247,4 +247,11 @@ void KVDKListIteratorGetValue(KVDKListIterator* iter, char** elem_data,
   *elem_data = CopyStringToChar(buffer);
   *elem_len = buffer.size();
 }
+
+void KVDKListIteratorGetValueView(KVDKListIterator* iter,
+                                  const char** elem_data, size_t* elem_len) {
+  StringView view = iter->rep->ValueView();
+  *elem_data = view.data();
+  *elem_len = view.size();
+}
 }
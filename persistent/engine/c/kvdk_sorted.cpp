@@ -91,6 +91,25 @@ KVDKSortedIterator* KVDKSortedIteratorCreate(KVDKEngine* engine,
   return result;
 }
 
+KVDKStatus KVDKSortedPartitionIteratorsCreate(KVDKEngine* engine,
+                                              const char* collection,
+                                              size_t collection_len,
+                                              KVDKSnapshot* snapshot,
+                                              size_t num_partitions,
+                                              KVDKSortedIterator** iterators,
+                                              size_t* num_iterators) {
+  std::vector<SortedIterator*> reps;
+  KVDKStatus s = engine->rep->SortedPartitionIteratorsCreate(
+      StringView{collection, collection_len}, num_partitions, &reps,
+      snapshot ? snapshot->rep : nullptr);
+  *num_iterators = reps.size();
+  for (size_t i = 0; i < reps.size(); i++) {
+    iterators[i] = new KVDKSortedIterator;
+    iterators[i]->rep = reps[i];
+  }
+  return s;
+}
+
 void KVDKSortedIteratorDestroy(KVDKEngine* engine,
                                KVDKSortedIterator* iterator) {
   if (iterator != nullptr) {
@@ -112,6 +131,11 @@ void KVDKSortedIteratorSeek(KVDKSortedIterator* iter, const char* str,
   iter->rep->Seek(std::string(str, str_len));
 }
 
+void KVDKSortedIteratorSeekForPrev(KVDKSortedIterator* iter, const char* str,
+                                   size_t str_len) {
+  iter->rep->SeekForPrev(std::string(str, str_len));
+}
+
 unsigned char KVDKSortedIteratorValid(KVDKSortedIterator* iter) {
   return iter->rep->Valid();
 }
@@ -134,4 +158,18 @@ void KVDKSortedIteratorValue(KVDKSortedIterator* iter, char** value,
   *value = CopyStringToChar(val_str);
 }
 
+void KVDKSortedIteratorKeyView(KVDKSortedIterator* iter, const char** key,
+                               size_t* key_len) {
+  StringView key_view = iter->rep->KeyView();
+  *key = key_view.data();
+  *key_len = key_view.size();
+}
+
+void KVDKSortedIteratorValueView(KVDKSortedIterator* iter, const char** value,
+                                 size_t* val_len) {
+  StringView val_view = iter->rep->ValueView();
+  *value = val_view.data();
+  *val_len = val_view.size();
+}
+
 }  // extern "C"
@@ -19,6 +19,32 @@ KVDKStatus KVDKGet(KVDKEngine* engine, const char* key, size_t key_len,
   return s;
 }
 
+KVDKStatus KVDKMultiGet(KVDKEngine* engine, size_t num_keys,
+                        const char** keys, const size_t* key_lens, char** vals,
+                        size_t* val_lens, KVDKStatus* statuses) {
+  std::vector<StringView> key_views;
+  key_views.reserve(num_keys);
+  for (size_t i = 0; i < num_keys; i++) {
+    key_views.emplace_back(keys[i], key_lens[i]);
+  }
+  std::vector<std::string> val_strs;
+  std::vector<KVDKStatus> s_vec;
+  KVDKStatus s = engine->rep->MultiGet(key_views, &val_strs, &s_vec);
+  for (size_t i = 0; i < num_keys; i++) {
+    vals[i] = nullptr;
+    val_lens[i] = 0;
+    statuses[i] = s;
+    if (s == KVDKStatus::Ok) {
+      statuses[i] = s_vec[i];
+      if (s_vec[i] == KVDKStatus::Ok) {
+        val_lens[i] = val_strs[i].size();
+        vals[i] = CopyStringToChar(val_strs[i]);
+      }
+    }
+  }
+  return s;
+}
+
 KVDKStatus KVDKPut(KVDKEngine* engine, const char* key, size_t key_len,
                    const char* val, size_t val_len,
                    const KVDKWriteOptions* write_option) {
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <algorithm>
+
 #include "alias.hpp"
 #include "kvdk/persistent/configs.hpp"
 
@@ -20,16 +22,31 @@ struct ImmutableConfigs {
   // The number of blocks in a PMem segment
   uint64_t pmem_segment_blocks;
 
+  // The number of NUMA pools, 0 for instances created before it persisted,
+  // which have a single pool
+  uint32_t pmem_numa_pools;
+
+  // Max number of pool files of each NUMA pool, which decides offsets of NUMA
+  // pools
+  uint32_t pmem_max_file_num;
+
   void AssignImmutableConfigs(Configs& configs) {
     configs.pmem_block_size = pmem_block_size;
     configs.pmem_segment_blocks = pmem_segment_blocks;
+    if (NumaPools() > 1) {
+      configs.pmem_max_file_num = pmem_max_file_num;
+    }
   }
 
+  uint32_t NumaPools() { return pmem_numa_pools == 0 ? 1 : pmem_numa_pools; }
+
   // Get persistent configs from "configs" and persist them to PMem
   // Notice: "this" should allocated on PMem
   void PersistImmutableConfigs(const Configs& configs) {
     pmem_block_size = configs.pmem_block_size;
     pmem_segment_blocks = configs.pmem_segment_blocks;
+    pmem_numa_pools = std::max<size_t>(configs.pmem_numa_dirs.size(), 1);
+    pmem_max_file_num = configs.pmem_max_file_num;
     pmem_persist(&pmem_block_size, sizeof(ImmutableConfigs) - 8);
     validation_flag = 1;
     pmem_persist(&validation_flag, 8);
@@ -12,7 +12,7 @@ static constexpr int kDataBufferSize = 1024 * 1024;
 StringRecord* StringRecord::PersistStringRecord(
     void* addr, uint32_t record_size, TimestampType timestamp, RecordType type,
     RecordStatus status, PMemOffsetType old_version, const StringView& key,
-    const StringView& value, ExpireTimeType expired_time) {
+    const StringView& value, ExpireTimeType expired_time, bool value_extents) {
   void* data_cpy_target;
   auto write_size = key.size() + value.size() + sizeof(StringRecord);
   bool with_buffer = write_size <= kDataBufferSize;
@@ -26,7 +26,7 @@ StringRecord* StringRecord::PersistStringRecord(
   }
   StringRecord::ConstructStringRecord(data_cpy_target, record_size, timestamp,
                                       type, status, old_version, key, value,
-                                      expired_time);
+                                      expired_time, value_extents);
   if (with_buffer) {
     pmem_memcpy(addr, data_cpy_target, write_size, PMEM_F_MEM_NONTEMPORAL);
     pmem_drain();
@@ -37,6 +37,18 @@ StringRecord* StringRecord::PersistStringRecord(
   return static_cast<StringRecord*>(addr);
 }
 
+StringExtentRecord* StringExtentRecord::WriteStringExtent(
+    void* addr, uint32_t record_size, TimestampType timestamp,
+    const StringView& data) {
+  DataEntry entry(0, record_size, timestamp, RecordType::StringExtent,
+                  RecordStatus::Normal, 0, data.size());
+  entry.header.checksum = Checksum(entry.meta, data);
+  pmem_memcpy(static_cast<char*>(addr) + sizeof(StringExtentRecord),
+              data.data(), data.size(), PMEM_F_MEM_NONTEMPORAL);
+  pmem_memcpy(addr, &entry, sizeof(DataEntry), PMEM_F_MEM_NONTEMPORAL);
+  return static_cast<StringExtentRecord*>(addr);
+}
+
 DLRecord* DLRecord::PersistDLRecord(
     void* addr, uint32_t record_size, TimestampType timestamp, RecordType type,
     RecordStatus status, PMemOffsetType old_version, PMemOffsetType prev,
@@ -23,6 +23,7 @@ enum RecordType : uint8_t {
   HashElem = (1 << 4),
   ListRecord = (1 << 5),
   ListElem = (1 << 6),
+  StringExtent = (1 << 7),
 };
 
 enum class RecordStatus : uint8_t {
@@ -93,8 +94,16 @@ struct DataEntry {
 };
 static_assert(sizeof(DataEntry) <= kMinPMemBlockSize);
 
+// A string record stores its value inline, or stores a large value in
+// StringExtent records and the encoded value size followed by offsets of the
+// extents inline, which is marked by kExtentsFlag in value size of the record
 struct StringRecord {
  public:
+  // Inline values are smaller than a PMem segment, so the highest bit of value
+  // size is free to mark a value stored in extents
+  static constexpr uint32_t kExtentsFlag = 1U << 31;
+  static constexpr uint64_t kMaxInlineValueSize = kExtentsFlag - 1;
+
   DataEntry entry;
   PMemOffsetType old_version;
   ExpireTimeType expired_time;
@@ -109,19 +118,23 @@ struct StringRecord {
       void* target_address, uint32_t _record_size, TimestampType _timestamp,
       RecordType _record_type, RecordStatus _record_status,
       PMemOffsetType _old_version, const StringView& _key,
-      const StringView& _value, ExpireTimeType _expired_time) {
-    StringRecord* record = new (target_address)
-        StringRecord(_record_size, _timestamp, _record_type, _record_status,
-                     _old_version, _key, _value, _expired_time);
+      const StringView& _value, ExpireTimeType _expired_time,
+      bool _value_extents = false) {
+    StringRecord* record = new (target_address) StringRecord(
+        _record_size, _timestamp, _record_type, _record_status, _old_version,
+        _key, _value, _expired_time, _value_extents);
     return record;
   }
 
   // Construct and persist a string record at pmem address "addr"
+  //
+  // value_extents: "value" is encoded extents of a large value by
+  // EncodeExtents()
   static StringRecord* PersistStringRecord(
       void* addr, uint32_t record_size, TimestampType timestamp,
       RecordType type, RecordStatus status, PMemOffsetType old_version,
       const StringView& key, const StringView& value,
-      ExpireTimeType expired_time = kPersistTime);
+      ExpireTimeType expired_time = kPersistTime, bool value_extents = false);
 
   void Destroy() { entry.Destroy(); }
 
@@ -129,8 +142,56 @@ struct StringRecord {
   StringView Key() const { return StringView(data, entry.meta.k_size); }
 
   // make sure there is data followed in data[0]
+  //
+  // Notice: this is the encoded extents if the value is stored in extents
   StringView Value() const {
-    return StringView(data + entry.meta.k_size, entry.meta.v_size);
+    return StringView(data + entry.meta.k_size, inlineSize());
+  }
+
+  bool HasExtents() const { return entry.meta.v_size & kExtentsFlag; }
+
+  // Size of a value stored in extents
+  uint64_t ExtentsValueSize() const {
+    uint64_t size;
+    memcpy_8(&size, Value().data());
+    return size;
+  }
+
+  uint64_t NumExtents() const {
+    return (inlineSize() - sizeof(uint64_t)) / sizeof(PMemOffsetType);
+  }
+
+  PMemOffsetType ExtentOffset(uint64_t i) const {
+    PMemOffsetType offset;
+    memcpy_8(&offset, Value().data() + sizeof(uint64_t) +
+                          i * sizeof(PMemOffsetType));
+    return offset;
+  }
+
+  // Return true if both records store their value in the same extents, which
+  // happens if only metadata of a string is updated
+  bool SharesExtents(const StringRecord* other) const {
+    return HasExtents() && other->HasExtents() && NumExtents() > 0 &&
+           other->NumExtents() > 0 && ExtentOffset(0) == other->ExtentOffset(0);
+  }
+
+  // Give up ownership of extents to a newer version of the string, so they
+  // are not freed along with this record
+  //
+  // Notice: the record is left invalid, only call this on an outdated version
+  void PersistDisownExtents() {
+    entry.meta.v_size &= ~kExtentsFlag;
+    pmem_persist(&entry.meta.v_size, sizeof(uint32_t));
+  }
+
+  // Encode a value of "value_size" stored in extents at "offsets" as value of
+  // a string record
+  static std::string EncodeExtents(uint64_t value_size,
+                                   const std::vector<PMemOffsetType>& offsets) {
+    std::string ret;
+    ret.append((char*)&value_size, sizeof(uint64_t));
+    ret.append((char*)offsets.data(), offsets.size() * sizeof(PMemOffsetType));
+    return ret;
   }
 
   // Check whether the record corrupted
@@ -199,9 +260,11 @@ struct StringRecord {
   StringRecord(uint32_t _record_size, TimestampType _timestamp,
                RecordType _record_type, RecordStatus _record_status,
                PMemOffsetType _old_version, const StringView& _key,
-               const StringView& _value, ExpireTimeType _expired_time)
+               const StringView& _value, ExpireTimeType _expired_time,
+               bool _value_extents)
       : entry(0, _record_size, _timestamp, _record_type, _record_status,
-              _key.size(), _value.size()),
+              _key.size(),
+              _value.size() | (_value_extents ? kExtentsFlag : 0)),
         old_version(_old_version),
         expired_time(_expired_time) {
     kvdk_assert(_record_type == RecordType::String, "");
@@ -210,22 +273,67 @@ struct StringRecord {
     entry.header.checksum = Checksum();
   }
 
+  uint32_t inlineSize() const { return entry.meta.v_size & ~kExtentsFlag; }
+
   // check validation of k_size and v_size, as record may be left corrupted
   bool ValidateRecordSize() {
-    return entry.meta.k_size + entry.meta.v_size + sizeof(StringRecord) <=
-           entry.header.record_size;
+    if (entry.meta.k_size + inlineSize() + sizeof(StringRecord) >
+        entry.header.record_size) {
+      return false;
+    }
+    return !HasExtents() ||
+           (inlineSize() >= sizeof(uint64_t) &&
+            (inlineSize() - sizeof(uint64_t)) % sizeof(PMemOffsetType) == 0);
   }
 
   uint32_t Checksum() {
     // we don't checksum expire time and old version
     uint32_t meta_checksum_size = sizeof(DataMeta);
-    uint32_t data_checksum_size = entry.meta.k_size + entry.meta.v_size;
+    uint32_t data_checksum_size = entry.meta.k_size + inlineSize();
 
     return get_checksum((char*)&entry.meta, meta_checksum_size) +
            get_checksum(data, data_checksum_size);
   }
 };
 
+// A piece of a large string value, which is owned by the string record
+// referencing it
+struct StringExtentRecord {
+ public:
+  DataEntry entry;
+  char data[0];
+
+  // Construct a string extent with "data" at pmem address "addr" with
+  // non-temporal stores, caller should pmem_drain() to persist it
+  static StringExtentRecord* WriteStringExtent(void* addr, uint32_t record_size,
+                                               TimestampType timestamp,
+                                               const StringView& data);
+
+  void Destroy() { entry.Destroy(); }
+
+  StringView Data() const { return StringView(data, entry.meta.v_size); }
+
+  bool Validate() {
+    if (sizeof(StringExtentRecord) + entry.meta.v_size <=
+        entry.header.record_size) {
+      return Checksum(entry.meta, Data()) == entry.header.checksum;
+    }
+    return false;
+  }
+
+  uint32_t GetRecordSize() const { return entry.header.record_size; }
+
+  static uint64_t RecordSize(uint64_t data_size) {
+    return data_size + sizeof(StringExtentRecord);
+  }
+
+ private:
+  static uint32_t Checksum(const DataMeta& meta, const StringView& data) {
+    return get_checksum(&meta, sizeof(DataMeta)) +
+           get_checksum(data.data(), data.size());
+  }
+};
+
 // doubly linked record
 struct DLRecord {
  public:
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <functional>
+
 #include "collection.hpp"
 #include "data_record.hpp"
 #include "kvdk/persistent/types.hpp"
@@ -138,6 +140,9 @@ class DLList {
 // Iter valid data under a snapshot in a dl list
 class DLListDataIterator {
  public:
+  // Return if a record key is in the iterating range
+  using RangeChecker = std::function<bool(const StringView& key)>;
+
   DLListDataIterator(DLList* dl_list, const PMEMAllocator* pmem_allocator,
                      const SnapshotImpl* snapshot)
       : dl_list_(dl_list),
@@ -145,6 +150,11 @@ class DLListDataIterator {
         current_(nullptr),
         snapshot_(snapshot) {}
 
+  // Bound iterating to a continuous range of the list. The iterator becomes
+  // invalid on reaching a record out of the range, without looking up its
+  // valid version or any records after it
+  void SetRange(RangeChecker in_range) { in_range_ = std::move(in_range); }
+
   void Locate(DLRecord* record, bool forward) {
     kvdk_assert(record != nullptr, "");
     current_ = record;
@@ -213,6 +223,10 @@ class DLListDataIterator {
   // Move current_ to next/prev valid version data record
   void skipInvalidRecords(bool forward) {
     while (Valid()) {
+      if (in_range_ && !in_range_(current_->Key())) {
+        current_ = nullptr;
+        break;
+      }
       DLRecord* valid_version_record = findValidVersion(current_);
       if (valid_version_record == nullptr ||
           valid_version_record->GetRecordStatus() == RecordStatus::Outdated) {
@@ -232,6 +246,7 @@ class DLListDataIterator {
   const PMEMAllocator* pmem_allocator_;
   DLRecord* current_;
   const SnapshotImpl* snapshot_;
+  RangeChecker in_range_;
 };
 
 // Iter all records in a dl list
@@ -5,12 +5,15 @@
 #include "kvdk/persistent/engine.hpp"
 
 #include "kv_engine.hpp"
+#include "sharded_engine.hpp"
 
 namespace KVDK_NAMESPACE {
 Status Engine::Open(const StringView name, Engine** engine_ptr,
                     const Configs& configs, FILE* log_file) {
   GlobalLogger.Init(log_file, configs.log_level);
-  Status s = KVEngine::Open(name, engine_ptr, configs);
+  Status s = configs.num_shards > 1 || ShardedEngine::ShardedInstance(name)
+                 ? ShardedEngine::Open(name, engine_ptr, configs)
+                 : KVEngine::Open(name, engine_ptr, configs);
   return s;
 }
 
@@ -18,7 +21,11 @@ Status Engine::Restore(const StringView engine_path,
                        const StringView backup_file, Engine** engine_ptr,
                        const Configs& configs, FILE* log_file) {
   GlobalLogger.Init(log_file, configs.log_level);
-  Status s = KVEngine::Restore(engine_path, backup_file, engine_ptr, configs);
+  Status s =
+      configs.num_shards > 1
+          ? ShardedEngine::Restore(engine_path, backup_file, engine_ptr,
+                                   configs)
+          : KVEngine::Restore(engine_path, backup_file, engine_ptr, configs);
   return s;
 }
 
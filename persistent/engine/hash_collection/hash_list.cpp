@@ -17,23 +17,32 @@ HashList::WriteResult HashList::Put(const StringView& key,
   return ret;
 }
 
-Status HashList::Get(const StringView& key, std::string* value) {
+Status HashList::Get(const StringView& key, std::string* value,
+                     TimestampType* timestamp) {
+  if (timestamp != nullptr) {
+    *timestamp = 0;
+  }
   std::string internal_key(InternalKey(key));
   auto lookup_result =
       hash_table_->Lookup<false>(internal_key, RecordType::HashElem);
-  if (lookup_result.s != Status::Ok ||
-      lookup_result.entry.GetRecordStatus() == RecordStatus::Outdated) {
+  if (lookup_result.s != Status::Ok) {
     return Status::NotFound;
   }
 
   DLRecord* pmem_record = lookup_result.entry.GetIndex().dl_record;
   kvdk_assert(pmem_record->GetRecordType() == RecordType::HashElem, "");
+  if (timestamp != nullptr) {
+    *timestamp = pmem_record->GetTimestamp();
+  }
   // As get is lockless, skiplist node may point to a new elem delete record
   // after we get it from hashtable
-  if (pmem_record->GetRecordStatus() == RecordStatus::Outdated) {
+  if (lookup_result.entry.GetRecordStatus() == RecordStatus::Outdated ||
+      pmem_record->GetRecordStatus() == RecordStatus::Outdated) {
     return Status::NotFound;
   } else {
-    value->assign(pmem_record->Value().data(), pmem_record->Value().size());
+    if (value != nullptr) {
+      value->assign(pmem_record->Value().data(), pmem_record->Value().size());
+    }
     return Status::Ok;
   }
 }
@@ -69,7 +69,12 @@ class HashList : public Collection {
                   TimestampType timestamp);
 
   // Get value of "key" from the hash list
-  Status Get(const StringView& key, std::string* value);
+  //
+  // If "timestamp" is not nullptr, it's set to timestamp of the newest record
+  // of "key" even if it's deleted, or 0 if no record found. "value" can be
+  // nullptr if only timestamp is required
+  Status Get(const StringView& key, std::string* value,
+             TimestampType* timestamp = nullptr);
 
   // Delete "key" from the hash list by replace it with a delete record
   //
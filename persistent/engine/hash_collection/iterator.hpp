@@ -26,20 +26,26 @@ class HashIteratorImpl final : public HashIterator {
 
   void Prev() final { dl_iter_.Prev(); }
 
-  std::string Key() const final {
+  std::string Key() const final { return string_view_2_string(KeyView()); }
+
+  std::string Value() const final {
+    return string_view_2_string(ValueView());
+  }
+
+  StringView KeyView() const final {
     if (!Valid()) {
       kvdk_assert(false, "Accessing data with invalid HashIterator!");
-      return std::string{};
+      return StringView{};
     }
-    return string_view_2_string(Collection::ExtractUserKey(dl_iter_.Key()));
+    return Collection::ExtractUserKey(dl_iter_.Key());
   }
 
-  std::string Value() const final {
+  StringView ValueView() const final {
     if (!Valid()) {
       kvdk_assert(false, "Accessing data with invalid HashIterator!");
-      return std::string{};
+      return StringView{};
     }
-    return string_view_2_string(dl_iter_.Value());
+    return dl_iter_.Value();
   }
 
   bool MatchKey(std::regex const& re) final {
@@ -47,7 +53,8 @@ class HashIteratorImpl final : public HashIterator {
       kvdk_assert(false, "Accessing data with invalid HashIterator!");
       return false;
     }
-    return std::regex_match(Key(), re);
+    StringView key = KeyView();
+    return std::regex_match(key.data(), key.data() + key.size(), re);
   }
 
  private:
@@ -0,0 +1,249 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright(c) 2022 Intel Corporation
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "alias.hpp"
+#include "logger.hpp"
+#include "utils/codec.hpp"
+#include "utils/utils.hpp"
+
+namespace KVDK_NAMESPACE {
+
+// "KVDKIMG2"
+constexpr uint64_t kIndexImageMagic = 0x32474d494b44564bULL;
+// String records of an image are grouped by ranges of hash slots for lazy
+// recovery, a range is the unit of restoring on demand
+constexpr uint64_t kMaxIndexImageSlotRanges = 1 << 16;
+
+// Compact image of DRAM indexes of a kvdk instance, persisted on clean shutdown
+// so the next open can restore indexes from it instead of scanning the whole
+// PMem space. Records are referred by PMem offsets rather than pointers.
+//
+// Format:
+// checksum | magic | pmem_file_size | pmem_block_size | pmem_segment_blocks |
+// num NUMA pools | offset heads | newest_ts | collection_id | hash_slots |
+// slots_per_range | num string records | string record offsets | num slot
+// ranges | slot range ends | num collection headers | collection header
+// offsets
+struct IndexImage {
+  uint64_t pmem_file_size = 0;
+  uint64_t pmem_block_size = 0;
+  uint64_t pmem_segment_blocks = 0;
+  // Offset of the first never allocated PMem segment of each NUMA pool
+  std::vector<PMemOffsetType> offset_heads;
+  // Newer than timestamps of all records on PMem
+  TimestampType newest_ts = 0;
+  CollectionIDType collection_id = 0;
+  // Number of slots of the hash table
+  uint64_t hash_slots = 0;
+  // Number of hash slots in each slot range
+  uint64_t slots_per_range = 0;
+  // Offsets of string records indexed by the hash table, ordered by their hash
+  // slots
+  std::vector<PMemOffsetType> string_records;
+  // End index of string records in each slot range, string records of the
+  // i-th range are in [slot_range_ends[i-1], slot_range_ends[i])
+  std::vector<uint64_t> slot_range_ends;
+  // Offsets of header records of sorted, list and hash collections
+  std::vector<PMemOffsetType> collection_headers;
+
+  // Persist image to "path". The image is written to a temp file and renamed
+  // to "path" after synced, so an existing "path" always holds a complete image
+  Status Persist(const std::string& path) const {
+    std::string image(sizeof(uint64_t) /* checksum */, 0);
+    image.reserve(sizeof(uint64_t) *
+                  (16 + offset_heads.size() + string_records.size() +
+                   slot_range_ends.size() + collection_headers.size()));
+    AppendUint64(&image, kIndexImageMagic);
+    AppendUint64(&image, pmem_file_size);
+    AppendUint64(&image, pmem_block_size);
+    AppendUint64(&image, pmem_segment_blocks);
+    AppendUint64(&image, offset_heads.size());
+    for (PMemOffsetType offset : offset_heads) {
+      AppendUint64(&image, offset);
+    }
+    AppendUint64(&image, newest_ts);
+    AppendUint64(&image, collection_id);
+    AppendUint64(&image, hash_slots);
+    AppendUint64(&image, slots_per_range);
+    AppendUint64(&image, string_records.size());
+    for (PMemOffsetType offset : string_records) {
+      AppendUint64(&image, offset);
+    }
+    AppendUint64(&image, slot_range_ends.size());
+    for (uint64_t end : slot_range_ends) {
+      AppendUint64(&image, end);
+    }
+    AppendUint64(&image, collection_headers.size());
+    for (PMemOffsetType offset : collection_headers) {
+      AppendUint64(&image, offset);
+    }
+    uint64_t checksum = get_checksum(image.data() + sizeof(uint64_t),
+                                     image.size() - sizeof(uint64_t));
+    memcpy(&image[0], &checksum, sizeof(uint64_t));
+
+    std::string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    if (fd < 0) {
+      GlobalLogger.Error("Create index image %s error: %s\n", tmp_path.c_str(),
+                         strerror(errno));
+      return Status::IOError;
+    }
+    size_t written = 0;
+    while (written < image.size()) {
+      ssize_t ret = write(fd, image.data() + written, image.size() - written);
+      if (ret <= 0) {
+        break;
+      }
+      written += ret;
+    }
+    bool success = (written == image.size()) && (fsync(fd) == 0);
+    close(fd);
+    if (!success || rename(tmp_path.c_str(), path.c_str()) != 0) {
+      GlobalLogger.Error("Write index image %s error: %s\n", path.c_str(),
+                         strerror(errno));
+      remove(tmp_path.c_str());
+      return Status::IOError;
+    }
+    return SyncDir(path);
+  }
+
+  // Remove image of "path" and sync its directory, so a removed image never
+  // comes back after crash
+  static Status Remove(const std::string& path) {
+    if (remove(path.c_str()) != 0 && errno != ENOENT) {
+      GlobalLogger.Error("Remove index image %s error: %s\n", path.c_str(),
+                         strerror(errno));
+      return Status::IOError;
+    }
+    return SyncDir(path);
+  }
+
+  // Sync directory of file "path" to persist its creation or removal
+  static Status SyncDir(const std::string& path) {
+    size_t pos = path.rfind('/');
+    std::string dir = pos == std::string::npos ? "." : path.substr(0, pos + 1);
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    bool success = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (!success) {
+      GlobalLogger.Error("Sync directory %s error: %s\n", dir.c_str(),
+                         strerror(errno));
+      return Status::IOError;
+    }
+    return Status::Ok;
+  }
+
+  // Load image from "path", return NotFound if no image exist, or Abort if the
+  // image is incomplete or corrupted
+  Status Load(const std::string& path) {
+    if (!file_exist(path)) {
+      return Status::NotFound;
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      GlobalLogger.Error("Open index image %s error: %s\n", path.c_str(),
+                         strerror(errno));
+      return Status::IOError;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+      GlobalLogger.Error("Index image %s is not a regular file\n",
+                         path.c_str());
+      close(fd);
+      return Status::Abort;
+    }
+    std::string image(file_stat.st_size, 0);
+    size_t read_size = 0;
+    while (read_size < image.size()) {
+      ssize_t ret = pread(fd, &image[read_size], image.size() - read_size,
+                          read_size);
+      if (ret <= 0) {
+        break;
+      }
+      read_size += ret;
+    }
+    close(fd);
+    if (read_size != image.size() || image.size() < sizeof(uint64_t)) {
+      GlobalLogger.Error("Read index image %s error\n", path.c_str());
+      return Status::Abort;
+    }
+
+    StringView view(image);
+    uint64_t checksum;
+    uint64_t magic;
+    FetchUint64(&view, &checksum);
+    if (checksum != get_checksum(view.data(), view.size())) {
+      GlobalLogger.Error("Checksum of index image %s mismatch\n",
+                         path.c_str());
+      return Status::Abort;
+    }
+
+    uint64_t num_pools;
+    uint64_t num_string_records;
+    uint64_t num_slot_ranges;
+    uint64_t num_collection_headers;
+    bool success =
+        FetchUint64(&view, &magic) && magic == kIndexImageMagic &&
+        FetchUint64(&view, &pmem_file_size) &&
+        FetchUint64(&view, &pmem_block_size) &&
+        FetchUint64(&view, &pmem_segment_blocks) &&
+        FetchUint64(&view, &num_pools) &&
+        view.size() >= num_pools * sizeof(uint64_t);
+    if (success) {
+      offset_heads.resize(num_pools);
+      for (PMemOffsetType& offset : offset_heads) {
+        FetchUint64(&view, &offset);
+      }
+      success = FetchUint64(&view, &newest_ts) &&
+                FetchUint64(&view, &collection_id) &&
+                FetchUint64(&view, &hash_slots) &&
+                FetchUint64(&view, &slots_per_range) &&
+                FetchUint64(&view, &num_string_records) &&
+                view.size() >= num_string_records * sizeof(uint64_t);
+    }
+    if (success) {
+      string_records.resize(num_string_records);
+      for (PMemOffsetType& offset : string_records) {
+        FetchUint64(&view, &offset);
+      }
+      success = FetchUint64(&view, &num_slot_ranges) &&
+                view.size() >= num_slot_ranges * sizeof(uint64_t);
+    }
+    if (success) {
+      slot_range_ends.resize(num_slot_ranges);
+      uint64_t prev_end = 0;
+      for (uint64_t& end : slot_range_ends) {
+        FetchUint64(&view, &end);
+        success &= (end >= prev_end && end <= num_string_records);
+        prev_end = end;
+      }
+      success = success && FetchUint64(&view, &num_collection_headers) &&
+                view.size() == num_collection_headers * sizeof(uint64_t);
+    }
+    if (success) {
+      collection_headers.resize(num_collection_headers);
+      for (PMemOffsetType& offset : collection_headers) {
+        FetchUint64(&view, &offset);
+      }
+    } else {
+      GlobalLogger.Error("Decode index image %s error\n", path.c_str());
+      return Status::Abort;
+    }
+    return Status::Ok;
+  }
+};
+
+}  // namespace KVDK_NAMESPACE
@@ -16,6 +16,7 @@
 #include <limits>
 #include <mutex>
 #include <thread>
+#include <unordered_set>
 
 #include "backup_log.hpp"
 #include "configs.hpp"
@@ -31,6 +32,8 @@
 namespace KVDK_NAMESPACE {
 // fsdax mode align to 2MB by default.
 constexpr uint64_t kPMEMMapSizeUnit = (1 << 21);
+// Initial size of the batch log of a thread
+constexpr size_t kMinBatchLogBytes = (64 << 10);
 
 void PendingBatch::PersistFinish() {
   num_kv = 0;
@@ -52,22 +55,41 @@ KVEngine::~KVEngine() {
   GlobalLogger.Info("Waiting bg threads exit ... \n");
   closing_ = true;
   terminateBackgroundWorks();
+  if (opened_ && configs_.persist_index_image) {
+    persistIndexImage();
+  }
   // deleteCollections();
+  for (size_t i = 0; i < engine_thread_cache_.size(); i++) {
+    auto& tc = engine_thread_cache_[i];
+    if (tc.batch_log != nullptr) {
+      pmem_unmap(tc.batch_log, tc.batch_log_size);
+      tc.batch_log = nullptr;
+    }
+  }
   ReportPMemUsage();
   GlobalLogger.Info("Instance closed\n");
 }
 
 Status KVEngine::Open(const StringView engine_path, Engine** engine_ptr,
                       const Configs& configs) {
+  return openImpl(engine_path, engine_ptr, configs,
+                  std::unordered_set<uint64_t>());
+}
+
+Status KVEngine::openImpl(
+    const StringView engine_path, Engine** engine_ptr, const Configs& configs,
+    const std::unordered_set<uint64_t>& committed_cross_shard_ids) {
   std::string engine_path_str(string_view_2_string(engine_path));
   GlobalLogger.Info("Opening kvdk instance from %s ...\n",
                     engine_path_str.c_str());
   KVEngine* engine = new KVEngine(configs);
+  engine->committed_cross_shard_ids_ = committed_cross_shard_ids;
   Status s = engine->init(engine_path_str, configs);
   if (s == Status::Ok) {
     s = engine->restoreExistingData();
   }
   if (s == Status::Ok) {
+    engine->opened_ = true;
     *engine_ptr = engine;
     engine->startBackgroundWorks();
     engine->ReportPMemUsage();
@@ -93,6 +115,7 @@ Status KVEngine::Restore(const StringView engine_path,
   }
 
   if (s == Status::Ok) {
+    engine->opened_ = true;
     *engine_ptr = engine;
     engine->startBackgroundWorks();
     engine->ReportPMemUsage();
@@ -122,6 +145,16 @@ void KVEngine::startBackgroundWorks() {
   bg_work_signals_.terminating = false;
   bg_threads_.emplace_back(&KVEngine::backgroundPMemAllocatorOrgnizer, this);
   bg_threads_.emplace_back(&KVEngine::backgroundPMemUsageReporter, this);
+  bg_threads_.emplace_back(&KVEngine::backgroundHashTableResizer, this);
+  if (configs_.pmem_compaction_usage_ratio > 0) {
+    bg_threads_.emplace_back(&KVEngine::backgroundPMemCompactor, this);
+  }
+  if (lazy_recovery_ != nullptr) {
+    lazy_recovery_->running_workers = configs_.lazy_recovery_threads;
+    for (uint32_t i = 0; i < configs_.lazy_recovery_threads; i++) {
+      bg_threads_.emplace_back(&KVEngine::backgroundLazyRecovery, this);
+    }
+  }
 
   bool close_reclaimer = false;
   TEST_SYNC_POINT_CALLBACK("KVEngine::backgroundCleaner::NothingToDo",
@@ -139,6 +172,8 @@ void KVEngine::terminateBackgroundWorks() {
     bg_work_signals_.dram_cleaner_cv.notify_all();
     bg_work_signals_.pmem_allocator_organizer_cv.notify_all();
     bg_work_signals_.pmem_usage_reporter_cv.notify_all();
+    bg_work_signals_.hash_table_resizer_cv.notify_all();
+    bg_work_signals_.pmem_compactor_cv.notify_all();
   }
   for (auto& t : bg_threads_) {
     t.join();
@@ -188,14 +223,28 @@ Status KVEngine::init(const std::string& name, const Configs& configs) {
     return s;
   }
 
+  std::vector<std::string> pmem_files;
+  if (configs_.pmem_numa_dirs.empty()) {
+    pmem_files.push_back(data_file_);
+  }
+  for (const std::string& numa_dir : configs_.pmem_numa_dirs) {
+    if (create_dir_if_missing(format_dir_path(numa_dir)) != 0) {
+      GlobalLogger.Error("Create NUMA pool dir %s error\n", numa_dir.c_str());
+      return Status::IOError;
+    }
+    pmem_files.push_back(data_file(numa_dir));
+  }
+
   pmem_allocator_.reset(PMEMAllocator::NewPMEMAllocator(
-      data_file_, configs_.pmem_file_size, configs_.pmem_segment_blocks,
-      configs_.pmem_block_size, configs_.max_access_threads,
+      pmem_files, configs_.pmem_file_size, configs_.pmem_max_file_num,
+      configs_.pmem_segment_blocks, configs_.pmem_block_size,
+      configs_.max_access_threads, configs_.pmem_slab_max_blocks,
       configs_.populate_pmem_space, configs_.use_devdax_mode,
       &version_controller_));
   hash_table_.reset(HashTable::NewHashTable(
       configs_.hash_bucket_num, configs_.num_buckets_per_slot,
-      pmem_allocator_.get(), configs_.max_access_threads));
+      configs_.max_hash_bucket_num, pmem_allocator_.get(),
+      configs_.max_access_threads));
   dllist_locks_.reset(new LockTable{1UL << 20});
   if (pmem_allocator_ == nullptr || hash_table_ == nullptr ||
       dllist_locks_ == nullptr) {
@@ -255,7 +304,8 @@ Status KVEngine::restoreData() {
       case RecordType::HashRecord:
       case RecordType::HashElem:
       case RecordType::ListRecord:
-      case RecordType::ListElem: {
+      case RecordType::ListElem:
+      case RecordType::StringExtent: {
         if (data_entry_cached.meta.status == RecordStatus::Dirty) {
           data_entry_cached.meta.type = RecordType::Empty;
         } else {
@@ -331,6 +381,13 @@ Status KVEngine::restoreData() {
         s = restoreHashElem(static_cast<DLRecord*>(recovering_pmem_record));
         break;
       }
+      case RecordType::StringExtent: {
+        // Owners of extents are known after all string records restored
+        engine_thread_cache.restored_string_extents.emplace_back(
+            pmem_allocator_->addr2offset_checked(recovering_pmem_record),
+            data_entry_cached.header.record_size);
+        break;
+      }
       default: {
         GlobalLogger.Error(
             "Invalid Record type when recovering. Trying "
@@ -354,6 +411,9 @@ bool KVEngine::validateRecord(void* data_record) {
     case RecordType::String: {
       return static_cast<StringRecord*>(data_record)->Validate();
     }
+    case RecordType::StringExtent: {
+      return static_cast<StringExtentRecord*>(data_record)->Validate();
+    }
     case RecordType::SortedRecord:
     case RecordType::SortedElem:
     case RecordType::HashRecord:
@@ -384,6 +444,15 @@ Status KVEngine::persistOrRecoverImmutableConfigs() {
     return Status::IOError;
   }
   if (configs->Valid()) {
+    if (configs->NumaPools() !=
+        std::max<size_t>(configs_.pmem_numa_dirs.size(), 1)) {
+      GlobalLogger.Error("Instance created with %u NUMA pools, but %lu "
+                         "pmem_numa_dirs configured\n",
+                         configs->NumaPools(),
+                         configs_.pmem_numa_dirs.size());
+      pmem_unmap(configs, len);
+      return Status::InvalidConfiguration;
+    }
     configs->AssignImmutableConfigs(configs_);
   }
 
@@ -408,26 +477,41 @@ Status KVEngine::Backup(const pmem::obj::string_view backup_log,
       static_cast<const SnapshotImpl*>(snapshot)->GetTimestamp();
   auto hashtable_iterator =
       hash_table_->GetIterator(0, hash_table_->GetSlotsNum());
+  std::vector<HashEntry> slot_entries;
   while (hashtable_iterator.Valid()) {
-    auto ul = hashtable_iterator.AcquireSlotLock();
-    auto slot_iter = hashtable_iterator.Slot();
-    while (slot_iter.Valid()) {
-      switch (slot_iter->GetRecordType()) {
+    // Copy hash entries of the slot without locking it, so writers to the slot
+    // are not blocked while we backup data indexed by these entries, which is
+    // protected by the backup snapshot
+    hashtable_iterator.OptimisticReadSlot([&]() {
+      slot_entries.clear();
+      auto slot_iter = hashtable_iterator.Slot();
+      while (slot_iter.Valid()) {
+        HashEntry entry(*slot_iter);
+        if (!entry.Empty() && !entry.Allocated()) {
+          slot_entries.push_back(entry);
+        }
+        slot_iter++;
+      }
+    });
+    for (const HashEntry& entry : slot_entries) {
+      switch (entry.GetRecordType()) {
         case RecordType::String: {
-          StringRecord* record = slot_iter->GetIndex().string_record;
+          StringRecord* record = entry.GetIndex().string_record;
           while (record != nullptr && record->GetTimestamp() > backup_ts) {
             record =
                 pmem_allocator_->offset2addr<StringRecord>(record->old_version);
           }
           if (record && record->GetRecordStatus() == RecordStatus::Normal &&
               !record->HasExpired()) {
-            s = backup.Append(RecordType::String, record->Key(),
-                              record->Value(), record->GetExpireTime());
+            std::string value;
+            readStringValue(record, &value);
+            s = backup.Append(RecordType::String, record->Key(), value,
+                              record->GetExpireTime());
           }
           break;
         }
         case RecordType::SortedRecord: {
-          DLRecord* header = slot_iter->GetIndex().skiplist->HeaderRecord();
+          DLRecord* header = entry.GetIndex().skiplist->HeaderRecord();
           while (header != nullptr && header->GetTimestamp() > backup_ts) {
             header =
                 pmem_allocator_->offset2addr<DLRecord>(header->old_version);
@@ -446,8 +530,9 @@ Status KVEngine::Backup(const pmem::obj::string_view backup_log,
                   static_cast<const SnapshotImpl*>(snapshot), false);
               for (skiplist_iter.SeekToFirst(); skiplist_iter.Valid();
                    skiplist_iter.Next()) {
-                s = backup.Append(RecordType::SortedElem, skiplist_iter.Key(),
-                                  skiplist_iter.Value(), kPersistTime);
+                s = backup.Append(RecordType::SortedElem,
+                                  skiplist_iter.KeyView(),
+                                  skiplist_iter.ValueView(), kPersistTime);
                 if (s != Status::Ok) {
                   break;
                 }
@@ -457,7 +542,7 @@ Status KVEngine::Backup(const pmem::obj::string_view backup_log,
           break;
         }
         case RecordType::HashRecord: {
-          DLRecord* header = slot_iter->GetIndex().hlist->HeaderRecord();
+          DLRecord* header = entry.GetIndex().hlist->HeaderRecord();
           while (header != nullptr && header->GetTimestamp() > backup_ts) {
             header =
                 pmem_allocator_->offset2addr<DLRecord>(header->old_version);
@@ -475,8 +560,8 @@ Status KVEngine::Backup(const pmem::obj::string_view backup_log,
                   false);
               for (hlist_iter.SeekToFirst(); hlist_iter.Valid();
                    hlist_iter.Next()) {
-                s = backup.Append(RecordType::HashElem, hlist_iter.Key(),
-                                  hlist_iter.Value(), kPersistTime);
+                s = backup.Append(RecordType::HashElem, hlist_iter.KeyView(),
+                                  hlist_iter.ValueView(), kPersistTime);
                 if (s != Status::Ok) {
                   break;
                 }
@@ -486,7 +571,7 @@ Status KVEngine::Backup(const pmem::obj::string_view backup_log,
           break;
         }
         case RecordType::ListRecord: {
-          DLRecord* header = slot_iter->GetIndex().list->HeaderRecord();
+          DLRecord* header = entry.GetIndex().list->HeaderRecord();
           while (header != nullptr && header->GetTimestamp() > backup_ts) {
             header =
                 pmem_allocator_->offset2addr<DLRecord>(header->old_version);
@@ -504,8 +589,8 @@ Status KVEngine::Backup(const pmem::obj::string_view backup_log,
                   false);
               for (list_iter.SeekToFirst(); list_iter.Valid();
                    list_iter.Next()) {
-                s = backup.Append(RecordType::ListElem, "", list_iter.Value(),
-                                  kPersistTime);
+                s = backup.Append(RecordType::ListElem, "",
+                                  list_iter.ValueView(), kPersistTime);
                 if (s != Status::Ok) {
                   break;
                 }
@@ -522,7 +607,6 @@ Status KVEngine::Backup(const pmem::obj::string_view backup_log,
         backup.Destroy();
         return s;
       }
-      slot_iter++;
     }
     hashtable_iterator.Next();
   }
@@ -721,27 +805,61 @@ Status KVEngine::restoreExistingData() {
       pmem_allocator_.get(), hash_table_.get(), dllist_locks_.get(),
       configs_.max_access_threads, *persist_checkpoint_));
 
-  Status s = batchWriteRollbackLogs();
+  bool rolled_back = false;
+  Status s = batchWriteRollbackLogs(&rolled_back);
   if (s != Status::Ok) {
     return s;
   }
 
-  std::vector<std::future<Status>> fs;
-  GlobalLogger.Info("Start restore data\n");
-  for (uint32_t i = 0; i < configs_.max_access_threads; i++) {
-    fs.push_back(std::async(&KVEngine::restoreData, this));
-  }
-
-  for (auto& f : fs) {
-    s = f.get();
+  // The index image only matches PMem data at the time it was persisted, so
+  // always discard it here and a later crash recovers by scanning PMem. Fail
+  // if it can't be removed durably, as restoring from a stale image drops
+  // data written after this open
+  IndexImage image;
+  Status image_status = image.Load(index_image_file());
+  if (image_status != Status::NotFound) {
+    s = IndexImage::Remove(index_image_file());
     if (s != Status::Ok) {
       return s;
     }
   }
-  fs.clear();
 
-  GlobalLogger.Info("RestoreData done: iterated %lu records\n",
-                    restored_.load());
+  uint64_t latest_version_ts = 0;
+  s = Status::NotFound;
+  if (image_status == Status::Ok && !rolled_back && !recoverToCheckpoint()) {
+    latest_version_ts = image.newest_ts;
+    s = restoreFromIndexImage(std::move(image));
+  }
+
+  if (s == Status::NotFound) {
+    std::vector<std::future<Status>> fs;
+    GlobalLogger.Info("Start restore data\n");
+    for (uint32_t i = 0; i < configs_.max_access_threads; i++) {
+      fs.push_back(std::async(&KVEngine::restoreData, this));
+    }
+
+    for (auto& f : fs) {
+      s = f.get();
+      if (s != Status::Ok) {
+        return s;
+      }
+    }
+    fs.clear();
+    freeOrphanStringExtents();
+
+    GlobalLogger.Info("RestoreData done: iterated %lu records\n",
+                      restored_.load());
+
+    if (restored_.load() > 0) {
+      for (size_t i = 0; i < engine_thread_cache_.size(); i++) {
+        auto& engine_thread_cache = engine_thread_cache_[i];
+        latest_version_ts =
+            std::max(engine_thread_cache.newest_restored_ts, latest_version_ts);
+      }
+    }
+  } else if (s != Status::Ok) {
+    return s;
+  }
 
   // restore skiplist by two optimization strategy
   auto s_ret = sorted_rebuilder_->Rebuild();
@@ -796,24 +914,417 @@ Status KVEngine::restoreExistingData() {
   }
 #endif
 
-  uint64_t latest_version_ts = 0;
-  if (restored_.load() > 0) {
-    for (size_t i = 0; i < engine_thread_cache_.size(); i++) {
-      auto& engine_thread_cache = engine_thread_cache_[i];
-      latest_version_ts =
-          std::max(engine_thread_cache.newest_restored_ts, latest_version_ts);
-    }
-  }
-
   persist_checkpoint_->Release();
   pmem_persist(persist_checkpoint_, sizeof(CheckPoint));
 
   version_controller_.Init(latest_version_ts);
   old_records_cleaner_.TryGlobalClean();
   kvdk_assert(pmem_allocator_->PMemUsageInBytes() >= 0, "Invalid PMem Usage");
+
+  if (lazy_recovery_ != nullptr) {
+    // String records are restored by background threads started after open,
+    // or on demand by accessing threads
+    hash_table_->StartLazyRestore(
+        lazy_recovery_->image.slots_per_range,
+        [this](uint64_t range_idx) { restoreImageRange(range_idx); });
+  }
   return Status::Ok;
 }
 
+DataEntry* KVEngine::imageRecord(
+    PMemOffsetType offset, const std::vector<PMemOffsetType>& offset_heads) {
+  const uint64_t block_size = configs_.pmem_block_size;
+  const uint64_t segment_size = block_size * configs_.pmem_segment_blocks;
+  if (offset % block_size != 0 ||
+      !pmem_allocator_->BeforeOffsetHead(offset, offset_heads)) {
+    return nullptr;
+  }
+  DataEntry* entry = pmem_allocator_->offset2addr_checked<DataEntry>(offset);
+  uint64_t record_size = entry->header.record_size;
+  if (record_size == 0 || record_size % block_size != 0 ||
+      offset % segment_size + record_size > segment_size) {
+    return nullptr;
+  }
+  return entry;
+}
+
+bool KVEngine::collectStringVersions(
+    PMemOffsetType offset, const std::vector<PMemOffsetType>& offset_heads,
+    std::vector<SpaceEntry>* used) {
+  const uint64_t max_records =
+      pmem_allocator_->PMemSize() / configs_.pmem_block_size;
+  uint64_t num_versions = 0;
+  StringRecord* newer = nullptr;
+  while (offset != kNullPMemOffset) {
+    DataEntry* entry = imageRecord(offset, offset_heads);
+    if (entry == nullptr || entry->meta.type != RecordType::String ||
+        ++num_versions > max_records) {
+      return false;
+    }
+    used->emplace_back(offset, entry->header.record_size);
+    StringRecord* record =
+        pmem_allocator_->offset2addr_checked<StringRecord>(offset);
+    // Extents shared with the newer version are already collected
+    bool shared = newer != nullptr && record->SharesExtents(newer);
+    newer = record;
+    for (uint64_t i = 0;
+         !shared && record->HasExtents() && i < record->NumExtents(); i++) {
+      DataEntry* extent = imageRecord(record->ExtentOffset(i), offset_heads);
+      if (extent == nullptr || extent->meta.type != RecordType::StringExtent) {
+        return false;
+      }
+      used->emplace_back(record->ExtentOffset(i), extent->header.record_size);
+    }
+    offset = record->old_version;
+  }
+  return true;
+}
+
+bool KVEngine::collectCollectionRecords(
+    PMemOffsetType header_offset,
+    const std::vector<PMemOffsetType>& offset_heads,
+    std::vector<SpaceEntry>* used) {
+  DataEntry* entry = imageRecord(header_offset, offset_heads);
+  if (entry == nullptr) {
+    return false;
+  }
+  RecordType elem_type;
+  switch (entry->meta.type) {
+    case RecordType::SortedRecord:
+      elem_type = RecordType::SortedElem;
+      break;
+    case RecordType::ListRecord:
+      elem_type = RecordType::ListElem;
+      break;
+    case RecordType::HashRecord:
+      elem_type = RecordType::HashElem;
+      break;
+    default:
+      return false;
+  }
+
+  const uint64_t max_records =
+      pmem_allocator_->PMemSize() / configs_.pmem_block_size;
+  DLRecord* header =
+      pmem_allocator_->offset2addr_checked<DLRecord>(header_offset);
+  used->emplace_back(header_offset, header->GetRecordSize());
+  PMemOffsetType prev = header_offset;
+  PMemOffsetType cur = header->next;
+  uint64_t num_elems = 0;
+  while (cur != header_offset) {
+    entry = imageRecord(cur, offset_heads);
+    if (entry == nullptr || entry->meta.type != elem_type ||
+        ++num_elems > max_records) {
+      return false;
+    }
+    DLRecord* record = pmem_allocator_->offset2addr_checked<DLRecord>(cur);
+    if (record->prev != prev) {
+      return false;
+    }
+    used->emplace_back(cur, record->GetRecordSize());
+    prev = cur;
+    cur = record->next;
+  }
+  return header->prev == prev;
+}
+
+// Sort "used_space" and return false if any of them overlapped
+static bool sortUsedSpace(std::vector<SpaceEntry>* used_space) {
+  std::sort(used_space->begin(), used_space->end(),
+            [](const SpaceEntry& a, const SpaceEntry& b) {
+              return a.offset < b.offset;
+            });
+  for (size_t i = 1; i < used_space->size(); i++) {
+    if ((*used_space)[i - 1].offset + (*used_space)[i - 1].size >
+        (*used_space)[i].offset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Status KVEngine::restoreFromIndexImage(IndexImage image) {
+  if (image.pmem_file_size != configs_.pmem_file_size ||
+      image.pmem_block_size != configs_.pmem_block_size ||
+      image.pmem_segment_blocks != configs_.pmem_segment_blocks ||
+      !pmem_allocator_->ValidOffsetHeads(image.offset_heads)) {
+    GlobalLogger.Info("Index image not match instance configs\n");
+    return Status::NotFound;
+  }
+
+  // String records are restored after open slot range by range, which requires
+  // the same hash slots as they were persisted
+  bool lazy = configs_.lazy_recovery_threads > 0 &&
+              image.hash_slots == hash_table_->GetSlotsNum() &&
+              image.slots_per_range > 0 &&
+              image.slot_range_ends.size() ==
+                  (image.hash_slots + image.slots_per_range - 1) /
+                      image.slots_per_range &&
+              image.slot_range_ends.back() == image.string_records.size();
+
+  GlobalLogger.Info("Start restore data from index image%s\n",
+                    lazy ? ", strings are restored lazily" : "");
+  const std::vector<PMemOffsetType>& offset_heads = image.offset_heads;
+  const uint64_t num_threads = configs_.max_access_threads;
+
+  // Collect PMem space of records reachable from the image. Newest string
+  // records still refer to their old versions, while old versions of
+  // collection records are dropped while rebuilding collections, so they are
+  // not collected and will be freed
+  std::vector<std::vector<SpaceEntry>> used_space(num_threads);
+  auto collect_used_space = [&](uint64_t task) -> bool {
+    std::vector<SpaceEntry>* used = &used_space[task];
+    for (size_t i = task; !lazy && i < image.string_records.size();
+         i += num_threads) {
+      if (!collectStringVersions(image.string_records[i], offset_heads,
+                                 used)) {
+        return false;
+      }
+    }
+
+    for (size_t i = task; i < image.collection_headers.size();
+         i += num_threads) {
+      if (!collectCollectionRecords(image.collection_headers[i], offset_heads,
+                                    used)) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  std::vector<std::future<bool>> collect_fs;
+  for (uint64_t i = 0; i < num_threads; i++) {
+    collect_fs.push_back(std::async(collect_used_space, i));
+  }
+  bool match = true;
+  for (auto& f : collect_fs) {
+    match &= f.get();
+  }
+
+  std::vector<SpaceEntry> all_used_space;
+  if (match) {
+    for (auto& used : used_space) {
+      all_used_space.insert(all_used_space.end(), used.begin(), used.end());
+      std::vector<SpaceEntry>().swap(used);
+    }
+    match = sortUsedSpace(&all_used_space);
+  }
+  if (!match) {
+    GlobalLogger.Info("Index image not match data on PMem\n");
+    return Status::NotFound;
+  }
+
+  pmem_allocator_->RestoreOffsetHeads(offset_heads);
+  restored_.fetch_add(all_used_space.size());
+  if (!lazy) {
+    pmem_allocator_->FreeUnusedSpace(offset_heads, all_used_space);
+    std::vector<SpaceEntry>().swap(all_used_space);
+  }
+
+  auto restore_index = [&](uint64_t task) -> Status {
+    this_thread.id = next_recovery_tid_.fetch_add(1);
+    for (size_t i = task; !lazy && i < image.string_records.size();
+         i += num_threads) {
+      StringRecord* record = pmem_allocator_->offset2addr_checked<StringRecord>(
+          image.string_records[i]);
+      Status s = hash_table_->RestoreInsert(
+          record->Key(), RecordType::String, record->GetRecordStatus(), record,
+          PointerType::StringRecord);
+      if (s != Status::Ok) {
+        if (s == Status::Abort) {
+          GlobalLogger.Error("Duplicated string record in index image\n");
+        }
+        return s;
+      }
+    }
+
+    for (size_t i = task; i < image.collection_headers.size();
+         i += num_threads) {
+      DLRecord* header = pmem_allocator_->offset2addr_checked<DLRecord>(
+          image.collection_headers[i]);
+      Status s;
+      switch (header->GetRecordType()) {
+        case RecordType::SortedRecord:
+          s = restoreSortedHeader(header);
+          break;
+        case RecordType::ListRecord:
+          s = listRestoreList(header);
+          break;
+        default:
+          s = restoreHashHeader(header);
+          break;
+      }
+      if (s != Status::Ok) {
+        return s;
+      }
+    }
+    return Status::Ok;
+  };
+
+  std::vector<std::future<Status>> restore_fs;
+  for (uint64_t i = 0; i < num_threads; i++) {
+    restore_fs.push_back(std::async(restore_index, i));
+  }
+  Status s = Status::Ok;
+  for (auto& f : restore_fs) {
+    Status ret = f.get();
+    if (ret != Status::Ok) {
+      s = ret;
+    }
+  }
+  if (s != Status::Ok) {
+    return s;
+  }
+
+  if (collection_id_.load() < image.collection_id) {
+    collection_id_.store(image.collection_id);
+  }
+  GlobalLogger.Info(
+      "Restore data from index image done: %lu strings, %lu collections\n",
+      lazy ? 0 : image.string_records.size(), image.collection_headers.size());
+
+  if (lazy) {
+    std::vector<PMemOffsetType>().swap(image.collection_headers);
+    lazy_recovery_.reset(new LazyRecovery);
+    lazy_recovery_->image = std::move(image);
+    lazy_recovery_->used_space = std::move(all_used_space);
+  }
+  return Status::Ok;
+}
+
+void KVEngine::restoreImageRange(uint64_t range_idx) {
+  const IndexImage& image = lazy_recovery_->image;
+  uint64_t begin = range_idx == 0 ? 0 : image.slot_range_ends[range_idx - 1];
+  uint64_t end = image.slot_range_ends[range_idx];
+  std::vector<SpaceEntry> used;
+  for (uint64_t i = begin; i < end; i++) {
+    size_t num_used = used.size();
+    // The instance is already serving, so we can't fall back to scan PMem
+    // here. Skip unmatched records and keep their space unfreed
+    if (!collectStringVersions(image.string_records[i], image.offset_heads,
+                               &used)) {
+      GlobalLogger.Error("String record at %lu in index image not match "
+                         "data on PMem\n",
+                         image.string_records[i]);
+      lazy_recovery_->corrupted = true;
+      used.resize(num_used);
+      continue;
+    }
+    StringRecord* record = pmem_allocator_->offset2addr_checked<StringRecord>(
+        image.string_records[i]);
+    Status s = hash_table_->RestoreInsert(record->Key(), RecordType::String,
+                                          record->GetRecordStatus(), record,
+                                          PointerType::StringRecord);
+    if (s != Status::Ok) {
+      GlobalLogger.Error("Restore string record at %lu from index image "
+                         "failed: %d\n",
+                         image.string_records[i], s);
+      lazy_recovery_->corrupted = true;
+      used.resize(num_used);
+    }
+  }
+
+  std::lock_guard<SpinMutex> lg(lazy_recovery_->used_space_lock);
+  lazy_recovery_->used_space.insert(lazy_recovery_->used_space.end(),
+                                    used.begin(), used.end());
+  lazy_recovery_->num_restored += end - begin;
+}
+
+void KVEngine::backgroundLazyRecovery() {
+  TEST_SYNC_POINT("KVEngine::backgroundLazyRecovery::Start");
+  // Ranges are restored regardless of closing, as PMem space not used by the
+  // image can only be freed after all of them restored
+  uint64_t num_ranges = hash_table_->GetLazyRestoreRangesNum();
+  while (true) {
+    uint64_t range_idx = lazy_recovery_->next_range.fetch_add(1);
+    if (range_idx >= num_ranges) {
+      break;
+    }
+    // Overflow hash buckets are allocated from per-access-thread cache
+    auto thread_holder = AcquireAccessThread();
+    hash_table_->RestoreRange(range_idx);
+  }
+
+  // The last worker finishes lazy recovery after all ranges restored
+  if (lazy_recovery_->running_workers.fetch_sub(1) == 1) {
+    hash_table_->FinishLazyRestore();
+    std::vector<SpaceEntry>& used_space = lazy_recovery_->used_space;
+    if (!lazy_recovery_->corrupted && sortUsedSpace(&used_space)) {
+      pmem_allocator_->FreeUnusedSpace(lazy_recovery_->image.offset_heads,
+                                       used_space);
+    } else {
+      GlobalLogger.Error(
+          "Index image not match data on PMem, its unused space not freed\n");
+    }
+    GlobalLogger.Info("Lazy recovery done: restored %lu strings\n",
+                      lazy_recovery_->num_restored.load());
+    std::vector<SpaceEntry>().swap(used_space);
+    std::vector<PMemOffsetType>().swap(lazy_recovery_->image.string_records);
+    std::vector<uint64_t>().swap(lazy_recovery_->image.slot_range_ends);
+  }
+}
+
+void KVEngine::persistIndexImage() {
+  IndexImage image;
+  image.pmem_file_size = configs_.pmem_file_size;
+  image.pmem_block_size = configs_.pmem_block_size;
+  image.pmem_segment_blocks = configs_.pmem_segment_blocks;
+  image.offset_heads = pmem_allocator_->OffsetHeads();
+  image.newest_ts = version_controller_.GetCurrentTimestamp();
+  image.collection_id = collection_id_.load();
+  image.hash_slots = hash_table_->GetSlotsNum();
+  image.slots_per_range =
+      std::max<uint64_t>(image.hash_slots / kMaxIndexImageSlotRanges, 1);
+
+  auto hashtable_iter = hash_table_->GetIterator(0, hash_table_->GetSlotsNum());
+  uint64_t slot_idx = 0;
+  while (hashtable_iter.Valid()) {
+    auto slot_lock(hashtable_iter.AcquireSlotLock());
+    auto slot_iter = hashtable_iter.Slot();
+    while (slot_iter.Valid()) {
+      if (!slot_iter->Empty() && !slot_iter->Allocated() &&
+          slot_iter->GetIndexType() == PointerType::StringRecord) {
+        image.string_records.push_back(pmem_allocator_->addr2offset_checked(
+            slot_iter->GetIndex().string_record));
+      }
+      slot_iter++;
+    }
+    hashtable_iter.Next();
+    slot_idx++;
+    if (slot_idx % image.slots_per_range == 0 ||
+        slot_idx == image.hash_slots) {
+      image.slot_range_ends.push_back(image.string_records.size());
+    }
+  }
+
+  // Destroyed or expired collections are kept in the image, so they can be
+  // cleaned while rebuilding collections
+  for (auto& skiplist : skiplists_) {
+    if (skiplist.second) {
+      image.collection_headers.push_back(pmem_allocator_->addr2offset_checked(
+          skiplist.second->HeaderRecord()));
+    }
+  }
+  for (auto& list : lists_) {
+    if (list.second) {
+      image.collection_headers.push_back(
+          pmem_allocator_->addr2offset_checked(list.second->HeaderRecord()));
+    }
+  }
+  for (auto& hlist : hlists_) {
+    if (hlist.second) {
+      image.collection_headers.push_back(
+          pmem_allocator_->addr2offset_checked(hlist.second->HeaderRecord()));
+    }
+  }
+
+  if (image.Persist(index_image_file()) == Status::Ok) {
+    GlobalLogger.Info(
+        "Persist index image done: %lu strings, %lu collections\n",
+        image.string_records.size(), image.collection_headers.size());
+  }
+}
+
 Status KVEngine::checkConfigs(const Configs& configs) {
   auto is_2pown = [](uint64_t n) { return (n > 0) && (n & (n - 1)) == 0; };
 
@@ -843,6 +1354,37 @@ Status KVEngine::checkConfigs(const Configs& configs) {
     return Status::InvalidConfiguration;
   }
 
+  if (configs.pmem_slab_max_blocks >= configs.pmem_segment_blocks) {
+    GlobalLogger.Error(
+        "pmem_slab_max_blocks should smaller than pmem_segment_blocks\n");
+    return Status::InvalidConfiguration;
+  }
+
+  if (configs.pmem_compaction_usage_ratio < 0 ||
+      configs.pmem_compaction_usage_ratio >= 1) {
+    GlobalLogger.Error("pmem_compaction_usage_ratio should in [0, 1)\n");
+    return Status::InvalidConfiguration;
+  }
+
+  if (configs.pmem_max_file_num == 0 ||
+      (configs.use_devdax_mode && configs.pmem_max_file_num != 1)) {
+    GlobalLogger.Error(
+        "pmem_max_file_num should be 1 in devdax mode and at least 1 else\n");
+    return Status::InvalidConfiguration;
+  }
+
+  if (configs.use_devdax_mode && !configs.pmem_numa_dirs.empty()) {
+    GlobalLogger.Error("pmem_numa_dirs is not supported in devdax mode\n");
+    return Status::InvalidConfiguration;
+  }
+
+  if ((configs.pmem_max_file_num > 1 || configs.pmem_numa_dirs.size() > 1) &&
+      configs.pmem_file_size % kPMemMapAlignment != 0) {
+    GlobalLogger.Error(
+        "pmem file size should align to 2MB with multiple pool files\n");
+    return Status::InvalidConfiguration;
+  }
+
   if (configs.pmem_segment_blocks * configs.pmem_block_size *
           configs.max_access_threads >
       configs.pmem_file_size) {
@@ -870,26 +1412,55 @@ Status KVEngine::checkConfigs(const Configs& configs) {
     return Status::InvalidConfiguration;
   }
 
+  if (!is_2pown(configs.max_hash_bucket_num) ||
+      configs.max_hash_bucket_num >= ((uint64_t)1 << 32) ||
+      configs.max_hash_bucket_num < configs.hash_bucket_num) {
+    GlobalLogger.Error(
+        "max_hash_bucket_num should be 2^n, smaller than 2^32 and not smaller "
+        "than hash_bucket_num\n");
+    return Status::InvalidConfiguration;
+  }
+
+  if (configs.hash_table_max_load_factor < 0) {
+    GlobalLogger.Error("hash_table_max_load_factor should not be negative\n");
+    return Status::InvalidConfiguration;
+  }
+
   return Status::Ok;
 }
 
-Status KVEngine::maybeInitBatchLogFile() {
+Status KVEngine::reserveBatchLog(size_t num_entries) {
   kvdk_assert(ThreadManager::ThreadID() >= 0, "");
   auto work_id = ThreadManager::ThreadID() % configs_.max_access_threads;
   auto& tc = engine_thread_cache_[work_id];
-  if (tc.batch_log == nullptr) {
-    int is_pmem;
-    size_t mapped_len;
-    std::string log_file_name = batch_log_dir_ + std::to_string(work_id);
-    void* addr = pmem_map_file(log_file_name.c_str(), BatchWriteLog::MaxBytes(),
-                               PMEM_FILE_CREATE, 0666, &mapped_len, &is_pmem);
-    if (addr == NULL) {
-      GlobalLogger.Error("Fail to Init BatchLog file. %s\n", strerror(errno));
-      return Status::PMemMapFileError;
-    }
-    kvdk_assert(is_pmem != 0 && mapped_len >= BatchWriteLog::MaxBytes(), "");
-    tc.batch_log = static_cast<char*>(addr);
+  size_t bytes = BatchWriteLog::MaxBytes(num_entries);
+  if (tc.batch_log != nullptr && tc.batch_log_size >= bytes) {
+    return Status::Ok;
+  }
+  // The batch log of a thread is mapped on its first batch, and grows to the
+  // largest batch of the thread. It's not processing here, so it can be
+  // remapped
+  size_t new_size = std::max(tc.batch_log_size, kMinBatchLogBytes);
+  while (new_size < bytes) {
+    new_size *= 2;
+  }
+  if (tc.batch_log != nullptr) {
+    pmem_unmap(tc.batch_log, tc.batch_log_size);
+    tc.batch_log = nullptr;
+    tc.batch_log_size = 0;
   }
+  int is_pmem;
+  size_t mapped_len;
+  std::string log_file_name = batch_log_dir_ + std::to_string(work_id);
+  void* addr = pmem_map_file(log_file_name.c_str(), new_size, PMEM_FILE_CREATE,
+                             0666, &mapped_len, &is_pmem);
+  if (addr == NULL) {
+    GlobalLogger.Error("Fail to Init BatchLog file. %s\n", strerror(errno));
+    return Status::PMemMapFileError;
+  }
+  kvdk_assert(is_pmem != 0 && mapped_len >= new_size, "");
+  tc.batch_log = static_cast<char*>(addr);
+  tc.batch_log_size = mapped_len;
   return Status::Ok;
 }
 
@@ -910,26 +1481,140 @@ Status KVEngine::CommitTransaction(TransactionImpl* txn) {
                         false /* key should already been locked by txn */);
 }
 
-Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch, bool lock_key) {
-  if (batch.Size() > BatchWriteLog::Capacity()) {
-    return Status::InvalidBatchSize;
-  }
+Status KVEngine::CommitTransaction(OptimisticTransactionImpl* txn) {
+  const WriteBatchImpl* batch = txn->GetBatch();
+  kvdk_assert(batch != nullptr, "");
+  return batchWriteImpl(*batch, true, &txn->GetReads());
+}
 
+Status KVEngine::TransactionGet(TransactionRead* read, std::string* value) {
   auto thread_holder = AcquireAccessThread();
 
-  Status s = maybeInitBatchLogFile();
+  if (!checkKeySize(read->key)) {
+    return Status::InvalidDataSize;
+  }
+  auto holder = version_controller_.GetLocalSnapshotHolder();
+  return transactionRead(*read, value, &read->timestamp);
+}
+
+Status KVEngine::transactionRead(const TransactionRead& read,
+                                 std::string* value, TimestampType* timestamp) {
+  *timestamp = 0;
+  if (read.type == RecordType::String) {
+    auto ret = lookupKey<false>(read.key, RecordType::String);
+    if (ret.s == Status::Ok || ret.s == Status::Outdated) {
+      StringRecord* string_record = ret.entry.GetIndex().string_record;
+      *timestamp = string_record->GetTimestamp();
+      if (ret.s == Status::Ok && value != nullptr) {
+        readStringValue(string_record, value);
+      }
+    }
+    return ret.s == Status::Outdated ? Status::NotFound : ret.s;
+  }
+
+  if (read.type == RecordType::SortedElem) {
+    auto ret = lookupKey<false>(read.collection, RecordType::SortedRecord);
+    if (ret.s != Status::Ok) {
+      return ret.s == Status::Outdated ? Status::NotFound : ret.s;
+    }
+    return ret.entry.GetIndex().skiplist->Get(read.key, value, timestamp);
+  }
+
+  kvdk_assert(read.type == RecordType::HashElem, "");
+  HashList* hlist;
+  Status s = hashListFind(read.collection, &hlist);
+  if (s != Status::Ok) {
+    return s;
+  }
+  return hlist->Get(read.key, value, timestamp);
+}
+
+Status KVEngine::validateTransactionReads(
+    const std::vector<TransactionRead>& reads,
+    const std::vector<std::unique_lock<SeqSpinMutex>>& guard) {
+  std::unordered_set<const SeqSpinMutex*> locked;
+  for (auto const& ul : guard) {
+    locked.insert(ul.mutex());
+  }
+
+  for (auto const& read : reads) {
+    // A read key locked by others may be being updated. Elements of a not
+    // existing collection are checked by lock of the collection
+    std::string internal_key;
+    StringView lock_key = read.key;
+    if (read.type == RecordType::SortedElem) {
+      lock_key = read.collection;
+      auto ret = lookupKey<false>(read.collection, RecordType::SortedRecord);
+      if (ret.s == Status::Ok) {
+        internal_key = ret.entry.GetIndex().skiplist->InternalKey(read.key);
+        lock_key = internal_key;
+      }
+    } else if (read.type == RecordType::HashElem) {
+      lock_key = read.collection;
+      HashList* hlist;
+      if (hashListFind(read.collection, &hlist) == Status::Ok) {
+        internal_key = hlist->InternalKey(read.key);
+        lock_key = internal_key;
+      }
+    }
+    SeqSpinMutex* spin = hash_table_->GetLock(lock_key);
+    if (locked.count(spin) == 0 && spin->IsLocked()) {
+      return Status::Abort;
+    }
+
+    TimestampType timestamp;
+    transactionRead(read, nullptr, &timestamp);
+    if (timestamp != read.timestamp) {
+      return Status::Abort;
+    }
+  }
+  return Status::Ok;
+}
+
+Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch, bool lock_key,
+                                const std::vector<TransactionRead>* reads) {
+  BatchWriteContext ctx(this);
+  Status s = batchWritePrepare(batch, lock_key, reads, &ctx);
   if (s != Status::Ok) {
     return s;
   }
 
-  // Prevent collection and nodes in double linked lists from being deleted
-  auto access_token = version_controller_.GetLocalSnapshotHolder();
+  // Persist the log with logs of concurrent batches, and commit them as a
+  // group
+  auto& tc = engine_thread_cache_[ThreadManager::ThreadID() %
+                                  configs_.max_access_threads];
+  BatchWriteGroup::Writer writer(&ctx.log, tc.batch_log, tc.batch_log_size);
+  batch_write_group_.Join(&writer);
+
+  // After preparation stage, no runtime error is allowed for now,
+  // otherwise we have to perform runtime rollback.
+  batchWriteRecords(&ctx);
+
+  TEST_CRASH_POINT("KVEngine::batchWriteImpl::BeforeCommit", "");
+
+  batch_write_group_.Commit(&writer);
+
+  batchWritePublish(&ctx);
+  return Status::Ok;
+}
 
-  std::vector<StringWriteArgs> string_args;
+Status KVEngine::batchWritePrepare(WriteBatchImpl const& batch, bool lock_key,
+                                   const std::vector<TransactionRead>* reads,
+                                   BatchWriteContext* ctx) {
+  if (batch.Size() > BatchWriteLog::Capacity()) {
+    return Status::InvalidBatchSize;
+  }
+
+  Status s = reserveBatchLog(batch.Size());
+  if (s != Status::Ok) {
+    return s;
+  }
+
+  auto& string_args = ctx->string_args;
+  auto& sorted_args = ctx->sorted_args;
+  auto& hash_args = ctx->hash_args;
   string_args.reserve(batch.StringOps().size());
-  std::vector<SortedWriteArgs> sorted_args;
   sorted_args.reserve(batch.SortedOps().size());
-  std::vector<HashWriteArgs> hash_args;
   hash_args.reserve(batch.HashOps().size());
 
   for (auto const& string_op : batch.StringOps()) {
@@ -966,59 +1651,46 @@ Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch, bool lock_key) {
         hlist->InitWriteArgs(hash_op.key, hash_op.value, hash_op.op));
   }
 
-  // Keys/internal keys to be locked on HashTable
-  std::vector<std::string> keys_to_lock;
+  // Keys/internal keys to be locked on HashTable. String keys are locked by
+  // views of the batch, and only internal keys of collection elements are
+  // built
+  std::vector<StringView> keys_to_lock;
+  std::vector<std::string> internal_keys;
   if (lock_key) {
+    keys_to_lock.reserve(batch.Size());
+    internal_keys.reserve(sorted_args.size() + hash_args.size());
     for (auto const& string_op : batch.StringOps()) {
       keys_to_lock.push_back(string_op.key);
     }
     for (auto const& arg : sorted_args) {
-      keys_to_lock.push_back(arg.skiplist->InternalKey(arg.key));
+      internal_keys.push_back(arg.skiplist->InternalKey(arg.key));
+      keys_to_lock.push_back(internal_keys.back());
     }
     for (auto const& arg : hash_args) {
-      keys_to_lock.push_back(arg.hlist->InternalKey(arg.key));
+      internal_keys.push_back(arg.hlist->InternalKey(arg.key));
+      keys_to_lock.push_back(internal_keys.back());
     }
   }
 
-  auto guard = hash_table_->RangeLock(keys_to_lock);
+  ctx->guard = hash_table_->RangeLock(keys_to_lock);
   keys_to_lock.clear();
+  internal_keys.clear();
 
-  // Lookup keys, allocate space according to result.
-  auto ReleaseResources = [&]() {
-  // Don't Free() if we simulate a crash.
-#ifndef KVDK_ENABLE_CRASHPOINT
-    for (auto iter = hash_args.rbegin(); iter != hash_args.rend(); ++iter) {
-      pmem_allocator_->Free(iter->space);
-      if (iter->lookup_result.entry_ptr->Allocated()) {
-        kvdk_assert(iter->lookup_result.s == Status::NotFound, "");
-        iter->lookup_result.entry_ptr->Clear();
-      }
-    }
-    for (auto iter = sorted_args.rbegin(); iter != sorted_args.rend(); ++iter) {
-      pmem_allocator_->Free(iter->space);
-      if (iter->lookup_result.entry_ptr->Allocated()) {
-        kvdk_assert(iter->lookup_result.s == Status::NotFound, "");
-        iter->lookup_result.entry_ptr->Clear();
-      }
-    }
-    for (auto iter = string_args.rbegin(); iter != string_args.rend(); ++iter) {
-      pmem_allocator_->Free(iter->space);
-      if (iter->res.entry_ptr->Allocated()) {
-        kvdk_assert(iter->res.s == Status::NotFound, "");
-        iter->res.entry_ptr->Clear();
-      }
+  if (reads != nullptr) {
+    Status s = validateTransactionReads(*reads, ctx->guard);
+    if (s != Status::Ok) {
+      return s;
     }
-#endif
-  };
-
-  defer(ReleaseResources());
+  }
 
   // Prevent generating snapshot newer than this WriteBatch
-  auto bw_token = version_controller_.GetBatchWriteToken();
+  ctx->bw_token.reset(new VersionController::BatchWriteToken(
+      version_controller_.GetBatchWriteToken()));
+  TimestampType ts = ctx->bw_token->Timestamp();
 
   // Prepare for Strings
   for (auto& args : string_args) {
-    Status s = stringWritePrepare(args, bw_token.Timestamp());
+    Status s = stringWritePrepare(args, ts);
     if (s != Status::Ok) {
       return s;
     }
@@ -1026,7 +1698,7 @@ Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch, bool lock_key) {
 
   // Prepare for Sorted Elements
   for (auto& args : sorted_args) {
-    Status s = sortedWritePrepare(args, bw_token.Timestamp());
+    Status s = sortedWritePrepare(args, ts);
     if (s != Status::Ok) {
       return s;
     }
@@ -1034,17 +1706,15 @@ Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch, bool lock_key) {
 
   // Prepare for Hash Elements
   for (auto& args : hash_args) {
-    Status s = hashWritePrepare(args, bw_token.Timestamp());
+    Status s = hashWritePrepare(args, ts);
     if (s != Status::Ok) {
       return s;
     }
   }
 
-  // Preparation done. Persist BatchLog for rollback.
-  BatchWriteLog log;
-  log.SetTimestamp(bw_token.Timestamp());
-  auto& tc = engine_thread_cache_[ThreadManager::ThreadID() %
-                                  configs_.max_access_threads];
+  // Preparation done. Build BatchLog for rollback.
+  BatchWriteLog& log = ctx->log;
+  log.SetTimestamp(ts);
   for (auto& args : string_args) {
     if (args.space.size == 0) {
       continue;
@@ -1077,15 +1747,12 @@ Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch, bool lock_key) {
     }
   }
 
-  log.EncodeTo(tc.batch_log);
-
-  BatchWriteLog::MarkProcessing(tc.batch_log);
-
-  // After preparation stage, no runtime error is allowed for now,
-  // otherwise we have to perform runtime rollback.
+  return Status::Ok;
+}
 
+void KVEngine::batchWriteRecords(BatchWriteContext* ctx) {
   // Write Strings
-  for (auto& args : string_args) {
+  for (auto& args : ctx->string_args) {
     if (args.space.size == 0) {
       continue;
     }
@@ -1094,7 +1761,7 @@ Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch, bool lock_key) {
   }
 
   // Write Sorted Elems
-  for (auto& args : sorted_args) {
+  for (auto& args : ctx->sorted_args) {
     if (args.space.size == 0) {
       continue;
     }
@@ -1103,18 +1770,16 @@ Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch, bool lock_key) {
   }
 
   // Write Hash Elems
-  for (auto& args : hash_args) {
+  for (auto& args : ctx->hash_args) {
     if (args.space.size == 0) {
       continue;
     }
     Status s = hashListWrite(args);
     kvdk_assert(s == Status::Ok, "");
   }
+}
 
-  TEST_CRASH_POINT("KVEngine::batchWriteImpl::BeforeCommit", "");
-
-  BatchWriteLog::MarkCommitted(tc.batch_log);
-
+void KVEngine::batchWritePublish(BatchWriteContext* ctx) {
   // Publish stages is where Strings and Collections make BatchWrite
   // visible to other threads.
   // This stage allows no failure during runtime,
@@ -1122,7 +1787,7 @@ Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch, bool lock_key) {
   // Crash is tolerated as BatchWrite will be recovered.
 
   // Publish Strings to HashTable
-  for (auto const& args : string_args) {
+  for (auto const& args : ctx->string_args) {
     if (args.space.size == 0) {
       continue;
     }
@@ -1131,7 +1796,7 @@ Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch, bool lock_key) {
   }
 
   // Publish Sorted Elements to HashTable
-  for (auto const& args : sorted_args) {
+  for (auto const& args : ctx->sorted_args) {
     if (args.space.size == 0) {
       continue;
     }
@@ -1140,7 +1805,7 @@ Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch, bool lock_key) {
   }
 
   // Publish Hash Elements to HashTable
-  for (auto& args : hash_args) {
+  for (auto& args : ctx->hash_args) {
     if (args.space.size == 0) {
       continue;
     }
@@ -1148,14 +1813,43 @@ Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch, bool lock_key) {
     kvdk_assert(s == Status::Ok, "");
   }
 
-  hash_args.clear();
-  sorted_args.clear();
-  string_args.clear();
+  ctx->hash_args.clear();
+  ctx->sorted_args.clear();
+  ctx->string_args.clear();
+}
 
-  return Status::Ok;
+void KVEngine::batchWriteRelease([[gnu::unused]] BatchWriteContext* ctx) {
+  // Don't Free() if we simulate a crash.
+#ifndef KVDK_ENABLE_CRASHPOINT
+  auto& hash_args = ctx->hash_args;
+  for (auto iter = hash_args.rbegin(); iter != hash_args.rend(); ++iter) {
+    pmem_allocator_->Free(iter->space);
+    if (iter->lookup_result.entry_ptr->Allocated()) {
+      kvdk_assert(iter->lookup_result.s == Status::NotFound, "");
+      iter->lookup_result.entry_ptr->Clear();
+    }
+  }
+  auto& sorted_args = ctx->sorted_args;
+  for (auto iter = sorted_args.rbegin(); iter != sorted_args.rend(); ++iter) {
+    pmem_allocator_->Free(iter->space);
+    if (iter->lookup_result.entry_ptr->Allocated()) {
+      kvdk_assert(iter->lookup_result.s == Status::NotFound, "");
+      iter->lookup_result.entry_ptr->Clear();
+    }
+  }
+  auto& string_args = ctx->string_args;
+  for (auto iter = string_args.rbegin(); iter != string_args.rend(); ++iter) {
+    pmem_allocator_->Free(iter->space);
+    pmem_allocator_->BatchFree(iter->extents);
+    if (iter->res.entry_ptr->Allocated()) {
+      kvdk_assert(iter->res.s == Status::NotFound, "");
+      iter->res.entry_ptr->Clear();
+    }
+  }
+#endif
 }
 
-Status KVEngine::batchWriteRollbackLogs() {
+Status KVEngine::batchWriteRollbackLogs(bool* rolled_back) {
   DIR* dir = opendir(batch_log_dir_.c_str());
   if (dir == NULL) {
     GlobalLogger.Error("Fail to opendir in batchWriteRollbackLogs. %s\n",
@@ -1171,18 +1865,43 @@ Status KVEngine::batchWriteRollbackLogs() {
     std::string log_file_path = batch_log_dir_ + fname;
     size_t mapped_len;
     int is_pmem;
-    void* addr = pmem_map_file(log_file_path.c_str(), BatchWriteLog::MaxBytes(),
-                               PMEM_FILE_CREATE, 0666, &mapped_len, &is_pmem);
+    // Batch logs are of various sizes, map the whole file. A log file too
+    // small to hold a log never persisted a log
+    struct stat log_stat;
+    if (stat(log_file_path.c_str(), &log_stat) != 0 ||
+        static_cast<size_t>(log_stat.st_size) < BatchWriteLog::MaxBytes(0)) {
+      continue;
+    }
+    void* addr = pmem_map_file(log_file_path.c_str(), 0, 0, 0666, &mapped_len,
+                               &is_pmem);
     if (addr == NULL) {
       GlobalLogger.Error("Fail to Rollback BatchLog file. %s\n",
                          strerror(errno));
       return Status::PMemMapFileError;
     }
-    kvdk_assert(is_pmem != 0 && mapped_len >= BatchWriteLog::MaxBytes(), "");
+    kvdk_assert(is_pmem != 0, "");
+    if (*static_cast<size_t*>(addr) > mapped_len) {
+      GlobalLogger.Error("Corrupted BatchLog file %s\n", log_file_path.c_str());
+      pmem_unmap(addr, mapped_len);
+      closedir(dir);
+      return Status::Abort;
+    }
 
     BatchWriteLog log;
     log.DecodeFrom(static_cast<char*>(addr));
 
+    *rolled_back |= !log.ListLogs().empty() || !log.HashLogs().empty() ||
+                    !log.SortedLogs().empty() || !log.StringLogs().empty();
+
+    // Records of a cross-shard batch are all persisted before it is committed
+    // on any shard, so keep it if it is committed on other shards
+    if (log.CrossShardId() != 0 &&
+        committed_cross_shard_ids_.count(log.CrossShardId()) > 0) {
+      GlobalLogger.Info("Keep batch %lu committed on other shards\n",
+                        log.CrossShardId());
+      log.Clear();
+    }
+
     Status s;
     for (auto iter = log.ListLogs().rbegin(); iter != log.ListLogs().rend();
          ++iter) {
@@ -1228,32 +1947,43 @@ Status KVEngine::batchWriteRollbackLogs() {
 
 Status KVEngine::GetTTL(const StringView key, TTLType* ttl_time) {
   *ttl_time = kInvalidTTL;
-  auto ul = hash_table_->AcquireLock(key);
-  auto res = lookupKey<false>(key, ExpirableRecordType);
-
-  if (res.s == Status::Ok) {
-    ExpireTimeType expire_time;
-    switch (res.entry_ptr->GetIndexType()) {
+  auto thread_holder = AcquireAccessThread();
+  // Hold a snapshot so data we read optimistically won't be freed
+  auto snapshot_holder = version_controller_.GetLocalSnapshotHolder();
+  HashTable::LookupResult res;
+  ExpireTimeType expire_time{};
+  hash_table_->OptimisticRead(key, [&]() {
+    // Do not update hash cache with an entry seen by a torn read
+    res = hash_table_->OptimisticLookup(key, PrimaryRecordType);
+    checkKeyLookupResult(&res, ExpirableRecordType);
+    if (res.s != Status::Ok) {
+      return;
+    }
+    switch (res.entry.GetIndexType()) {
       case PointerType::Skiplist: {
-        expire_time = res.entry_ptr->GetIndex().skiplist->GetExpireTime();
+        expire_time = res.entry.GetIndex().skiplist->GetExpireTime();
         break;
       }
       case PointerType::List: {
-        expire_time = res.entry_ptr->GetIndex().list->GetExpireTime();
+        expire_time = res.entry.GetIndex().list->GetExpireTime();
         break;
       }
       case PointerType::HashList: {
-        expire_time = res.entry_ptr->GetIndex().hlist->GetExpireTime();
+        expire_time = res.entry.GetIndex().hlist->GetExpireTime();
         break;
       }
       case PointerType::StringRecord: {
-        expire_time = res.entry_ptr->GetIndex().string_record->GetExpireTime();
+        expire_time = res.entry.GetIndex().string_record->GetExpireTime();
         break;
       }
       default: {
-        return Status::NotSupported;
+        res.s = Status::NotSupported;
       }
     }
+  });
+  hash_table_->UpdateCache(res);
+
+  if (res.s == Status::Ok) {
     // return ttl time
     *ttl_time = TimeUtils::ExpireTimeToTTL(expire_time);
   }
@@ -1261,6 +1991,9 @@ Status KVEngine::GetTTL(const StringView key, TTLType* ttl_time) {
 }
 
 Status KVEngine::TypeOf(StringView key, ValueType* type) {
+  auto thread_holder = AcquireAccessThread();
+  // Hold a snapshot so the hash buckets we access won't be freed by resizing
+  auto snapshot_holder = version_controller_.GetLocalSnapshotHolder();
   auto res = lookupKey<false>(key, ExpirableRecordType);
 
   if (res.s == Status::Ok) {
@@ -1307,18 +2040,11 @@ Status KVEngine::Expire(const StringView key, TTLType ttl_time) {
   }
 
   if (lookup_result.s == Status::Ok) {
-    WriteOptions write_option{ttl_time};
     switch (lookup_result.entry_ptr->GetIndexType()) {
       case PointerType::StringRecord: {
         ul.unlock();
         version_controller_.ReleaseLocalSnapshot();
-        lookup_result.s = Modify(
-            key,
-            [](const std::string* old_val, std::string* new_val, void*) {
-              new_val->assign(*old_val);
-              return ModifyOperation::Write;
-            },
-            nullptr, write_option);
+        lookup_result.s = stringExpireImpl(key, expired_time);
         break;
       }
       case PointerType::Skiplist: {
@@ -1372,44 +2098,51 @@ template HashTable::LookupResult KVEngine::lookupElem<false>(StringView,
 template <bool may_insert>
 HashTable::LookupResult KVEngine::lookupKey(StringView key, uint8_t type_mask) {
   auto result = hash_table_->Lookup<may_insert>(key, PrimaryRecordType);
+  checkKeyLookupResult(&result, type_mask);
+  return result;
+}
 
-  if (result.s != Status::Ok) {
+void KVEngine::checkKeyLookupResult(HashTable::LookupResult* result,
+                                    uint8_t type_mask) {
+  if (result->s != Status::Ok) {
     kvdk_assert(
-        result.s == Status::NotFound || result.s == Status::MemoryOverflow, "");
-    return result;
+        result->s == Status::NotFound || result->s == Status::MemoryOverflow,
+        "");
+    return;
   }
 
-  RecordType type = result.entry.GetRecordType();
-  RecordStatus record_status = result.entry.GetRecordStatus();
+  RecordType type = result->entry.GetRecordType();
+  RecordStatus record_status = result->entry.GetRecordStatus();
   bool type_match = type_mask & type;
 
   // TODO: fix mvcc of different type keys
   if (!type_match) {
-    result.s = Status::WrongType;
+    result->s = Status::WrongType;
   } else if (record_status == RecordStatus::Outdated) {
-    result.s = Status::Outdated;
+    result->s = Status::Outdated;
   } else {
     switch (type) {
       case RecordType::String: {
-        result.s = result.entry.GetIndex().string_record->HasExpired()
-                       ? Status::Outdated
-                       : Status::Ok;
+        result->s = result->entry.GetIndex().string_record->HasExpired()
+                        ? Status::Outdated
+                        : Status::Ok;
         break;
       }
       case RecordType::SortedRecord:
-        result.s = result.entry.GetIndex().skiplist->HasExpired()
-                       ? Status::Outdated
-                       : Status::Ok;
+        result->s = result->entry.GetIndex().skiplist->HasExpired()
+                        ? Status::Outdated
+                        : Status::Ok;
 
         break;
       case RecordType::ListRecord:
-        result.s = result.entry.GetIndex().list->HasExpired() ? Status::Outdated
-                                                              : Status::Ok;
+        result->s = result->entry.GetIndex().list->HasExpired()
+                        ? Status::Outdated
+                        : Status::Ok;
         break;
       case RecordType::HashRecord: {
-        result.s = result.entry.GetIndex().hlist->HasExpired()
-                       ? Status::Outdated
-                       : Status::Ok;
+        result->s = result->entry.GetIndex().hlist->HasExpired()
+                        ? Status::Outdated
+                        : Status::Ok;
         break;
       }
       default: {
@@ -1418,7 +2151,6 @@ HashTable::LookupResult KVEngine::lookupKey(StringView key, uint8_t type_mask) {
       }
     }
   }
-  return result;
 }
 
 template HashTable::LookupResult KVEngine::lookupKey<true>(StringView, uint8_t);
@@ -1444,6 +2176,10 @@ T* KVEngine::removeOutDatedVersion(T* record, TimestampType min_snapshot_ts) {
         pmem_allocator_->offset2addr_checked<T>(old_record->old_version);
     ret = remove_record;
     old_record->PersistOldVersion(kNullPMemOffset);
+    if (std::is_same<T, StringRecord>::value) {
+      disownSharedStringExtents((StringRecord*)old_record,
+                                (StringRecord*)remove_record);
+    }
     while (remove_record != nullptr) {
       if (remove_record->GetRecordStatus() == RecordStatus::Normal) {
         remove_record->PersistStatus(RecordStatus::Dirty);
@@ -1467,7 +2203,11 @@ namespace KVDK_NAMESPACE {
 
 /// TODO: move this into VersionController.
 Snapshot* KVEngine::GetSnapshot(bool make_checkpoint) {
-  Snapshot* ret = version_controller_.NewGlobalSnapshot();
+  return getSnapshotAt(rdtsc(), make_checkpoint);
+}
+
+Snapshot* KVEngine::getSnapshotAt(uint64_t tsc, bool make_checkpoint) {
+  Snapshot* ret = version_controller_.NewGlobalSnapshotAt(tsc);
 
   if (make_checkpoint) {
     std::lock_guard<std::mutex> lg(checkpoint_lock_);
@@ -1490,6 +2230,9 @@ void KVEngine::backgroundPMemUsageReporter() {
     }
     ReportPMemUsage();
     GlobalLogger.Info("Cleaner Thread Num: %ld\n", cleaner_.ActiveThreadNum());
+    auto cache_stats = hash_table_->GetCacheStats();
+    GlobalLogger.Info("Hash Cache Hits: %lu, Misses: %lu\n", cache_stats.hits,
+                      cache_stats.misses);
   }
 }
 
@@ -1506,4 +2249,284 @@ void KVEngine::backgroundPMemAllocatorOrgnizer() {
     pmem_allocator_->BackgroundWork();
   }
 }
+
+void KVEngine::backgroundHashTableResizer() {
+  // Number of slots migrated per access thread acquiring
+  constexpr uint64_t kMigrateSlotsUnit = 1024;
+  auto interval = std::chrono::milliseconds{
+      static_cast<std::uint64_t>(configs_.background_work_interval * 1000)};
+  TimestampType retire_ts = 0;
+  while (!bg_work_signals_.terminating) {
+    {
+      std::unique_lock<SpinMutex> ul(bg_work_signals_.terminating_lock);
+      if (!bg_work_signals_.terminating) {
+        bg_work_signals_.hash_table_resizer_cv.wait_for(ul, interval);
+      }
+    }
+
+    if (hash_table_->HasRetiredBuckets()) {
+      version_controller_.UpdateLocalOldestSnapshot();
+      if (retire_ts < std::min(version_controller_.LocalOldestSnapshotTS(),
+                               version_controller_.GlobalOldestSnapshotTs())) {
+        hash_table_->ReleaseRetiredBuckets();
+      }
+    }
+
+    if (!hash_table_->NeedResize(configs_.hash_table_max_load_factor) ||
+        hash_table_->StartResize() != Status::Ok) {
+      continue;
+    }
+
+    uint64_t slot_idx = 0;
+    while (slot_idx < hash_table_->GetSlotsNum() &&
+           !bg_work_signals_.terminating) {
+      uint64_t migrated_idx;
+      {
+        // Overflow buckets are allocated from per-access-thread cache
+        auto thread_holder = AcquireAccessThread();
+        migrated_idx = hash_table_->MigrateSlots(
+            slot_idx, slot_idx + kMigrateSlotsUnit);
+      }
+      if (migrated_idx == slot_idx) {
+        // The slot is locked, let its holder go on with the access thread
+        std::this_thread::yield();
+      }
+      slot_idx = migrated_idx;
+    }
+
+    if (slot_idx >= hash_table_->GetSlotsNum()) {
+      hash_table_->FinishResize();
+      retire_ts = version_controller_.GetCurrentTimestamp();
+      GlobalLogger.Info("Hash table resized to %lu buckets\n",
+                        hash_table_->GetBucketsNum());
+    }
+  }
+}
+
+void KVEngine::backgroundPMemCompactor() {
+  // Max number of segments drained in a round
+  constexpr size_t kMaxDrainSegments = 16;
+  auto interval = std::chrono::milliseconds{
+      static_cast<std::uint64_t>(configs_.background_work_interval * 1000)};
+  while (!bg_work_signals_.terminating) {
+    {
+      std::unique_lock<SpinMutex> ul(bg_work_signals_.terminating_lock);
+      if (!bg_work_signals_.terminating) {
+        bg_work_signals_.pmem_compactor_cv.wait_for(ul, interval);
+      }
+    }
+
+    freeRelocatedRecords();
+    // Space of lazy restored records are not accounted to segments until
+    // lazy recovery finished
+    if (lazy_recovery_ != nullptr && lazy_recovery_->running_workers > 0) {
+      continue;
+    }
+
+    // Records may be allocated in draining segments before they drained, so
+    // relocate them again until the segments reclaimed
+    std::vector<PMemOffsetType> segments = pmem_allocator_->DrainingSegments();
+    if (segments.size() < kMaxDrainSegments) {
+      std::vector<PMemOffsetType> draining;
+      for (PMemOffsetType offset : pmem_allocator_->SparseSegments(
+               configs_.pmem_compaction_usage_ratio,
+               kMaxDrainSegments - segments.size())) {
+        if (segmentCompactable(offset)) {
+          draining.push_back(offset);
+        }
+      }
+      pmem_allocator_->DrainSegments(draining);
+      segments.insert(segments.end(), draining.begin(), draining.end());
+    }
+
+    for (PMemOffsetType offset : segments) {
+      if (bg_work_signals_.terminating || !compactSegment(offset)) {
+        break;
+      }
+    }
+  }
+}
+
+bool KVEngine::segmentCompactable(PMemOffsetType segment_offset) {
+  PMemOffsetType end = segment_offset + pmem_allocator_->SegmentSize();
+  PMemOffsetType offset = segment_offset;
+  while (offset < end) {
+    DataEntry* entry = pmem_allocator_->offset2addr_checked<DataEntry>(offset);
+    uint32_t record_size = entry->header.record_size;
+    if (record_size == 0 || record_size > end - offset) {
+      break;
+    }
+    RecordType type = entry->meta.type;
+    if (type & (CollectionType | RecordType::ListElem)) {
+      DLRecord* record = static_cast<DLRecord*>(static_cast<void*>(entry));
+      if (record->Validate()) {
+        return false;
+      }
+    } else if (type == RecordType::StringExtent) {
+      // Extents are not relocated, freed ones are destroyed
+      return false;
+    } else if (type == RecordType::SortedElem) {
+      DLRecord* record = static_cast<DLRecord*>(static_cast<void*>(entry));
+      if (record->Validate()) {
+        std::lock_guard<std::mutex> lg(skiplists_mu_);
+        auto iter = skiplists_.find(Skiplist::FetchID(record));
+        if (iter != skiplists_.end() && iter->second != nullptr &&
+            !iter->second->IndexWithHashtable()) {
+          return false;
+        }
+      }
+    }
+    offset += record_size;
+  }
+  return true;
+}
+
+bool KVEngine::compactSegment(PMemOffsetType segment_offset) {
+  auto thread_holder = AcquireAccessThread();
+  PMemOffsetType end = segment_offset + pmem_allocator_->SegmentSize();
+  PMemOffsetType offset = segment_offset;
+  // Allocations in the draining segment have been finished, so walking its
+  // records by size is safe
+  while (offset < end) {
+    DataEntry* entry = pmem_allocator_->offset2addr_checked<DataEntry>(offset);
+    uint32_t record_size = entry->header.record_size;
+    if (record_size == 0 || record_size > end - offset) {
+      break;
+    }
+    bool ok = true;
+    switch (entry->meta.type) {
+      case RecordType::String: {
+        ok = relocateStringRecord(
+            static_cast<StringRecord*>(static_cast<void*>(entry)));
+        break;
+      }
+      case RecordType::SortedElem:
+      case RecordType::HashElem: {
+        ok = relocateDLRecord(
+            static_cast<DLRecord*>(static_cast<void*>(entry)));
+        break;
+      }
+      default:
+        break;
+    }
+    if (!ok) {
+      return false;
+    }
+    offset += record_size;
+  }
+  return true;
+}
+
+bool KVEngine::relocateStringRecord(StringRecord* record) {
+  if (!record->Validate()) {
+    return true;
+  }
+  auto ul = hash_table_->AcquireLock(record->Key());
+  auto lookup_result =
+      hash_table_->Lookup<false>(record->Key(), RecordType::String);
+  if (lookup_result.s != Status::Ok ||
+      lookup_result.entry.GetIndex().string_record != record) {
+    // Not the newest version, it will be freed by cleaner
+    return true;
+  }
+
+  SpaceEntry space = pmem_allocator_->Allocate(record->GetRecordSize());
+  if (space.size == 0) {
+    return false;
+  }
+  StringRecord* new_record = StringRecord::PersistStringRecord(
+      pmem_allocator_->offset2addr_checked(space.offset), space.size,
+      record->GetTimestamp(), record->GetRecordType(),
+      record->GetRecordStatus(), record->old_version, record->Key(),
+      record->Value(), record->GetExpireTime(), record->HasExtents());
+  hash_table_->Insert(lookup_result, RecordType::String,
+                      lookup_result.entry.GetRecordStatus(), new_record,
+                      PointerType::StringRecord);
+  relocated_records_.push_back(PendingFreeSpaceEntry{
+      SpaceEntry(pmem_allocator_->addr2offset_checked(record),
+                 record->GetRecordSize()),
+      version_controller_.GetCurrentTimestamp()});
+  return true;
+}
+
+bool KVEngine::relocateDLRecord(DLRecord* record) {
+  if (!record->Validate()) {
+    return true;
+  }
+  RecordType type = record->GetRecordType();
+  auto ul = hash_table_->AcquireLock(record->Key());
+  auto lookup_result = hash_table_->Lookup<false>(record->Key(), type);
+  if (lookup_result.s != Status::Ok) {
+    return true;
+  }
+  SkiplistNode* dram_node = nullptr;
+  DLRecord* indexed_record;
+  if (lookup_result.entry.GetIndexType() == PointerType::SkiplistNode) {
+    dram_node = lookup_result.entry.GetIndex().skiplist_node;
+    indexed_record = dram_node->record;
+  } else {
+    kvdk_assert(lookup_result.entry.GetIndexType() == PointerType::DLRecord,
+                "wrong index type of elem record");
+    indexed_record = lookup_result.entry.GetIndex().dl_record;
+  }
+  if (indexed_record != record) {
+    return true;
+  }
+
+  SpaceEntry space = pmem_allocator_->Allocate(record->GetRecordSize());
+  if (space.size == 0) {
+    return false;
+  }
+  DLRecord* new_record = DLRecord::PersistDLRecord(
+      pmem_allocator_->offset2addr_checked(space.offset), space.size,
+      record->GetTimestamp(), type, record->GetRecordStatus(),
+      record->old_version, record->prev, record->next, record->Key(),
+      record->Value());
+  bool success =
+      type == RecordType::SortedElem
+          ? Skiplist::Replace(record, new_record, dram_node,
+                              pmem_allocator_.get(), dllist_locks_.get())
+          : DLList::Replace(record, new_record, pmem_allocator_.get(),
+                            dllist_locks_.get());
+  if (!success) {
+    // Unlinked by cleaner
+    pmem_allocator_->PurgeAndFree(new_record);
+    return true;
+  }
+  if (dram_node != nullptr) {
+    hash_table_->Insert(lookup_result, type,
+                        lookup_result.entry.GetRecordStatus(), dram_node,
+                        PointerType::SkiplistNode);
+  } else {
+    hash_table_->Insert(lookup_result, type,
+                        lookup_result.entry.GetRecordStatus(), new_record,
+                        PointerType::DLRecord);
+  }
+  relocated_records_.push_back(PendingFreeSpaceEntry{
+      SpaceEntry(pmem_allocator_->addr2offset_checked(record),
+                 record->GetRecordSize()),
+      version_controller_.GetCurrentTimestamp()});
+  return true;
+}
+
+void KVEngine::freeRelocatedRecords() {
+  if (relocated_records_.empty()) {
+    return;
+  }
+  version_controller_.UpdateLocalOldestSnapshot();
+  TimestampType oldest_snapshot_ts =
+      std::min(version_controller_.LocalOldestSnapshotTS(),
+               version_controller_.GlobalOldestSnapshotTs());
+  auto thread_holder = AcquireAccessThread();
+  std::vector<SpaceEntry> entries;
+  while (!relocated_records_.empty() &&
+         relocated_records_.front().release_time < oldest_snapshot_ts) {
+    const SpaceEntry& entry = relocated_records_.front().entry;
+    pmem_allocator_->offset2addr_checked<DataEntry>(entry.offset)->Destroy();
+    entries.push_back(entry);
+    relocated_records_.pop_front();
+  }
+  pmem_allocator_->BatchFree(entries);
+}
+
 }  // namespace KVDK_NAMESPACE
@@ -17,6 +17,7 @@
 #include <queue>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "alias.hpp"
@@ -25,6 +26,7 @@
 #include "hash_collection/hash_list.hpp"
 #include "hash_collection/rebuilder.hpp"
 #include "hash_table.hpp"
+#include "index_image.hpp"
 #include "kvdk/persistent/engine.hpp"
 #include "list_collection/list.hpp"
 #include "list_collection/rebuilder.hpp"
@@ -36,6 +38,7 @@
 #include "structures.hpp"
 #include "thread_manager.hpp"
 #include "transaction_impl.hpp"
+#include "transaction_lock_manager.hpp"
 #include "utils/utils.hpp"
 #include "version/old_records_cleaner.hpp"
 #include "version/version_controller.hpp"
@@ -44,6 +47,7 @@
 namespace KVDK_NAMESPACE {
 class KVEngine : public Engine {
   friend class SortedCollectionRebuilder;
+  friend class ShardedEngine;
 
  public:
   ~KVEngine();
@@ -89,6 +93,9 @@ class KVEngine : public Engine {
 
   // String
   Status Get(const StringView key, std::string* value) final;
+  Status MultiGet(const std::vector<StringView>& keys,
+                  std::vector<std::string>* values,
+                  std::vector<Status>* statuses) final;
   Status Put(const StringView key, const StringView value,
              const WriteOptions& write_options) final;
   Status Delete(const StringView key) final;
@@ -106,9 +113,14 @@ class KVEngine : public Engine {
                    const StringView value) final;
   Status SortedDelete(const StringView collection,
                       const StringView user_key) final;
-  SortedIterator* SortedIteratorCreate(const StringView collection,
-                                       Snapshot* snapshot, Status* s) final;
+  SortedIterator* SortedIteratorCreate(
+      const StringView collection, Snapshot* snapshot, Status* s,
+      const SortedIteratorOptions& options) final;
   void SortedIteratorRelease(SortedIterator* sorted_iterator) final;
+  Status SortedPartitionIteratorsCreate(
+      const StringView collection, size_t num_partitions,
+      std::vector<SortedIterator*>* iterators, Snapshot* snapshot,
+      const SortedIteratorOptions& options) final;
 
   // List
   Status ListCreate(StringView key) final;
@@ -174,7 +186,11 @@ class KVEngine : public Engine {
     return std::unique_ptr<WriteBatch>{new WriteBatchImpl{}};
   }
 
-  std::unique_ptr<Transaction> TransactionCreate() final {
+  std::unique_ptr<Transaction> TransactionCreate(
+      const TransactionOptions& options) final {
+    if (options.optimistic) {
+      return std::unique_ptr<Transaction>(new OptimisticTransactionImpl(this));
+    }
     return std::unique_ptr<Transaction>(new TransactionImpl(this));
   }
 
@@ -188,6 +204,18 @@ class KVEngine : public Engine {
 
   Status CommitTransaction(TransactionImpl* txn);
 
+  TransactionLockManager* GetTransactionLockManager() {
+    return &txn_lock_manager_;
+  }
+
+  // Lock keys written by "txn", validate its reads and commit its writes.
+  // Return Status::Abort if validation failed
+  Status CommitTransaction(OptimisticTransactionImpl* txn);
+
+  // Read value of "read" for an optimistic transaction, and set timestamp of
+  // the newest record of the key to "read->timestamp"
+  Status TransactionGet(TransactionRead* read, std::string* value);
+
   // For test cases
   const std::unordered_map<CollectionIDType, std::shared_ptr<Skiplist>>&
   GetSkiplists() {
@@ -200,6 +228,8 @@ class KVEngine : public Engine {
  private:
   friend OldRecordsCleaner;
   friend Cleaner;
+  friend TransactionImpl;
+  friend OptimisticTransactionImpl;
 
   KVEngine(const Configs& configs)
       : access_thread_cv_(configs.max_access_threads),
@@ -214,10 +244,12 @@ class KVEngine : public Engine {
     EngineThreadCache() = default;
 
     char* batch_log = nullptr;
+    size_t batch_log_size = 0;
 
     // Info used in recovery
     uint64_t newest_restored_ts = 0;
     std::unordered_map<uint64_t, int> visited_skiplist_ids{};
+    std::vector<SpaceEntry> restored_string_extents{};
   };
 
   struct CleanerThreadCache {
@@ -309,6 +341,11 @@ class KVEngine : public Engine {
   template <bool may_insert>
   HashTable::LookupResult lookupKey(StringView key, uint8_t type_mask);
 
+  // Check type and status of a key found by hash table lookup, and update
+  // result->s as the return status of lookupKey
+  void checkKeyLookupResult(HashTable::LookupResult* result,
+                            uint8_t type_mask);
+
   // Look up a collection element in hash table
   //
   // Store a copy of hash entry in LookupResult::entry, and a pointer to the
@@ -411,13 +448,60 @@ class KVEngine : public Engine {
     return Status::Ok;
   }
 
-  Status maybeInitBatchLogFile();
+  // Map or grow batch log of this thread to hold "num_entries" log entries
+  Status reserveBatchLog(size_t num_entries);
 
   Status stringPutImpl(const StringView& key, const StringView& value,
                        const WriteOptions& write_options);
 
   Status stringDeleteImpl(const StringView& key);
 
+  // Update expire time of a string without rewriting its value
+  Status stringExpireImpl(const StringView& key, ExpireTimeType expired_time);
+
+  // Return true if "value" of "key" should be stored in extents
+  bool largeValue(const StringView& key, const StringView& value) {
+    return value.size() > configs_.large_value_threshold ||
+           value.size() > StringRecord::kMaxInlineValueSize ||
+           key.size() + value.size() + sizeof(StringRecord) >
+               pmem_allocator_->SegmentSize();
+  }
+
+  // Allocate PMem space of extents to store "value" in "extents", and encode
+  // them to "encoded_extents" as value of the string record. Nothing allocated
+  // on failure
+  Status allocateStringExtents(const StringView& value,
+                               std::vector<SpaceEntry>* extents,
+                               std::string* encoded_extents);
+
+  // Persist "value" to extents allocated by allocateStringExtents(), this
+  // should be done before persisting the string record
+  void persistStringExtents(const std::vector<SpaceEntry>& extents,
+                            TimestampType ts, const StringView& value);
+
+  // Destroy extents of a string record and append their space to "entries",
+  // unless they are shared with its newer version whose first extent is
+  // "newer_extent". Caller should destroy the record before this.
+  //
+  // Return first extent of the record, or kNullPMemOffset if it has no
+  // extents, which is "newer_extent" of its older version
+  PMemOffsetType purgeStringExtents(const StringRecord* record,
+                                    PMemOffsetType newer_extent,
+                                    std::vector<SpaceEntry>* entries);
+
+  // Disown extents of "old_record" and its older versions shared with
+  // "record", called after they are unlinked from "record" to be freed
+  void disownSharedStringExtents(const StringRecord* record,
+                                 StringRecord* old_record);
+
+  // Copy value of a string record to "value", gathering it from extents if
+  // stored in them
+  void readStringValue(const StringRecord* record, std::string* value);
+
+  // Free string extents met in restoreData() but not owned by any restored
+  // string record
+  void freeOrphanStringExtents();
+
   Status stringWritePrepare(StringWriteArgs& args, TimestampType ts);
   Status stringWrite(StringWriteArgs& args);
   Status stringWritePublish(StringWriteArgs const& args);
@@ -431,6 +515,45 @@ class KVEngine : public Engine {
 
   Status restoreExistingData();
 
+  // Restore hash index of string records and collection headers from index
+  // image persisted on last clean shutdown, and restore PMem allocation status
+  // from records reachable from them. Return NotFound without touching any data
+  // if the image does not match data on PMem, then caller should fall back to
+  // scan the whole PMem space by restoreData()
+  //
+  // With lazy recovery, only collections are restored here, and string records
+  // are left to restoreImageRange()
+  Status restoreFromIndexImage(IndexImage image);
+
+  // Return data entry of a record at "offset" if it is a record inside PMem
+  // space before "offset_heads" of its NUMA pool, otherwise return nullptr
+  DataEntry* imageRecord(PMemOffsetType offset,
+                         const std::vector<PMemOffsetType>& offset_heads);
+
+  // Append PMem space of string record at "offset" and its old versions to
+  // "used", return false if any of them is not a valid string record
+  bool collectStringVersions(PMemOffsetType offset,
+                             const std::vector<PMemOffsetType>& offset_heads,
+                             std::vector<SpaceEntry>* used);
+
+  // Append PMem space of a collection header at "header_offset" and its
+  // elements to "used", return false if any of them is not valid or linked
+  bool collectCollectionRecords(
+      PMemOffsetType header_offset,
+      const std::vector<PMemOffsetType>& offset_heads,
+      std::vector<SpaceEntry>* used);
+
+  // Restore string records of a hash slot range from index image of lazy
+  // recovery, called by HashTable::RestoreRange()
+  void restoreImageRange(uint64_t range_idx);
+
+  // Run in background to restore string records of lazy recovery, the last
+  // finished thread frees PMem space not used by the index image
+  void backgroundLazyRecovery();
+
+  // Persist DRAM indexes to index image on clean shutdown
+  void persistIndexImage();
+
   Status restoreDataFromBackup(const std::string& backup_log);
   Status sortedWritePrepare(SortedWriteArgs& args, TimestampType ts);
   Status sortedWrite(SortedWriteArgs& args);
@@ -452,9 +575,84 @@ class KVEngine : public Engine {
 
   Status persistOrRecoverImmutableConfigs();
 
-  Status batchWriteImpl(WriteBatchImpl const& batch, bool lock_key);
+  // If "reads" is not nullptr, they are validated after locking keys of
+  // "batch", and Status::Abort is returned if any read record is changed
+  Status batchWriteImpl(WriteBatchImpl const& batch, bool lock_key,
+                        const std::vector<TransactionRead>* reads = nullptr);
+
+  // Resources of a batch write held from its preparation to its publishing.
+  // Space allocated for a batch not published is freed on destruction
+  struct BatchWriteContext {
+    explicit BatchWriteContext(KVEngine* e)
+        : engine(e),
+          thread_holder(&e->access_thread_cv_[ThreadManager::ThreadID() %
+                                              e->access_thread_cv_.size()]),
+          snapshot_holder(&e->version_controller_) {}
+
+    ~BatchWriteContext() { engine->batchWriteRelease(this); }
+
+    KVEngine* engine;
+    AccessThreadCV::Holder thread_holder;
+    // Prevent collection and nodes in double linked lists from being deleted
+    VersionController::LocalSnapshotHolder snapshot_holder;
+    std::vector<StringWriteArgs> string_args;
+    std::vector<SortedWriteArgs> sorted_args;
+    std::vector<HashWriteArgs> hash_args;
+    std::vector<std::unique_lock<SeqSpinMutex>> guard;
+    // Prevent generating snapshot newer than the batch
+    std::unique_ptr<VersionController::BatchWriteToken> bw_token;
+    BatchWriteLog log;
+  };
+
+  // Stages of a batch write:
+  // 1. batchWritePrepare() locks keys of "batch", validates "reads" if any,
+  // allocates space of records and builds the batch log in "ctx"
+  // 2. After the log is persisted and marked processing, batchWriteRecords()
+  // writes records to PMem
+  // 3. After the log is marked committed, batchWritePublish() makes records
+  // visible to other threads
+  // Only the preparation may fail, which leaves nothing written
+  Status batchWritePrepare(WriteBatchImpl const& batch, bool lock_key,
+                           const std::vector<TransactionRead>* reads,
+                           BatchWriteContext* ctx);
+
+  void batchWriteRecords(BatchWriteContext* ctx);
+
+  void batchWritePublish(BatchWriteContext* ctx);
+
+  // Free space allocated for records of "ctx" not published
+  void batchWriteRelease(BatchWriteContext* ctx);
+
+  // Snapshot at CPU tsc "tsc", see VersionController::NewGlobalSnapshotAt()
+  Snapshot* getSnapshotAt(uint64_t tsc, bool make_checkpoint);
+
+  // Batch log space of this thread
+  char* threadBatchLog() {
+    return engine_thread_cache_[ThreadManager::ThreadID() %
+                                configs_.max_access_threads]
+        .batch_log;
+  }
 
-  Status batchWriteRollbackLogs();
+  // Open the instance. In recovery, unfinished batches of cross-shard batch
+  // writes in "committed_cross_shard_ids" are kept instead of rolled back, as
+  // they are committed on other shards of the ShardedEngine
+  static Status openImpl(const StringView engine_path, Engine** engine_ptr,
+                         const Configs& configs,
+                         const std::unordered_set<uint64_t>&
+                             committed_cross_shard_ids);
+
+  // Read value and newest record timestamp of "read", value is not read if
+  // "value" is nullptr. Caller should hold snapshot
+  Status transactionRead(const TransactionRead& read, std::string* value,
+                         TimestampType* timestamp);
+
+  Status validateTransactionReads(
+      const std::vector<TransactionRead>& reads,
+      const std::vector<std::unique_lock<SeqSpinMutex>>& guard);
+
+  // Rollback unfinished batch writes, "rolled_back" is set to true if any
+  // unfinished batch is found
+  Status batchWriteRollbackLogs(bool* rolled_back);
 
   /// List helper functions
   // Find and lock the list. Initialize non-existing if required.
@@ -584,6 +782,12 @@ class KVEngine : public Engine {
     return format_dir_path(instance_path) + "configs";
   }
 
+  inline std::string index_image_file() { return index_image_file(dir_); }
+
+  inline static std::string index_image_file(const std::string& instance_path) {
+    return format_dir_path(instance_path) + "index_image";
+  }
+
   // If this instance is a backup of another kvdk instance
   bool recoverToCheckpoint() {
     return configs_.recover_to_checkpoint && persist_checkpoint_->Valid();
@@ -595,6 +799,33 @@ class KVEngine : public Engine {
   // Run in background to merge and balance free space of PMem Allocator
   void backgroundPMemAllocatorOrgnizer();
 
+  // Run in background to grow hash table if it's overloaded, and release
+  // retired hash buckets after no reader accessing them
+  void backgroundHashTableResizer();
+
+  // Run in background to relocate live records out of sparse PMem segments,
+  // so the segments can be reclaimed by PMem allocator
+  void backgroundPMemCompactor();
+
+  // Relocate live records of a draining segment, return false if PMem space
+  // overflowed
+  bool compactSegment(PMemOffsetType segment_offset);
+
+  // If all valid records in a segment can be relocated by compactSegment()
+  bool segmentCompactable(PMemOffsetType segment_offset);
+
+  // Copy "record" to newly allocated space and replace it in its index if it's
+  // the indexed version of its key, the replaced one is freed after no
+  // snapshot may access it. Return false if PMem space overflowed.
+  //
+  // Notice: only string records, and elems of hash lists and hash indexed
+  // skiplists are supported
+  bool relocateStringRecord(StringRecord* record);
+  bool relocateDLRecord(DLRecord* record);
+
+  // Free relocated records not accessed by any snapshot
+  void freeRelocatedRecords();
+
   /* functions for cleaner thread cache */
   // Remove old version records from version chain of new_record and cache it
   template <typename T>
@@ -619,8 +850,32 @@ class KVEngine : public Engine {
   Array<EngineThreadCache> engine_thread_cache_;
   Array<CleanerThreadCache> cleaner_thread_cache_;
 
+  // Group commit of concurrent batch writes
+  BatchWriteGroup batch_write_group_;
+
+  // See openImpl()
+  std::unordered_set<uint64_t> committed_cross_shard_ids_;
+
   // restored kvs in reopen
   std::atomic<uint64_t> restored_{0};
+
+  // State of restoring string records after open, see
+  // Configs::lazy_recovery_threads
+  struct LazyRecovery {
+    IndexImage image;
+    // PMem space of records restored from the image
+    std::vector<SpaceEntry> used_space;
+    SpinMutex used_space_lock;
+    std::atomic<uint64_t> next_range{0};
+    std::atomic<uint32_t> running_workers{0};
+    std::atomic<uint64_t> num_restored{0};
+    // Set if any string record of the image not match data on PMem
+    std::atomic<bool> corrupted{false};
+  };
+  std::unique_ptr<LazyRecovery> lazy_recovery_;
+
+  // Records replaced by relocated copies, only accessed by compactor thread
+  std::deque<PendingFreeSpaceEntry> relocated_records_;
   std::atomic<CollectionIDType> collection_id_{0};
 
   std::unique_ptr<HashTable> hash_table_;
@@ -645,6 +900,8 @@ class KVEngine : public Engine {
   std::unique_ptr<PMEMAllocator> pmem_allocator_;
   Configs configs_;
   bool closing_{false};
+  // Set after the instance is successfully opened or restored
+  bool opened_{false};
   std::vector<std::thread> bg_threads_;
 
   std::unique_ptr<SortedCollectionRebuilder> sorted_rebuilder_;
@@ -663,6 +920,8 @@ class KVEngine : public Engine {
     std::condition_variable_any pmem_usage_reporter_cv;
     std::condition_variable_any pmem_allocator_organizer_cv;
     std::condition_variable_any dram_cleaner_cv;
+    std::condition_variable_any hash_table_resizer_cv;
+    std::condition_variable_any pmem_compactor_cv;
 
     SpinMutex terminating_lock;
     bool terminating = false;
@@ -676,6 +935,7 @@ class KVEngine : public Engine {
   std::atomic<int64_t> round_robin_id_{0};
 
   CollectionTransactionCV ct_cv_;
+  TransactionLockManager txn_lock_manager_;
   // We manually allocate recovery thread id for no conflict in multi-thread
   // recovering
   // Todo: do not hard code
@@ -75,16 +75,23 @@ template <typename T>
 void KVEngine::cleanOutdatedRecordImpl(T* old_record) {
   static_assert(std::is_same<T, StringRecord>::value ||
                 std::is_same<T, DLRecord>::value);
+  std::vector<SpaceEntry> extents;
+  PMemOffsetType newer_extent = kNullPMemOffset;
   while (old_record) {
     T* next = pmem_allocator_->offset2addr<T>(old_record->old_version);
     auto record_size = old_record->GetRecordSize();
     if (old_record->GetRecordStatus() == RecordStatus::Normal) {
       old_record->Destroy();
     }
+    if (std::is_same<T, StringRecord>::value) {
+      newer_extent = purgeStringExtents((StringRecord*)old_record,
+                                        newer_extent, &extents);
+    }
     pmem_allocator_->Free(SpaceEntry(
         pmem_allocator_->addr2offset_checked(old_record), record_size));
     old_record = next;
   }
+  pmem_allocator_->BatchFree(extents);
 }
 
 void KVEngine::tryCleanCachedOutdatedRecord() {
@@ -125,12 +132,14 @@ void KVEngine::purgeAndFreeStringRecords(
     const std::vector<StringRecord*>& old_records) {
   std::vector<SpaceEntry> entries;
   for (auto old_record : old_records) {
+    PMemOffsetType newer_extent = kNullPMemOffset;
     while (old_record) {
       StringRecord* next =
           pmem_allocator_->offset2addr<StringRecord>(old_record->old_version);
       if (old_record->GetRecordStatus() == RecordStatus::Normal) {
         old_record->Destroy();
       }
+      newer_extent = purgeStringExtents(old_record, newer_extent, &entries);
       entries.emplace_back(pmem_allocator_->addr2offset(old_record),
                            old_record->GetRecordSize());
       old_record = next;
@@ -231,7 +231,7 @@ Status KVEngine::ListBatchPushFront(StringView list_name,
   }
   auto thread_holder = AcquireAccessThread();
 
-  Status s = maybeInitBatchLogFile();
+  Status s = reserveBatchLog(elems.size());
   if (s != Status::Ok) {
     return s;
   }
@@ -259,7 +259,7 @@ Status KVEngine::ListBatchPushBack(StringView list_name,
   }
   auto thread_holder = AcquireAccessThread();
 
-  Status s = maybeInitBatchLogFile();
+  Status s = reserveBatchLog(elems.size());
   if (s != Status::Ok) {
     return s;
   }
@@ -272,11 +272,6 @@ Status KVEngine::ListBatchPopFront(StringView list_name, size_t n,
     return Status::InvalidDataSize;
   }
   auto thread_holder = AcquireAccessThread();
-
-  Status s = maybeInitBatchLogFile();
-  if (s != Status::Ok) {
-    return s;
-  }
   return listBatchPopImpl(list_name, ListPos::Front, n, elems);
 }
 
@@ -286,11 +281,6 @@ Status KVEngine::ListBatchPopBack(StringView list_name, size_t n,
     return Status::InvalidDataSize;
   }
   auto thread_holder = AcquireAccessThread();
-  Status s = maybeInitBatchLogFile();
-  if (s != Status::Ok) {
-    return s;
-  }
-
   return listBatchPopImpl(list_name, ListPos::Back, n, elems);
 }
 
@@ -301,7 +291,8 @@ Status KVEngine::ListMove(StringView src, ListPos src_pos, StringView dst,
   }
   auto thread_holder = AcquireAccessThread();
 
-  Status s = maybeInitBatchLogFile();
+  // Pop from src and push to dst
+  Status s = reserveBatchLog(2);
   if (s != Status::Ok) {
     return s;
   }
@@ -585,6 +576,11 @@ Status KVEngine::listBatchPopImpl(StringView list_name, ListPos pos, size_t n,
   }
   auto guard = list->AcquireLock();
 
+  s = reserveBatchLog(std::min(n, list->Size()));
+  if (s != Status::Ok) {
+    return s;
+  }
+
   auto bw_token = version_controller_.GetBatchWriteToken();
   BatchWriteLog log;
   log.SetTimestamp(bw_token.Timestamp());
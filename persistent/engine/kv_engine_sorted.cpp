@@ -192,8 +192,9 @@ Status KVEngine::SortedDelete(const StringView collection,
   return sortedDeleteImpl(skiplist, user_key);
 }
 
-SortedIterator* KVEngine::SortedIteratorCreate(const StringView collection,
-                                               Snapshot* snapshot, Status* s) {
+SortedIterator* KVEngine::SortedIteratorCreate(
+    const StringView collection, Snapshot* snapshot, Status* s,
+    const SortedIteratorOptions& options) {
   Skiplist* skiplist;
   bool create_snapshot = snapshot == nullptr;
   if (create_snapshot) {
@@ -204,11 +205,19 @@ SortedIterator* KVEngine::SortedIteratorCreate(const StringView collection,
   if (s != nullptr) {
     *s = (res.s == Status::Outdated) ? Status::NotFound : res.s;
   }
+  if (res.s == Status::Ok && !options.prefix.empty() &&
+      !res.entry_ptr->GetIndex().skiplist->BytewiseOrdered()) {
+    // Keys with a prefix may not be adjacent in a custom order
+    res.s = Status::InvalidArgument;
+    if (s != nullptr) {
+      *s = res.s;
+    }
+  }
   if (res.s == Status::Ok) {
     skiplist = res.entry_ptr->GetIndex().skiplist;
     return new SortedIteratorImpl(skiplist, pmem_allocator_.get(),
                                   static_cast<SnapshotImpl*>(snapshot),
-                                  create_snapshot);
+                                  create_snapshot, options);
   } else {
     if (create_snapshot) {
       ReleaseSnapshot(snapshot);
@@ -229,6 +238,62 @@ void KVEngine::SortedIteratorRelease(SortedIterator* sorted_iterator) {
   delete iter;
 }
 
+Status KVEngine::SortedPartitionIteratorsCreate(
+    const StringView collection, size_t num_partitions,
+    std::vector<SortedIterator*>* iterators, Snapshot* snapshot,
+    const SortedIteratorOptions& options) {
+  if (num_partitions == 0 || iterators == nullptr) {
+    return Status::InvalidArgument;
+  }
+  iterators->clear();
+  bool create_snapshot = snapshot == nullptr;
+  if (create_snapshot) {
+    snapshot = GetSnapshot(false);
+  }
+  auto res = lookupKey<false>(collection, RecordType::SortedRecord);
+  if (res.s != Status::Ok) {
+    if (create_snapshot) {
+      ReleaseSnapshot(snapshot);
+    }
+    return res.s == Status::Outdated ? Status::NotFound : res.s;
+  }
+  Skiplist* skiplist = res.entry_ptr->GetIndex().skiplist;
+  if (!options.prefix.empty() && !skiplist->BytewiseOrdered()) {
+    if (create_snapshot) {
+      ReleaseSnapshot(snapshot);
+    }
+    return Status::InvalidArgument;
+  }
+  const SnapshotImpl* snapshot_impl = static_cast<SnapshotImpl*>(snapshot);
+  std::shared_ptr<const SnapshotImpl> shared_snapshot;
+  if (create_snapshot) {
+    shared_snapshot.reset(snapshot_impl, [this](const SnapshotImpl* s) {
+      ReleaseSnapshot(s);
+    });
+  }
+
+  SortedIteratorImpl whole_range(skiplist, pmem_allocator_.get(),
+                                 snapshot_impl, false, options);
+  std::vector<std::string> split_keys;
+  skiplist->SplitKeys(whole_range.rangeBegin(), whole_range.rangeEnd(),
+                      num_partitions, &split_keys);
+  for (size_t i = 0; i <= split_keys.size(); i++) {
+    SortedIteratorOptions partition_options = options;
+    if (i > 0) {
+      partition_options.lower_bound = split_keys[i - 1];
+    }
+    if (i < split_keys.size()) {
+      partition_options.upper_bound = split_keys[i];
+    }
+    SortedIteratorImpl* iter =
+        new SortedIteratorImpl(skiplist, pmem_allocator_.get(), snapshot_impl,
+                               false, partition_options);
+    iter->shared_snapshot_ = shared_snapshot;
+    iterators->push_back(iter);
+  }
+  return Status::Ok;
+}
+
 Status KVEngine::sortedDeleteImpl(Skiplist* skiplist,
                                   const StringView& user_key) {
   std::string collection_key(skiplist->InternalKey(user_key));
@@ -2,6 +2,8 @@
  * Copyright(c) 2021 Intel Corporation
  */
 
+#include <unordered_set>
+
 #include "kv_engine.hpp"
 #include "utils/sync_point.hpp"
 
@@ -27,8 +29,7 @@ Status KVEngine::Modify(const StringView key, ModifyFunc modify_func,
   // push it into cleaner
   if (lookup_result.s == Status::Ok) {
     existing_record = lookup_result.entry.GetIndex().string_record;
-    existing_value.assign(existing_record->Value().data(),
-                          existing_record->Value().size());
+    readStringValue(existing_record, &existing_value);
   } else if (lookup_result.s == Status::Outdated) {
     existing_record = lookup_result.entry.GetIndex().string_record;
   } else if (lookup_result.s == Status::NotFound) {
@@ -51,11 +52,28 @@ Status KVEngine::Modify(const StringView key, ModifyFunc modify_func,
               ? existing_record->GetExpireTime()
               : TimeUtils::TTLToExpireTime(write_options.ttl_time, base_time);
 
-      SpaceEntry space_entry =
-          pmem_allocator_->Allocate(StringRecord::RecordSize(key, new_value));
+      std::vector<SpaceEntry> extents;
+      std::string encoded_extents;
+      bool value_extents = largeValue(key, new_value);
+      if (value_extents) {
+        Status s =
+            allocateStringExtents(new_value, &extents, &encoded_extents);
+        if (s != Status::Ok) {
+          return s;
+        }
+      }
+      StringView record_value =
+          value_extents ? StringView(encoded_extents) : StringView(new_value);
+
+      SpaceEntry space_entry = pmem_allocator_->Allocate(
+          StringRecord::RecordSize(key, record_value));
       if (space_entry.size == 0) {
+        pmem_allocator_->BatchFree(extents);
         return Status::PmemOverflow;
       }
+      if (value_extents) {
+        persistStringExtents(extents, new_ts, new_value);
+      }
 
       StringRecord* new_record =
           pmem_allocator_->offset2addr_checked<StringRecord>(
@@ -66,7 +84,7 @@ Status KVEngine::Modify(const StringView key, ModifyFunc modify_func,
           existing_record == nullptr
               ? kNullPMemOffset
               : pmem_allocator_->addr2offset_checked(existing_record),
-          key, new_value, expired_time);
+          key, record_value, expired_time, value_extents);
       insertKeyOrElem(lookup_result, RecordType::String, RecordStatus::Normal,
                       new_record);
       break;
@@ -126,13 +144,58 @@ Status KVEngine::Get(const StringView key, std::string* value) {
                     string_record->GetRecordStatus() != RecordStatus::Outdated,
                 "Got wrong data type in string get");
     kvdk_assert(string_record->ValidOrDirty(), "Corrupted data in string get");
-    value->assign(string_record->Value().data(), string_record->Value().size());
+    readStringValue(string_record, value);
     return Status::Ok;
   } else {
     return ret.s == Status::Outdated ? Status::NotFound : ret.s;
   }
 }
 
+Status KVEngine::MultiGet(const std::vector<StringView>& keys,
+                          std::vector<std::string>* values,
+                          std::vector<Status>* statuses) {
+  auto thread_holder = AcquireAccessThread();
+
+  for (const StringView& key : keys) {
+    if (!checkKeySize(key)) {
+      return Status::InvalidDataSize;
+    }
+  }
+  values->resize(keys.size());
+  statuses->resize(keys.size());
+
+  auto holder = version_controller_.GetLocalSnapshotHolder();
+  std::vector<HashTable::LookupResult> results;
+  hash_table_->MultiLookup(keys, PrimaryRecordType, &results);
+
+  // Check all found keys and prefetch their values before copying any of them
+  for (auto& ret : results) {
+    checkKeyLookupResult(&ret, RecordType::String);
+    if (ret.s == Status::Ok) {
+      _mm_prefetch(ret.entry.GetIndex().string_record->Value().data(),
+                   _MM_HINT_T0);
+    }
+  }
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto& ret = results[i];
+    if (ret.s == Status::Ok) {
+      StringRecord* string_record = ret.entry.GetIndex().string_record;
+      kvdk_assert(
+          string_record->GetRecordType() == RecordType::String &&
+              string_record->GetRecordStatus() != RecordStatus::Outdated,
+          "Got wrong data type in string get");
+      kvdk_assert(string_record->ValidOrDirty(), "Corrupted data in string get");
+      readStringValue(string_record, &(*values)[i]);
+      (*statuses)[i] = Status::Ok;
+    } else {
+      (*values)[i].clear();
+      (*statuses)[i] = ret.s == Status::Outdated ? Status::NotFound : ret.s;
+    }
+  }
+  return Status::Ok;
+}
+
 Status KVEngine::Delete(const StringView key) {
   auto thread_holder = AcquireAccessThread();
 
@@ -178,6 +241,43 @@ Status KVEngine::stringDeleteImpl(const StringView& key) {
              : lookup_result.s;
 }
 
+Status KVEngine::stringExpireImpl(const StringView& key,
+                                  ExpireTimeType expired_time) {
+  auto ul = hash_table_->AcquireLock(key);
+  auto holder = version_controller_.GetLocalSnapshotHolder();
+  TimestampType new_ts = holder.Timestamp();
+
+  auto lookup_result = lookupKey<false>(key, RecordType::String);
+  if (lookup_result.s != Status::Ok) {
+    return lookup_result.s == Status::Outdated ? Status::NotFound
+                                               : lookup_result.s;
+  }
+
+  // The new version copies value of the existing record as is, so a value
+  // stored in extents is shared by them rather than rewritten, and owned by
+  // the new version
+  StringRecord* existing_record = lookup_result.entry.GetIndex().string_record;
+  SpaceEntry space_entry = pmem_allocator_->Allocate(
+      StringRecord::RecordSize(key, existing_record->Value()));
+  if (space_entry.size == 0) {
+    return Status::PmemOverflow;
+  }
+
+  StringRecord* new_record =
+      pmem_allocator_->offset2addr_checked<StringRecord>(space_entry.offset);
+  StringRecord::PersistStringRecord(
+      new_record, space_entry.size, new_ts, RecordType::String,
+      RecordStatus::Normal,
+      pmem_allocator_->addr2offset_checked(existing_record), key,
+      existing_record->Value(), expired_time, existing_record->HasExtents());
+  insertKeyOrElem(lookup_result, RecordType::String, RecordStatus::Normal,
+                  new_record);
+
+  removeAndCacheOutdatedVersion(new_record);
+  tryCleanCachedOutdatedRecord();
+  return Status::Ok;
+}
+
 Status KVEngine::stringPutImpl(const StringView& key, const StringView& value,
                                const WriteOptions& write_options) {
   int64_t base_time = TimeUtils::millisecond_time();
@@ -213,19 +313,37 @@ Status KVEngine::stringPutImpl(const StringView& key, const StringView& value,
           ? existing_record->GetExpireTime()
           : TimeUtils::TTLToExpireTime(write_options.ttl_time, base_time);
 
+  // Large value is stored in extents, and the record only stores the encoded
+  // extents
+  std::vector<SpaceEntry> extents;
+  std::string encoded_extents;
+  bool value_extents = largeValue(key, value);
+  if (value_extents) {
+    Status s = allocateStringExtents(value, &extents, &encoded_extents);
+    if (s != Status::Ok) {
+      return s;
+    }
+  }
+  StringView record_value =
+      value_extents ? StringView(encoded_extents) : value;
+
   // Persist key-value pair to PMem
   SpaceEntry space_entry =
-      pmem_allocator_->Allocate(StringRecord::RecordSize(key, value));
+      pmem_allocator_->Allocate(StringRecord::RecordSize(key, record_value));
   if (space_entry.size == 0) {
+    pmem_allocator_->BatchFree(extents);
     return Status::PmemOverflow;
   }
+  if (value_extents) {
+    persistStringExtents(extents, new_ts, value);
+  }
 
   StringRecord* new_record =
       pmem_allocator_->offset2addr_checked<StringRecord>(space_entry.offset);
   StringRecord::PersistStringRecord(
       new_record, space_entry.size, new_ts, RecordType::String,
       RecordStatus::Normal, pmem_allocator_->addr2offset(existing_record), key,
-      value, expired_time);
+      record_value, expired_time, value_extents);
 
   insertKeyOrElem(lookup_result, RecordType::String, RecordStatus::Normal,
                   new_record);
@@ -285,8 +403,18 @@ Status KVEngine::stringWritePrepare(StringWriteArgs& args, TimestampType ts) {
   if (args.op == WriteOp::Delete && args.res.s != Status::Ok) {
     return Status::Ok;
   }
-  args.space =
-      pmem_allocator_->Allocate(StringRecord::RecordSize(args.key, args.value));
+  bool value_extents =
+      args.op == WriteOp::Put && largeValue(args.key, args.value);
+  if (value_extents) {
+    Status s = allocateStringExtents(args.value, &args.extents,
+                                     &args.encoded_extents);
+    if (s != Status::Ok) {
+      return s;
+    }
+  }
+  args.space = pmem_allocator_->Allocate(StringRecord::RecordSize(
+      args.key,
+      value_extents ? StringView(args.encoded_extents) : args.value));
   if (args.space.size == 0) {
     return Status::PmemOverflow;
   }
@@ -306,9 +434,15 @@ Status KVEngine::stringWrite(StringWriteArgs& args) {
     old_off = pmem_allocator_->addr2offset_checked(
         args.res.entry.GetIndex().string_record);
   }
+  bool value_extents = !args.encoded_extents.empty();
+  if (value_extents) {
+    persistStringExtents(args.extents, args.ts, args.value);
+  }
   args.new_rec = StringRecord::PersistStringRecord(
       new_addr, args.space.size, args.ts, RecordType::String, record_status,
-      old_off, args.key, args.value);
+      old_off, args.key,
+      value_extents ? StringView(args.encoded_extents) : args.value,
+      kPersistTime, value_extents);
   return Status::Ok;
 }
 
@@ -327,4 +461,135 @@ Status KVEngine::stringRollback(TimestampType,
   return Status::Ok;
 }
 
+Status KVEngine::allocateStringExtents(const StringView& value,
+                                       std::vector<SpaceEntry>* extents,
+                                       std::string* encoded_extents) {
+  const uint64_t max_data_size =
+      pmem_allocator_->SegmentSize() - sizeof(StringExtentRecord);
+  std::vector<PMemOffsetType> offsets;
+  uint64_t remaining = value.size();
+  while (remaining > 0) {
+    uint64_t data_size = std::min(remaining, max_data_size);
+    SpaceEntry space =
+        pmem_allocator_->Allocate(StringExtentRecord::RecordSize(data_size));
+    if (space.size == 0) {
+      pmem_allocator_->BatchFree(*extents);
+      extents->clear();
+      return Status::PmemOverflow;
+    }
+    extents->push_back(space);
+    offsets.push_back(space.offset);
+    remaining -= data_size;
+  }
+  *encoded_extents = StringRecord::EncodeExtents(value.size(), offsets);
+  return Status::Ok;
+}
+
+void KVEngine::persistStringExtents(const std::vector<SpaceEntry>& extents,
+                                    TimestampType ts, const StringView& value) {
+  uint64_t written = 0;
+  for (const SpaceEntry& extent : extents) {
+    uint64_t data_size = std::min(value.size() - written,
+                                  extent.size - sizeof(StringExtentRecord));
+    StringExtentRecord::WriteStringExtent(
+        pmem_allocator_->offset2addr_checked(extent.offset), extent.size, ts,
+        StringView(value.data() + written, data_size));
+    written += data_size;
+  }
+  kvdk_assert(written == value.size(), "string extents too small for value");
+  pmem_drain();
+}
+
+PMemOffsetType KVEngine::purgeStringExtents(const StringRecord* record,
+                                            PMemOffsetType newer_extent,
+                                            std::vector<SpaceEntry>* entries) {
+  if (!record->HasExtents() || record->NumExtents() == 0) {
+    return kNullPMemOffset;
+  }
+  PMemOffsetType first_extent = record->ExtentOffset(0);
+  if (first_extent == newer_extent) {
+    return first_extent;
+  }
+  for (uint64_t i = 0; i < record->NumExtents(); i++) {
+    PMemOffsetType offset = record->ExtentOffset(i);
+    StringExtentRecord* extent =
+        pmem_allocator_->offset2addr_checked<StringExtentRecord>(offset);
+    entries->emplace_back(offset, extent->GetRecordSize());
+    extent->Destroy();
+  }
+  return first_extent;
+}
+
+void KVEngine::disownSharedStringExtents(const StringRecord* record,
+                                         StringRecord* old_record) {
+  while (old_record != nullptr && old_record->SharesExtents(record)) {
+    old_record->PersistDisownExtents();
+    old_record = pmem_allocator_->offset2addr<StringRecord>(
+        old_record->old_version);
+  }
+}
+
+void KVEngine::readStringValue(const StringRecord* record, std::string* value) {
+  if (!record->HasExtents()) {
+    value->assign(record->Value().data(), record->Value().size());
+    return;
+  }
+  value->resize(record->ExtentsValueSize());
+  uint64_t read = 0;
+  for (uint64_t i = 0; i < record->NumExtents(); i++) {
+    StringView data = pmem_allocator_
+                          ->offset2addr_checked<StringExtentRecord>(
+                              record->ExtentOffset(i))
+                          ->Data();
+    kvdk_assert(read + data.size() <= value->size(), "Corrupted string extent");
+    memcpy_nt_load(&(*value)[read], data.data(), data.size());
+    read += data.size();
+  }
+  kvdk_assert(read == value->size(), "Corrupted string extent");
+}
+
+void KVEngine::freeOrphanStringExtents() {
+  std::vector<SpaceEntry> extents;
+  for (size_t i = 0; i < engine_thread_cache_.size(); i++) {
+    auto& restored = engine_thread_cache_[i].restored_string_extents;
+    extents.insert(extents.end(), restored.begin(), restored.end());
+    std::vector<SpaceEntry>().swap(restored);
+  }
+  if (extents.empty()) {
+    return;
+  }
+
+  // Old versions of strings are already purged by restoreStringRecord(), so
+  // only extents of indexed records are owned
+  std::unordered_set<PMemOffsetType> owned;
+  auto hashtable_iter = hash_table_->GetIterator(0, hash_table_->GetSlotsNum());
+  while (hashtable_iter.Valid()) {
+    auto slot_lock(hashtable_iter.AcquireSlotLock());
+    auto slot_iter = hashtable_iter.Slot();
+    while (slot_iter.Valid()) {
+      if (!slot_iter->Empty() && !slot_iter->Allocated() &&
+          slot_iter->GetIndexType() == PointerType::StringRecord) {
+        StringRecord* record = slot_iter->GetIndex().string_record;
+        for (uint64_t i = 0; record->HasExtents() && i < record->NumExtents();
+             i++) {
+          owned.insert(record->ExtentOffset(i));
+        }
+      }
+      slot_iter++;
+    }
+    hashtable_iter.Next();
+  }
+
+  std::vector<SpaceEntry> orphans;
+  for (const SpaceEntry& extent : extents) {
+    if (owned.count(extent.offset) == 0) {
+      pmem_allocator_->offset2addr_checked<DataEntry>(extent.offset)->Destroy();
+      orphans.push_back(extent);
+    }
+  }
+  pmem_allocator_->BatchFree(orphans);
+  GlobalLogger.Info("Restored %lu string extents, freed %lu orphans\n",
+                    extents.size() - orphans.size(), orphans.size());
+}
+
 }  // namespace KVDK_NAMESPACE
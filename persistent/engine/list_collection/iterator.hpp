@@ -69,12 +69,16 @@ class ListIteratorImpl final : public ListIterator {
   }
 
   std::string Value() const final {
+    auto sw = ValueView();
+    return std::string{sw.data(), sw.size()};
+  }
+
+  StringView ValueView() const final {
     if (!Valid()) {
       kvdk_assert(false, "Accessing data with invalid ListIterator!");
-      return std::string{};
+      return StringView{};
     }
-    auto sw = dl_iter_.Value();
-    return std::string{sw.data(), sw.size()};
+    return dl_iter_.Value();
   }
 
  private:
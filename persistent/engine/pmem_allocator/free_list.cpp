@@ -24,167 +24,158 @@ void SpaceMap::Set(uint64_t offset, uint64_t size) {
   if (size == 0) {
     return;
   }
-  SpinMutex* start_lock = &map_spins_[offset / lock_granularity_];
-  std::lock_guard<SpinMutex> start_lg(*start_lock);
-  kvdk_assert(map_[offset].Empty(), "Set space map on a already set byte");
-  auto to_set = size > INT8_MAX ? INT8_MAX : size;
-  map_[offset] = Token(true, to_set);
-  uint64_t remaining = size - to_set;
-  uint64_t cur = offset + to_set;
-  if (remaining > 0) {
-    setRemaining(cur, remaining, offset);
-  }
+  kvdk_assert(offset + size <= num_blocks_, "Set space map overflow");
+  ChunkLocks locks(this, offset);
+  locks.LockTo(offset + size - 1);
+  setFree(offset, size);
+  setStart(offset, true);
 
-  kvdk_assert(testLocked(offset) == size, "");
+  kvdk_assert(testLocked(offset, locks) == size, "");
 }
 
 bool SpaceMap::TestAndClear(uint64_t offset, uint64_t size) {
-  assert(offset < map_.size());
+  assert(offset < num_blocks_);
   if (size == 0) {
     return true;
   }
-  std::vector<std::unique_lock<SpinMutex>> locked;
-  SpinMutex* last_lock = &map_spins_[offset / lock_granularity_];
-  locked.emplace_back(*last_lock);
-  uint64_t in_clear = 0;
-  std::vector<uint64_t> to_clear_offsets;
-  if (map_[offset].IsStart()) {
-    in_clear = map_[offset].Size();
-    to_clear_offsets.push_back(offset);
-    uint64_t cur = offset + in_clear;
-
-    while (cur < map_.size() && in_clear <= size) {
-      SpinMutex* cur_lock = &map_spins_[cur / lock_granularity_];
-      if (cur_lock != last_lock) {
-        last_lock = cur_lock;
-        locked.emplace_back(*last_lock);
-      }
-      if (map_[cur].Empty() || map_[cur].IsStart()) {
-        break;
-      }
-      in_clear += map_[cur].Size();
-      to_clear_offsets.push_back(cur);
-      cur = offset + in_clear;
-    }
+  ChunkLocks locks(this, offset);
+  if (!isStart(offset) ||
+      entryEnd(offset, std::min(offset + size + 1, num_blocks_), locks) !=
+          offset + size) {
+    return false;
   }
+  setStart(offset, false);
+  clearFree(offset, size);
+  return true;
+}
 
-  if (in_clear == size) {
-    for (uint64_t tco : to_clear_offsets) {
-      map_[tco].Clear();
+void SpaceMap::Clear(uint64_t offset, uint64_t size) {
+  if (size == 0) {
+    return;
+  }
+  kvdk_assert(offset + size <= num_blocks_, "Clear space map overflow");
+  ChunkLocks locks(this, offset);
+  locks.LockTo(offset + size - 1);
+  uint64_t end = offset + size;
+  while (offset < end) {
+    Chunk& chunk = chunks_[offset / kSpaceMapChunkBlocks];
+    uint64_t word = (offset % kSpaceMapChunkBlocks) / 64;
+    uint64_t bit = offset % 64;
+    uint64_t n = std::min<uint64_t>(64 - bit, end - offset);
+    if (chunk.bitmap != nullptr) {
+      uint64_t mask = (n == 64 ? ~0ULL : ((1ULL << n) - 1)) << bit;
+      chunk.bitmap->num_free -=
+          __builtin_popcountll(chunk.bitmap->free[word] & mask);
+      chunk.bitmap->free[word] &= ~mask;
+      chunk.bitmap->start[word] &= ~mask;
+      if (chunk.bitmap->num_free == 0) {
+        chunk.bitmap.reset();
+      }
     }
-    return true;
+    offset += n;
   }
-  return false;
 }
 
 uint64_t SpaceMap::Test(uint64_t start_offset) {
-  std::lock_guard<SpinMutex> lg(map_spins_[start_offset / lock_granularity_]);
-  return testLocked(start_offset);
+  ChunkLocks locks(this, start_offset);
+  return testLocked(start_offset, locks);
 }
 
 uint64_t SpaceMap::TryMerge(uint64_t start_offset, uint64_t start_size,
                             uint64_t limit_merge_size) {
-  uint64_t end_offset = std::min(start_offset + limit_merge_size, map_.size());
+  uint64_t end_offset = std::min(start_offset + limit_merge_size, num_blocks_);
   kvdk_assert(start_size > 0 && start_offset + start_size <= end_offset, "");
-  uint64_t merged_size = 0;
-  SpinMutex* last_lock = &map_spins_[start_offset / lock_granularity_];
-  std::lock_guard<SpinMutex> start_lg(*last_lock);
-  std::vector<std::unique_lock<SpinMutex>> iter_locked;
-  if (testLocked(start_offset) == start_size) {
-    merged_size = start_size;
-    uint64_t in_merge_offset = start_offset + merged_size;
-    uint64_t in_merge_size = 0;
-    std::vector<uint64_t> to_clear_offsets;
-    while (true) {
-      uint64_t cur = in_merge_offset + in_merge_size;
-      if (cur >= end_offset || in_merge_size >
-                                   merged_size * kMaxAjacentSpaceSizeInMerge /* do not merge a small space with a far larger one */) {
-        break;
-      }
-      SpinMutex* cur_lock = &map_spins_[cur / lock_granularity_];
-      if (cur_lock != last_lock) {
-        iter_locked.emplace_back(*cur_lock);
-        last_lock = cur_lock;
-      }
-      if (map_[cur].IsStart() || map_[cur].Empty()) {
-        if (in_merge_size > 0) {
-          merged_size += in_merge_size;
-          for (uint64_t tco : to_clear_offsets) {
-            map_[tco].Clear();
-          }
-          to_clear_offsets.clear();
-          in_merge_offset = cur;
-          in_merge_size = 0;
-        }
-      } else {
-        kvdk_assert(in_merge_size > 0 && cur > in_merge_offset,
-                    "space map error in TryMerge");
-      }
+  ChunkLocks locks(this, start_offset);
+  if (testLocked(start_offset, locks) != start_size) {
+    return 0;
+  }
 
-      if (map_[cur].Empty()) {
-        break;
-      } else {
-        to_clear_offsets.push_back(cur);
-        in_merge_size += map_[cur].Size();
-      }
+  uint64_t merged_size = start_size;
+  uint64_t cur = start_offset + merged_size;
+  while (cur < end_offset) {
+    locks.LockTo(cur);
+    if (!isStart(cur)) {
+      break;
+    }
+    // Do not merge a following space beyond end_offset, or a far larger one
+    uint64_t next = entryEnd(cur, std::min(end_offset + 1, num_blocks_), locks);
+    if (next > end_offset ||
+        next - cur > merged_size * kMaxAjacentSpaceSizeInMerge) {
+      break;
     }
+    setStart(cur, false);
+    merged_size += next - cur;
+    cur = next;
   }
 
-  iter_locked.clear();
-  if (merged_size > start_size) {
-    setRemaining(start_offset + start_size, merged_size - start_size,
-                 start_offset);
-  }
+  return merged_size;
+}
 
-  // Check merged spaced size
-  kvdk_assert(merged_size == 0 || testLocked(start_offset) == merged_size, "");
+uint64_t SpaceMap::testLocked(uint64_t start_offset, ChunkLocks& locks) {
+  if (!isStart(start_offset)) {
+    return 0;
+  }
+  return entryEnd(start_offset, num_blocks_, locks) - start_offset;
+}
 
-  return merged_size;
+uint64_t SpaceMap::entryEnd(uint64_t start_offset, uint64_t limit,
+                            ChunkLocks& locks) {
+  uint64_t cur = start_offset + 1;
+  while (cur < limit) {
+    locks.LockTo(cur);
+    ChunkBitmap* bitmap = chunks_[cur / kSpaceMapChunkBlocks].bitmap.get();
+    if (bitmap == nullptr) {
+      return cur;
+    }
+    uint64_t word = (cur % kSpaceMapChunkBlocks) / 64;
+    uint64_t bit = cur % 64;
+    // Find the first start or non-free block in this word from "cur"
+    uint64_t stop =
+        (~bitmap->free[word] | bitmap->start[word]) & (~0ULL << bit);
+    if (stop != 0) {
+      return std::min(limit, cur - bit + __builtin_ctzll(stop));
+    }
+    cur = cur - bit + 64;
+  }
+  return limit;
 }
 
-uint64_t SpaceMap::testLocked(uint64_t start_offset) {
-  std::vector<std::unique_lock<SpinMutex>> locked;
-  SpinMutex* last_lock = &map_spins_[start_offset / lock_granularity_];
-  uint64_t size = 0;
-  if (map_[start_offset].IsStart()) {
-    kvdk_assert(map_[start_offset].IsStart(), "");
-    size = map_[start_offset].Size();
-    uint64_t cur = start_offset + size;
-    while (cur < map_.size()) {
-      SpinMutex* cur_lock = &map_spins_[cur / lock_granularity_];
-      if (cur_lock != last_lock) {
-        last_lock = cur_lock;
-        locked.emplace_back(*last_lock);
-      }
-      if (map_[cur].IsStart() || map_[cur].Empty()) {
-        return size;
-      }
-      size += map_[cur].Size();
-      cur = start_offset + size;
+void SpaceMap::setFree(uint64_t offset, uint64_t size) {
+  uint64_t end = offset + size;
+  while (offset < end) {
+    Chunk& chunk = chunks_[offset / kSpaceMapChunkBlocks];
+    if (chunk.bitmap == nullptr) {
+      chunk.bitmap.reset(new ChunkBitmap);
     }
+    uint64_t word = (offset % kSpaceMapChunkBlocks) / 64;
+    uint64_t bit = offset % 64;
+    uint64_t n = std::min<uint64_t>(64 - bit, end - offset);
+    uint64_t mask = (n == 64 ? ~0ULL : ((1ULL << n) - 1)) << bit;
+    kvdk_assert((chunk.bitmap->free[word] & mask) == 0,
+                "Set space map on a already set block");
+    chunk.bitmap->free[word] |= mask;
+    chunk.bitmap->num_free += n;
+    offset += n;
   }
-  return size;
 }
 
-void SpaceMap::setRemaining(uint64_t remaining_offset, uint64_t remaining,
-                            uint64_t start_offset) {
-  SpinMutex* last_lock = &map_spins_[start_offset / lock_granularity_];
-  std::vector<std::unique_lock<SpinMutex>> remaining_locked;
-  uint64_t cur = remaining_offset;
-  kvdk_assert(testLocked(start_offset) == (remaining_offset - start_offset),
-              "");
-  while (remaining > 0) {
-    kvdk_assert(cur < map_.size(), "Set space map overflow");
-    uint8_t to_set = remaining > INT8_MAX ? INT8_MAX : remaining;
-    SpinMutex* cur_lock = &map_spins_[cur / lock_granularity_];
-    if (cur_lock != last_lock) {
-      remaining_locked.emplace_back(*cur_lock);
-      last_lock = cur_lock;
+void SpaceMap::clearFree(uint64_t offset, uint64_t size) {
+  uint64_t end = offset + size;
+  while (offset < end) {
+    Chunk& chunk = chunks_[offset / kSpaceMapChunkBlocks];
+    uint64_t word = (offset % kSpaceMapChunkBlocks) / 64;
+    uint64_t bit = offset % 64;
+    uint64_t n = std::min<uint64_t>(64 - bit, end - offset);
+    uint64_t mask = (n == 64 ? ~0ULL : ((1ULL << n) - 1)) << bit;
+    kvdk_assert(chunk.bitmap != nullptr &&
+                    (chunk.bitmap->free[word] & mask) == mask,
+                "Clear space map on a not set block");
+    chunk.bitmap->free[word] &= ~mask;
+    chunk.bitmap->num_free -= n;
+    if (chunk.bitmap->num_free == 0) {
+      chunk.bitmap.reset();
     }
-    kvdk_assert(map_[cur].Empty(), "");
-    map_[cur] = Token(false, to_set);
-    cur += to_set;
-    remaining -= to_set;
+    offset += n;
   }
 }
 
@@ -349,6 +340,12 @@ bool Freelist::Get(uint32_t size, SpaceEntry* space_entry) {
   return getLargeEntry(size, space_entry);
 }
 
+void Freelist::Discard(const SpaceEntry& range) {
+  assert(range.size % block_size_ == 0);
+  assert(range.offset % block_size_ == 0);
+  space_map_.Clear(range.offset / block_size_, range.size / block_size_);
+}
+
 void Freelist::MoveCachedEntriesToPool() {
   std::vector<PMemOffsetType> moving_small_entry_list;
   std::set<SpaceEntry, SpaceEntry::SpaceCmp> moving_large_entry_set;
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <set>
 
 #include "../alias.hpp"
@@ -16,18 +17,26 @@ namespace KVDK_NAMESPACE {
 constexpr uint32_t kMaxSmallBlockSize = 255;
 constexpr uint32_t kMaxBlockSizeIndex = 255;
 constexpr uint32_t kBlockSizeIndexInterval = 1024;
-constexpr uint32_t kSpaceMapLockGranularity = 256;
+constexpr uint32_t kSpaceMapChunkBlocks = 1024;
 
 class PMEMAllocator;
 
-// A byte map to record free blocks of PMem space, used for merging adjacent
-// free space entries in the free list
+// A hierarchical bitmap to record free blocks of PMem space, used for merging
+// adjacent free space entries in the free list
+//
+// Each block has a free bit and a start bit, a free space entry starts at a
+// block with both bits set, and covers following free blocks until next start
+// or non-free block, so adjacent entries are merged by clearing start bits.
+//
+// Blocks are divided into chunks of kSpaceMapChunkBlocks, the top level holds
+// a lock and a bitmap pointer per chunk, and bitmap of a chunk is allocated
+// only while the chunk has free blocks, so space fully in use or never used
+// costs no bitmap memory
 class SpaceMap {
  public:
   SpaceMap(uint64_t num_blocks)
-      : map_(num_blocks, {false, 0}),
-        lock_granularity_(kSpaceMapLockGranularity),
-        map_spins_(num_blocks / lock_granularity_ + 1) {}
+      : num_blocks_(num_blocks),
+        chunks_(num_blocks / kSpaceMapChunkBlocks + 1) {}
 
   bool TestAndClear(uint64_t offset, uint64_t size);
 
@@ -38,37 +47,80 @@ class SpaceMap {
 
   void Set(uint64_t offset, uint64_t size);
 
-  uint64_t Size() { return map_.size(); }
+  // Clear all free blocks in [offset, offset + size), entries covering them
+  // are regarded as invalid
+  void Clear(uint64_t offset, uint64_t size);
+
+  uint64_t Size() { return num_blocks_; }
 
  private:
-  // test size with start_offset locked
-  uint64_t testLocked(uint64_t start_offset);
+  static constexpr uint32_t kChunkWords = kSpaceMapChunkBlocks / 64;
+
+  struct ChunkBitmap {
+    uint64_t free[kChunkWords] = {};
+    uint64_t start[kChunkWords] = {};
+    uint32_t num_free = 0;
+  };
 
-  // set remaining space bytes of space "start_offset", the start offset should
-  // already been locked
-  void setRemaining(uint64_t remaining_offset, uint64_t remaining,
-                    uint64_t start_offset);
+  struct Chunk {
+    std::unique_ptr<ChunkBitmap> bitmap;
+    SpinMutex spin;
+  };
 
-  // The highest 1 bit ot the token indicates if this is the start of a space
-  // entry, the lower 7 bits indicate how many free blocks followed
-  struct Token {
+  // Hold locks of continuous chunks, chunks are always locked in increasing
+  // order while scanning the map
+  class ChunkLocks {
    public:
-    Token(bool is_start, uint8_t size)
-        : token_(size | (is_start ? (1 << 7) : 0)) {}
-    uint8_t Size() { return token_ & INT8_MAX; }
-    void Clear() { token_ = 0; }
-    bool Empty() { return Size() == 0; }
-    bool IsStart() { return token_ & (1 << 7); }
-    void UnStart() { token_ &= INT8_MAX; }
+    ChunkLocks(SpaceMap* map, uint64_t offset)
+        : map_(map), last_chunk_(offset / kSpaceMapChunkBlocks) {
+      locked_.emplace_back(map_->chunks_[last_chunk_].spin);
+    }
+
+    // Lock all chunks until the chunk of "offset"
+    void LockTo(uint64_t offset) {
+      while (last_chunk_ < offset / kSpaceMapChunkBlocks) {
+        locked_.emplace_back(map_->chunks_[++last_chunk_].spin);
+      }
+    }
 
    private:
-    uint8_t token_;
+    SpaceMap* map_;
+    uint64_t last_chunk_;
+    std::vector<std::unique_lock<SpinMutex>> locked_;
   };
 
-  std::vector<Token> map_;
-  // every lock_granularity_ bytes share a spin lock
-  const uint32_t lock_granularity_;
-  std::vector<SpinMutex> map_spins_;
+  // Return size of free space entry start at "start_offset", 0 if it's not a
+  // start of free space. Chunk of start_offset should be locked
+  uint64_t testLocked(uint64_t start_offset, ChunkLocks& locks);
+
+  // Return the first start or non-free block after "start_offset", or "limit"
+  // if no such block before it
+  uint64_t entryEnd(uint64_t start_offset, uint64_t limit, ChunkLocks& locks);
+
+  // Set or clear free bits of blocks in [offset, offset + size), chunks of the
+  // range should be locked
+  void setFree(uint64_t offset, uint64_t size);
+  void clearFree(uint64_t offset, uint64_t size);
+
+  bool isStart(uint64_t offset) {
+    ChunkBitmap* bitmap = chunks_[offset / kSpaceMapChunkBlocks].bitmap.get();
+    uint64_t bit = offset % kSpaceMapChunkBlocks;
+    return bitmap != nullptr && (bitmap->start[bit / 64] >> (bit % 64)) & 1;
+  }
+
+  void setStart(uint64_t offset, bool start) {
+    ChunkBitmap* bitmap = chunks_[offset / kSpaceMapChunkBlocks].bitmap.get();
+    uint64_t bit = offset % kSpaceMapChunkBlocks;
+    kvdk_assert(bitmap != nullptr, "set start bit of a non-free block");
+    if (start) {
+      bitmap->start[bit / 64] |= (1ULL << (bit % 64));
+    } else {
+      bitmap->start[bit / 64] &= ~(1ULL << (bit % 64));
+    }
+  }
+
+  const uint64_t num_blocks_;
+  Array<Chunk> chunks_;
 };
 
 // free entry pool consists of three level vectors, the first level
@@ -201,6 +253,10 @@ class Freelist {
   // Request a free space entry that equal to or larger than "size"
   bool Get(uint32_t size, SpaceEntry* space_entry);
 
+  // Invalidate free space entries inside "range", they will be dropped while
+  // fetched from the free list
+  void Discard(const SpaceEntry& range);
+
   // Merge adjacent free spaces stored in the entry pool into larger one
   //
   // Fetch every free space entry lists from active_pool_, for each entry in the
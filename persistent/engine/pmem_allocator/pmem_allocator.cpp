@@ -5,40 +5,133 @@
 #include "pmem_allocator.hpp"
 
 #include <libpmem.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/sysmacros.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <thread>
 
 #include "../thread_manager.hpp"
 
+#ifndef MAP_SHARED_VALIDATE
+#define MAP_SHARED_VALIDATE 0x03
+#endif
+
+#ifndef MAP_SYNC
+#define MAP_SYNC 0x80000
+#endif
+
 namespace KVDK_NAMESPACE {
 
-PMEMAllocator::PMEMAllocator(char* pmem, uint64_t pmem_size,
-                             uint64_t num_segment_blocks, uint32_t block_size,
-                             uint32_t max_access_threads,
+PMEMAllocator::PMEMAllocator(char* reserved, uint64_t reserved_size,
+                             char* pmem,
+                             const std::vector<std::string>& pmem_files,
+                             uint64_t pool_file_size, uint32_t max_pool_files,
+                             bool use_devdax_mode, uint64_t num_segment_blocks,
+                             uint32_t block_size, uint32_t max_access_threads,
+                             uint32_t slab_max_blocks,
                              VersionController* version_controller)
-    : pmem_(pmem),
+    : reserved_(reserved),
+      reserved_size_(reserved_size),
+      pmem_(pmem),
+      pmem_files_(pmem_files),
+      pool_file_size_(pool_file_size),
+      max_pool_files_(max_pool_files),
+      pool_span_(pool_file_size * max_pool_files),
+      use_devdax_mode_(use_devdax_mode),
       palloc_thread_cache_(max_access_threads),
       block_size_(block_size),
       segment_size_(num_segment_blocks * block_size),
-      offset_head_(0),
-      pmem_size_(pmem_size),
+      num_pools_(pmem_files.size()),
+      pools_(new NumaPool[pmem_files.size()]),
+      fetching_pool_(0),
       free_list_(num_segment_blocks, block_size, max_access_threads,
-                 pmem_size / block_size / num_segment_blocks *
+                 pool_span_ * num_pools_ / block_size / num_segment_blocks *
                      num_segment_blocks /*num blocks*/,
                  this),
+      slab_(slab_max_blocks, block_size, max_access_threads, this),
+      segments_(pool_span_ * num_pools_ / segment_size_),
       version_controller_(version_controller) {
   init_data_size_2_block_size();
+  for (uint32_t i = 0; i < num_pools_; i++) {
+    pools_[i].offset_head.store(poolBase(i));
+  }
 }
 
 void PMEMAllocator::Free(const SpaceEntry& space_entry) {
   if (space_entry.size > 0) {
     assert(space_entry.size % block_size_ == 0);
-    free_list_.Push(space_entry);
+    SegmentStatus& segment = segmentStatus(space_entry.offset);
+    // Space of a draining segment is reclaimed along with the segment
+    if (!segment.draining.load()) {
+      pushSpace(space_entry);
+    }
+    // Decrease usage after pushed, so a drained segment is reclaimed after
+    // its space pushed and can be dropped
+    segment.usage.fetch_sub(space_entry.size);
     LogDeallocation(ThreadManager::ThreadID(), space_entry.size);
   }
 }
 
+void PMEMAllocator::pushSpace(const SpaceEntry& entry) {
+  if (slab_.Serve(entry.size / block_size_)) {
+    slab_.Free(entry);
+  } else {
+    free_list_.Push(entry);
+  }
+}
+
+void PMEMAllocator::freeRemaining(const SpaceEntry& entry) {
+  if (entry.size > 0 && !segmentStatus(entry.offset).draining.load()) {
+    pushSpace(entry);
+  }
+}
+
+bool PMEMAllocator::claimSpace(const SpaceEntry& entry) {
+  SegmentStatus& segment = segmentStatus(entry.offset);
+  segment.usage.fetch_add(entry.size);
+  if (segment.draining.load()) {
+    segment.usage.fetch_sub(entry.size);
+    return false;
+  }
+  return true;
+}
+
+void PMEMAllocator::BatchFree(const std::vector<SpaceEntry>& entries) {
+  if (entries.size() > 0) {
+    LogDeallocation(ThreadManager::ThreadID(), batchPush(entries));
+  }
+}
+
+uint64_t PMEMAllocator::batchPush(const std::vector<SpaceEntry>& entries) {
+  std::vector<SpaceEntry> large_entries;
+  for (const SpaceEntry& entry : entries) {
+    if (segmentStatus(entry.offset).draining.load()) {
+      continue;
+    }
+    if (slab_.Serve(entry.size / block_size_)) {
+      slab_.Free(entry);
+    } else {
+      large_entries.push_back(entry);
+    }
+  }
+  // Avoid copying entries if slab is disabled and no segment is draining
+  if (large_entries.size() == entries.size()) {
+    free_list_.BatchPush(entries);
+  } else {
+    free_list_.BatchPush(large_entries);
+  }
+
+  uint64_t freed_size = 0;
+  for (const SpaceEntry& entry : entries) {
+    segmentStatus(entry.offset).usage.fetch_sub(entry.size);
+    freed_size += entry.size;
+  }
+  return freed_size;
+}
+
 std::int64_t PMEMAllocator::PMemUsageInBytes() {
   std::int64_t total = 0;
   for (auto const& ptcache : palloc_thread_cache_) {
@@ -48,76 +141,38 @@ std::int64_t PMEMAllocator::PMemUsageInBytes() {
   return total;
 }
 
+uint64_t PMEMAllocator::PMemSize() const {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < num_pools_; i++) {
+    total += pools_[i].size.load();
+  }
+  return total;
+}
+
 void PMEMAllocator::populateSpace() {
   GlobalLogger.Info("Populating PMem space ...\n");
   assert((pmem_ - static_cast<char*>(nullptr)) % 64 == 0);
-  for (size_t i = 0; i < pmem_size_ / 64; i++) {
-    _mm512_stream_si512(reinterpret_cast<__m512i*>(pmem_) + i,
-                        _mm512_set1_epi64(0ULL));
+  for (uint32_t pool = 0; pool < num_pools_; pool++) {
+    __m512i* begin = reinterpret_cast<__m512i*>(pmem_ + poolBase(pool));
+    for (size_t i = 0; i < pools_[pool].size.load() / 64; i++) {
+      _mm512_stream_si512(begin + i, _mm512_set1_epi64(0ULL));
+    }
   }
   _mm_mfence();
   GlobalLogger.Info("Populating done\n");
 }
 
-PMEMAllocator::~PMEMAllocator() { pmem_unmap(pmem_, pmem_size_); }
+PMEMAllocator::~PMEMAllocator() { munmap(reserved_, reserved_size_); }
 
 PMEMAllocator* PMEMAllocator::NewPMEMAllocator(
-    const std::string& pmem_file, uint64_t pmem_size,
-    uint64_t num_segment_blocks, uint32_t block_size,
-    uint32_t max_access_threads, bool populate_space_on_new_file,
-    bool use_devdax_mode, VersionController* version_controller) {
-  int is_pmem;
-  uint64_t mapped_size;
-  char* pmem;
-  // TODO jiayu: Should we clear map failed file?
-  bool pmem_file_exist = file_exist(pmem_file);
-  if (!use_devdax_mode) {
-    if ((pmem = (char*)pmem_map_file(pmem_file.c_str(), pmem_size,
-                                     PMEM_FILE_CREATE, 0666, &mapped_size,
-                                     &is_pmem)) == nullptr) {
-      GlobalLogger.Error("PMem map file %s failed: %s\n", pmem_file.c_str(),
-                         strerror(errno));
-      return nullptr;
-    }
-
-    if (!is_pmem) {
-      GlobalLogger.Error("%s is not a pmem path\n", pmem_file.c_str());
-      return nullptr;
-    }
-  } else {
-    if (!checkDevDaxAndGetSize(pmem_file.c_str(), &mapped_size)) {
-      GlobalLogger.Error(
-          "checkDevDaxAndGetSize %s failed device %s faild: %s\n",
-          pmem_file.c_str(), strerror(errno));
-      return nullptr;
-    }
-
-    int flags = PROT_READ | PROT_WRITE;
-    int fd = open(pmem_file.c_str(), O_RDWR, 0666);
-    if (fd < 0) {
-      GlobalLogger.Error("Open devdax device %s faild: %s\n", pmem_file.c_str(),
-                         strerror(errno));
-      return nullptr;
-    }
-
-    if ((pmem = (char*)mmap(nullptr, pmem_size, flags, MAP_SHARED, fd, 0)) ==
-        nullptr) {
-      GlobalLogger.Error("Mmap devdax device %s faild: %s\n", pmem_file.c_str(),
-                         strerror(errno));
-      return nullptr;
-    }
-  }
-
-  if (mapped_size != pmem_size) {
-    GlobalLogger.Error(
-        "Pmem map file %s size %lu is not same as expected %lu\n",
-        pmem_file.c_str(), mapped_size, pmem_size);
-    return nullptr;
-  }
-
+    const std::vector<std::string>& pmem_files, uint64_t pool_file_size,
+    uint32_t max_pool_files, uint64_t num_segment_blocks, uint32_t block_size,
+    uint32_t max_access_threads, uint32_t slab_max_blocks,
+    bool populate_space_on_new_file, bool use_devdax_mode,
+    VersionController* version_controller) {
   uint64_t segment_size = block_size * num_segment_blocks;
 
-  if (pmem_size < segment_size * max_access_threads) {
+  if (pool_file_size < segment_size * max_access_threads) {
     GlobalLogger.Error(
         "pmem file too small, should larger than pmem_segment_blocks * "
         "pmem_block_size * max_access_threads\n");
@@ -127,28 +182,105 @@ PMEMAllocator* PMEMAllocator::NewPMEMAllocator(
   // num_segment_blocks and block_size are persisted and never changes.
   // No need to worry user modify those parameters so that records may be
   // skipped.
-  size_t sz_wasted = pmem_size % (segment_size);
+  size_t sz_wasted = pool_file_size % (segment_size);
   if (sz_wasted != 0) {
     GlobalLogger.Error(
         "Pmem file size not aligned with segment size, pmem file size is %llu, "
         "segment_size is %llu\n",
-        pmem_size, block_size * num_segment_blocks);
+        pool_file_size, block_size * num_segment_blocks);
+    return nullptr;
+  }
+
+  if (slab_max_blocks >= num_segment_blocks) {
+    GlobalLogger.Error(
+        "slab max blocks %u should smaller than segment blocks %lu\n",
+        slab_max_blocks, num_segment_blocks);
+    return nullptr;
+  }
+
+  if (max_pool_files == 0 || pmem_files.empty() ||
+      (use_devdax_mode && (max_pool_files != 1 || pmem_files.size() != 1))) {
+    GlobalLogger.Error(
+        "max pool files and NUMA pools should be 1 in devdax mode and at "
+        "least 1 else\n");
+    return nullptr;
+  }
+
+  if ((max_pool_files > 1 || pmem_files.size() > 1) &&
+      pool_file_size % kPMemMapAlignment != 0) {
+    GlobalLogger.Error(
+        "Pmem file size should align to %lu bytes with multiple pool files\n",
+        kPMemMapAlignment);
+    return nullptr;
+  }
+
+  // Pool files of all NUMA pools are created together, so a missing one means
+  // pools configured not match the instance
+  std::vector<uint32_t> num_pool_files(pmem_files.size(), 1);
+  uint32_t num_exist = 0;
+  for (size_t pool = 0; pool < pmem_files.size(); pool++) {
+    const std::string& pmem_file = pmem_files[pool];
+    if (!file_exist(pmem_file)) {
+      continue;
+    }
+    num_exist++;
+    while (!use_devdax_mode &&
+           file_exist(poolFile(pmem_file, num_pool_files[pool]))) {
+      num_pool_files[pool]++;
+    }
+    if (num_pool_files[pool] > max_pool_files) {
+      GlobalLogger.Error("%u pool files of %s exist, more than max %u\n",
+                         num_pool_files[pool], pmem_file.c_str(),
+                         max_pool_files);
+      return nullptr;
+    }
+  }
+  bool pmem_file_exist = num_exist > 0;
+  if (pmem_file_exist && num_exist != pmem_files.size()) {
+    GlobalLogger.Error("Pool files of %lu NUMA pools missing\n",
+                       pmem_files.size() - num_exist);
     return nullptr;
   }
 
+  // Reserve address space for all pool files, aligned for huge page mapping
+  uint64_t reserved_size =
+      pool_file_size * max_pool_files * pmem_files.size() + kPMemMapAlignment;
+  char* reserved =
+      (char*)mmap(nullptr, reserved_size, PROT_NONE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED) {
+    GlobalLogger.Error("Reserve %lu bytes address space for PMem failed: %s\n",
+                       reserved_size, strerror(errno));
+    return nullptr;
+  }
+  char* pmem = reserved + (kPMemMapAlignment -
+                           (uint64_t)reserved % kPMemMapAlignment) %
+                              kPMemMapAlignment;
+
   PMEMAllocator* allocator = nullptr;
   // We need to allocate a byte map in pmem allocator which require a large
   // memory, so we catch exception here
   try {
-    allocator =
-        new PMEMAllocator(pmem, pmem_size, num_segment_blocks, block_size,
-                          max_access_threads, version_controller);
+    allocator = new PMEMAllocator(
+        reserved, reserved_size, pmem, pmem_files, pool_file_size,
+        max_pool_files, use_devdax_mode, num_segment_blocks, block_size,
+        max_access_threads, slab_max_blocks, version_controller);
   } catch (std::bad_alloc& err) {
     GlobalLogger.Error("Error while initialize PMEMAllocator: %s\n",
                        err.what());
+    munmap(reserved, reserved_size);
     return nullptr;
   }
 
+  for (uint32_t pool = 0; pool < pmem_files.size(); pool++) {
+    for (uint32_t i = 0; i < num_pool_files[pool]; i++) {
+      if (!allocator->mapPoolFile(pool, i, false)) {
+        delete allocator;
+        return nullptr;
+      }
+    }
+  }
+
   GlobalLogger.Info("Map pmem space done\n");
 
   if (!pmem_file_exist && populate_space_on_new_file) {
@@ -158,27 +290,289 @@ PMEMAllocator* PMEMAllocator::NewPMEMAllocator(
   return allocator;
 }
 
+bool PMEMAllocator::mapPoolFile(uint32_t pool, uint32_t file_index,
+                                bool create) {
+  std::string pool_file = poolFile(pmem_files_[pool], file_index);
+  char* addr = pmem_ + poolBase(pool) + file_index * pool_file_size_;
+  int fd;
+  if (!use_devdax_mode_) {
+    fd = open(pool_file.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+      GlobalLogger.Error("Open pmem file %s failed: %s\n", pool_file.c_str(),
+                         strerror(errno));
+      return false;
+    }
+    struct stat st;
+    // A file left by crash while creating should be truncated
+    if (fstat(fd, &st) != 0 || (create && ftruncate(fd, 0) != 0)) {
+      GlobalLogger.Error("Stat pmem file %s failed: %s\n", pool_file.c_str(),
+                         strerror(errno));
+      close(fd);
+      return false;
+    }
+    uint64_t file_size = create ? 0 : st.st_size;
+    if (file_size > pool_file_size_) {
+      GlobalLogger.Error(
+          "Pmem file %s size %lu is not same as expected %lu\n",
+          pool_file.c_str(), file_size, pool_file_size_);
+      close(fd);
+      return false;
+    }
+    int err = file_size < pool_file_size_
+                  ? posix_fallocate(fd, 0, pool_file_size_)
+                  : 0;
+    if (err != 0) {
+      GlobalLogger.Error("Allocate pmem file %s failed: %s\n",
+                         pool_file.c_str(), strerror(err));
+      close(fd);
+      return false;
+    }
+  } else {
+    uint64_t device_size;
+    if (!checkDevDaxAndGetSize(pool_file.c_str(), &device_size)) {
+      GlobalLogger.Error("checkDevDaxAndGetSize %s failed: %s\n",
+                         pool_file.c_str(), strerror(errno));
+      return false;
+    }
+    if (device_size != pool_file_size_) {
+      GlobalLogger.Error(
+          "Pmem map file %s size %lu is not same as expected %lu\n",
+          pool_file.c_str(), device_size, pool_file_size_);
+      return false;
+    }
+    fd = open(pool_file.c_str(), O_RDWR, 0666);
+    if (fd < 0) {
+      GlobalLogger.Error("Open devdax device %s faild: %s\n",
+                         pool_file.c_str(), strerror(errno));
+      return false;
+    }
+  }
+
+  int prot = PROT_READ | PROT_WRITE;
+  bool is_pmem = true;
+  void* mapped = MAP_FAILED;
+  if (!use_devdax_mode_) {
+    // Fall back to a normal shared mapping if the file system is not DAX,
+    // the same as pmem_map_file()
+    mapped = mmap(addr, pool_file_size_, prot,
+                  MAP_SHARED_VALIDATE | MAP_SYNC | MAP_FIXED, fd, 0);
+    if (mapped == MAP_FAILED && (errno == EOPNOTSUPP || errno == EINVAL)) {
+      mapped = mmap(addr, pool_file_size_, prot, MAP_SHARED | MAP_FIXED, fd, 0);
+      is_pmem = mapped != MAP_FAILED && pmem_is_pmem(addr, pool_file_size_);
+    }
+  } else {
+    mapped = mmap(addr, pool_file_size_, prot, MAP_SHARED | MAP_FIXED, fd, 0);
+  }
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    GlobalLogger.Error("PMem map file %s failed: %s\n", pool_file.c_str(),
+                       strerror(errno));
+    return false;
+  }
+  if (!is_pmem) {
+    GlobalLogger.Error("%s is not a pmem path\n", pool_file.c_str());
+    return false;
+  }
+  pools_[pool].size.fetch_add(pool_file_size_);
+  return true;
+}
+
+bool PMEMAllocator::addPoolFile(uint32_t pool) {
+  uint32_t num_pool_files = pools_[pool].size.load() / pool_file_size_;
+  if (num_pool_files == max_pool_files_ ||
+      !mapPoolFile(pool, num_pool_files, true)) {
+    return false;
+  }
+  GlobalLogger.Info("Add PMem pool file %s\n",
+                    poolFile(pmem_files_[pool], num_pool_files).c_str());
+  return true;
+}
+
 bool PMEMAllocator::FetchSegment(SpaceEntry* segment_space_entry) {
   assert(segment_space_entry);
 
-  std::lock_guard<SpinMutex> lg(offset_head_lock_);
-  if (offset_head_ <= pmem_size_ - segment_size_ &&
-      offset2addr<DataHeader>(offset_head_)->record_size != 0) {
-    *segment_space_entry = SpaceEntry{offset_head_, segment_size_};
-    offset_head_ += segment_size_;
-    LogAllocation(-1, segment_size_);
-    return true;
+  std::lock_guard<SpinMutex> lg(fetch_lock_);
+  while (fetching_pool_ < num_pools_) {
+    NumaPool& pool = pools_[fetching_pool_];
+    uint64_t offset_head = pool.offset_head.load();
+    if (offset_head + segment_size_ <=
+            poolBase(fetching_pool_) + pool.size.load() &&
+        offset2addr<DataHeader>(offset_head)->record_size != 0) {
+      *segment_space_entry = SpaceEntry{offset_head, segment_size_};
+      segmentStatus(offset_head).usage.store(segment_size_);
+      pool.offset_head.store(offset_head + segment_size_);
+      LogAllocation(-1, segment_size_);
+      return true;
+    }
+    fetching_pool_++;
   }
   return false;
 }
 
+std::vector<PMemOffsetType> PMEMAllocator::OffsetHeads() {
+  std::vector<PMemOffsetType> ret;
+  for (uint32_t i = 0; i < num_pools_; i++) {
+    ret.push_back(pools_[i].offset_head.load());
+  }
+  return ret;
+}
+
+bool PMEMAllocator::ValidOffsetHeads(
+    const std::vector<PMemOffsetType>& offset_heads) {
+  if (offset_heads.size() != num_pools_) {
+    return false;
+  }
+  for (uint32_t i = 0; i < num_pools_; i++) {
+    if (offset_heads[i] % segment_size_ != 0 ||
+        offset_heads[i] < poolBase(i) ||
+        offset_heads[i] > poolBase(i) + pools_[i].size.load()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void PMEMAllocator::RestoreOffsetHeads(
+    const std::vector<PMemOffsetType>& offset_heads) {
+  kvdk_assert(ValidOffsetHeads(offset_heads),
+              "invalid offset heads in RestoreOffsetHeads");
+  for (uint32_t i = 0; i < num_pools_; i++) {
+    pools_[i].offset_head.store(offset_heads[i]);
+    for (PMemOffsetType offset = poolBase(i); offset < offset_heads[i];
+         offset += segment_size_) {
+      segmentStatus(offset).usage.store(segment_size_);
+    }
+    LogAllocation(-1, offset_heads[i] - poolBase(i));
+  }
+}
+
+void PMEMAllocator::FreeUnusedSpace(const std::vector<PMemOffsetType>& ends,
+                                    const std::vector<SpaceEntry>& used_space) {
+  kvdk_assert(ValidOffsetHeads(ends), "invalid end offsets in FreeUnusedSpace");
+  std::vector<SpaceEntry> unused_space;
+  auto add_unused_space = [&](PMemOffsetType begin, PMemOffsetType end) {
+    while (begin < end) {
+      // A free space entry should not cross segments
+      PMemOffsetType segment_end = (begin / segment_size_ + 1) * segment_size_;
+      uint64_t size = std::min(end, segment_end) - begin;
+      persistSpaceEntry(begin, size);
+      unused_space.emplace_back(begin, size);
+      begin += size;
+    }
+  };
+
+  auto used = used_space.begin();
+  for (uint32_t pool = 0; pool < num_pools_; pool++) {
+    PMemOffsetType cur = poolBase(pool);
+    for (; used != used_space.end() && used->offset < ends[pool]; used++) {
+      kvdk_assert(
+          used->offset >= cur && used->offset + used->size <= ends[pool],
+          "used space should be sorted and not overlapped");
+      add_unused_space(cur, used->offset);
+      cur = used->offset + used->size;
+    }
+    add_unused_space(cur, ends[pool]);
+  }
+  kvdk_assert(used == used_space.end(),
+              "used space should be before end offsets");
+
+  LogDeallocation(-1, batchPush(unused_space));
+}
+
 bool PMEMAllocator::allocateSegmentSpace(SpaceEntry* segment_entry) {
-  std::lock_guard<SpinMutex> lg(offset_head_lock_);
-  if (offset_head_ <= pmem_size_ - segment_size_) {
-    *segment_entry = SpaceEntry{offset_head_, segment_size_};
-    offset_head_ += segment_size_;
-    persistSpaceEntry(segment_entry->offset, segment_size_);
-    return true;
+  SpaceEntry& segment_batch =
+      palloc_thread_cache_[ThreadManager::ThreadID() %
+                           palloc_thread_cache_.size()]
+          .segment_batch;
+  if (segment_batch.size == 0 && !reserveSegments(&segment_batch)) {
+    return stealSegment(segment_entry);
+  }
+  *segment_entry = SpaceEntry{segment_batch.offset, segment_size_};
+  segment_batch.offset += segment_size_;
+  segment_batch.size -= segment_size_;
+  persistSpaceEntry(segment_entry->offset, segment_size_);
+  return true;
+}
+
+bool PMEMAllocator::reserveSegments(SpaceEntry* segment_batch) {
+  uint32_t local_pool = localPool();
+  for (uint32_t i = 0; i < num_pools_; i++) {
+    if (reservePoolSegments((local_pool + i) % num_pools_, segment_batch)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t PMEMAllocator::localPool() const {
+  unsigned cpu;
+  unsigned node;
+  if (num_pools_ == 1 || syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+    return 0;
+  }
+  return node % num_pools_;
+}
+
+bool PMEMAllocator::reservePoolSegments(uint32_t pool_index,
+                                        SpaceEntry* segment_batch) {
+  NumaPool& pool = pools_[pool_index];
+  PMemOffsetType base = poolBase(pool_index);
+  uint64_t offset_head = pool.offset_head.load();
+  while (true) {
+    uint64_t num_remaining =
+        (base + pool.size.load() - offset_head) / segment_size_;
+    if (num_remaining == 0) {
+      std::lock_guard<SpinMutex> lg(pool.lock);
+      offset_head = pool.offset_head.load();
+      if (offset_head + segment_size_ > base + pool.size.load() &&
+          !addPoolFile(pool_index)) {
+        return false;
+      }
+      continue;
+    }
+    // Leave never used segments to other threads while running out of space
+    uint64_t num_reserve = std::max<uint64_t>(
+        1, std::min(kSegmentBatchSize,
+                    num_remaining / palloc_thread_cache_.size()));
+    // Segments are marked before published by bumping offset head, so used
+    // segments are never after a never used one, which ends recovery
+    for (uint64_t i = 0; i < num_reserve; i++) {
+      markSegment(offset_head + i * segment_size_);
+    }
+    if (pool.offset_head.compare_exchange_weak(
+            offset_head, offset_head + num_reserve * segment_size_)) {
+      *segment_batch = SpaceEntry{offset_head, num_reserve * segment_size_};
+      return true;
+    }
+  }
+}
+
+void PMEMAllocator::markSegment(PMemOffsetType offset) {
+  // Threads racing for the segment may mark it concurrently, and the winner
+  // may already use it, so only set header of a never used segment
+  uint64_t* header = offset2addr_checked<uint64_t>(offset);
+  uint64_t expected = 0;
+  uint64_t padding;
+  DataHeader padding_header(0, segment_size_);
+  static_assert(sizeof(DataHeader) == sizeof(uint64_t), "");
+  memcpy(&padding, &padding_header, sizeof(DataHeader));
+  __atomic_compare_exchange_n(header, &expected, padding, false,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  // Persist even if marked by others, as they may not persisted it yet
+  pmem_persist(header, sizeof(DataHeader));
+}
+
+bool PMEMAllocator::stealSegment(SpaceEntry* segment_entry) {
+  // Thread cache of the caller is locked, so only try locking others to avoid
+  // dead lock
+  for (auto& ptcache : palloc_thread_cache_) {
+    std::unique_lock<SpinMutex> ul(ptcache.spin, std::try_to_lock);
+    if (ul.owns_lock() && ptcache.segment_batch.size > 0) {
+      *segment_entry = SpaceEntry{ptcache.segment_batch.offset, segment_size_};
+      ptcache.segment_batch.offset += segment_size_;
+      ptcache.segment_batch.size -= segment_size_;
+      return true;
+    }
   }
   return false;
 }
@@ -239,9 +633,34 @@ SpaceEntry PMEMAllocator::Allocate(uint64_t size) {
   }
   auto& palloc_thread_cache = palloc_thread_cache_[ThreadManager::ThreadID() %
                                                    palloc_thread_cache_.size()];
-  while (palloc_thread_cache.segment_entry.size < aligned_size) {
+  std::lock_guard<SpinMutex> lg(palloc_thread_cache.spin);
+  if (slab_.Serve(b_size)) {
+    space_entry = slab_.Allocate(b_size);
+    if (space_entry.size > 0) {
+      LogAllocation(ThreadManager::ThreadID(), space_entry.size);
+      return space_entry;
+    }
+  }
+  while (true) {
+    if (palloc_thread_cache.segment_entry.size >= aligned_size) {
+      space_entry = palloc_thread_cache.segment_entry;
+      space_entry.size = aligned_size;
+      if (claimSpace(space_entry)) {
+        break;
+      }
+      // The cached segment is draining
+      palloc_thread_cache.segment_entry.size = 0;
+    }
+
     // allocate from free list space
     if (palloc_thread_cache.free_entry.size >= aligned_size) {
+      space_entry = palloc_thread_cache.free_entry;
+      space_entry.size = aligned_size;
+      if (!claimSpace(space_entry)) {
+        // Got from a draining segment
+        palloc_thread_cache.free_entry.size = 0;
+        continue;
+      }
       // Padding remaining space
       auto extra_space = palloc_thread_cache.free_entry.size - aligned_size;
       if (extra_space > 0) {
@@ -252,8 +671,6 @@ SpaceEntry PMEMAllocator::Allocate(uint64_t size) {
                           extra_space);
       }
 
-      space_entry = palloc_thread_cache.free_entry;
-      space_entry.size = aligned_size;
       if (offset2addr_checked<DataEntry>(space_entry.offset)
               ->header.record_size != space_entry.size) {
         // TODO (jiayu): Avoid persist metadata on PMem in allocation
@@ -266,10 +683,7 @@ SpaceEntry PMEMAllocator::Allocate(uint64_t size) {
     }
 
     if (palloc_thread_cache.free_entry.size > 0) {
-      // Not a true free
-      LogAllocation(ThreadManager::ThreadID(),
-                    palloc_thread_cache.free_entry.size);
-      Free(palloc_thread_cache.free_entry);
+      freeRemaining(palloc_thread_cache.free_entry);
       palloc_thread_cache.free_entry.size = 0;
     }
 
@@ -278,18 +692,15 @@ SpaceEntry PMEMAllocator::Allocate(uint64_t size) {
       continue;
     }
 
-    LogAllocation(ThreadManager::ThreadID(),
-                  palloc_thread_cache.segment_entry.size);
-    Free(palloc_thread_cache.segment_entry);
+    freeRemaining(palloc_thread_cache.segment_entry);
     // allocate a new segment, add remainning space of the old one
     // to the free list
     if (!allocateSegmentSpace(&palloc_thread_cache.segment_entry)) {
+      palloc_thread_cache.segment_entry.size = 0;
       GlobalLogger.Error("PMem OVERFLOW!\n");
-      return space_entry;
+      return SpaceEntry();
     }
   }
-  space_entry = palloc_thread_cache.segment_entry;
-  space_entry.size = aligned_size;
 
   // Persist size of space entry on PMem
   // TODO (jiayu): Avoid persist metadata on PMem in allocation
@@ -300,6 +711,109 @@ SpaceEntry PMEMAllocator::Allocate(uint64_t size) {
   return space_entry;
 }
 
+std::vector<PMemOffsetType> PMEMAllocator::SparseSegments(
+    double max_usage_ratio, size_t max_num) {
+  std::set<PMemOffsetType> cached;
+  for (auto& ptcache : palloc_thread_cache_) {
+    std::lock_guard<SpinMutex> lg(ptcache.spin);
+    if (ptcache.segment_entry.size > 0) {
+      cached.insert(ptcache.segment_entry.offset / segment_size_);
+    }
+  }
+  for (PMemOffsetType offset : slab_.ClassSegments()) {
+    cached.insert(offset / segment_size_);
+  }
+
+  std::vector<PMemOffsetType> ret;
+  for (uint32_t pool = 0; pool < num_pools_; pool++) {
+    PMemOffsetType head = pools_[pool].offset_head.load();
+    for (uint64_t i = poolBase(pool) / segment_size_;
+         i < head / segment_size_ && ret.size() < max_num; i++) {
+      SegmentStatus& segment = segments_[i];
+      int64_t usage = segment.usage.load();
+      // A segment with no allocated space is not compacted, or reclaimed
+      // segments would be drained again and again
+      if (!segment.draining.load() && cached.count(i) == 0 && usage > 0 &&
+          usage <= max_usage_ratio * segment_size_) {
+        ret.push_back(i * segment_size_);
+      }
+    }
+  }
+  return ret;
+}
+
+void PMEMAllocator::DrainSegments(const std::vector<PMemOffsetType>& segments) {
+  if (segments.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<SpinMutex> lg(draining_segments_spin_);
+    for (PMemOffsetType offset : segments) {
+      kvdk_assert(offset % segment_size_ == 0 &&
+                      BeforeOffsetHead(offset, OffsetHeads()),
+                  "drain a invalid segment");
+      if (!segmentStatus(offset).draining.exchange(true)) {
+        draining_segments_.push_back(offset);
+      }
+    }
+  }
+  dropDrainingSpace();
+}
+
+std::vector<PMemOffsetType> PMEMAllocator::DrainingSegments() {
+  std::lock_guard<SpinMutex> lg(draining_segments_spin_);
+  return draining_segments_;
+}
+
+void PMEMAllocator::dropDrainingSpace() {
+  // Wait allocations in progress and drop their cached space
+  for (auto& ptcache : palloc_thread_cache_) {
+    std::lock_guard<SpinMutex> lg(ptcache.spin);
+    for (SpaceEntry* entry : {&ptcache.free_entry, &ptcache.segment_entry}) {
+      if (entry->size > 0 && segmentStatus(entry->offset).draining.load()) {
+        entry->size = 0;
+      }
+    }
+  }
+  slab_.DropDrainingSpace();
+  for (PMemOffsetType offset : DrainingSegments()) {
+    free_list_.Discard(SpaceEntry(offset, segment_size_));
+  }
+}
+
+void PMEMAllocator::reclaimDrainedSegments() {
+  std::vector<PMemOffsetType> drained;
+  for (PMemOffsetType offset : DrainingSegments()) {
+    if (segmentStatus(offset).usage.load() == 0) {
+      drained.push_back(offset);
+    }
+  }
+  if (drained.empty()) {
+    return;
+  }
+
+  // Space of drained segments may be pushed by Free() before it found the
+  // segment draining, drop them before reclaim
+  dropDrainingSpace();
+  std::vector<SpaceEntry> reclaimed;
+  for (PMemOffsetType offset : drained) {
+    kvdk_assert(segmentStatus(offset).usage.load() == 0,
+                "allocate space from a draining segment");
+    persistSpaceEntry(offset, segment_size_);
+    reclaimed.emplace_back(offset, segment_size_);
+  }
+  {
+    std::lock_guard<SpinMutex> lg(draining_segments_spin_);
+    for (PMemOffsetType offset : drained) {
+      draining_segments_.erase(std::find(draining_segments_.begin(),
+                                         draining_segments_.end(), offset));
+      segmentStatus(offset).draining.store(false);
+    }
+  }
+  free_list_.BatchPush(reclaimed);
+  GlobalLogger.Info("Reclaimed %lu compacted PMem segments\n", drained.size());
+}
+
 void PMEMAllocator::persistSpaceEntry(PMemOffsetType offset, uint64_t size) {
   std::uint32_t sz = static_cast<std::uint32_t>(size);
   kvdk_assert(size == static_cast<std::uint64_t>(sz), "Integer Overflow!");
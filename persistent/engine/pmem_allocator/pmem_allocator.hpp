@@ -7,8 +7,10 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 
+#include <atomic>
 #include <memory>
 #include <set>
+#include <string>
 #include <vector>
 
 #include "../alias.hpp"
@@ -17,26 +19,46 @@
 #include "../structures.hpp"
 #include "../version/version_controller.hpp"
 #include "free_list.hpp"
+#include "slab_allocator.hpp"
 
 namespace KVDK_NAMESPACE {
 
 constexpr PMemOffsetType kNullPMemOffset = UINT64_MAX;
 constexpr uint64_t kMinPaddingBlocks = 8;
+// Pool files are mapped at this alignment for huge page mapping
+constexpr uint64_t kPMemMapAlignment = 2ULL << 20;
+// Max number of never used segments an access thread reserves at a time
+constexpr uint64_t kSegmentBatchSize = 4;
 
 // Manage allocation/de-allocation of PMem space at block unit
 //
 // PMem space consists of several segment, and a segment is consists of
 // several blocks, a block is the minimal allocation unit of PMem space. The
 // maximum allocated data size should smaller than a segment.
+//
+// PMem space consists of one or more NUMA pools, each backed by pool files of
+// the same size on PMem of a NUMA node. All pool files are mapped to
+// continuous virtual address space, so offset of the j-th pool file of the
+// i-th NUMA pool is ((i * max pool files + j) * pool file size), which
+// encodes the pool, and offsets are translated to addresses by a single
+// addition. Access threads reserve never used segments from the pool of their
+// NUMA node, and a new pool file is added to the pool while all its segments
+// are used. Other pools are used after a pool reaches max pool files.
 class PMEMAllocator : public Allocator {
  public:
   virtual ~PMEMAllocator();
 
+  // Map existing pool files "pmem_file", "pmem_file.1", "pmem_file.2"... of
+  // "pool_file_size" bytes for each "pmem_file" in "pmem_files", or create
+  // "pmem_file" if not exist. Pool files of the i-th "pmem_file" are NUMA pool
+  // of the i-th NUMA node, at most "max_pool_files" pool files are used in
+  // each pool
   static PMEMAllocator* NewPMEMAllocator(
-      const std::string& pmem_file, uint64_t pmem_size,
-      uint64_t num_segment_blocks, uint32_t block_size,
-      uint32_t max_access_threads, bool populate_pmem_space_on_new_file,
-      bool use_devdax_mode, VersionController* version_controller);
+      const std::vector<std::string>& pmem_files, uint64_t pool_file_size,
+      uint32_t max_pool_files, uint64_t num_segment_blocks, uint32_t block_size,
+      uint32_t max_access_threads, uint32_t slab_max_blocks,
+      bool populate_pmem_space_on_new_file, bool use_devdax_mode,
+      VersionController* version_controller);
 
   // Allocate a PMem space, return offset and actually allocated space in bytes
   SpaceEntry Allocate(uint64_t size) override;
@@ -97,25 +119,80 @@ class PMEMAllocator : public Allocator {
   }
 
   inline bool validate_offset(uint64_t offset) const {
-    return offset < pmem_size_ && offset != kNullPMemOffset;
+    uint64_t pool = num_pools_ == 1 ? 0 : offset / pool_span_;
+    return pool < num_pools_ &&
+           offset - pool * pool_span_ <
+               pools_[pool].size.load(std::memory_order_relaxed);
   }
 
+  // Total size of mapped pool files
+  uint64_t PMemSize() const;
+
+  // Number of NUMA pools
+  uint32_t NumPools() const { return num_pools_; }
+
   // Try to fetch an used segment to segment_space_entry, until reach the a
-  // never used segment or end of pmem space
+  // never used segment or end of each NUMA pool
   //
   // Notice: Please only use this function in recovery
   bool FetchSegment(SpaceEntry* segment_space_entry);
 
-  // Regularly execute by background thread of KVDK
-  void BackgroundWork() { free_list_.OrganizeFreeSpace(); }
+  // Offset of the first never allocated segment of each NUMA pool
+  std::vector<PMemOffsetType> OffsetHeads();
 
-  void BatchFree(const std::vector<SpaceEntry>& entries) {
-    if (entries.size() > 0) {
-      uint64_t freed = free_list_.BatchPush(entries);
-      LogDeallocation(ThreadManager::ThreadID(), freed);
-    }
+  // If "offset_heads" are valid offset heads of NUMA pools of this allocator
+  bool ValidOffsetHeads(const std::vector<PMemOffsetType>& offset_heads);
+
+  // If "offset" is before offset head of its NUMA pool in "offset_heads"
+  bool BeforeOffsetHead(PMemOffsetType offset,
+                        const std::vector<PMemOffsetType>& offset_heads) const {
+    uint64_t pool = offset / pool_span_;
+    return pool < offset_heads.size() && offset < offset_heads[pool];
   }
 
+  // Restore allocation status without fetching and scanning segments one by
+  // one: segments before "offset_heads" of each NUMA pool are regarded as
+  // allocated, and space of them not used by any record is freed later by
+  // FreeUnusedSpace()
+  //
+  // Notice: Please only use this function in recovery
+  void RestoreOffsetHeads(const std::vector<PMemOffsetType>& offset_heads);
+
+  // Mark space before "ends" of each NUMA pool not covered by sorted and
+  // non-overlapped "used_space" as padding and free it, caller should
+  // guarantee the freed space is not referred by any data
+  void FreeUnusedSpace(const std::vector<PMemOffsetType>& ends,
+                       const std::vector<SpaceEntry>& used_space);
+
+  // Regularly execute by background thread of KVDK
+  void BackgroundWork() {
+    free_list_.OrganizeFreeSpace();
+    reclaimDrainedSegments();
+  }
+
+  // Return offsets of at most "max_num" segments whose allocated space is not
+  // more than "max_usage_ratio" of a segment, segments with no allocated
+  // space, cached by access threads for allocation or already draining are
+  // excluded
+  std::vector<PMemOffsetType> SparseSegments(double max_usage_ratio,
+                                             size_t max_num);
+
+  // Drain segments for compaction
+  //
+  // Free space of a draining segment is no longer allocated, and space freed
+  // in it is not recycled, so after all records in it relocated and freed by
+  // caller, the whole segment is reclaimed as a free space entry in
+  // BackgroundWork(). After this returns, no allocation in progress is still
+  // using space of the draining segments
+  void DrainSegments(const std::vector<PMemOffsetType>& segments);
+
+  // Offsets of draining segments not reclaimed yet
+  std::vector<PMemOffsetType> DrainingSegments();
+
+  uint64_t SegmentSize() const { return segment_size_; }
+
+  void BatchFree(const std::vector<SpaceEntry>& entries);
+
   void LogAllocation(int64_t tid, size_t sz) {
     if (tid == -1) {
       global_allocated_size_.fetch_add(sz);
@@ -143,9 +220,14 @@ class PMEMAllocator : public Allocator {
 
  private:
   friend Freelist;
-
-  PMEMAllocator(char* pmem, uint64_t pmem_size, uint64_t num_segment_blocks,
-                uint32_t block_size, uint32_t max_access_threads,
+  friend SlabAllocator;
+
+  PMEMAllocator(char* reserved, uint64_t reserved_size, char* pmem,
+                const std::vector<std::string>& pmem_files,
+                uint64_t pool_file_size,
+                uint32_t max_pool_files, bool use_devdax_mode,
+                uint64_t num_segment_blocks, uint32_t block_size,
+                uint32_t max_access_threads, uint32_t slab_max_blocks,
                 VersionController* version_controller);
   // Access threads cache a dedicated PMem segment and a free space to
   // avoid contention
@@ -155,13 +237,96 @@ class PMEMAllocator : public Allocator {
     // Space fetched from head of PMem segments, the size is aligned to
     // block_size_
     SpaceEntry segment_entry;
+    // Never used segments reserved from offset head, segment_entry and class
+    // segments of slab are fetched from it
+    SpaceEntry segment_batch;
     std::int64_t allocated_sz{};
+    // Held while allocating, so segment draining can wait for allocations
+    // using cached space
+    SpinMutex spin;
+  };
+
+  // PMem space of a NUMA node
+  struct NumaPool {
+    // Offset of the first never allocated segment
+    std::atomic<uint64_t> offset_head{0};
+    // Size of mapped pool files, only grows while holding lock
+    std::atomic<uint64_t> size{0};
+    // Protect adding pool files
+    SpinMutex lock;
+  };
+
+  // Allocation status of a PMem segment
+  struct SegmentStatus {
+    // Allocated bytes in the segment
+    std::atomic<int64_t> usage{0};
+    std::atomic<bool> draining{false};
   };
 
+  SegmentStatus& segmentStatus(PMemOffsetType offset) {
+    return segments_[offset / segment_size_];
+  }
+
+  // Account allocation of "entry" to its segment, return false if the segment
+  // is draining, then the space should be dropped
+  bool claimSpace(const SpaceEntry& entry);
+
+  // Push unclaimed space cached by allocator back to slab or free list
+  void freeRemaining(const SpaceEntry& entry);
+
+  void pushSpace(const SpaceEntry& entry);
+
+  // Drop space of draining segments cached by access threads, slab and free
+  // list
+  void dropDrainingSpace();
+
+  // Reclaim draining segments with no allocated space left
+  void reclaimDrainedSegments();
+
+  // Fetch a never used segment from segment batch of the access thread, the
+  // thread cache should be locked
   bool allocateSegmentSpace(SpaceEntry* segment_entry);
 
+  // Reserve a batch of never used segments from NUMA pool of the calling
+  // thread, or other pools if it is used up
+  bool reserveSegments(SpaceEntry* segment_batch);
+
+  // Reserve a batch of never used segments by bumping offset head of "pool",
+  // fewer segments are reserved while space is running out
+  bool reservePoolSegments(uint32_t pool, SpaceEntry* segment_batch);
+
+  // NUMA pool of the node the calling thread running on
+  uint32_t localPool() const;
+
+  PMemOffsetType poolBase(uint32_t pool) const { return pool * pool_span_; }
+
+  // Take a reserved segment from segment batch of other threads while no
+  // never used segment left
+  bool stealSegment(SpaceEntry* segment_entry);
+
+  // Mark a never used segment as padding on PMem
+  void markSegment(PMemOffsetType offset);
+
+  // Push entries to the slab allocator or the free list by their size, return
+  // total freed size
+  uint64_t batchPush(const std::vector<SpaceEntry>& entries);
+
   static bool checkDevDaxAndGetSize(const char* path, uint64_t* size);
 
+  static std::string poolFile(const std::string& pmem_file,
+                              uint32_t file_index) {
+    return file_index == 0 ? pmem_file
+                           : pmem_file + "." + std::to_string(file_index);
+  }
+
+  // Map pool file of "file_index" of "pool" next to its mapped pool files,
+  // truncate the file before mapping if "create" is true
+  bool mapPoolFile(uint32_t pool, uint32_t file_index, bool create);
+
+  // Add a new pool file to "pool" while all its segments used, lock of the
+  // pool should be held
+  bool addPoolFile(uint32_t pool);
+
   // Populate PMem space so the following access can be faster
   // Warning! this will zero the entire PMem space
   void populateSpace();
@@ -184,16 +349,33 @@ class PMEMAllocator : public Allocator {
   // Mark and persist a space entry on PMem
   void persistSpaceEntry(PMemOffsetType offset, uint64_t size);
 
+  // Virtual address space reserved for all pool files
+  char* reserved_;
+  uint64_t reserved_size_;
   char* pmem_;
+  const std::vector<std::string> pmem_files_;
+  const uint64_t pool_file_size_;
+  const uint32_t max_pool_files_;
+  // Size of virtual address space of a NUMA pool
+  const uint64_t pool_span_;
+  const bool use_devdax_mode_;
   std::vector<PAllocThreadCache, AlignedAllocator<PAllocThreadCache>>
       palloc_thread_cache_;
   const uint32_t block_size_;
   const uint64_t segment_size_;
-  // Protect PMem offset head
-  SpinMutex offset_head_lock_;
-  uint64_t offset_head_;
-  uint64_t pmem_size_;
+  const uint32_t num_pools_;
+  std::unique_ptr<NumaPool[]> pools_;
+  // Protect fetching segments in recovery
+  SpinMutex fetch_lock_;
+  // NUMA pool fetching segments in recovery
+  uint32_t fetching_pool_;
   Freelist free_list_;
+  // Serve small records in size classes
+  SlabAllocator slab_;
+  Array<SegmentStatus> segments_;
+  // Protect draining_segments_
+  SpinMutex draining_segments_spin_;
+  std::vector<PMemOffsetType> draining_segments_;
   // For quickly get corresponding block size of a requested data size
   std::vector<uint16_t> data_size_2_block_size_;
   VersionController* version_controller_;
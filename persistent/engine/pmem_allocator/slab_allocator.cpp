@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright(c) 2022 Intel Corporation
+ */
+
+#include "slab_allocator.hpp"
+
+#include <algorithm>
+
+#include "../thread_manager.hpp"
+#include "pmem_allocator.hpp"
+
+namespace KVDK_NAMESPACE {
+
+SlabAllocator::SlabAllocator(uint32_t max_slab_blocks, uint32_t block_size,
+                             uint32_t num_threads,
+                             PMEMAllocator* pmem_allocator)
+    : max_slab_blocks_(max_slab_blocks),
+      block_size_(block_size),
+      thread_caches_(num_threads, max_slab_blocks),
+      depots_(max_slab_blocks + 1),
+      pmem_allocator_(pmem_allocator) {}
+
+SlabAllocator::ClassCache& SlabAllocator::threadClassCache(uint32_t b_size) {
+  return thread_caches_[ThreadManager::ThreadID() % thread_caches_.size()]
+      .class_caches[b_size];
+}
+
+SpaceEntry SlabAllocator::Allocate(uint32_t b_size) {
+  kvdk_assert(Serve(b_size), "allocate size not served by slab");
+  PMemOffsetType offset;
+  uint64_t slot_size = b_size * block_size_;
+  {
+    ClassCache& cache = threadClassCache(b_size);
+    std::lock_guard<SpinMutex> lg(cache.spin);
+    while (popCached(cache, b_size, &offset)) {
+      // Slots in a draining segment are dropped
+      if (!pmem_allocator_->claimSpace(SpaceEntry(offset, slot_size))) {
+        continue;
+      }
+      if (pmem_allocator_->offset2addr_checked<DataEntry>(offset)
+              ->header.record_size != slot_size) {
+        pmem_allocator_->persistSpaceEntry(offset, slot_size);
+      }
+      return SpaceEntry(offset, slot_size);
+    }
+    while (carve(cache, b_size, &offset)) {
+      if (pmem_allocator_->claimSpace(SpaceEntry(offset, slot_size))) {
+        pmem_allocator_->persistSpaceEntry(offset, slot_size);
+        return SpaceEntry(offset, slot_size);
+      }
+      // The class segment is draining, fetch a new one
+      cache.segment.size = 0;
+    }
+  }
+
+  // PMem space exhausted, take a cached slot of this class from other threads,
+  // or a larger slot
+  SpaceEntry stolen;
+  for (uint32_t c = b_size; c <= max_slab_blocks_; c++) {
+    while (steal(c, b_size, &stolen)) {
+      if (!pmem_allocator_->claimSpace(stolen)) {
+        continue;
+      }
+      if (pmem_allocator_->offset2addr_checked<DataEntry>(stolen.offset)
+              ->header.record_size != stolen.size) {
+        pmem_allocator_->persistSpaceEntry(stolen.offset, stolen.size);
+      }
+      return stolen;
+    }
+  }
+  return SpaceEntry();
+}
+
+void SlabAllocator::Free(const SpaceEntry& entry) {
+  uint64_t b_size = entry.size / block_size_;
+  kvdk_assert(entry.size % block_size_ == 0 && Serve(b_size),
+              "free size not served by slab");
+  ClassCache& cache = threadClassCache(b_size);
+  std::lock_guard<SpinMutex> lg(cache.spin);
+  if (cache.loaded.size() == kSlabMagazineSize) {
+    if (!cache.previous.empty()) {
+      // The previous magazine may be partially used by allocation
+      Depot& depot = depots_[b_size];
+      std::lock_guard<SpinMutex> depot_lg(depot.spin);
+      depot.magazines.emplace_back();
+      depot.magazines.back().swap(cache.previous);
+    }
+    cache.loaded.swap(cache.previous);
+    cache.loaded.reserve(kSlabMagazineSize);
+  }
+  cache.loaded.push_back(entry.offset);
+}
+
+bool SlabAllocator::popCached(ClassCache& cache, uint32_t b_size,
+                              PMemOffsetType* offset) {
+  if (cache.loaded.empty()) {
+    if (!cache.previous.empty()) {
+      cache.loaded.swap(cache.previous);
+    } else {
+      Depot& depot = depots_[b_size];
+      std::lock_guard<SpinMutex> lg(depot.spin);
+      if (depot.magazines.empty()) {
+        return false;
+      }
+      cache.loaded.swap(depot.magazines.back());
+      depot.magazines.pop_back();
+    }
+  }
+  *offset = cache.loaded.back();
+  cache.loaded.pop_back();
+  return true;
+}
+
+bool SlabAllocator::carve(ClassCache& cache, uint32_t b_size,
+                          PMemOffsetType* offset) {
+  uint64_t slot_size = b_size * block_size_;
+  if (cache.segment.size < slot_size) {
+    if (cache.segment.size > 0) {
+      // Remaining space is smaller than a slot, free it to its own class
+      pmem_allocator_->persistSpaceEntry(cache.segment.offset,
+                                         cache.segment.size);
+      pmem_allocator_->freeRemaining(cache.segment);
+      cache.segment.size = 0;
+    }
+    if (!pmem_allocator_->allocateSegmentSpace(&cache.segment)) {
+      return false;
+    }
+  }
+  *offset = cache.segment.offset;
+  cache.segment.offset += slot_size;
+  cache.segment.size -= slot_size;
+  return true;
+}
+
+bool SlabAllocator::steal(uint32_t class_b_size, uint32_t min_b_size,
+                          SpaceEntry* entry) {
+  uint64_t slot_size = class_b_size * block_size_;
+  {
+    Depot& depot = depots_[class_b_size];
+    std::lock_guard<SpinMutex> lg(depot.spin);
+    if (!depot.magazines.empty()) {
+      Magazine& magazine = depot.magazines.back();
+      *entry = SpaceEntry(magazine.back(), slot_size);
+      magazine.pop_back();
+      if (magazine.empty()) {
+        depot.magazines.pop_back();
+      }
+      return true;
+    }
+  }
+  for (uint64_t i = 0; i < thread_caches_.size(); i++) {
+    ClassCache& cache = thread_caches_[i].class_caches[class_b_size];
+    std::lock_guard<SpinMutex> lg(cache.spin);
+    for (Magazine* magazine : {&cache.loaded, &cache.previous}) {
+      if (!magazine->empty()) {
+        *entry = SpaceEntry(magazine->back(), slot_size);
+        magazine->pop_back();
+        return true;
+      }
+    }
+    // Remaining space of the class segment may be smaller than a slot
+    if (cache.segment.size >= min_b_size * block_size_) {
+      *entry = SpaceEntry(cache.segment.offset,
+                          std::min<uint64_t>(slot_size, cache.segment.size));
+      cache.segment.offset += entry->size;
+      cache.segment.size -= entry->size;
+      return true;
+    }
+  }
+  return false;
+}
+
+void SlabAllocator::DropDrainingSpace() {
+  auto draining = [&](PMemOffsetType offset) {
+    return pmem_allocator_->segmentStatus(offset).draining.load();
+  };
+  auto drop_slots = [&](Magazine& magazine) {
+    magazine.erase(std::remove_if(magazine.begin(), magazine.end(), draining),
+                   magazine.end());
+  };
+  for (uint64_t i = 0; i < thread_caches_.size(); i++) {
+    for (uint32_t c = 1; c <= max_slab_blocks_; c++) {
+      ClassCache& cache = thread_caches_[i].class_caches[c];
+      std::lock_guard<SpinMutex> lg(cache.spin);
+      drop_slots(cache.loaded);
+      drop_slots(cache.previous);
+      if (cache.segment.size > 0 && draining(cache.segment.offset)) {
+        cache.segment.size = 0;
+      }
+    }
+  }
+  for (uint32_t c = 1; c <= max_slab_blocks_; c++) {
+    Depot& depot = depots_[c];
+    std::lock_guard<SpinMutex> lg(depot.spin);
+    for (Magazine& magazine : depot.magazines) {
+      drop_slots(magazine);
+    }
+    depot.magazines.erase(
+        std::remove_if(depot.magazines.begin(), depot.magazines.end(),
+                       [](const Magazine& m) { return m.empty(); }),
+        depot.magazines.end());
+  }
+}
+
+std::vector<PMemOffsetType> SlabAllocator::ClassSegments() {
+  std::vector<PMemOffsetType> ret;
+  for (uint64_t i = 0; i < thread_caches_.size(); i++) {
+    for (uint32_t c = 1; c <= max_slab_blocks_; c++) {
+      ClassCache& cache = thread_caches_[i].class_caches[c];
+      std::lock_guard<SpinMutex> lg(cache.spin);
+      if (cache.segment.size > 0) {
+        ret.push_back(cache.segment.offset);
+      }
+    }
+  }
+  return ret;
+}
+
+}  // namespace KVDK_NAMESPACE
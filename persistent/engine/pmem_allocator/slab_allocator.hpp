@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright(c) 2022 Intel Corporation
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "../alias.hpp"
+#include "../allocator.hpp"
+#include "../utils/utils.hpp"
+
+namespace KVDK_NAMESPACE {
+
+// Number of free slots a magazine holds
+constexpr uint32_t kSlabMagazineSize = 256;
+
+class PMEMAllocator;
+
+// Allocate small PMem space in fixed size classes
+//
+// A size class serves space of a certain number of blocks, from 1 to
+// "max_slab_blocks". New slots of a class are carved from PMem segments
+// dedicated to the class, so records of similar size are packed together and
+// a freed slot is always reused by a record of the same class, instead of
+// being split and merged in the free list.
+//
+// Freed slots are cached in magazines: each access thread caches a loaded and
+// a previous magazine per class, and allocation and free only push or pop the
+// loaded magazine. Full magazines are exchanged with a depot shared by all
+// threads, so the shared state is touched about once per kSlabMagazineSize
+// operations. A slot keeps its size on PMem while it's free, so recovery
+// frees it to the same class.
+class SlabAllocator {
+ public:
+  SlabAllocator(uint32_t max_slab_blocks, uint32_t block_size,
+                uint32_t num_threads, PMEMAllocator* pmem_allocator);
+
+  // If space of "b_size" blocks is served by slab
+  bool Serve(uint64_t b_size) const {
+    return b_size > 0 && b_size <= max_slab_blocks_;
+  }
+
+  // Allocate a slot of "b_size" blocks, PMem space of the slot is marked as a
+  // padding of its size. Return an empty entry if no free slot and no PMem
+  // segment left for the class.
+  //
+  // A larger slot may be returned while PMem space is exhausted
+  SpaceEntry Allocate(uint32_t b_size);
+
+  // Free a slot, its size should be served by slab
+  void Free(const SpaceEntry& entry);
+
+  // Drop cached slots and class segment space inside draining PMem segments,
+  // they are reclaimed along with the whole segment
+  void DropDrainingSpace();
+
+  // Offsets of remaining space of class segments
+  std::vector<PMemOffsetType> ClassSegments();
+
+ private:
+  using Magazine = std::vector<PMemOffsetType>;
+
+  struct ClassCache {
+    Magazine loaded;
+    Magazine previous;
+    // Remaining space of the segment dedicated to this class
+    SpaceEntry segment;
+    // Cached classes of a thread may be accessed by cleaner threads sharing
+    // the same thread cache, this lock is nearly uncontended
+    SpinMutex spin;
+  };
+
+  struct alignas(64) SlabThreadCache {
+    SlabThreadCache(uint32_t max_slab_blocks)
+        : class_caches(max_slab_blocks + 1) {}
+
+    Array<ClassCache> class_caches;
+  };
+
+  struct alignas(64) Depot {
+    // Magazines exchanged by threads, they are full or nearly full
+    std::vector<Magazine> magazines;
+    SpinMutex spin;
+  };
+
+  // Pop a slot from a cached magazine or the depot
+  bool popCached(ClassCache& cache, uint32_t b_size, PMemOffsetType* offset);
+
+  // Carve a slot from the class segment, fetch a new segment if it's used up
+  bool carve(ClassCache& cache, uint32_t b_size, PMemOffsetType* offset);
+
+  // Take a free slot of "class_b_size" class cached by any thread, or carve
+  // one not smaller than "min_b_size" blocks from a class segment of any
+  // thread. Only used while PMem space is exhausted
+  bool steal(uint32_t class_b_size, uint32_t min_b_size, SpaceEntry* entry);
+
+  ClassCache& threadClassCache(uint32_t b_size);
+
+  const uint32_t max_slab_blocks_;
+  const uint32_t block_size_;
+  Array<SlabThreadCache> thread_caches_;
+  Array<Depot> depots_;
+  PMEMAllocator* pmem_allocator_;
+};
+
+}  // namespace KVDK_NAMESPACE
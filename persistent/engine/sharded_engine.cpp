@@ -0,0 +1,703 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright(c) 2022 Intel Corporation
+ */
+
+#include "sharded_engine.hpp"
+
+#include <libpmem.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstdio>
+#include <functional>
+#include <thread>
+
+#include "kv_engine.hpp"
+#include "logger.hpp"
+#include "utils/sync_point.hpp"
+#include "write_batch_impl.hpp"
+
+namespace KVDK_NAMESPACE {
+
+namespace {
+// Bind this thread to "cpus"
+Status bindCpus(const std::vector<uint32_t>& cpus) {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (uint32_t cpu : cpus) {
+    if (cpu >= CPU_SETSIZE) {
+      GlobalLogger.Error("Invalid CPU %u of a shard\n", cpu);
+      return Status::InvalidConfiguration;
+    }
+    CPU_SET(cpu, &cpu_set);
+  }
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (ret != 0) {
+    GlobalLogger.Error("Bind thread to CPUs of a shard error: %s\n",
+                       strerror(ret));
+    return Status::InvalidConfiguration;
+  }
+  return Status::Ok;
+}
+
+// Run "func" on each shard index in parallel, and return the first non-Ok
+// status. If "shard_cpus" is not empty, "func" of shard i runs on a new thread
+// bound to shard_cpus[i]
+Status forEachShard(uint32_t num_shards,
+                    const std::vector<std::vector<uint32_t>>& shard_cpus,
+                    std::function<Status(uint32_t shard)> func) {
+  std::vector<Status> status(num_shards, Status::Ok);
+  std::vector<std::thread> ths;
+  uint32_t first = shard_cpus.empty() ? 1 : 0;
+  for (uint32_t i = first; i < num_shards; i++) {
+    ths.emplace_back([&, i]() {
+      status[i] = shard_cpus.empty() ? Status::Ok : bindCpus(shard_cpus[i]);
+      if (status[i] == Status::Ok) {
+        status[i] = func(i);
+      }
+    });
+  }
+  if (first == 1) {
+    status[0] = func(0);
+  }
+  for (auto& t : ths) {
+    t.join();
+  }
+  for (Status s : status) {
+    if (s != Status::Ok) {
+      return s;
+    }
+  }
+  return Status::Ok;
+}
+
+std::string shardBackupLog(const StringView backup_log, uint32_t shard) {
+  return string_view_2_string(backup_log) + "." + std::to_string(shard);
+}
+}  // namespace
+
+// A transaction bound to the shard of its first operation, operations on other
+// shards return Status::NotSupported. The first failure is kept and fails the
+// remaining operations and Commit(), which rollbacks the transaction
+class ShardedTransaction final : public Transaction {
+ public:
+  ShardedTransaction(ShardedEngine* engine,
+                     std::vector<std::unique_ptr<Engine>>* shards,
+                     const TransactionOptions& options)
+      : engine_(engine), shards_(shards), options_(options) {}
+
+  Status StringPut(const StringView key, const StringView value) final {
+    return bind(key) ? txn_->StringPut(key, value) : status_;
+  }
+
+  Status StringDelete(const StringView key) final {
+    return bind(key) ? txn_->StringDelete(key) : status_;
+  }
+
+  Status StringGet(const StringView key, std::string* value) final {
+    return bind(key) ? txn_->StringGet(key, value) : status_;
+  }
+
+  Status SortedPut(const StringView collection, const StringView key,
+                   const StringView value) final {
+    return bind(collection) ? txn_->SortedPut(collection, key, value)
+                            : status_;
+  }
+
+  Status SortedDelete(const StringView collection,
+                      const StringView key) final {
+    return bind(collection) ? txn_->SortedDelete(collection, key) : status_;
+  }
+
+  Status SortedGet(const StringView collection, const StringView key,
+                   std::string* value) final {
+    return bind(collection) ? txn_->SortedGet(collection, key, value)
+                            : status_;
+  }
+
+  Status HashPut(const StringView collection, const StringView key,
+                 const StringView value) final {
+    return bind(collection) ? txn_->HashPut(collection, key, value) : status_;
+  }
+
+  Status HashDelete(const StringView collection, const StringView key) final {
+    return bind(collection) ? txn_->HashDelete(collection, key) : status_;
+  }
+
+  Status HashGet(const StringView collection, const StringView key,
+                 std::string* value) final {
+    return bind(collection) ? txn_->HashGet(collection, key, value) : status_;
+  }
+
+  Status Commit() final {
+    Status s = status_;
+    if (s != Status::Ok) {
+      Rollback();
+      return s;
+    }
+    s = txn_ == nullptr ? Status::Ok : txn_->Commit();
+    reset();
+    return s;
+  }
+
+  void Rollback() final {
+    if (txn_ != nullptr) {
+      txn_->Rollback();
+    }
+    reset();
+  }
+
+  Status InternalStatus() final {
+    return status_ != Status::Ok || txn_ == nullptr ? status_
+                                                    : txn_->InternalStatus();
+  }
+
+  TransactionLockStats LockStats() final {
+    TransactionLockStats stats = lock_stats_;
+    if (txn_ != nullptr) {
+      addLockStats(txn_->LockStats(), &stats);
+    }
+    return stats;
+  }
+
+ private:
+  // Bind the transaction to shard of "key" if it is not bound yet, return
+  // false if it is bound to another shard or already failed
+  bool bind(const StringView key) {
+    if (status_ != Status::Ok) {
+      return false;
+    }
+    uint32_t shard = engine_->ShardIndex(key);
+    if (txn_ == nullptr) {
+      txn_ = (*shards_)[shard]->TransactionCreate(options_);
+      shard_ = shard;
+    } else if (shard != shard_) {
+      GlobalLogger.Error("Transaction across shards is not supported\n");
+      status_ = Status::NotSupported;
+      return false;
+    }
+    return true;
+  }
+
+  void reset() {
+    if (txn_ != nullptr) {
+      addLockStats(txn_->LockStats(), &lock_stats_);
+    }
+    txn_.reset();
+    status_ = Status::Ok;
+  }
+
+  static void addLockStats(const TransactionLockStats& src,
+                           TransactionLockStats* dst) {
+    dst->waits += src.waits;
+    dst->wait_microseconds += src.wait_microseconds;
+    dst->conflicts += src.conflicts;
+  }
+
+  ShardedEngine* engine_;
+  std::vector<std::unique_ptr<Engine>>* shards_;
+  TransactionOptions options_;
+  std::unique_ptr<Transaction> txn_{nullptr};
+  uint32_t shard_{0};
+  Status status_{Status::Ok};
+  // Lock waits of transactions on shards already committed or rollbacked
+  TransactionLockStats lock_stats_;
+};
+
+ShardedEngine::~ShardedEngine() {
+  GlobalLogger.Info("Closing %lu shards\n", shards_.size());
+  // Close shards in parallel as each one waits background works and persists
+  // its index image
+  forEachShard(shards_.size(), std::vector<std::vector<uint32_t>>(),
+               [&](uint32_t shard) {
+                 shards_[shard].reset();
+                 return Status::Ok;
+               });
+  if (commit_slots_ != nullptr) {
+    pmem_unmap(commit_slots_, commit_slots_bytes_);
+  }
+}
+
+Status ShardedEngine::Open(const StringView engine_path, Engine** engine_ptr,
+                           const Configs& configs) {
+  return openShards(engine_path, StringView{}, engine_ptr, configs);
+}
+
+Status ShardedEngine::Restore(const StringView engine_path,
+                              const StringView backup_log,
+                              Engine** engine_ptr, const Configs& configs) {
+  return openShards(engine_path, backup_log, engine_ptr, configs);
+}
+
+bool ShardedEngine::ShardedInstance(const StringView engine_path) {
+  return engine_path.size() > 0 &&
+         file_exist(shardsFile(string_view_2_string(engine_path)));
+}
+
+Status ShardedEngine::openShards(const StringView engine_path,
+                                 const StringView backup_log,
+                                 Engine** engine_ptr, const Configs& configs) {
+  std::string dir = format_dir_path(string_view_2_string(engine_path));
+  uint32_t num_shards = configs.num_shards;
+  if (configs.use_devdax_mode) {
+    GlobalLogger.Error("Sharded instance is not supported in devdax mode\n");
+    return Status::InvalidConfiguration;
+  }
+  if (num_shards == 0) {
+    GlobalLogger.Error("num_shards should be larger than 0\n");
+    return Status::InvalidConfiguration;
+  }
+  if (!configs.shard_cpus.empty()) {
+    if (configs.shard_cpus.size() != num_shards) {
+      GlobalLogger.Error("shard_cpus should have %u entries\n", num_shards);
+      return Status::InvalidConfiguration;
+    }
+    for (auto const& cpus : configs.shard_cpus) {
+      if (cpus.empty()) {
+        GlobalLogger.Error("An entry of shard_cpus is empty\n");
+        return Status::InvalidConfiguration;
+      }
+    }
+  }
+  if (create_dir_if_missing(dir) != 0) {
+    GlobalLogger.Error("Create engine dir %s error\n", dir.c_str());
+    return Status::IOError;
+  }
+
+  // The number of shards is persisted while creating the instance, as keys
+  // are routed by it
+  std::string shards_file = shardsFile(dir);
+  if (file_exist(shards_file)) {
+    FILE* fp = fopen(shards_file.c_str(), "r");
+    uint32_t persisted_shards = 0;
+    if (fp == nullptr || fscanf(fp, "%u", &persisted_shards) != 1) {
+      GlobalLogger.Error("Read shards file %s error\n", shards_file.c_str());
+      if (fp != nullptr) {
+        fclose(fp);
+      }
+      return Status::IOError;
+    }
+    fclose(fp);
+    if (persisted_shards != num_shards) {
+      GlobalLogger.Error(
+          "num_shards %u mismatch with the existing instance of %u shards\n",
+          num_shards, persisted_shards);
+      return Status::InvalidConfiguration;
+    }
+  } else {
+    // A non-sharded instance stores its configs file in the instance dir
+    if (file_exist(dir + "configs")) {
+      GlobalLogger.Error("Open a non-sharded instance with %u shards\n",
+                         num_shards);
+      return Status::InvalidConfiguration;
+    }
+    FILE* fp = fopen(shards_file.c_str(), "w");
+    if (fp == nullptr || fprintf(fp, "%u\n", num_shards) < 0 ||
+        fsync(fileno(fp)) != 0) {
+      GlobalLogger.Error("Write shards file %s error\n", shards_file.c_str());
+      if (fp != nullptr) {
+        fclose(fp);
+      }
+      return Status::IOError;
+    }
+    fclose(fp);
+  }
+
+  std::vector<Configs> shard_configs(num_shards, configs);
+  for (uint32_t i = 0; i < num_shards; i++) {
+    shard_configs[i].num_shards = 1;
+    shard_configs[i].shard_cpus.clear();
+    for (std::string& numa_dir : shard_configs[i].pmem_numa_dirs) {
+      if (create_dir_if_missing(numa_dir) != 0) {
+        GlobalLogger.Error("Create NUMA dir %s error\n", numa_dir.c_str());
+        return Status::IOError;
+      }
+      numa_dir = shardDir(numa_dir, i);
+    }
+  }
+
+  // Cross-shard batches committed before the last crash are kept by shards
+  // in recovery, the commits file is reset after all shards recovered
+  std::string commits_file = crossShardCommitsFile(dir);
+  std::unordered_set<uint64_t> committed_ids;
+  if (backup_log.size() == 0 && file_exist(commits_file)) {
+    Status s = readCrossShardCommits(commits_file, &committed_ids);
+    if (s != Status::Ok) {
+      return s;
+    }
+  }
+
+  GlobalLogger.Info("Opening %u shards in %s ...\n", num_shards, dir.c_str());
+  ShardedEngine* engine = new ShardedEngine();
+  engine->shards_.resize(num_shards);
+  engine->shard_cpus_ = configs.shard_cpus;
+  Status s = forEachShard(num_shards, configs.shard_cpus, [&](uint32_t shard) {
+    Engine* shard_engine = nullptr;
+    Status ret =
+        backup_log.size() == 0
+            ? KVEngine::openImpl(shardDir(dir, shard), &shard_engine,
+                                 shard_configs[shard], committed_ids)
+            : KVEngine::Restore(shardDir(dir, shard),
+                                shardBackupLog(backup_log, shard),
+                                &shard_engine, shard_configs[shard]);
+    engine->shards_[shard].reset(shard_engine);
+    return ret;
+  });
+  if (s == Status::Ok) {
+    s = engine->initCrossShardCommits(commits_file,
+                                      configs.max_access_threads);
+  }
+  if (s != Status::Ok) {
+    GlobalLogger.Error("Open shards in %s failed: %d\n", dir.c_str(), s);
+    delete engine;
+    return s;
+  }
+  *engine_ptr = engine;
+  return Status::Ok;
+}
+
+Status ShardedEngine::readCrossShardCommits(
+    const std::string& file, std::unordered_set<uint64_t>* ids) {
+  size_t mapped_len;
+  int is_pmem;
+  void* addr = pmem_map_file(file.c_str(), 0, 0, 0666, &mapped_len, &is_pmem);
+  if (addr == nullptr) {
+    GlobalLogger.Error("Map cross-shard commits file %s error: %s\n",
+                       file.c_str(), strerror(errno));
+    return Status::PMemMapFileError;
+  }
+  uint64_t* slots = static_cast<uint64_t*>(addr);
+  for (size_t i = 0; i < mapped_len / sizeof(uint64_t); i++) {
+    if (slots[i] != 0) {
+      ids->insert(slots[i]);
+    }
+  }
+  pmem_unmap(addr, mapped_len);
+  return Status::Ok;
+}
+
+Status ShardedEngine::initCrossShardCommits(const std::string& file,
+                                            uint32_t num_slots) {
+  size_t bytes = num_slots * sizeof(uint64_t);
+  size_t mapped_len;
+  int is_pmem;
+  void* addr = pmem_map_file(file.c_str(), bytes, PMEM_FILE_CREATE, 0666,
+                             &mapped_len, &is_pmem);
+  if (addr == nullptr) {
+    GlobalLogger.Error("Map cross-shard commits file %s error: %s\n",
+                       file.c_str(), strerror(errno));
+    return Status::PMemMapFileError;
+  }
+  commit_slots_ = static_cast<uint64_t*>(addr);
+  commit_slots_bytes_ = mapped_len;
+  pmem_memset_persist(commit_slots_, 0, bytes);
+  for (uint32_t i = 0; i < num_slots; i++) {
+    free_commit_slots_.push_back(i);
+  }
+  return Status::Ok;
+}
+
+StringView ShardedEngine::hashTag(const StringView key) {
+  const char* begin =
+      static_cast<const char*>(memchr(key.data(), '{', key.size()));
+  if (begin != nullptr) {
+    begin++;
+    size_t remain = key.data() + key.size() - begin;
+    const char* end = static_cast<const char*>(memchr(begin, '}', remain));
+    if (end != nullptr && end != begin) {
+      return StringView(begin, end - begin);
+    }
+  }
+  return key;
+}
+
+Status ShardedEngine::MultiGet(const std::vector<StringView>& keys,
+                               std::vector<std::string>* values,
+                               std::vector<Status>* statuses) {
+  values->clear();
+  statuses->clear();
+  values->resize(keys.size());
+  statuses->resize(keys.size(), Status::Ok);
+
+  // Group keys by shard, and scatter results of each shard back
+  std::vector<std::vector<size_t>> shard_indexes(shards_.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    shard_indexes[ShardIndex(keys[i])].push_back(i);
+  }
+  std::vector<StringView> shard_keys;
+  std::vector<std::string> shard_values;
+  std::vector<Status> shard_statuses;
+  for (uint32_t shard = 0; shard < shards_.size(); shard++) {
+    auto const& indexes = shard_indexes[shard];
+    if (indexes.empty()) {
+      continue;
+    }
+    shard_keys.clear();
+    for (size_t idx : indexes) {
+      shard_keys.push_back(keys[idx]);
+    }
+    Status s =
+        shards_[shard]->MultiGet(shard_keys, &shard_values, &shard_statuses);
+    if (s != Status::Ok) {
+      return s;
+    }
+    for (size_t i = 0; i < indexes.size(); i++) {
+      (*values)[indexes[i]].swap(shard_values[i]);
+      (*statuses)[indexes[i]] = shard_statuses[i];
+    }
+  }
+  return Status::Ok;
+}
+
+Status ShardedEngine::BatchWrite(std::unique_ptr<WriteBatch> const& batch) {
+  WriteBatchImpl const* batch_impl =
+      dynamic_cast<WriteBatchImpl const*>(batch.get());
+  if (batch_impl == nullptr) {
+    return Status::InvalidArgument;
+  }
+
+  // A batch on a single shard is committed by the shard alone
+  uint32_t shard = 0;
+  bool shard_found = false;
+  bool cross_shard = false;
+  auto check_shard = [&](const StringView key) {
+    uint32_t key_shard = ShardIndex(key);
+    if (!shard_found) {
+      shard = key_shard;
+      shard_found = true;
+    } else if (key_shard != shard) {
+      cross_shard = true;
+    }
+  };
+  for (auto const& op : batch_impl->StringOps()) {
+    check_shard(op.key);
+  }
+  for (auto const& op : batch_impl->SortedOps()) {
+    check_shard(op.collection);
+  }
+  for (auto const& op : batch_impl->HashOps()) {
+    check_shard(op.collection);
+  }
+  if (!cross_shard) {
+    return shards_[shard]->BatchWrite(batch);
+  }
+
+  std::vector<std::unique_ptr<WriteBatchImpl>> shard_batches(shards_.size());
+  auto shard_batch = [&](const StringView key) -> WriteBatchImpl* {
+    auto& b = shard_batches[ShardIndex(key)];
+    if (b == nullptr) {
+      b.reset(new WriteBatchImpl);
+    }
+    return b.get();
+  };
+  for (auto const& op : batch_impl->StringOps()) {
+    if (op.op == WriteOp::Put) {
+      shard_batch(op.key)->StringPut(op.key, op.value);
+    } else {
+      shard_batch(op.key)->StringDelete(op.key);
+    }
+  }
+  for (auto const& op : batch_impl->SortedOps()) {
+    if (op.op == WriteOp::Put) {
+      shard_batch(op.collection)->SortedPut(op.collection, op.key, op.value);
+    } else {
+      shard_batch(op.collection)->SortedDelete(op.collection, op.key);
+    }
+  }
+  for (auto const& op : batch_impl->HashOps()) {
+    if (op.op == WriteOp::Put) {
+      shard_batch(op.collection)->HashPut(op.collection, op.key, op.value);
+    } else {
+      shard_batch(op.collection)->HashDelete(op.collection, op.key);
+    }
+  }
+  return crossShardBatchWrite(shard_batches);
+}
+
+Status ShardedEngine::crossShardBatchWrite(
+    const std::vector<std::unique_ptr<WriteBatchImpl>>& shard_batches) {
+  auto shared_lock = LockShared(cross_shard_lock_);
+  uint64_t id = next_cross_shard_id_.fetch_add(1);
+  std::vector<KVEngine*> engines;
+  std::vector<std::unique_ptr<KVEngine::BatchWriteContext>> ctxs;
+  for (uint32_t shard = 0; shard < shards_.size(); shard++) {
+    if (shard_batches[shard] == nullptr) {
+      continue;
+    }
+    KVEngine* engine = static_cast<KVEngine*>(shards_[shard].get());
+    ctxs.emplace_back(new KVEngine::BatchWriteContext(engine));
+    Status s = engine->batchWritePrepare(*shard_batches[shard], true, nullptr,
+                                         ctxs.back().get());
+    if (s != Status::Ok) {
+      return s;
+    }
+    ctxs.back()->log.SetCrossShardId(id);
+    engines.push_back(engine);
+  }
+
+  for (size_t i = 0; i < ctxs.size(); i++) {
+    char* log_space = engines[i]->threadBatchLog();
+    ctxs[i]->log.EncodeTo(log_space);
+    BatchWriteLog::MarkProcessing(log_space);
+    engines[i]->batchWriteRecords(ctxs[i].get());
+  }
+
+  TEST_CRASH_POINT("ShardedEngine::crossShardBatchWrite::BeforeCommit", "");
+
+  uint32_t slot = acquireCommitSlot();
+  commit_slots_[slot] = id;
+  pmem_persist(&commit_slots_[slot], sizeof(uint64_t));
+
+  TEST_CRASH_POINT("ShardedEngine::crossShardBatchWrite::AfterCommit", "");
+
+  for (size_t i = 0; i < ctxs.size(); i++) {
+    BatchWriteLog::MarkCommitted(engines[i]->threadBatchLog());
+    engines[i]->batchWritePublish(ctxs[i].get());
+  }
+
+  commit_slots_[slot] = 0;
+  pmem_persist(&commit_slots_[slot], sizeof(uint64_t));
+  releaseCommitSlot(slot);
+  return Status::Ok;
+}
+
+uint32_t ShardedEngine::acquireCommitSlot() {
+  std::unique_lock<std::mutex> ul(commit_slots_mu_);
+  while (free_commit_slots_.empty()) {
+    commit_slots_cv_.wait(ul);
+  }
+  uint32_t slot = free_commit_slots_.back();
+  free_commit_slots_.pop_back();
+  return slot;
+}
+
+void ShardedEngine::releaseCommitSlot(uint32_t slot) {
+  {
+    std::lock_guard<std::mutex> lg(commit_slots_mu_);
+    free_commit_slots_.push_back(slot);
+  }
+  commit_slots_cv_.notify_one();
+}
+
+std::unique_ptr<Transaction> ShardedEngine::TransactionCreate(
+    const TransactionOptions& options) {
+  return std::unique_ptr<Transaction>(
+      new ShardedTransaction(this, &shards_, options));
+}
+
+Status ShardedEngine::ListMove(StringView src_list, ListPos src_pos,
+                               StringView dst_list, ListPos dst_pos,
+                               std::string* elem) {
+  uint32_t shard = ShardIndex(src_list);
+  if (ShardIndex(dst_list) != shard) {
+    GlobalLogger.Error("ListMove across shards is not supported\n");
+    return Status::NotSupported;
+  }
+  return shards_[shard]->ListMove(src_list, src_pos, dst_list, dst_pos, elem);
+}
+
+SortedIterator* ShardedEngine::SortedIteratorCreate(
+    const StringView collection, Snapshot* snapshot, Status* s,
+    const SortedIteratorOptions& options) {
+  uint32_t shard = ShardIndex(collection);
+  SortedIterator* iter = shards_[shard]->SortedIteratorCreate(
+      collection, shardSnapshot(snapshot, shard), s, options);
+  addIterator(iter, shards_[shard].get());
+  return iter;
+}
+
+Status ShardedEngine::SortedPartitionIteratorsCreate(
+    const StringView collection, size_t num_partitions,
+    std::vector<SortedIterator*>* iterators, Snapshot* snapshot,
+    const SortedIteratorOptions& options) {
+  uint32_t shard = ShardIndex(collection);
+  Status s = shards_[shard]->SortedPartitionIteratorsCreate(
+      collection, num_partitions, iterators, shardSnapshot(snapshot, shard),
+      options);
+  if (s == Status::Ok) {
+    for (SortedIterator* iter : *iterators) {
+      addIterator(iter, shards_[shard].get());
+    }
+  }
+  return s;
+}
+
+ListIterator* ShardedEngine::ListIteratorCreate(StringView list,
+                                                Snapshot* snapshot,
+                                                Status* status) {
+  uint32_t shard = ShardIndex(list);
+  ListIterator* iter = shards_[shard]->ListIteratorCreate(
+      list, shardSnapshot(snapshot, shard), status);
+  addIterator(iter, shards_[shard].get());
+  return iter;
+}
+
+HashIterator* ShardedEngine::HashIteratorCreate(StringView collection,
+                                                Snapshot* snapshot,
+                                                Status* s) {
+  uint32_t shard = ShardIndex(collection);
+  HashIterator* iter = shards_[shard]->HashIteratorCreate(
+      collection, shardSnapshot(snapshot, shard), s);
+  addIterator(iter, shards_[shard].get());
+  return iter;
+}
+
+Snapshot* ShardedEngine::GetSnapshot(bool make_checkpoint) {
+  ShardedSnapshot* snapshot = new ShardedSnapshot;
+  std::lock_guard<RWLock> lg(cross_shard_lock_);
+  uint64_t tsc = rdtsc();
+  for (auto& shard : shards_) {
+    snapshot->snapshots.push_back(static_cast<KVEngine*>(shard.get())
+                                      ->getSnapshotAt(tsc, make_checkpoint));
+  }
+  return snapshot;
+}
+
+Status ShardedEngine::Backup(const pmem::obj::string_view backup_log,
+                             const Snapshot* snapshot) {
+  return forEachShard(shards_.size(), shard_cpus_, [&](uint32_t shard) {
+    return shards_[shard]->Backup(shardBackupLog(backup_log, shard),
+                                  shardSnapshot(snapshot, shard));
+  });
+}
+
+void ShardedEngine::ReleaseSnapshot(const Snapshot* snapshot) {
+  if (snapshot == nullptr) {
+    return;
+  }
+  const ShardedSnapshot* sharded_snapshot =
+      static_cast<const ShardedSnapshot*>(snapshot);
+  for (uint32_t shard = 0; shard < shards_.size(); shard++) {
+    shards_[shard]->ReleaseSnapshot(sharded_snapshot->snapshots[shard]);
+  }
+  delete sharded_snapshot;
+}
+
+bool ShardedEngine::registerComparator(const StringView& comparator_name,
+                                       Comparator comparator) {
+  bool ret = true;
+  for (auto& shard : shards_) {
+    ret = shard->registerComparator(comparator_name, comparator) && ret;
+  }
+  return ret;
+}
+
+void ShardedEngine::addIterator(const void* iterator, Engine* shard) {
+  if (iterator != nullptr) {
+    std::lock_guard<std::mutex> lg(iterators_mu_);
+    iterator_shards_[iterator] = shard;
+  }
+}
+
+Engine* ShardedEngine::releaseIterator(const void* iterator) {
+  std::lock_guard<std::mutex> lg(iterators_mu_);
+  auto iter = iterator_shards_.find(iterator);
+  if (iter == iterator_shards_.end()) {
+    return nullptr;
+  }
+  Engine* shard = iter->second;
+  iterator_shards_.erase(iter);
+  return shard;
+}
+
+}  // namespace KVDK_NAMESPACE
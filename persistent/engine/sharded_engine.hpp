@@ -0,0 +1,392 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright(c) 2022 Intel Corporation
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "alias.hpp"
+#include "kvdk/persistent/engine.hpp"
+#include "utils/utils.hpp"
+
+namespace KVDK_NAMESPACE {
+
+class WriteBatchImpl;
+
+// A kvdk instance consists of Configs::num_shards independent KVEngine
+// shards, each has its own hash table, version controller, cleaner and PMem
+// space, stored in "shard0", "shard1"... of the instance dir.
+//
+// Strings are routed to shards by hash of their keys, and collections by hash
+// of their names, so all elements of a collection are in the same shard. If a
+// key or collection name contains a non-empty "{tag}", only the first tag is
+// hashed, so keys sharing a tag are in the same shard.
+//
+// Operations on a single shard keep their guarantees. Operations across
+// shards are fanned out to each shard:
+// * BatchWrite across shards is atomic by a two-phase commit over batch logs
+// of the shards, see crossShardBatchWrite()
+// * GetSnapshot takes snapshots of all shards at the same time, and none of
+// them is in the middle of a cross-shard batch, so Backup on it is consistent
+// across shards
+// * MultiGet is consistent inside each shard only
+// * A transaction can only access keys of one shard, and ListMove between
+// lists of different shards is not supported
+class ShardedEngine : public Engine {
+ public:
+  ~ShardedEngine();
+
+  static Status Open(const StringView engine_path, Engine** engine_ptr,
+                     const Configs& configs);
+
+  // Restore shard i of the instance from "backup_log.i"
+  static Status Restore(const StringView engine_path,
+                        const StringView backup_log, Engine** engine_ptr,
+                        const Configs& configs);
+
+  // If an instance sharded by ShardedEngine exists at "engine_path"
+  static bool ShardedInstance(const StringView engine_path);
+
+  Status TypeOf(StringView key, ValueType* type) final {
+    return shardOf(key)->TypeOf(key, type);
+  }
+
+  Status Put(const StringView key, const StringView value,
+             const WriteOptions& options) final {
+    return shardOf(key)->Put(key, value, options);
+  }
+
+  Status Get(const StringView key, std::string* value) final {
+    return shardOf(key)->Get(key, value);
+  }
+
+  Status MultiGet(const std::vector<StringView>& keys,
+                  std::vector<std::string>* values,
+                  std::vector<Status>* statuses) final;
+
+  Status Delete(const StringView key) final {
+    return shardOf(key)->Delete(key);
+  }
+
+  Status Modify(const StringView key, ModifyFunc modify_func,
+                void* modify_args, const WriteOptions& options) final {
+    return shardOf(key)->Modify(key, modify_func, modify_args, options);
+  }
+
+  Status BatchWrite(std::unique_ptr<WriteBatch> const& batch) final;
+
+  std::unique_ptr<WriteBatch> WriteBatchCreate() final {
+    return shards_[0]->WriteBatchCreate();
+  }
+
+  std::unique_ptr<Transaction> TransactionCreate(
+      const TransactionOptions& options) final;
+
+  Status GetTTL(const StringView key, int64_t* ttl_time) final {
+    return shardOf(key)->GetTTL(key, ttl_time);
+  }
+
+  Status Expire(const StringView key, int64_t ttl_time) final {
+    return shardOf(key)->Expire(key, ttl_time);
+  }
+
+  // Sorted
+  Status SortedCreate(const StringView collection,
+                      const SortedCollectionConfigs& configs) final {
+    return shardOf(collection)->SortedCreate(collection, configs);
+  }
+
+  Status SortedDestroy(const StringView collection) final {
+    return shardOf(collection)->SortedDestroy(collection);
+  }
+
+  Status SortedSize(const StringView collection, size_t* size) final {
+    return shardOf(collection)->SortedSize(collection, size);
+  }
+
+  Status SortedPut(const StringView collection, const StringView key,
+                   const StringView value) final {
+    return shardOf(collection)->SortedPut(collection, key, value);
+  }
+
+  Status SortedGet(const StringView collection, const StringView key,
+                   std::string* value) final {
+    return shardOf(collection)->SortedGet(collection, key, value);
+  }
+
+  Status SortedDelete(const StringView collection,
+                      const StringView key) final {
+    return shardOf(collection)->SortedDelete(collection, key);
+  }
+
+  SortedIterator* SortedIteratorCreate(
+      const StringView collection, Snapshot* snapshot, Status* s,
+      const SortedIteratorOptions& options) final;
+
+  void SortedIteratorRelease(SortedIterator* sorted_iterator) final {
+    Engine* shard = releaseIterator(sorted_iterator);
+    if (shard != nullptr) {
+      shard->SortedIteratorRelease(sorted_iterator);
+    }
+  }
+
+  Status SortedPartitionIteratorsCreate(
+      const StringView collection, size_t num_partitions,
+      std::vector<SortedIterator*>* iterators, Snapshot* snapshot,
+      const SortedIteratorOptions& options) final;
+
+  // List
+  Status ListCreate(StringView list) final {
+    return shardOf(list)->ListCreate(list);
+  }
+
+  Status ListDestroy(StringView list) final {
+    return shardOf(list)->ListDestroy(list);
+  }
+
+  Status ListSize(StringView list, size_t* sz) final {
+    return shardOf(list)->ListSize(list, sz);
+  }
+
+  Status ListPushFront(StringView list, StringView elem) final {
+    return shardOf(list)->ListPushFront(list, elem);
+  }
+
+  Status ListPushBack(StringView list, StringView elem) final {
+    return shardOf(list)->ListPushBack(list, elem);
+  }
+
+  Status ListPopFront(StringView list, std::string* elem) final {
+    return shardOf(list)->ListPopFront(list, elem);
+  }
+
+  Status ListPopBack(StringView list, std::string* elem) final {
+    return shardOf(list)->ListPopBack(list, elem);
+  }
+
+  Status ListBatchPushFront(StringView list,
+                            std::vector<std::string> const& elems) final {
+    return shardOf(list)->ListBatchPushFront(list, elems);
+  }
+
+  Status ListBatchPushFront(StringView list,
+                            std::vector<StringView> const& elems) final {
+    return shardOf(list)->ListBatchPushFront(list, elems);
+  }
+
+  Status ListBatchPushBack(StringView list,
+                           std::vector<std::string> const& elems) final {
+    return shardOf(list)->ListBatchPushBack(list, elems);
+  }
+
+  Status ListBatchPushBack(StringView list,
+                           std::vector<StringView> const& elems) final {
+    return shardOf(list)->ListBatchPushBack(list, elems);
+  }
+
+  Status ListBatchPopFront(StringView list, size_t n,
+                           std::vector<std::string>* elems) final {
+    return shardOf(list)->ListBatchPopFront(list, n, elems);
+  }
+
+  Status ListBatchPopBack(StringView list, size_t n,
+                          std::vector<std::string>* elems) final {
+    return shardOf(list)->ListBatchPopBack(list, n, elems);
+  }
+
+  Status ListMove(StringView src_list, ListPos src_pos, StringView dst_list,
+                  ListPos dst_pos, std::string* elem) final;
+
+  Status ListInsertAt(StringView list, StringView elem, long index) final {
+    return shardOf(list)->ListInsertAt(list, elem, index);
+  }
+
+  Status ListInsertBefore(StringView list, StringView elem,
+                          StringView pos) final {
+    return shardOf(list)->ListInsertBefore(list, elem, pos);
+  }
+
+  Status ListInsertAfter(StringView list, StringView elem,
+                         StringView pos) final {
+    return shardOf(list)->ListInsertAfter(list, elem, pos);
+  }
+
+  Status ListErase(StringView list, long index, std::string* elem) final {
+    return shardOf(list)->ListErase(list, index, elem);
+  }
+
+  Status ListReplace(StringView list, long index, StringView elem) final {
+    return shardOf(list)->ListReplace(list, index, elem);
+  }
+
+  ListIterator* ListIteratorCreate(StringView list, Snapshot* snapshot,
+                                   Status* status) final;
+
+  void ListIteratorRelease(ListIterator* list_iterator) final {
+    Engine* shard = releaseIterator(list_iterator);
+    if (shard != nullptr) {
+      shard->ListIteratorRelease(list_iterator);
+    }
+  }
+
+  // Hash
+  Status HashCreate(StringView collection) final {
+    return shardOf(collection)->HashCreate(collection);
+  }
+
+  Status HashDestroy(StringView collection) final {
+    return shardOf(collection)->HashDestroy(collection);
+  }
+
+  Status HashSize(StringView collection, size_t* len) final {
+    return shardOf(collection)->HashSize(collection, len);
+  }
+
+  Status HashGet(StringView collection, StringView key,
+                 std::string* value) final {
+    return shardOf(collection)->HashGet(collection, key, value);
+  }
+
+  Status HashPut(StringView collection, StringView key,
+                 StringView value) final {
+    return shardOf(collection)->HashPut(collection, key, value);
+  }
+
+  Status HashDelete(StringView collection, StringView key) final {
+    return shardOf(collection)->HashDelete(collection, key);
+  }
+
+  Status HashModify(StringView collection, StringView key,
+                    ModifyFunc modify_func, void* cb_args) final {
+    return shardOf(collection)->HashModify(collection, key, modify_func,
+                                           cb_args);
+  }
+
+  HashIterator* HashIteratorCreate(StringView collection, Snapshot* snapshot,
+                                   Status* s) final;
+
+  void HashIteratorRelease(HashIterator* hash_iterator) final {
+    Engine* shard = releaseIterator(hash_iterator);
+    if (shard != nullptr) {
+      shard->HashIteratorRelease(hash_iterator);
+    }
+  }
+
+  // Snapshot of each shard, they are taken at the same CPU tsc
+  Snapshot* GetSnapshot(bool make_checkpoint) final;
+
+  // Backup shard i on its snapshot to "backup_log.i"
+  Status Backup(const pmem::obj::string_view backup_log,
+                const Snapshot* snapshot) final;
+
+  void ReleaseSnapshot(const Snapshot* snapshot) final;
+
+  bool registerComparator(const StringView& comparator_name,
+                          Comparator comparator) final;
+
+  // Index of the shard "key" or collection name routed to
+  uint32_t ShardIndex(const StringView key) const {
+    StringView shard_key = hashTag(key);
+    return hash_str(shard_key.data(), shard_key.size()) % shards_.size();
+  }
+
+ private:
+  struct ShardedSnapshot : public Snapshot {
+    std::vector<Snapshot*> snapshots;
+  };
+
+  ShardedEngine() = default;
+
+  static Status openShards(const StringView engine_path,
+                           const StringView backup_log, Engine** engine_ptr,
+                           const Configs& configs);
+
+  static std::string shardDir(const std::string& engine_path, uint32_t shard) {
+    return format_dir_path(engine_path) + "shard" + std::to_string(shard);
+  }
+
+  static std::string shardsFile(const std::string& engine_path) {
+    return format_dir_path(engine_path) + "shards";
+  }
+
+  static std::string crossShardCommitsFile(const std::string& engine_path) {
+    return format_dir_path(engine_path) + "cross_shard_commits";
+  }
+
+  // Read ids of cross-shard batches persisted in slots of "file"
+  static Status readCrossShardCommits(const std::string& file,
+                                      std::unordered_set<uint64_t>* ids);
+
+  // Create or reset "file" with "num_slots" empty slots, and map it
+  Status initCrossShardCommits(const std::string& file, uint32_t num_slots);
+
+  // Commit "shard_batches" atomically, each one is the part of a batch on a
+  // shard, or null if the batch doesn't operate the shard.
+  //
+  // 1. Each shard prepares its part in ascending order of shards, so
+  // concurrent cross-shard batches lock keys without deadlock. A failure
+  // releases all shards, and nothing is written
+  // 2. Each shard persists the log of its part alone, tagged with a new
+  // cross-shard id, then writes its records
+  // 3. The id is persisted to a free slot of the cross-shard commits file,
+  // which is the commit point
+  // 4. Each shard marks its log committed and publishes its records, then the
+  // slot is cleared
+  //
+  // During recovery, unfinished logs tagged with ids in the commits file are
+  // kept, and other unfinished logs are rolled back by their shards
+  Status crossShardBatchWrite(
+      const std::vector<std::unique_ptr<WriteBatchImpl>>& shard_batches);
+
+  // Take a free slot of the cross-shard commits file, wait if none
+  uint32_t acquireCommitSlot();
+
+  void releaseCommitSlot(uint32_t slot);
+
+  // Content of the first non-empty "{tag}" of "key", or "key" if no tag
+  static StringView hashTag(const StringView key);
+
+  Engine* shardOf(const StringView key) const {
+    return shards_[ShardIndex(key)].get();
+  }
+
+  // Snapshot of "shard" in a sharded snapshot
+  static Snapshot* shardSnapshot(const Snapshot* snapshot, uint32_t shard) {
+    return snapshot == nullptr ? nullptr
+                               : static_cast<const ShardedSnapshot*>(snapshot)
+                                     ->snapshots[shard];
+  }
+
+  // Record the shard created "iterator" until it is released
+  void addIterator(const void* iterator, Engine* shard);
+
+  // Return the shard created "iterator" and forget it
+  Engine* releaseIterator(const void* iterator);
+
+  std::vector<std::unique_ptr<Engine>> shards_;
+  // See Configs::shard_cpus
+  std::vector<std::vector<uint32_t>> shard_cpus_;
+  // Mapped slots of the cross-shard commits file
+  uint64_t* commit_slots_{nullptr};
+  size_t commit_slots_bytes_{0};
+  std::mutex commit_slots_mu_;
+  std::condition_variable commit_slots_cv_;
+  std::vector<uint32_t> free_commit_slots_;
+  std::atomic<uint64_t> next_cross_shard_id_{1};
+  // Held shared by cross-shard batches and exclusively by GetSnapshot(), so
+  // no snapshot is taken in the middle of a cross-shard batch
+  RWLock cross_shard_lock_;
+  // Shard of each iterator not released yet
+  std::mutex iterators_mu_;
+  std::unordered_map<const void*, Engine*> iterator_shards_;
+};
+
+}  // namespace KVDK_NAMESPACE
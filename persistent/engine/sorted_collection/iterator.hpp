@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <memory>
+
 #include "../alias.hpp"
 #include "skiplist.hpp"
 
@@ -13,25 +15,76 @@ class KVEngine;
 
 class SortedIteratorImpl : public SortedIterator {
  public:
-  SortedIteratorImpl(Skiplist* skiplist, const PMEMAllocator* pmem_allocator,
-                     const SnapshotImpl* snapshot, bool own_snapshot)
+  SortedIteratorImpl(
+      Skiplist* skiplist, const PMEMAllocator* pmem_allocator,
+      const SnapshotImpl* snapshot, bool own_snapshot,
+      const SortedIteratorOptions& options = SortedIteratorOptions())
       : skiplist_(skiplist),
         snapshot_(snapshot),
         own_snapshot_(own_snapshot),
-        dl_iter_(&skiplist->dl_list_, pmem_allocator, snapshot) {}
+        options_(options),
+        dl_iter_(&skiplist->dl_list_, pmem_allocator, snapshot) {
+    if (!options_.lower_bound.empty() || !options_.upper_bound.empty() ||
+        !options_.prefix.empty()) {
+      dl_iter_.SetRange(RangeChecker{skiplist_, options_});
+    }
+  }
 
   virtual ~SortedIteratorImpl() = default;
 
   virtual void Seek(const std::string& key) override {
     assert(skiplist_);
+    const std::string* target = &key;
+    if (!options_.lower_bound.empty() &&
+        skiplist_->Compare(*target, options_.lower_bound) < 0) {
+      target = &options_.lower_bound;
+    }
+    if (!options_.prefix.empty() &&
+        skiplist_->Compare(*target, options_.prefix) < 0) {
+      target = &options_.prefix;
+    }
     Splice splice(skiplist_);
-    skiplist_->Seek(key, &splice);
+    skiplist_->Seek(*target, &splice);
     dl_iter_.Locate(splice.next_pmem_record, true);
   }
 
-  virtual void SeekToFirst() override { dl_iter_.SeekToFirst(); }
+  virtual void SeekForPrev(const std::string& key) override {
+    assert(skiplist_);
+    std::string end = rangeEnd();
+    if (!end.empty() && skiplist_->Compare(key, end) >= 0) {
+      seekBefore(end);
+      return;
+    }
+    Splice splice(skiplist_);
+    skiplist_->Seek(key, &splice);
+    DLRecord* next = splice.next_pmem_record;
+    if (next->GetRecordType() == RecordType::SortedElem &&
+        skiplist_->Compare(Skiplist::UserKey(next), key) == 0) {
+      dl_iter_.Locate(next, false);
+    } else {
+      dl_iter_.Locate(splice.prev_pmem_record, false);
+    }
+  }
+
+  virtual void SeekToFirst() override {
+    // An empty key is not the smallest one in a custom order, seek to the
+    // range begin instead
+    std::string begin = rangeBegin();
+    if (begin.empty()) {
+      dl_iter_.SeekToFirst();
+    } else {
+      Seek(begin);
+    }
+  }
 
-  virtual void SeekToLast() override { dl_iter_.SeekToLast(); }
+  virtual void SeekToLast() override {
+    std::string end = rangeEnd();
+    if (end.empty()) {
+      dl_iter_.SeekToLast();
+    } else {
+      seekBefore(end);
+    }
+  }
 
   virtual bool Valid() override { return dl_iter_.Valid(); }
 
@@ -39,22 +92,92 @@ class SortedIteratorImpl : public SortedIterator {
 
   virtual void Prev() override { dl_iter_.Prev(); }
 
-  virtual std::string Key() override {
+  virtual std::string Key() override { return string_view_2_string(KeyView()); }
+
+  virtual std::string Value() override {
+    return string_view_2_string(ValueView());
+  }
+
+  virtual StringView KeyView() override {
     if (!Valid()) return "";
-    return string_view_2_string(Skiplist::ExtractUserKey(dl_iter_.Key()));
+    return Skiplist::ExtractUserKey(dl_iter_.Key());
   }
 
-  virtual std::string Value() override {
+  virtual StringView ValueView() override {
     if (!Valid()) return "";
-    return string_view_2_string(dl_iter_.Value());
+    return dl_iter_.Value();
   }
 
  private:
   friend KVEngine;
 
+  // Check if a record key is in bounds of options
+  struct RangeChecker {
+    bool operator()(const StringView& key) const {
+      StringView user_key = Skiplist::ExtractUserKey(key);
+      if (!options.prefix.empty() &&
+          (user_key.size() < options.prefix.size() ||
+           memcmp(user_key.data(), options.prefix.data(),
+                  options.prefix.size()) != 0)) {
+        return false;
+      }
+      if (!options.lower_bound.empty() &&
+          skiplist->Compare(user_key, options.lower_bound) < 0) {
+        return false;
+      }
+      if (!options.upper_bound.empty() &&
+          skiplist->Compare(user_key, options.upper_bound) >= 0) {
+        return false;
+      }
+      return true;
+    }
+
+    Skiplist* skiplist;
+    SortedIteratorOptions options;
+  };
+
+  // Position at the last key less than "key"
+  void seekBefore(const StringView& key) {
+    Splice splice(skiplist_);
+    skiplist_->Seek(key, &splice);
+    dl_iter_.Locate(splice.prev_pmem_record, false);
+  }
+
+  // Return the smallest key in bounds, or empty if no such bound
+  std::string rangeBegin() const {
+    if (!options_.prefix.empty() &&
+        (options_.lower_bound.empty() ||
+         skiplist_->Compare(options_.lower_bound, options_.prefix) < 0)) {
+      return options_.prefix;
+    }
+    return options_.lower_bound;
+  }
+
+  // Return the smallest key greater than all keys in bounds, or empty if no
+  // such bound. Keys with prefix are bounded by the next prefix in bytewise
+  // order, prefix is only allowed in collections ordered bytewise
+  std::string rangeEnd() const {
+    std::string end = options_.prefix;
+    while (!end.empty() && static_cast<unsigned char>(end.back()) == 0xff) {
+      end.pop_back();
+    }
+    if (!end.empty()) {
+      end.back() = static_cast<char>(end.back() + 1);
+    }
+    if (!options_.upper_bound.empty() &&
+        (end.empty() || skiplist_->Compare(options_.upper_bound, end) < 0)) {
+      end = options_.upper_bound;
+    }
+    return end;
+  }
+
   Skiplist* skiplist_;
   const SnapshotImpl* snapshot_;
   bool own_snapshot_;
+  // Snapshot shared with other partition iterators, released with the last
+  // one of them
+  std::shared_ptr<const SnapshotImpl> shared_snapshot_;
+  SortedIteratorOptions options_;
   DLListDataIterator dl_iter_;
 };
 }  // namespace KVDK_NAMESPACE
\ No newline at end of file
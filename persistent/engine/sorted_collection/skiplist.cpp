@@ -536,16 +536,28 @@ Status Skiplist::DecodeSortedCollectionValue(
   return Status::Ok;
 }
 
-Status Skiplist::Get(const StringView& key, std::string* value) {
+Status Skiplist::Get(const StringView& key, std::string* value,
+                     TimestampType* timestamp) {
+  if (timestamp != nullptr) {
+    *timestamp = 0;
+  }
   if (!IndexWithHashtable()) {
     Splice splice(this);
     Seek(key, &splice);
     auto type = splice.next_pmem_record->GetRecordType();
     auto status = splice.next_pmem_record->GetRecordStatus();
-    if (type == RecordType::SortedElem && status != RecordStatus::Outdated &&
-        equal_string_view(key, UserKey(splice.next_pmem_record))) {
-      value->assign(splice.next_pmem_record->Value().data(),
-                    splice.next_pmem_record->Value().size());
+    if (type != RecordType::SortedElem ||
+        !equal_string_view(key, UserKey(splice.next_pmem_record))) {
+      return Status::NotFound;
+    }
+    if (timestamp != nullptr) {
+      *timestamp = splice.next_pmem_record->GetTimestamp();
+    }
+    if (status != RecordStatus::Outdated) {
+      if (value != nullptr) {
+        value->assign(splice.next_pmem_record->Value().data(),
+                      splice.next_pmem_record->Value().size());
+      }
       return Status::Ok;
     } else {
       return Status::NotFound;
@@ -553,8 +565,7 @@ Status Skiplist::Get(const StringView& key, std::string* value) {
   } else {
     std::string internal_key = InternalKey(key);
     auto ret = hash_table_->Lookup<false>(internal_key, RecordType::SortedElem);
-    if (ret.s != Status::Ok ||
-        ret.entry.GetRecordStatus() == RecordStatus::Outdated) {
+    if (ret.s != Status::Ok) {
       return Status::NotFound;
     }
 
@@ -575,12 +586,18 @@ Status Skiplist::Get(const StringView& key, std::string* value) {
       }
     }
     kvdk_assert(pmem_record->GetRecordType() == RecordType::SortedElem, "");
+    if (timestamp != nullptr) {
+      *timestamp = pmem_record->GetTimestamp();
+    }
     // As get is lockless, skiplist node may point to a new elem delete record
     // after we get it from hashtable
-    if (pmem_record->GetRecordStatus() == RecordStatus::Outdated) {
+    if (ret.entry.GetRecordStatus() == RecordStatus::Outdated ||
+        pmem_record->GetRecordStatus() == RecordStatus::Outdated) {
       return Status::NotFound;
     } else {
-      value->assign(pmem_record->Value().data(), pmem_record->Value().size());
+      if (value != nullptr) {
+        value->assign(pmem_record->Value().data(), pmem_record->Value().size());
+      }
       return Status::Ok;
     }
   }
@@ -947,6 +964,49 @@ void Skiplist::destroyRecords() {
 
 size_t Skiplist::Size() { return size_.load(std::memory_order_relaxed); }
 
+void Skiplist::SplitKeys(const StringView& begin, const StringView& end,
+                         size_t num_parts,
+                         std::vector<std::string>* split_keys) {
+  split_keys->clear();
+  if (num_parts <= 1) {
+    return;
+  }
+  std::vector<SkiplistNode*> nodes;
+  // Last node before "begin" on the current level, nodes on lower levels are
+  // searched from it
+  SkiplistNode* start = header_;
+  for (int l = header_->Height(); l >= 1; l--) {
+    nodes.clear();
+    SkiplistNode* node = start->Next(l).RawPointer();
+    while (node != nullptr) {
+      auto next = node->Next(l);
+      StringView key = UserKey(node);
+      if (!begin.empty() && Compare(key, begin) <= 0) {
+        start = node;
+      } else if (!end.empty() && Compare(key, end) >= 0) {
+        break;
+      } else if (next.GetTag() != SkiplistNode::NodeStatus::Deleted) {
+        nodes.push_back(node);
+      }
+      node = next.RawPointer();
+    }
+    if (nodes.size() >= num_parts) {
+      break;
+    }
+  }
+
+  if (nodes.size() >= num_parts) {
+    for (size_t i = 1; i < num_parts; i++) {
+      split_keys->push_back(
+          string_view_2_string(UserKey(nodes[i * nodes.size() / num_parts])));
+    }
+  } else {
+    for (SkiplistNode* node : nodes) {
+      split_keys->push_back(string_view_2_string(UserKey(node)));
+    }
+  }
+}
+
 void Skiplist::UpdateSize(int64_t delta) {
   kvdk_assert(delta >= 0 || size_.load() >= static_cast<size_t>(-delta),
               "Update skiplist size to negative");
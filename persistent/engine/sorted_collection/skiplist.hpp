@@ -228,7 +228,12 @@ class Skiplist : public Collection {
                   TimestampType timestamp);
 
   // Get value of "key" from the skiplist
-  Status Get(const StringView& key, std::string* value);
+  //
+  // If "timestamp" is not nullptr, it's set to timestamp of the newest record
+  // of "key" even if it's deleted, or 0 if no record found. "value" can be
+  // nullptr if only timestamp is required
+  Status Get(const StringView& key, std::string* value,
+             TimestampType* timestamp = nullptr);
 
   // Delete "key" from the skiplist by replace it with a delete record
   //
@@ -297,12 +302,27 @@ class Skiplist : public Collection {
   // Return number of elements in skiplist
   size_t Size();
 
+  // Split keys in range ["begin", "end") into at most "num_parts" ranges of
+  // similar size, with keys of nodes on the highest index level which has
+  // enough nodes in the range. Store the split keys in ascending order to
+  // "split_keys". An empty "begin" or "end" means unbounded.
+  void SplitKeys(const StringView& begin, const StringView& end,
+                 size_t num_parts, std::vector<std::string>* split_keys);
+
   void UpdateSize(int64_t delta);
 
   int Compare(const StringView& src_key, const StringView& target_key) {
     return comparator_(src_key, target_key);
   }
 
+  // Return true if keys are ordered bytewise by the default comparator, so
+  // keys with the same prefix are adjacent
+  bool BytewiseOrdered() const {
+    using CompareFunc = int (*)(const StringView&, const StringView&);
+    const CompareFunc* func = comparator_.target<CompareFunc>();
+    return func != nullptr && *func == compare_string_view;
+  }
+
   static bool MatchType(DLRecord* record) {
     RecordType type = record->GetRecordType();
     return type == RecordType::SortedElem || type == RecordType::SortedRecord;
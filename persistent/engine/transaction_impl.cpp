@@ -7,14 +7,13 @@
 #include "kv_engine.hpp"
 
 namespace KVDK_NAMESPACE {
-// To avoid deadlock in transaction, we abort locking key in
-// random(kLockTimeoutMicrosecondsMin,kLockTimeoutMicrosecondsMax) and
-// return Timeout in write operations
-constexpr int64_t kLockTimeoutMicrosecondsMin = 5000;
-constexpr int64_t kLockTimeoutMicrosecondsMax = 15000;
+// Dead lock between transactions is avoided by TransactionLockManager, this
+// only bounds waiting for a long running transaction or a non-transaction
+// writer
+constexpr int64_t kLockTimeoutMicroseconds = 100000;
 
 TransactionImpl::TransactionImpl(KVEngine* engine)
-    : engine_(engine), timeout_(randomTimeout()) {
+    : engine_(engine), timeout_(kLockTimeoutMicroseconds) {
   kvdk_assert(engine_ != nullptr, "");
   batch_.reset(
       dynamic_cast<WriteBatchImpl*>(engine_->WriteBatchCreate().release()));
@@ -52,7 +51,7 @@ Status TransactionImpl::StringGet(const StringView key, std::string* value) {
     if (op->op == WriteOp::Delete) {
       return Status::NotFound;
     } else {
-      value->assign(op->value);
+      value->assign(op->value.data(), op->value.size());
       return Status::Ok;
     }
   } else {
@@ -68,19 +67,11 @@ Status TransactionImpl::StringGet(const StringView key, std::string* value) {
 Status TransactionImpl::SortedPut(const StringView collection,
                                   const StringView key,
                                   const StringView value) {
-  acquireCollectionTransaction();
-  auto hash_table = engine_->GetHashTable();
-  auto lookup_result =
-      hash_table->Lookup<false>(collection, RecordType::SortedRecord);
-  if (lookup_result.s != Status::Ok) {
-    kvdk_assert(lookup_result.s == Status::NotFound, "");
-    return lookup_result.s;
-  }
-  Skiplist* skiplist = lookup_result.entry.GetIndex().skiplist;
-  auto internal_key = skiplist->InternalKey(key);
-  if (!tryLock(hash_table->GetLock(internal_key))) {
-    status_ = Status::Timeout;
-    return status_;
+  Collection* skiplist;
+  Status s =
+      lockCollectionKey(collection, key, RecordType::SortedRecord, &skiplist);
+  if (s != Status::Ok) {
+    return s;
   }
 
   batch_->SortedPut(collection, key, value);
@@ -89,19 +80,11 @@ Status TransactionImpl::SortedPut(const StringView collection,
 
 Status TransactionImpl::SortedDelete(const StringView collection,
                                      const StringView key) {
-  acquireCollectionTransaction();
-  auto hash_table = engine_->GetHashTable();
-  auto lookup_result =
-      hash_table->Lookup<false>(collection, RecordType::SortedRecord);
-  if (lookup_result.s != Status::Ok) {
-    kvdk_assert(lookup_result.s == Status::NotFound, "");
-    return lookup_result.s;
-  }
-  Skiplist* skiplist = lookup_result.entry.GetIndex().skiplist;
-  auto internal_key = skiplist->InternalKey(key);
-  if (!tryLock(hash_table->GetLock(internal_key))) {
-    status_ = Status::Timeout;
-    return status_;
+  Collection* skiplist;
+  Status s =
+      lockCollectionKey(collection, key, RecordType::SortedRecord, &skiplist);
+  if (s != Status::Ok) {
+    return s;
   }
 
   batch_->SortedDelete(collection, key);
@@ -115,44 +98,29 @@ Status TransactionImpl::SortedGet(const StringView collection,
     if (op->op == WriteOp::Delete) {
       return Status::NotFound;
     } else {
-      value->assign(op->value);
+      value->assign(op->value.data(), op->value.size());
       return Status::Ok;
     }
   } else {
-    acquireCollectionTransaction();
-    auto hash_table = engine_->GetHashTable();
-    auto lookup_result =
-        hash_table->Lookup<false>(collection, RecordType::SortedRecord);
-    if (lookup_result.s != Status::Ok) {
-      kvdk_assert(lookup_result.s == Status::NotFound, "");
-      return lookup_result.s;
-    }
-    Skiplist* skiplist = lookup_result.entry.GetIndex().skiplist;
-    auto internal_key = skiplist->InternalKey(key);
-    if (!tryLock(hash_table->GetLock(internal_key))) {
-      status_ = Status::Timeout;
-      return status_;
+    Collection* skiplist;
+    Status s =
+        lockCollectionKey(collection, key, RecordType::SortedRecord, &skiplist);
+    if (s != Status::Ok) {
+      return s;
     }
 
-    return skiplist->Get(key, value);
+    auto thread_holder = engine_->AcquireAccessThread();
+    auto holder = engine_->version_controller_.GetLocalSnapshotHolder();
+    return static_cast<Skiplist*>(skiplist)->Get(key, value);
   }
 }
 
 Status TransactionImpl::HashPut(const StringView collection,
                                 const StringView key, const StringView value) {
-  acquireCollectionTransaction();
-  auto hash_table = engine_->GetHashTable();
-  auto lookup_result =
-      hash_table->Lookup<false>(collection, RecordType::HashRecord);
-  if (lookup_result.s != Status::Ok) {
-    kvdk_assert(lookup_result.s == Status::NotFound, "");
-    return lookup_result.s;
-  }
-  HashList* hlist = lookup_result.entry.GetIndex().hlist;
-  auto internal_key = hlist->InternalKey(key);
-  if (!tryLock(hash_table->GetLock(internal_key))) {
-    status_ = Status::Timeout;
-    return status_;
+  Collection* hlist;
+  Status s = lockCollectionKey(collection, key, RecordType::HashRecord, &hlist);
+  if (s != Status::Ok) {
+    return s;
   }
 
   batch_->HashPut(collection, key, value);
@@ -161,19 +129,10 @@ Status TransactionImpl::HashPut(const StringView collection,
 
 Status TransactionImpl::HashDelete(const StringView collection,
                                    const StringView key) {
-  acquireCollectionTransaction();
-  auto hash_table = engine_->GetHashTable();
-  auto lookup_result =
-      hash_table->Lookup<false>(collection, RecordType::HashRecord);
-  if (lookup_result.s != Status::Ok) {
-    kvdk_assert(lookup_result.s == Status::NotFound, "");
-    return lookup_result.s;
-  }
-  HashList* hlist = lookup_result.entry.GetIndex().hlist;
-  auto internal_key = hlist->InternalKey(key);
-  if (!tryLock(hash_table->GetLock(internal_key))) {
-    status_ = Status::Timeout;
-    return status_;
+  Collection* hlist;
+  Status s = lockCollectionKey(collection, key, RecordType::HashRecord, &hlist);
+  if (s != Status::Ok) {
+    return s;
   }
 
   batch_->HashDelete(collection, key);
@@ -187,27 +146,55 @@ Status TransactionImpl::HashGet(const StringView collection,
     if (op->op == WriteOp::Delete) {
       return Status::NotFound;
     } else {
-      value->assign(op->value);
+      value->assign(op->value.data(), op->value.size());
       return Status::Ok;
     }
   } else {
-    acquireCollectionTransaction();
-    auto hash_table = engine_->GetHashTable();
+    Collection* hlist;
+    Status s =
+        lockCollectionKey(collection, key, RecordType::HashRecord, &hlist);
+    if (s != Status::Ok) {
+      return s;
+    }
+
+    auto thread_holder = engine_->AcquireAccessThread();
+    auto holder = engine_->version_controller_.GetLocalSnapshotHolder();
+    return static_cast<HashList*>(hlist)->Get(key, value);
+  }
+}
+
+Status TransactionImpl::lockCollectionKey(const StringView collection,
+                                          const StringView key,
+                                          RecordType type,
+                                          Collection** found) {
+  acquireCollectionTransaction();
+  std::string internal_key;
+  {
+    // Hold a snapshot so the hash buckets we access won't be freed by
+    // resizing. Released before locking the key as that may wait for long
+    auto thread_holder = engine_->AcquireAccessThread();
+    auto holder = engine_->version_controller_.GetLocalSnapshotHolder();
     auto lookup_result =
-        hash_table->Lookup<false>(collection, RecordType::HashRecord);
+        engine_->GetHashTable()->Lookup<false>(collection, type);
     if (lookup_result.s != Status::Ok) {
       kvdk_assert(lookup_result.s == Status::NotFound, "");
       return lookup_result.s;
     }
-    HashList* hlist = lookup_result.entry.GetIndex().hlist;
-    auto internal_key = hlist->InternalKey(key);
-    if (!tryLock(hash_table->GetLock(internal_key))) {
-      status_ = Status::Timeout;
-      return status_;
+    if (type == RecordType::SortedRecord) {
+      *found = lookup_result.entry.GetIndex().skiplist;
+    } else {
+      kvdk_assert(type == RecordType::HashRecord, "");
+      *found = lookup_result.entry.GetIndex().hlist;
     }
+    internal_key = (*found)->InternalKey(key);
+  }
 
-    return hlist->Get(key, value);
+  // The collection won't be destroyed as we hold collection transaction lock
+  if (!tryLock(engine_->GetHashTable()->GetLock(internal_key))) {
+    status_ = Status::Timeout;
+    return status_;
   }
+  return Status::Ok;
 }
 
 void TransactionImpl::acquireCollectionTransaction() {
@@ -216,40 +203,43 @@ void TransactionImpl::acquireCollectionTransaction() {
   }
 }
 
-bool TransactionImpl::tryLock(SpinMutex* spin) {
+bool TransactionImpl::tryLock(SeqSpinMutex* spin) {
   auto iter = locked_.find(spin);
   if (iter == locked_.end()) {
-    if (tryLockImpl(spin)) {
+    auto lock_manager = engine_->GetTransactionLockManager();
+    if (start_ts_ == 0) {
+      start_ts_ = lock_manager->NewStartTimestamp();
+    }
+    if (lock_manager->Lock(spin, start_ts_, timeout_, &lock_stats_) ==
+        Status::Ok) {
       locked_.insert(spin);
       return true;
     }
+    lock_failed_ = true;
     return false;
   } else {
     return true;
   }
 }
 
-bool TransactionImpl::tryLockImpl(SpinMutex* spin) {
-  auto now = TimeUtils::microseconds_time();
-  while (!spin->try_lock()) {
-    if (TimeUtils::microseconds_time() - now > timeout_) {
-      return false;
-    }
-  }
-  return true;
-}
-
 Status TransactionImpl::Commit() {
   Status s = engine_->CommitTransaction(this);
+  // Next transaction on this struct starts with a new timestamp
+  lock_failed_ = false;
   Rollback();
   return s;
 }
 
 void TransactionImpl::Rollback() {
-  for (SpinMutex* s : locked_) {
-    s->unlock();
+  auto lock_manager = engine_->GetTransactionLockManager();
+  for (SeqSpinMutex* s : locked_) {
+    lock_manager->Unlock(s);
   }
   locked_.clear();
+  if (!lock_failed_) {
+    start_ts_ = 0;
+  }
+  lock_failed_ = false;
   string_kv_.clear();
   sorted_kv_.clear();
   hash_kv_.clear();
@@ -261,9 +251,147 @@ void TransactionImpl::SetLockTimeout(int64_t microseconds) {
   timeout_ = microseconds;
 }
 
-int64_t TransactionImpl::randomTimeout() {
-  return fast_random_64() %
-             (kLockTimeoutMicrosecondsMax - kLockTimeoutMicrosecondsMin) +
-         kLockTimeoutMicrosecondsMin;
+OptimisticTransactionImpl::OptimisticTransactionImpl(KVEngine* engine)
+    : engine_(engine) {
+  kvdk_assert(engine_ != nullptr, "");
+  batch_.reset(
+      dynamic_cast<WriteBatchImpl*>(engine_->WriteBatchCreate().release()));
+  kvdk_assert(batch_ != nullptr, "");
+}
+
+OptimisticTransactionImpl::~OptimisticTransactionImpl() { Rollback(); }
+
+Status OptimisticTransactionImpl::StringPut(const StringView key,
+                                            const StringView value) {
+  batch_->StringPut(key, value);
+  return Status::Ok;
+}
+
+Status OptimisticTransactionImpl::StringDelete(const StringView key) {
+  batch_->StringDelete(key);
+  return Status::Ok;
+}
+
+Status OptimisticTransactionImpl::StringGet(const StringView key,
+                                            std::string* value) {
+  auto op = batch_->StringGet(key);
+  if (op != nullptr) {
+    if (op->op == WriteOp::Delete) {
+      return Status::NotFound;
+    } else {
+      value->assign(op->value.data(), op->value.size());
+      return Status::Ok;
+    }
+  }
+  return read(RecordType::String, "", key, value);
+}
+
+Status OptimisticTransactionImpl::SortedPut(const StringView collection,
+                                            const StringView key,
+                                            const StringView value) {
+  Status s = checkCollection(collection, RecordType::SortedRecord);
+  if (s == Status::Ok) {
+    batch_->SortedPut(collection, key, value);
+  }
+  return s;
+}
+
+Status OptimisticTransactionImpl::SortedDelete(const StringView collection,
+                                               const StringView key) {
+  Status s = checkCollection(collection, RecordType::SortedRecord);
+  if (s == Status::Ok) {
+    batch_->SortedDelete(collection, key);
+  }
+  return s;
+}
+
+Status OptimisticTransactionImpl::SortedGet(const StringView collection,
+                                            const StringView key,
+                                            std::string* value) {
+  auto op = batch_->SortedGet(collection, key);
+  if (op != nullptr) {
+    if (op->op == WriteOp::Delete) {
+      return Status::NotFound;
+    } else {
+      value->assign(op->value.data(), op->value.size());
+      return Status::Ok;
+    }
+  }
+  return read(RecordType::SortedElem, collection, key, value);
+}
+
+Status OptimisticTransactionImpl::HashPut(const StringView collection,
+                                          const StringView key,
+                                          const StringView value) {
+  Status s = checkCollection(collection, RecordType::HashRecord);
+  if (s == Status::Ok) {
+    batch_->HashPut(collection, key, value);
+  }
+  return s;
+}
+
+Status OptimisticTransactionImpl::HashDelete(const StringView collection,
+                                             const StringView key) {
+  Status s = checkCollection(collection, RecordType::HashRecord);
+  if (s == Status::Ok) {
+    batch_->HashDelete(collection, key);
+  }
+  return s;
+}
+
+Status OptimisticTransactionImpl::HashGet(const StringView collection,
+                                          const StringView key,
+                                          std::string* value) {
+  auto op = batch_->HashGet(collection, key);
+  if (op != nullptr) {
+    if (op->op == WriteOp::Delete) {
+      return Status::NotFound;
+    } else {
+      value->assign(op->value.data(), op->value.size());
+      return Status::Ok;
+    }
+  }
+  return read(RecordType::HashElem, collection, key, value);
+}
+
+Status OptimisticTransactionImpl::checkCollection(const StringView collection,
+                                                  RecordType type) {
+  // Hold a snapshot so the hash buckets we access won't be freed by resizing
+  auto thread_holder = engine_->AcquireAccessThread();
+  auto holder = engine_->version_controller_.GetLocalSnapshotHolder();
+  auto lookup_result = engine_->GetHashTable()->Lookup<false>(collection, type);
+  if (lookup_result.s != Status::Ok) {
+    kvdk_assert(lookup_result.s == Status::NotFound, "");
+  }
+  return lookup_result.s;
+}
+
+Status OptimisticTransactionImpl::read(RecordType type,
+                                       const StringView collection,
+                                       const StringView key,
+                                       std::string* value) {
+  reads_.emplace_back();
+  TransactionRead& read = reads_.back();
+  read.type = type;
+  read.collection.assign(collection.data(), collection.size());
+  read.key.assign(key.data(), key.size());
+  Status s = engine_->TransactionGet(&read, value);
+  if (s != Status::Ok && s != Status::NotFound) {
+    // Nothing read
+    reads_.pop_back();
+  }
+  return s;
+}
+
+Status OptimisticTransactionImpl::Commit() {
+  Status s = engine_->CommitTransaction(this);
+  status_ = s;
+  Rollback();
+  return s;
+}
+
+void OptimisticTransactionImpl::Rollback() {
+  batch_->Clear();
+  reads_.clear();
 }
 }  // namespace KVDK_NAMESPACE
\ No newline at end of file
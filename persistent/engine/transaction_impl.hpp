@@ -7,6 +7,7 @@
 #include <condition_variable>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include "alias.hpp"
 #include "kvdk/persistent/transaction.hpp"
@@ -15,6 +16,7 @@
 namespace KVDK_NAMESPACE {
 
 class KVEngine;
+class Collection;
 
 // Collections of in processing transaction should not be created or
 // destroyed, we use this for communication between collection related
@@ -116,12 +118,13 @@ class TransactionImpl final : public Transaction {
   Status Commit() final;
   void Rollback() final;
   Status InternalStatus() final { return status_; }
+  TransactionLockStats LockStats() final { return lock_stats_; }
 
   // This used by kv engine
   WriteBatchImpl* GetBatch() { return batch_.get(); }
 
-  // Set lock time out while acquiring a key lock in transaction, if <0,
-  // operations will immediately return timeout while failed to lock a key
+  // Set max time of waiting for a key lock in transaction, if <=0, operations
+  // will immediately return timeout while failed to lock a key
   void SetLockTimeout(int64_t micro_seconds);
 
  private:
@@ -130,10 +133,12 @@ class TransactionImpl final : public Transaction {
     std::string value;
   };
 
-  bool tryLock(SpinMutex* spin);
-  bool tryLockImpl(SpinMutex* spin);
+  bool tryLock(SeqSpinMutex* spin);
   void acquireCollectionTransaction();
-  int64_t randomTimeout();
+  // Look up "collection" of "type" and lock "key" of it, store the found
+  // collection to "found"
+  Status lockCollectionKey(const StringView collection, const StringView key,
+                           RecordType type, Collection** found);
 
   KVEngine* engine_;
   Status status_;
@@ -144,8 +149,67 @@ class TransactionImpl final : public Transaction {
   std::unordered_map<std::string, KVOp> string_kv_;
   std::unique_ptr<WriteBatchImpl> batch_;
   // TODO use std::unique_lock
-  std::unordered_set<SpinMutex*> locked_;
+  std::unordered_set<SeqSpinMutex*> locked_;
   std::unique_ptr<CollectionTransactionCV::TransactionToken> ct_token_;
   int64_t timeout_;
+  // Start timestamp from TransactionLockManager, 0 if not started
+  TimestampType start_ts_{0};
+  // If a lock failed since the transaction started, it keeps start_ts_ on
+  // rollback to get older for retry
+  bool lock_failed_{false};
+  TransactionLockStats lock_stats_;
+};
+
+// A key read by an optimistic transaction, and timestamp of its newest record
+// while reading, or 0 if no record found
+struct TransactionRead {
+  // RecordType::String, RecordType::SortedElem or RecordType::HashElem
+  RecordType type;
+  // Empty for strings
+  std::string collection;
+  std::string key;
+  TimestampType timestamp;
+};
+
+// Transaction with optimistic concurrency control. Operations take no locks,
+// writes are buffered and reads record timestamps of the read records. On
+// commit, the engine locks keys of the buffered writes in order, and aborts the
+// transaction if any read record has been updated or is being updated by
+// others
+class OptimisticTransactionImpl final : public Transaction {
+ public:
+  OptimisticTransactionImpl(KVEngine* engine);
+  ~OptimisticTransactionImpl() final;
+  Status StringPut(const StringView key, const StringView value) final;
+  Status StringDelete(const StringView key) final;
+  Status StringGet(const StringView key, std::string* value) final;
+  Status SortedPut(const StringView collection, const StringView key,
+                   const StringView value) final;
+  Status SortedDelete(const StringView collection, const StringView key) final;
+  Status SortedGet(const StringView collection, const StringView key,
+                   std::string* value) final;
+  Status HashPut(const StringView collection, const StringView key,
+                 const StringView value) final;
+  Status HashDelete(const StringView collection, const StringView key) final;
+  Status HashGet(const StringView collection, const StringView key,
+                 std::string* value) final;
+  Status Commit() final;
+  void Rollback() final;
+  Status InternalStatus() final { return status_; }
+
+  // This used by kv engine
+  WriteBatchImpl* GetBatch() { return batch_.get(); }
+  const std::vector<TransactionRead>& GetReads() const { return reads_; }
+
+ private:
+  // Check if "collection" of "type" exists before buffering its writes
+  Status checkCollection(const StringView collection, RecordType type);
+  Status read(RecordType type, const StringView collection,
+              const StringView key, std::string* value);
+
+  KVEngine* engine_;
+  Status status_;
+  std::unique_ptr<WriteBatchImpl> batch_;
+  std::vector<TransactionRead> reads_;
 };
 }  // namespace KVDK_NAMESPACE
\ No newline at end of file
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright(c) 2022 Intel Corporation
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "alias.hpp"
+#include "kvdk/persistent/transaction.hpp"
+#include "utils/utils.hpp"
+
+namespace KVDK_NAMESPACE {
+
+// Manage hash table slot locks held by pessimistic transactions, and avoid
+// dead lock between transactions with wait-die ordering: a transaction waits
+// for a lock held by a younger transaction, and fails immediately on a lock
+// held by an older one. Transactions are ordered by start timestamps issued by
+// NewStartTimestamp().
+//
+// Waiters park on a condition variable instead of spinning. Slot locks held by
+// non-transaction writers are short-term, they are waited by yielding.
+class TransactionLockManager {
+ public:
+  TransactionLockManager() : stripes_(kNumStripes) {}
+
+  // Return a start timestamp for a new transaction, a smaller one is older
+  TimestampType NewStartTimestamp() {
+    return next_start_ts_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Lock "spin" for the transaction started at "start_ts"
+  //
+  // Return:
+  // Status::Ok on success
+  // Status::Timeout if "spin" is held by an older transaction, or waited more
+  // than "timeout_us" microseconds
+  Status Lock(SeqSpinMutex* spin, TimestampType start_ts, int64_t timeout_us,
+              TransactionLockStats* stats) {
+    Stripe& stripe = stripeOf(spin);
+    int64_t begin = 0;
+    std::unique_lock<SpinMutex> ul(stripe.spin);
+    while (true) {
+      if (spin->try_lock()) {
+        stripe.owners[spin] = start_ts;
+        break;
+      }
+
+      if (begin == 0) {
+        begin = TimeUtils::microseconds_time();
+      }
+      int64_t remain = timeout_us - (TimeUtils::microseconds_time() - begin);
+      auto iter = stripe.owners.find(spin);
+      if (iter != stripe.owners.end() && iter->second < start_ts) {
+        stats->conflicts++;
+        return Status::Timeout;
+      }
+      if (remain <= 0) {
+        stats->conflicts++;
+        stats->wait_microseconds += TimeUtils::microseconds_time() - begin;
+        return Status::Timeout;
+      }
+
+      if (iter == stripe.owners.end()) {
+        // Locked by a non-transaction writer
+        ul.unlock();
+        std::this_thread::yield();
+        ul.lock();
+      } else {
+        stats->waits++;
+        stripe.cv.wait_for(ul, std::chrono::microseconds(remain));
+      }
+    }
+    if (begin != 0) {
+      stats->wait_microseconds += TimeUtils::microseconds_time() - begin;
+    }
+    return Status::Ok;
+  }
+
+  // Unlock "spin" locked by Lock(), and wake up its waiters
+  void Unlock(SeqSpinMutex* spin) {
+    Stripe& stripe = stripeOf(spin);
+    std::lock_guard<SpinMutex> lg(stripe.spin);
+    stripe.owners.erase(spin);
+    spin->unlock();
+    stripe.cv.notify_all();
+  }
+
+ private:
+  static constexpr size_t kNumStripes = 1024;
+
+  struct Stripe {
+    SpinMutex spin;
+    std::condition_variable_any cv;
+    // Start timestamp of transaction holding each lock
+    std::unordered_map<const SeqSpinMutex*, TimestampType> owners;
+  };
+
+  Stripe& stripeOf(const SeqSpinMutex* spin) {
+    uint64_t h = reinterpret_cast<uint64_t>(spin) * 0x9E3779B97F4A7C15ULL;
+    return stripes_[(h >> 32) % kNumStripes];
+  }
+
+  std::vector<Stripe> stripes_;
+  // Start from 1 so 0 means a transaction not started
+  std::atomic<TimestampType> next_start_ts_{1};
+};
+
+}  // namespace KVDK_NAMESPACE
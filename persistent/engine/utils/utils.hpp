@@ -11,10 +11,12 @@
 #include <unistd.h>
 #include <x86intrin.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <memory>
 #include <mutex>
@@ -122,6 +124,32 @@ inline void memcpy_1(void* dst, const void* src) {
   *((uint8_t*)dst) = *((uint8_t*)src);
 }
 
+// Copy "size" bytes from "src" with streaming loads, which don't pollute cache
+// by reading large data from PMem
+inline void memcpy_nt_load(void* dst, const void* src, size_t size) {
+  char* d = static_cast<char*>(dst);
+  const char* s = static_cast<const char*>(src);
+  size_t head = std::min<size_t>((16 - (uintptr_t)s % 16) % 16, size);
+  memcpy(d, s, head);
+  d += head;
+  s += head;
+  size -= head;
+  for (; size >= 64; size -= 64, s += 64, d += 64) {
+    __m128i m0 = _mm_stream_load_si128((__m128i*)s + 0);
+    __m128i m1 = _mm_stream_load_si128((__m128i*)s + 1);
+    __m128i m2 = _mm_stream_load_si128((__m128i*)s + 2);
+    __m128i m3 = _mm_stream_load_si128((__m128i*)s + 3);
+    _mm_storeu_si128((__m128i*)d + 0, m0);
+    _mm_storeu_si128((__m128i*)d + 1, m1);
+    _mm_storeu_si128((__m128i*)d + 2, m2);
+    _mm_storeu_si128((__m128i*)d + 3, m3);
+  }
+  for (; size >= 16; size -= 16, s += 16, d += 16) {
+    _mm_storeu_si128((__m128i*)d, _mm_stream_load_si128((__m128i*)s));
+  }
+  memcpy(d, s, size);
+}
+
 inline std::string format_dir_path(const std::string& dir) {
   return dir.back() == '/' ? dir : dir + "/";
 }
@@ -197,6 +225,61 @@ class SpinMutex {
   SpinMutex& operator=(const SpinMutex& s) = delete;
 };
 
+// A spin mutex with a sequence number, which is odd while locked and increased
+// by both lock() and unlock(). Besides locking, readers can read data protected
+// by it optimistically: begin with ReadBegin(), read data, then the read data
+// is consistent if ReadValidate() returns true, otherwise retry.
+class SeqSpinMutex {
+ private:
+  std::atomic<uint32_t> seq_{0};
+
+ public:
+  SeqSpinMutex() = default;
+
+  void lock() {
+    while (!try_lock()) {
+      for (size_t i = 0; i != 64; ++i) {
+        _mm_pause();
+      }
+    }
+  }
+
+  void unlock() {
+    seq_.store(seq_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+
+  bool try_lock() {
+    uint32_t seq = seq_.load(std::memory_order_relaxed);
+    return (seq & 1) == 0 &&
+           seq_.compare_exchange_strong(seq, seq + 1,
+                                        std::memory_order_acquire);
+  }
+
+  // If the mutex is locked by any thread, the result may be outdated once
+  // returned
+  bool IsLocked() const { return seq_.load(std::memory_order_acquire) & 1; }
+
+  // Wait until unlocked and return the sequence number
+  uint32_t ReadBegin() const {
+    uint32_t seq;
+    while ((seq = seq_.load(std::memory_order_acquire)) & 1) {
+      _mm_pause();
+    }
+    return seq;
+  }
+
+  // Return true if no writer locked the mutex since ReadBegin() returned "seq"
+  bool ReadValidate(uint32_t seq) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return seq_.load(std::memory_order_relaxed) == seq;
+  }
+
+  SeqSpinMutex(const SeqSpinMutex& s) = delete;
+  SeqSpinMutex(SeqSpinMutex&& s) = delete;
+  SeqSpinMutex& operator=(const SeqSpinMutex& s) = delete;
+};
+
 template <typename SharedMutex>
 class SharedLock {
  public:
@@ -237,7 +237,13 @@ class VersionController {
 
   // Create a new global snapshot
   SnapshotImpl* NewGlobalSnapshot(bool may_block = true) {
-    TimestampType ts = GetCurrentTimestamp();
+    return NewGlobalSnapshotAt(rdtsc(), may_block);
+  }
+
+  // Create a new global snapshot at CPU tsc "tsc", which is not later than
+  // now. Snapshots of instances created at the same tsc are of the same time
+  SnapshotImpl* NewGlobalSnapshotAt(uint64_t tsc, bool may_block = true) {
+    TimestampType ts = tsc - tsc_on_startup_ + base_timestamp_;
     if (may_block) {
       for (size_t i = 0; i < version_thread_cache_.size(); i++) {
         while (ts >= version_thread_cache_[i].batch_write_ts) {
@@ -1,56 +1,107 @@
 #include "write_batch_impl.hpp"
 
-#include "alias.hpp"
-
-namespace KVDK_NAMESPACE {
-
-void BatchWriteLog::EncodeTo(char* dst) {
-  kvdk_assert(stage == Stage::Initializing, "");
+#include <algorithm>
+#include <mutex>
+#include <thread>
 
-  size_t total_bytes;
-  total_bytes =
-      sizeof(total_bytes) + sizeof(timestamp_) + sizeof(stage) +
-      sizeof(string_logs_.size()) +
-      string_logs_.size() * sizeof(StringLogEntry) +
-      sizeof(sorted_logs_.size()) +
-      sorted_logs_.size() * sizeof(SortedLogEntry) + sizeof(hash_logs_.size()) +
-      hash_logs_.size() * sizeof(HashLogEntry) + sizeof(list_logs_.size()) +
-      list_logs_.size() * sizeof(ListLogEntry);
+#include <libpmem.h>
 
-  std::string buffer;
-  buffer.reserve(total_bytes);
+#include "alias.hpp"
 
-  AppendPOD(&buffer, total_bytes);
-  AppendPOD(&buffer, timestamp_);
-  AppendPOD(&buffer, stage);
+namespace KVDK_NAMESPACE {
 
-  AppendPOD(&buffer, string_logs_.size());
-  for (size_t i = 0; i < string_logs_.size(); i++) {
-    AppendPOD(&buffer, string_logs_[i]);
+void WriteBatchArena::Clear() {
+  large_blocks_.clear();
+  if (blocks_.size() > 1) {
+    blocks_.erase(blocks_.begin(), blocks_.end() - 1);
   }
+  if (!blocks_.empty()) {
+    cur_ = blocks_.back().get();
+    remain_ = block_size_;
+  }
+}
 
-  AppendPOD(&buffer, sorted_logs_.size());
-  for (size_t i = 0; i < sorted_logs_.size(); i++) {
-    AppendPOD(&buffer, sorted_logs_[i]);
+char* WriteBatchArena::allocateSlow(size_t size) {
+  // Blocks grow for large batches. A large key or value gets a dedicated
+  // block, so the rest of the current block is not wasted
+  size_t block_size =
+      std::min(std::max(block_size_ * 2, kMinBlockSize), kMaxBlockSize);
+  if (size > block_size / 4) {
+    large_blocks_.emplace_back(new char[size]);
+    return large_blocks_.back().get();
   }
+  blocks_.emplace_back(new char[block_size]);
+  block_size_ = block_size;
+  cur_ = blocks_.back().get() + size;
+  remain_ = block_size - size;
+  return blocks_.back().get();
+}
 
-  AppendPOD(&buffer, hash_logs_.size());
-  for (size_t i = 0; i < hash_logs_.size(); i++) {
-    AppendPOD(&buffer, hash_logs_[i]);
+template <typename Op>
+void WriteBatchImpl::deduplicateOps(std::vector<Op>* ops, OpIndex* index) {
+  // Keep ops indexed as the last op of their keys, and move them forward
+  size_t cnt = 0;
+  for (size_t i = 0; i < ops->size(); i++) {
+    auto iter = index->find(opKey((*ops)[i]));
+    kvdk_assert(iter != index->end(), "op of a write batch not indexed");
+    if (iter->second == i) {
+      iter->second = cnt;
+      (*ops)[cnt++] = (*ops)[i];
+    }
   }
+  ops->resize(cnt);
+}
 
-  AppendPOD(&buffer, list_logs_.size());
-  for (size_t i = 0; i < list_logs_.size(); i++) {
-    AppendPOD(&buffer, list_logs_[i]);
+void WriteBatchImpl::deduplicate() const {
+  if (!deduplicated_) {
+    deduplicateOps(&string_ops_, &string_index_);
+    deduplicateOps(&sorted_ops_, &sorted_index_);
+    deduplicateOps(&hash_ops_, &hash_index_);
+    deduplicated_ = true;
   }
+}
 
-  kvdk_assert(buffer.size() == total_bytes, "");
+namespace {
+// Stream "size" bytes to PMem at "*dst" and move it forward
+void appendNoDrain(char** dst, const void* src, size_t size) {
+  pmem_memcpy(*dst, src, size, PMEM_F_MEM_NONTEMPORAL | PMEM_F_MEM_NODRAIN);
+  *dst += size;
+}
 
-  memcpy(dst, buffer.data(), buffer.size());
-  for (size_t i = 0; i < buffer.size(); i += 64) {
-    _mm_clflushopt(&dst[i]);
-  }
-  _mm_mfence();
+template <typename Entry>
+void appendLogsNoDrain(char** dst, const std::vector<Entry>& logs) {
+  size_t num = logs.size();
+  appendNoDrain(dst, &num, sizeof(num));
+  appendNoDrain(dst, logs.data(), num * sizeof(Entry));
+}
+}  // namespace
+
+size_t BatchWriteLog::EncodedBytes() const {
+  return sizeof(size_t) + sizeof(timestamp_) + sizeof(stage) +
+         sizeof(cross_shard_id_) + sizeof(string_logs_.size()) +
+         string_logs_.size() * sizeof(StringLogEntry) +
+         sizeof(sorted_logs_.size()) +
+         sorted_logs_.size() * sizeof(SortedLogEntry) +
+         sizeof(hash_logs_.size()) + hash_logs_.size() * sizeof(HashLogEntry) +
+         sizeof(list_logs_.size()) + list_logs_.size() * sizeof(ListLogEntry);
+}
+
+void BatchWriteLog::EncodeTo(char* dst) {
+  kvdk_assert(stage == Stage::Initializing, "");
+
+  size_t total_bytes = EncodedBytes();
+  char* cur = dst;
+  appendNoDrain(&cur, &total_bytes, sizeof(total_bytes));
+  appendNoDrain(&cur, &timestamp_, sizeof(timestamp_));
+  appendNoDrain(&cur, &stage, sizeof(stage));
+  appendNoDrain(&cur, &cross_shard_id_, sizeof(cross_shard_id_));
+  appendLogsNoDrain(&cur, string_logs_);
+  appendLogsNoDrain(&cur, sorted_logs_);
+  appendLogsNoDrain(&cur, hash_logs_);
+  appendLogsNoDrain(&cur, list_logs_);
+
+  kvdk_assert(static_cast<size_t>(cur - dst) == total_bytes, "");
+  pmem_drain();
 }
 
 void BatchWriteLog::DecodeFrom(char const* src) {
@@ -67,6 +118,7 @@ void BatchWriteLog::DecodeFrom(char const* src) {
   total_bytes = FetchPOD<size_t>(&sw);
   timestamp_ = FetchPOD<TimestampType>(&sw);
   stage = FetchPOD<Stage>(&sw);
+  cross_shard_id_ = FetchPOD<uint64_t>(&sw);
 
   if (stage == Stage::Initializing || stage == Stage::Committed) {
     // No need to deserialize furthermore.
@@ -100,4 +152,95 @@ void BatchWriteLog::DecodeFrom(char const* src) {
   kvdk_assert(sw.size() == 0, "");
 }
 
-}  // namespace KVDK_NAMESPACE
\ No newline at end of file
+namespace {
+// Wait until "cond" is true, spin first as a group is committed in a short
+// time
+template <typename Cond>
+void waitFor(Cond cond) {
+  for (size_t i = 0; !cond(); i++) {
+    if (i < 1024) {
+      _mm_pause();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+}  // namespace
+
+void BatchWriteGroup::Join(Writer* writer) {
+  {
+    std::lock_guard<SpinMutex> lg(spin_);
+    pending_.push_back(writer);
+    if (!leading_) {
+      leading_ = true;
+      writer->state.store(kLeading, std::memory_order_relaxed);
+    }
+  }
+  waitFor([&]() {
+    return writer->state.load(std::memory_order_acquire) != kPending;
+  });
+  if (writer->state.load(std::memory_order_relaxed) == kLeading) {
+    lead(writer);
+  }
+  kvdk_assert(writer->state.load() == kProcessing, "");
+}
+
+void BatchWriteGroup::lead(Writer* leader) {
+  std::vector<Writer*> members;
+  BatchWriteLog log;
+  log.SetTimestamp(leader->log->Timestamp());
+  {
+    std::lock_guard<SpinMutex> lg(spin_);
+    kvdk_assert(pending_.front() == leader, "");
+    while (!pending_.empty() &&
+           (members.empty() ||
+            BatchWriteLog::MaxBytes(log.Size() +
+                                    pending_.front()->log->Size()) <=
+                leader->log_space_size)) {
+      members.push_back(pending_.front());
+      log.Append(*pending_.front()->log);
+      pending_.pop_front();
+    }
+  }
+
+  log.EncodeTo(leader->log_space);
+  BatchWriteLog::MarkProcessing(leader->log_space);
+
+  std::shared_ptr<Group> group = nullptr;
+  if (members.size() > 1) {
+    group = std::make_shared<Group>(members.size(), leader->log_space);
+  }
+  {
+    // Writers arrived while persisting the group log are led by the first
+    // one of them
+    std::lock_guard<SpinMutex> lg(spin_);
+    if (pending_.empty()) {
+      leading_ = false;
+    } else {
+      pending_.front()->state.store(kLeading, std::memory_order_release);
+    }
+  }
+  for (Writer* member : members) {
+    member->group = group;
+    member->state.store(kProcessing, std::memory_order_release);
+  }
+}
+
+void BatchWriteGroup::Commit(Writer* writer) {
+  if (writer->group == nullptr) {
+    BatchWriteLog::MarkCommitted(writer->log_space);
+    return;
+  }
+  Group* group = writer->group.get();
+  // Records of each member are persisted before it finished
+  if (group->unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    BatchWriteLog::MarkCommitted(group->log_space);
+    group->committed.store(true, std::memory_order_release);
+  } else {
+    waitFor(
+        [&]() { return group->committed.load(std::memory_order_acquire); });
+  }
+  writer->group.reset();
+}
+
+}  // namespace KVDK_NAMESPACE
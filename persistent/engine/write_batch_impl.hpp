@@ -2,8 +2,11 @@
 
 #include <x86intrin.h>
 
+#include <atomic>
 #include <cstring>
-#include <unordered_set>
+#include <deque>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "alias.hpp"
@@ -14,159 +17,232 @@
 
 namespace KVDK_NAMESPACE {
 
+// Append-only arena of a write batch, appended bytes are stable until the
+// arena cleared
+class WriteBatchArena {
+ public:
+  WriteBatchArena() = default;
+  WriteBatchArena(const WriteBatchArena&) = delete;
+  WriteBatchArena& operator=(const WriteBatchArena&) = delete;
+
+  // Copy "src" to the arena and return a view of the copy
+  StringView Append(const StringView& src) {
+    if (src.size() == 0) {
+      return StringView("", 0);
+    }
+    char* dst;
+    if (src.size() <= remain_) {
+      dst = cur_;
+      cur_ += src.size();
+      remain_ -= src.size();
+    } else {
+      dst = allocateSlow(src.size());
+    }
+    memcpy(dst, src.data(), src.size());
+    return StringView(dst, src.size());
+  }
+
+  // Drop appended bytes, the last block is kept for reusing
+  void Clear();
+
+ private:
+  // Allocate "size" bytes from a new block
+  char* allocateSlow(size_t size);
+
+  static constexpr size_t kMinBlockSize = 1 << 10;
+  static constexpr size_t kMaxBlockSize = 1 << 20;
+
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  // Dedicated blocks of large keys or values
+  std::vector<std::unique_ptr<char[]>> large_blocks_;
+  size_t block_size_{0};
+  char* cur_{nullptr};
+  size_t remain_{0};
+};
+
+// Ops of a write batch are views of keys and values copied to an arena, and
+// appended in order, with a hash index from each key to its last op. A key may
+// be written several times, the batch is deduplicated to the last op of each
+// key on first read of its ops, so writing a batch only costs an append.
 class WriteBatchImpl final : public WriteBatch {
  public:
   struct StringOp {
-    StringOp(WriteOp o, const StringView& k, const StringView& v)
-        : op(o), key(string_view_2_string(k)), value(string_view_2_string(v)) {}
-
     WriteOp op;
-    std::string key;
-    std::string value;
+    StringView key;
+    StringView value;
   };
 
   struct SortedOp {
-    SortedOp(WriteOp o, const StringView& c, const StringView& k,
-             const StringView& v)
-        : op(o),
-          collection(string_view_2_string(c)),
-          key(string_view_2_string(k)),
-          value(string_view_2_string(v)) {}
-
     WriteOp op;
-    std::string collection;
-    std::string key;
-    std::string value;
+    StringView collection;
+    StringView key;
+    StringView value;
   };
 
   struct HashOp {
-    HashOp(WriteOp o, const StringView& c, const StringView& k,
-           const StringView& v)
-        : op(o),
-          collection(string_view_2_string(c)),
-          key(string_view_2_string(k)),
-          value(string_view_2_string(v)) {}
-
     WriteOp op;
-    std::string collection;
-    std::string key;
-    std::string value;
-  };
-
-  struct HashEq {
-    size_t operator()(StringOp const& string_op) const {
-      return xxh_hash(string_op.key);
-    }
-    size_t operator()(SortedOp const& sorted_op) const {
-      return xxh_hash(sorted_op.collection) ^ xxh_hash(sorted_op.key);
-    }
-    size_t operator()(HashOp const& hash_op) const {
-      return xxh_hash(hash_op.collection) ^ xxh_hash(hash_op.key);
-    }
-    bool operator()(StringOp const& lhs, StringOp const& rhs) const {
-      return lhs.key == rhs.key;
-    }
-    bool operator()(SortedOp const& lhs, SortedOp const& rhs) const {
-      return lhs.collection == rhs.collection && lhs.key == rhs.key;
-    }
-    bool operator()(HashOp const& lhs, HashOp const& rhs) const {
-      return lhs.collection == rhs.collection && lhs.key == rhs.key;
-    }
+    StringView collection;
+    StringView key;
+    StringView value;
   };
 
   void StringPut(const StringView key, const StringView value) final {
-    StringOp op{WriteOp::Put, key, value};
-    string_ops_.erase(op);
-    string_ops_.insert(op);
+    appendOp(&string_ops_, &string_index_,
+             StringOp{WriteOp::Put, arena_.Append(key), arena_.Append(value)});
   }
 
   void StringDelete(const StringView key) final {
-    StringOp op{WriteOp::Delete, key, std::string{}};
-    string_ops_.erase(op);
-    string_ops_.insert(op);
+    appendOp(&string_ops_, &string_index_,
+             StringOp{WriteOp::Delete, arena_.Append(key), StringView("", 0)});
   }
 
   void SortedPut(const StringView collection, const StringView key,
                  const StringView value) final {
-    SortedOp op{WriteOp::Put, collection, key, value};
-    sorted_ops_.erase(op);
-    sorted_ops_.insert(op);
+    appendOp(&sorted_ops_, &sorted_index_,
+             SortedOp{WriteOp::Put, arena_.Append(collection),
+                      arena_.Append(key), arena_.Append(value)});
   }
 
   void SortedDelete(const StringView collection, const StringView key) final {
-    SortedOp op{WriteOp::Delete, collection, key, std::string{}};
-    sorted_ops_.erase(op);
-    sorted_ops_.insert(op);
+    appendOp(&sorted_ops_, &sorted_index_,
+             SortedOp{WriteOp::Delete, arena_.Append(collection),
+                      arena_.Append(key), StringView("", 0)});
   }
 
   void HashPut(const StringView collection, const StringView key,
                const StringView value) final {
-    HashOp op{WriteOp::Put, collection, key, value};
-    hash_ops_.erase(op);
-    hash_ops_.insert(op);
+    appendOp(&hash_ops_, &hash_index_,
+             HashOp{WriteOp::Put, arena_.Append(collection), arena_.Append(key),
+                    arena_.Append(value)});
   }
 
   void HashDelete(const StringView collection, const StringView key) final {
-    HashOp op{WriteOp::Delete, collection, key, std::string{}};
-    hash_ops_.erase(op);
-    hash_ops_.insert(op);
+    appendOp(&hash_ops_, &hash_index_,
+             HashOp{WriteOp::Delete, arena_.Append(collection),
+                    arena_.Append(key), StringView("", 0)});
   }
 
-  // Get a string op from this batch
+  // Get the last string op of "key" in this batch
   // if key not exist in this batch, return nullptr
-  const StringOp* StringGet(const StringView key) {
-    StringOp op{WriteOp::Put, key, ""};
-    auto iter = string_ops_.find(op);
-    if (iter == string_ops_.end()) {
-      return nullptr;
-    }
-    return &(*iter);
+  const StringOp* StringGet(const StringView key) const {
+    return findOp(string_ops_, string_index_, OpKey{StringView("", 0), key});
   }
 
-  // Get a sorted op from this batch
+  // Get the last sorted op of collection key in this batch
   // if collection key not exist in this batch, return nullptr
-  const SortedOp* SortedGet(const StringView collection, const StringView key) {
-    SortedOp op{WriteOp::Put, collection, key, ""};
-    auto iter = sorted_ops_.find(op);
-    if (iter == sorted_ops_.end()) {
-      return nullptr;
-    }
-    return &(*iter);
+  const SortedOp* SortedGet(const StringView collection,
+                            const StringView key) const {
+    return findOp(sorted_ops_, sorted_index_, OpKey{collection, key});
   }
 
-  // Get a hash op from this batch
+  // Get the last hash op of collection key in this batch
   // if the collection key not exist in this batch, return nullptr
-  const HashOp* HashGet(const StringView collection, const StringView key) {
-    HashOp op{WriteOp::Put, collection, key, ""};
-    auto iter = hash_ops_.find(op);
-    if (iter == hash_ops_.end()) {
-      return nullptr;
-    }
-    return &(*iter);
+  const HashOp* HashGet(const StringView collection,
+                        const StringView key) const {
+    return findOp(hash_ops_, hash_index_, OpKey{collection, key});
   }
 
   void Clear() final {
     string_ops_.clear();
     sorted_ops_.clear();
     hash_ops_.clear();
+    string_index_.clear();
+    sorted_index_.clear();
+    hash_index_.clear();
+    arena_.Clear();
+    deduplicated_ = true;
   }
 
+  // Number of deduplicated ops
   size_t Size() const final {
+    deduplicate();
     return string_ops_.size() + sorted_ops_.size() + hash_ops_.size();
   }
 
-  using StringOpBatch = std::unordered_set<StringOp, HashEq, HashEq>;
-  using SortedOpBatch = std::unordered_set<SortedOp, HashEq, HashEq>;
-  using HashOpBatch = std::unordered_set<HashOp, HashEq, HashEq>;
+  using StringOpBatch = std::vector<StringOp>;
+  using SortedOpBatch = std::vector<SortedOp>;
+  using HashOpBatch = std::vector<HashOp>;
 
-  StringOpBatch const& StringOps() const { return string_ops_; }
-  SortedOpBatch const& SortedOps() const { return sorted_ops_; }
-  HashOpBatch const& HashOps() const { return hash_ops_; }
+  // Deduplicated ops, in order of their last write
+  StringOpBatch const& StringOps() const {
+    deduplicate();
+    return string_ops_;
+  }
+  SortedOpBatch const& SortedOps() const {
+    deduplicate();
+    return sorted_ops_;
+  }
+  HashOpBatch const& HashOps() const {
+    deduplicate();
+    return hash_ops_;
+  }
 
  private:
-  StringOpBatch string_ops_;
-  SortedOpBatch sorted_ops_;
-  HashOpBatch hash_ops_;
+  // Collection and key of an op, collection is empty for string ops
+  struct OpKey {
+    StringView collection;
+    StringView key;
+  };
+
+  struct OpKeyHash {
+    size_t operator()(const OpKey& op_key) const {
+      return hash_str(op_key.collection.data(), op_key.collection.size()) *
+                 31 +
+             hash_str(op_key.key.data(), op_key.key.size());
+    }
+  };
+
+  struct OpKeyEqual {
+    bool operator()(const OpKey& lhs, const OpKey& rhs) const {
+      return equal_string_view(lhs.key, rhs.key) &&
+             equal_string_view(lhs.collection, rhs.collection);
+    }
+  };
+
+  // Index of the last op of each key
+  using OpIndex = std::unordered_map<OpKey, size_t, OpKeyHash, OpKeyEqual>;
+
+  static OpKey opKey(const StringOp& op) {
+    return OpKey{StringView("", 0), op.key};
+  }
+
+  template <typename CollectionOp>
+  static OpKey opKey(const CollectionOp& op) {
+    return OpKey{op.collection, op.key};
+  }
+
+  template <typename Op>
+  void appendOp(std::vector<Op>* ops, OpIndex* index, const Op& op) {
+    ops->push_back(op);
+    auto ret = index->emplace(opKey(op), ops->size() - 1);
+    if (!ret.second) {
+      ret.first->second = ops->size() - 1;
+      deduplicated_ = false;
+    }
+  }
+
+  template <typename Op>
+  static const Op* findOp(const std::vector<Op>& ops, const OpIndex& index,
+                          const OpKey& op_key) {
+    auto iter = index.find(op_key);
+    return iter == index.end() ? nullptr : &ops[iter->second];
+  }
+
+  // Keep the last op of each key
+  void deduplicate() const;
+
+  template <typename Op>
+  static void deduplicateOps(std::vector<Op>* ops, OpIndex* index);
+
+  // Ops are deduplicated lazily on read, so they are mutable
+  mutable StringOpBatch string_ops_;
+  mutable SortedOpBatch sorted_ops_;
+  mutable HashOpBatch hash_ops_;
+  mutable OpIndex string_index_;
+  mutable OpIndex sorted_index_;
+  mutable OpIndex hash_index_;
+  mutable bool deduplicated_{true};
+  WriteBatchArena arena_;
 };
 
 struct StringWriteArgs {
@@ -177,6 +253,9 @@ struct StringWriteArgs {
   TimestampType ts;
   HashTable::LookupResult res;
   StringRecord* new_rec;
+  // Extents of a large value and their encoding stored in the record
+  std::vector<SpaceEntry> extents;
+  std::string encoded_extents;
 
   void Assign(WriteBatchImpl::StringOp const& string_op) {
     key = string_op.key;
@@ -195,6 +274,10 @@ class BatchWriteLog {
   //    Stage::Initializing is directly discarded and purged.
   //    Stage::Processing is rolled back.
   //    Stage::Committed is directly purged.
+  // A batch on a shard of a cross-shard batch write is tagged with the non-zero
+  // id of the cross-shard batch, see ShardedEngine::BatchWrite(). It is kept
+  // instead of rolled back in Stage::Processing, if the cross-shard batch has
+  // been committed on other shards.
   enum class Stage : size_t {
     // Initializing must be 0 so that empty file can be skipped.
     Initializing = 0,
@@ -228,6 +311,8 @@ class BatchWriteLog {
 
   void SetTimestamp(TimestampType ts) { timestamp_ = ts; }
 
+  void SetCrossShardId(uint64_t id) { cross_shard_id_ = id; }
+
   void StringPut(PMemOffsetType offset) {
     string_logs_.emplace_back(StringLogEntry{Op::Put, offset});
   }
@@ -260,6 +345,18 @@ class BatchWriteLog {
     list_logs_.emplace_back(ListLogEntry{Op::Delete, offset});
   }
 
+  // Append entries of "other" to this log
+  void Append(const BatchWriteLog& other) {
+    string_logs_.insert(string_logs_.end(), other.string_logs_.begin(),
+                        other.string_logs_.end());
+    sorted_logs_.insert(sorted_logs_.end(), other.sorted_logs_.begin(),
+                        other.sorted_logs_.end());
+    hash_logs_.insert(hash_logs_.end(), other.hash_logs_.begin(),
+                      other.hash_logs_.end());
+    list_logs_.insert(list_logs_.end(), other.list_logs_.begin(),
+                      other.list_logs_.end());
+  }
+
   void Clear() {
     string_logs_.clear();
     sorted_logs_.clear();
@@ -272,23 +369,31 @@ class BatchWriteLog {
            list_logs_.size();
   }
 
-  static size_t Capacity() { return (1UL << 20); }
+  // Max number of entries of a log. The log space of a thread grows on
+  // demand, so this only rejects unreasonable batches
+  static size_t Capacity() { return (1UL << 30); }
 
-  static size_t MaxBytes() {
+  // Bytes of an encoded log with "num_entries" entries at most
+  static size_t MaxBytes(size_t num_entries) {
     static_assert(sizeof(HashLogEntry) >= sizeof(StringLogEntry), "");
     static_assert(sizeof(HashLogEntry) >= sizeof(SortedLogEntry), "");
     static_assert(sizeof(HashLogEntry) >= sizeof(ListLogEntry), "");
     return sizeof(size_t) + sizeof(TimestampType) + sizeof(Stage) +
-           sizeof(size_t) + Capacity() * sizeof(HashLogEntry);
+           sizeof(uint64_t) + 4 * sizeof(size_t) +
+           num_entries * sizeof(HashLogEntry);
   }
 
+  // Bytes of the encoded log
+  size_t EncodedBytes() const;
+
   // Format of the BatchWriteLog
-  // total_bytes | timestamp | stage |
+  // total_bytes | timestamp | stage | cross_shard_id |
   // N | StringLogEntry*N |
   // M | SortedLogEntry*M
   // K | HashLogEntry*K
   // L | ListLogEntry*K
-  // dst is expected to have capacity of MaxBytes().
+  // dst is expected to have capacity of EncodedBytes(). Entries are streamed
+  // to dst without an intermediate buffer.
   void EncodeTo(char* dst);
 
   void DecodeFrom(char const* src);
@@ -325,14 +430,72 @@ class BatchWriteLog {
   HashLog const& HashLogs() const { return hash_logs_; }
   ListLog const& ListLogs() const { return list_logs_; }
   TimestampType Timestamp() const { return timestamp_; }
+  uint64_t CrossShardId() const { return cross_shard_id_; }
 
  private:
   Stage stage{Stage::Initializing};
   TimestampType timestamp_;
+  // 0 if the batch is not a part of a cross-shard batch
+  uint64_t cross_shard_id_{0};
   StringLog string_logs_;
   SortedLog sorted_logs_;
   HashLog hash_logs_;
   ListLog list_logs_;
 };
 
+// Group commit of concurrent batch writes.
+//
+// A prepared batch joins the group with its log. The first writer arrived
+// leads the writers pending meanwhile: it persists their logs as a single
+// BatchWriteLog to its own batch log space and marks it processing, then
+// hands leading over to writers arrived later. Each member writes its records,
+// and the last member finished marks the group log committed, so a group of
+// concurrent batches costs a single log encoding and stage transitions. During
+// recovery, the group log is rolled back as a whole.
+class BatchWriteGroup {
+ public:
+  struct Group;
+
+  struct Writer {
+    Writer(const BatchWriteLog* l, char* space, size_t space_size)
+        : log(l), log_space(space), log_space_size(space_size) {}
+
+    const BatchWriteLog* log;
+    // Batch log space of the writer thread, used if it leads a group, so a
+    // group is limited to the log space of its leader
+    char* log_space;
+    size_t log_space_size;
+    std::atomic<int> state{kPending};
+    // Group of the writer, null if it is committed alone
+    std::shared_ptr<Group> group{nullptr};
+  };
+
+  struct Group {
+    Group(size_t num_writers, char* space)
+        : unfinished(num_writers), log_space(space) {}
+
+    std::atomic<size_t> unfinished;
+    std::atomic<bool> committed{false};
+    char* log_space;
+  };
+
+  // Join a group and return after log of the group is persisted and marked
+  // processing, then "writer" should write its records and call Commit()
+  void Join(Writer* writer);
+
+  // Return after the group log of "writer" is marked committed
+  void Commit(Writer* writer);
+
+ private:
+  static constexpr int kPending = 0;
+  static constexpr int kLeading = 1;
+  static constexpr int kProcessing = 2;
+
+  void lead(Writer* leader);
+
+  SpinMutex spin_;
+  std::deque<Writer*> pending_;
+  bool leading_{false};
+};
+
 }  // namespace KVDK_NAMESPACE
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "comparator.hpp"
 #include "types.hpp"
@@ -38,14 +39,52 @@ struct Configs {
   // degraded due to synchronization cost
   uint64_t max_access_threads = 64;
 
-  // Size of PMem space to store KV data, this is not scalable in current
-  // edition.
+  // Size of a PMem pool file to store KV data
   //
   // Notice that it should be larger than (max_access_threads *
   // pmem_segment_blocks  * pmem_block_size)
-  // TODO: sacle out
   uint64_t pmem_file_size = (256ULL << 30);
 
+  // Max number of PMem pool files of the instance
+  //
+  // An instance is created with a single pool file, and another pool file of
+  // pmem_file_size is added in the instance dir while PMem space used up,
+  // until this number. With more than 1 pool files, pmem_file_size should
+  // align to 2MB. Newly added pool files are not populated. It should be 1 in
+  // devdax mode
+  uint32_t pmem_max_file_num = 1;
+
+  // Dirs on PMem of each NUMA node to store pool files, one per node
+  //
+  // The i-th dir should be on PMem local to the i-th NUMA node and dedicated
+  // to the instance. Each dir holds a NUMA pool of up to pmem_max_file_num
+  // pool files, and access threads allocate PMem space from the pool of the
+  // node they are running on. Empty to store a single pool in the instance
+  // dir. The number of dirs can't be changed after the instance created, and
+  // pmem_max_file_num is also persisted with more than 1 dirs. Not supported
+  // in devdax mode
+  std::vector<std::string> pmem_numa_dirs;
+
+  // Number of independent shards of the instance
+  //
+  // With more than 1 shards, the instance dir holds a sub-instance of each
+  // shard, which has its own hash table, PMem pool files and background
+  // cleaner, and each of pmem_numa_dirs holds a sub-dir of each shard. Keys
+  // and collections are routed to shards by hash of keys and collection names,
+  // or by hash of the first non-empty "{tag}" in them. Other configs are
+  // applied to each shard, e.g. pmem_file_size is size of a pool file of a
+  // shard. The number of shards can't be changed after the instance created.
+  // Not supported in devdax mode
+  uint32_t num_shards = 1;
+
+  // CPUs of each shard, empty to not bind threads of shards to CPUs
+  //
+  // If not empty, it should have num_shards non-empty entries. Shard i is
+  // opened on a thread bound to CPUs of the i-th entry, so are background
+  // threads of the shard, and Backup of a sharded instance writes shard i on
+  // a thread bound to them, e.g. CPUs of the NUMA node storing the shard
+  std::vector<std::vector<uint32_t>> shard_cpus;
+
   // Populate PMem space while creating a new instance.
   //
   // This can improve write performance in runtime, but will take long time to
@@ -61,10 +100,35 @@ struct Configs {
   //
   // A PMem segment is a piece of private space of a access thread, so each
   // thread can allocate space without contention. It also decides the max size
-  // of (key + value), which is slightly smaller than
-  // (pmem_block_size * pmem_segment_blocks)
+  // of a PMem record, which is (pmem_block_size * pmem_segment_blocks)
   uint64_t pmem_segment_blocks = 2 * 1024 * 1024;
 
+  // Max size of string values stored inline in their records
+  //
+  // A string value larger than this, or can't be stored in a PMem segment with
+  // its key, is split into extents of at most a segment, and its record only
+  // stores offsets of the extents. Extents are read with streaming loads and
+  // freed along with the record.
+  uint64_t large_value_threshold = 16 * 1024 * 1024;
+
+  // Max number of blocks of records allocated from size class slabs
+  //
+  // Records not larger than (pmem_slab_max_blocks * pmem_block_size) are
+  // allocated from PMem segments dedicated to their size classes, and freed
+  // space of them is only reused by records of the same class through
+  // thread-local caches, which avoids free list contention and fragmentation
+  // of small records. Set it to 0 to allocate all records from the free list.
+  uint32_t pmem_slab_max_blocks = 4;
+
+  // Max ratio of allocated space in a PMem segment to compact it
+  //
+  // A background thread regularly relocates live records out of segments
+  // whose allocated space is not more than this ratio of segment size, then
+  // reclaims each of them as a whole free space, so space fragmented by
+  // long-lived records pinned between freed records can be reused by large
+  // records. Set it to 0 to disable compaction
+  double pmem_compaction_usage_ratio = 0;
+
   // The number of bucket groups in the hash table.
   //
   // It should be 2^n and should smaller than 2^32.
@@ -81,6 +145,19 @@ struct Configs {
   // contentions and more memory consumption
   uint32_t num_buckets_per_slot = 1;
 
+  // Max average number of hash entries per bucket
+  //
+  // A background thread doubles hash buckets online while the average hash
+  // entries per bucket exceeds this, so the hash table can start small and
+  // grow with the data set. Set it to 0 to disable resizing
+  double hash_table_max_load_factor = 4.0;
+
+  // The max number of hash buckets the hash table can grow to
+  //
+  // It should be 2^n, should smaller than 2^32 and not smaller than
+  // hash_bucket_num
+  uint64_t max_hash_bucket_num = (1ULL << 31);
+
   // Time interval to do background work in seconds
   //
   // In KVDK, a background thread will regularly organize PMem free space,
@@ -129,6 +206,21 @@ struct Configs {
   // during recovery.
   bool recover_to_checkpoint = false;
 
+  // Persist an image of DRAM indexes to the instance dir on clean shutdown, so
+  // the next open restores indexes from the image instead of scanning the whole
+  // PMem space. The image is discarded once opened, so an instance not cleanly
+  // closed still recovers by the full scan
+  bool persist_index_image = true;
+
+  // Number of background threads to restore string indexes after open while
+  // restoring from an index image, 0 to restore them before open returns.
+  //
+  // With lazy recovery, open returns after collections restored. Accessing a
+  // key not restored yet restores keys of the same hash slot range first, so
+  // the first access may be slower. Before all strings restored, new data is
+  // only written to PMem space never used by the index image.
+  uint32_t lazy_recovery_threads = 0;
+
   // If customer compare functions is used in a kvdk engine, these functions
   // should be registered to the comparator before open engine
   ComparatorTable comparator;
@@ -149,4 +241,25 @@ struct WriteOptions {
   bool update_ttl;
 };
 
+struct SortedIteratorOptions {
+  // Iterate keys not less than lower_bound only, no bound if empty
+  std::string lower_bound;
+
+  // Iterate keys less than upper_bound only, no bound if empty
+  std::string upper_bound;
+
+  // Iterate keys starting with prefix only, no bound if empty. Keys with the
+  // same prefix are adjacent only in bytewise order, so it is supported by
+  // collections of the default comparator only
+  std::string prefix;
+};
+
+struct TransactionOptions {
+  // Use optimistic concurrency control instead of locking keys on each
+  // operation. Writes are buffered and reads are validated at Commit(), which
+  // returns Status::Abort if a key read by the transaction has been updated by
+  // others since it was read
+  bool optimistic = false;
+};
+
 }  // namespace KVDK_NAMESPACE
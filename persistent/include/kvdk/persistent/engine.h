@@ -136,6 +136,13 @@ extern void KVDKTransactionRollback(KVDKTransaction* txn);
 // For String KV
 extern KVDKStatus KVDKGet(KVDKEngine* engine, const char* key, size_t key_len,
                           size_t* val_len, char** val);
+// Get values of "num_keys" keys in one batch, value and status of keys[i] are
+// stored to vals[i], val_lens[i] and statuses[i]. vals[i] is set to NULL if
+// keys[i] is not found, otherwise it should be freed by caller
+extern KVDKStatus KVDKMultiGet(KVDKEngine* engine, size_t num_keys,
+                               const char** keys, const size_t* key_lens,
+                               char** vals, size_t* val_lens,
+                               KVDKStatus* statuses);
 extern KVDKStatus KVDKPut(KVDKEngine* engine, const char* key, size_t key_len,
                           const char* val, size_t val_len,
                           const KVDKWriteOptions* write_option);
@@ -184,12 +191,22 @@ extern KVDKSortedIterator* KVDKSortedIteratorCreate(KVDKEngine* engine,
                                                     size_t collection_len,
                                                     KVDKSnapshot* snapshot,
                                                     KVDKStatus* s);
+// Create at most "num_partitions" iterators on disjoint key ranges of
+// "collection" for parallel scan, store them to "iterators" which should have
+// space for "num_partitions" iterators and their number to "num_iterators".
+// Each iterator should be destroyed by KVDKSortedIteratorDestroy
+extern KVDKStatus KVDKSortedPartitionIteratorsCreate(
+    KVDKEngine* engine, const char* collection, size_t collection_len,
+    KVDKSnapshot* snapshot, size_t num_partitions,
+    KVDKSortedIterator** iterators, size_t* num_iterators);
 extern void KVDKSortedIteratorDestroy(KVDKEngine* engine,
                                       KVDKSortedIterator* iterator);
 extern void KVDKSortedIteratorSeekToFirst(KVDKSortedIterator* iter);
 extern void KVDKSortedIteratorSeekToLast(KVDKSortedIterator* iter);
 extern void KVDKSortedIteratorSeek(KVDKSortedIterator* iter, const char* str,
                                    size_t str_len);
+extern void KVDKSortedIteratorSeekForPrev(KVDKSortedIterator* iter,
+                                          const char* str, size_t str_len);
 extern void KVDKSortedIteratorNext(KVDKSortedIterator* iter);
 extern void KVDKSortedIteratorPrev(KVDKSortedIterator* iter);
 extern unsigned char KVDKSortedIteratorValid(KVDKSortedIterator* iter);
@@ -197,6 +214,13 @@ extern void KVDKSortedIteratorKey(KVDKSortedIterator* iter, char** key,
                                   size_t* key_len);
 extern void KVDKSortedIteratorValue(KVDKSortedIterator* iter, char** value,
                                     size_t* val_len);
+// Zero-copy version of KVDKSortedIteratorKey/KVDKSortedIteratorValue, the
+// returned data must not be freed and is valid until the iterator moves or is
+// destroyed
+extern void KVDKSortedIteratorKeyView(KVDKSortedIterator* iter,
+                                      const char** key, size_t* key_len);
+extern void KVDKSortedIteratorValueView(KVDKSortedIterator* iter,
+                                        const char** value, size_t* val_len);
 
 /// Hash //////////////////////////////////////////////////////////////////////
 extern KVDKStatus KVDKHashCreate(KVDKEngine* engine, char const* key_data,
@@ -237,6 +261,15 @@ extern void KVDKHashIteratorGetKey(KVDKHashIterator* iter, char** field_data,
                                    size_t* field_len);
 extern void KVDKHashIteratorGetValue(KVDKHashIterator* iter, char** value_data,
                                      size_t* value_len);
+// Zero-copy version of KVDKHashIteratorGetKey/KVDKHashIteratorGetValue, the
+// returned data must not be freed and is valid until the iterator moves or is
+// destroyed
+extern void KVDKHashIteratorGetKeyView(KVDKHashIterator* iter,
+                                       const char** field_data,
+                                       size_t* field_len);
+extern void KVDKHashIteratorGetValueView(KVDKHashIterator* iter,
+                                         const char** value_data,
+                                         size_t* value_len);
 extern int KVDKHashIteratorMatchKey(KVDKHashIterator* iter,
                                     KVDKRegex const* re);
 
@@ -322,6 +355,11 @@ extern void KVDKListIteratorSeekPos(KVDKListIterator* iter, long pos);
 extern int KVDKListIteratorIsValid(KVDKListIterator* iter);
 extern void KVDKListIteratorGetValue(KVDKListIterator* iter, char** elem_data,
                                      size_t* elem_len);
+// Zero-copy version of KVDKListIteratorGetValue, the returned data must not be
+// freed and is valid until the iterator moves or is destroyed
+extern void KVDKListIteratorGetValueView(KVDKListIterator* iter,
+                                         const char** elem_data,
+                                         size_t* elem_len);
 
 /* ttl_time is negetive or positive number, If ttl_time == INT64_MAX,
  * the key is persistent; If ttl_time <=0, the key is expired immediately.
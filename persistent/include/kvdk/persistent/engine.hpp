@@ -6,6 +6,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "comparator.hpp"
 #include "configs.hpp"
@@ -80,6 +81,23 @@ class Engine {
   // Return Status::NotFound if the "key" does not exist.
   virtual Status Get(const StringView key, std::string* value) = 0;
 
+  // Search a batch of STRING-type KVs of "keys" in the kvdk instance on a
+  // consistent snapshot. Cache misses of different keys are overlapped, so
+  // this is faster than calling Get() for each key.
+  //
+  // Args:
+  // * values: store value of keys[i] to (*values)[i], resized to keys.size()
+  // * statuses: store status of keys[i] to (*statuses)[i] as Get() returns,
+  // resized to keys.size()
+  //
+  // Return:
+  // Return Status::Ok if all keys searched, check "statuses" for result of
+  // each key.
+  // Return Status::InvalidDataSize if any key is too long.
+  virtual Status MultiGet(const std::vector<StringView>& keys,
+                          std::vector<std::string>* values,
+                          std::vector<Status>* statuses) = 0;
+
   // Remove STRING-type KV of "key".
   //
   // Return:
@@ -122,9 +140,17 @@ class Engine {
 
   // Start a transaction on the kvdk instance.
   //
-  // The transaction is implemented with pessimistic locking, so any operation
-  // may conflict with other access thread and compete locks. A transaction
-  // operation will return Status::Timeout in this case to avoid dead lock.
+  // By default, the transaction is implemented with pessimistic locking, so
+  // any operation may conflict with other access thread and compete locks. To
+  // avoid dead lock, a transaction waits for locks held by younger
+  // transactions (started later), and an operation returns Status::Timeout
+  // immediately on locks held by older ones. The transaction keeps its age
+  // after Rollback() of such a failure, so a retried transaction won't starve.
+  //
+  // With TransactionOptions::optimistic, operations take no locks, and
+  // conflicts are detected at Commit(), which locks only the written keys and
+  // returns Status::Abort if any key read by the transaction has been updated
+  // since it was read. This is cheaper for workloads with few conflicts.
   //
   // Return:
   // Return a pointer to transaction struct for doing transactions.
@@ -137,7 +163,8 @@ class Engine {
   // transaction on this struct.
   // 3. Commit or Rollback the transaction as soon as possible to release locks
   // it holds.
-  virtual std::unique_ptr<Transaction> TransactionCreate() = 0;
+  virtual std::unique_ptr<Transaction> TransactionCreate(
+      const TransactionOptions& options = TransactionOptions()) = 0;
 
   // Search the STRING-type or Collection and get the corresponding expired
   // time to *expired_time on success.
@@ -503,23 +530,51 @@ class Engine {
   // snapshot is nullptr, then a internal snapshot will be created at current
   // version and the iterator will be created on it
   // * status: store operation status if not null
+  // * options: bounds of iterating keys, the iterator becomes invalid once it
+  // moves out of the bounds without visiting any key beyond them
   //
   // Return:
   // Return A pointer to iterator on success.
   // Return nullptr if collection not exist or any other errors, and store error
-  // status to "status"
+  // status to "status", which is Status::InvalidArgument if "options" has a
+  // prefix but the collection uses a custom comparator
   //
   // Notice:
   // 1. Iterator will be invalid after the passed snapshot is released
   // 2. Please release the iterator as soon as it is not needed, as the holding
   // snapshot will forbid newer data being freed
-  virtual SortedIterator* SortedIteratorCreate(const StringView collection,
-                                               Snapshot* snapshot = nullptr,
-                                               Status* s = nullptr) = 0;
+  virtual SortedIterator* SortedIteratorCreate(
+      const StringView collection, Snapshot* snapshot = nullptr,
+      Status* s = nullptr,
+      const SortedIteratorOptions& options = SortedIteratorOptions()) = 0;
 
   // Release a sorted iterator and its holding resouces
   virtual void SortedIteratorRelease(SortedIterator*) = 0;
 
+  // Create iterators on at most "num_partitions" disjoint and continuous key
+  // ranges of sorted collection "collection" for scanning it in parallel. The
+  // ranges are split by keys on upper levels of the collection index, so they
+  // hold similar number of keys, and all iterators read at the same snapshot.
+  //
+  // Args:
+  // * iterators: store created iterators in key order, each of them should be
+  // released by SortedIteratorRelease()
+  // * snapshot: same as SortedIteratorCreate(), if snapshot is nullptr, an
+  // internal snapshot is shared by all the iterators, and released with the
+  // last of them
+  // * options: bounds of the whole iterating range to split
+  //
+  // Return:
+  // Status::Ok on success, less than "num_partitions" iterators may be created
+  // if the collection is small
+  // Status::NotFound if collection not exist
+  // Status::InvalidArgument if "num_partitions" is 0, or "options" has a prefix
+  // but the collection uses a custom comparator
+  virtual Status SortedPartitionIteratorsCreate(
+      const StringView collection, size_t num_partitions,
+      std::vector<SortedIterator*>* iterators, Snapshot* snapshot = nullptr,
+      const SortedIteratorOptions& options = SortedIteratorOptions()) = 0;
+
   // Register a customized comparator to the engine on runtime
   //
   // Return:
@@ -12,8 +12,12 @@ namespace KVDK_NAMESPACE {
 
 class SortedIterator {
  public:
+  // Position at the first key not less than "key"
   virtual void Seek(const std::string& key) = 0;
 
+  // Position at the last key not greater than "key"
+  virtual void SeekForPrev(const std::string& key) = 0;
+
   virtual void SeekToFirst() = 0;
 
   virtual void SeekToLast() = 0;
@@ -28,6 +32,13 @@ class SortedIterator {
 
   virtual std::string Value() = 0;
 
+  // Zero-copy version of Key()/Value(). The returned data is pinned by the
+  // iterator's snapshot and stays valid until the iterator moves or is
+  // released
+  virtual StringView KeyView() = 0;
+
+  virtual StringView ValueView() = 0;
+
   virtual ~SortedIterator() = default;
 };
 
@@ -55,6 +66,10 @@ class ListIterator {
 
   virtual std::string Value() const = 0;
 
+  // Zero-copy version of Value(), valid until the iterator moves or is
+  // released
+  virtual StringView ValueView() const = 0;
+
   virtual ~ListIterator() = default;
 };
 
@@ -74,6 +89,12 @@ class HashIterator {
 
   virtual std::string Value() const = 0;
 
+  // Zero-copy version of Key()/Value(), valid until the iterator moves or is
+  // released
+  virtual StringView KeyView() const = 0;
+
+  virtual StringView ValueView() const = 0;
+
   virtual bool MatchKey(std::regex const& re) = 0;
 
   virtual ~HashIterator() = default;
@@ -9,6 +9,16 @@
 #include "types.hpp"
 
 namespace KVDK_NAMESPACE {
+// Lock waits of a transaction
+struct TransactionLockStats {
+  // Times of waiting for a lock held by a younger transaction
+  uint64_t waits = 0;
+  // Total time spent in waiting for locks
+  uint64_t wait_microseconds = 0;
+  // Number of operations failed with Status::Timeout on lock conflict
+  uint64_t conflicts = 0;
+};
+
 // This struct is used to do transaction operations. A transaction struct is
 // assotiated with a kvdk instance
 class Transaction {
@@ -17,13 +27,15 @@ class Transaction {
   //
   // Return:
   // Status::Ok on success
-  // Status::Timeout on conflict and long-time lock contention
+  // Status::Timeout on conflict with an older transaction and long-time lock
+  // contention
   virtual Status StringPut(const StringView key, const StringView value) = 0;
   // Delete a STRING-type key to the transaction
   //
   // Return:
   // Status::Ok on success
-  // Status::Timeout on conflict and long-time lock contention
+  // Status::Timeout on conflict with an older transaction and long-time lock
+  // contention
   virtual Status StringDelete(const StringView key) = 0;
   // Get value of a STRING-type KV. It will first get from the transaction
   // operations (Put/Delete), then the kvdk instance of the transaction
@@ -31,14 +43,16 @@ class Transaction {
   // Return:
   // Status::Ok on success and store value to "*value"
   // Status::NotFound if key not existed or be deleted by this transaction
-  // Status::Timeout on conflict and long-time lock contention
+  // Status::Timeout on conflict with an older transaction and long-time lock
+  // contention
   virtual Status StringGet(const StringView key, std::string* value) = 0;
   // Put a KV of sorted collection to the transaction
   //
   // Return:
   // Status::Ok on success
   // Status::NotFound if collection does not exist
-  // Status::Timeout on conflict and long-time lock contention
+  // Status::Timeout on conflict with an older transaction and long-time lock
+  // contention
   virtual Status SortedPut(const StringView collection, const StringView key,
                            const StringView value) = 0;
   // Delete a KV from sorted collection to the trnasaction.
@@ -46,7 +60,8 @@ class Transaction {
   // Return:
   // Status::Ok on success
   // Status::NotFound if collection does not exist
-  // Status::Timeout on conflict and long-time lock contention
+  // Status::Timeout on conflict with an older transaction and long-time lock
+  // contention
   virtual Status SortedDelete(const StringView collection,
                               const StringView key) = 0;
   // Get value of a KV from sorted collection. It will first get from the
@@ -56,7 +71,8 @@ class Transaction {
   // Return:
   // Status::Ok and store value to "*value" on success
   // Status::NotFound if collection or key does not exist
-  // Status::Timeout on conflict and long-time lock contention
+  // Status::Timeout on conflict with an older transaction and long-time lock
+  // contention
   virtual Status SortedGet(const StringView collection, const StringView key,
                            std::string* value) = 0;
   // Put a KV of hash collection to the transaction
@@ -64,7 +80,8 @@ class Transaction {
   // Return:
   // Status::Ok on success
   // Status::NotFound if collection does not exist
-  // Status::Timeout on conflict and long-time lock contention
+  // Status::Timeout on conflict with an older transaction and long-time lock
+  // contention
   virtual Status HashPut(const StringView collection, const StringView key,
                          const StringView value) = 0;
   // Delete a KV from hash collection to the transaction
@@ -72,7 +89,8 @@ class Transaction {
   // Return:
   // Status::Ok on success
   // Status::NotFound if collection does not exist
-  // Status::Timeout on conflict and long-time lock contention
+  // Status::Timeout on conflict with an older transaction and long-time lock
+  // contention
   virtual Status HashDelete(const StringView collection,
                             const StringView key) = 0;
 
@@ -83,7 +101,8 @@ class Transaction {
   // Return:
   // Status::Ok and store value to "*value" on success
   // Status::NotFound if collection or key does not exist
-  // Status::Timeout on conflict and long-time lock contention
+  // Status::Timeout on conflict with an older transaction and long-time lock
+  // contention
   virtual Status HashGet(const StringView collection, const StringView key,
                          std::string* value) = 0;
 
@@ -93,6 +112,8 @@ class Transaction {
   // Return:
   // Status::Ok on success, all operations will be persistent on the instance
   // Status::PMemOverflow/Status::MemoryOverflow if PMem/DRAM exhausted
+  // Status::Abort if the transaction is optimistic and a key it read has been
+  // updated by others, no operation will be applied
   virtual Status Commit() = 0;
 
   // Rollback all operations of the transaction, release locks it holds
@@ -101,6 +122,10 @@ class Transaction {
   // Return status of the last transaction operation
   virtual Status InternalStatus() = 0;
 
+  // Return lock waits of the transaction since it's created. Optimistic
+  // transactions take no locks before commit, so they have no lock waits
+  virtual TransactionLockStats LockStats() { return TransactionLockStats(); }
+
   virtual ~Transaction() = default;
 };
 }  // namespace KVDK_NAMESPACE
\ No newline at end of file
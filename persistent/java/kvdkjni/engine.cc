@@ -168,6 +168,82 @@ jbyteArray Java_io_pmem_kvdk_Engine_get(JNIEnv* env, jobject, jlong handle,
   return nullptr;
 }
 
+/*
+ * Class:     io_pmem_kvdk_Engine
+ * Method:    multiGet
+ * Signature: (J[[B)[[B
+ */
+jobjectArray Java_io_pmem_kvdk_Engine_multiGet(JNIEnv* env, jobject,
+                                               jlong handle,
+                                               jobjectArray keys) {
+  auto* engine = reinterpret_cast<KVDK_NAMESPACE::Engine*>(handle);
+
+  const jsize num_keys = env->GetArrayLength(keys);
+  std::vector<std::string> key_strs(num_keys);
+  for (jsize i = 0; i < num_keys; i++) {
+    jbyteArray key =
+        static_cast<jbyteArray>(env->GetObjectArrayElement(keys, i));
+    if (env->ExceptionCheck()) {
+      // exception thrown: ArrayIndexOutOfBoundsException
+      return nullptr;
+    }
+    const jsize key_len = env->GetArrayLength(key);
+    key_strs[i].resize(key_len);
+    env->GetByteArrayRegion(key, 0, key_len,
+                            reinterpret_cast<jbyte*>(&key_strs[i][0]));
+    env->DeleteLocalRef(key);
+    if (env->ExceptionCheck()) {
+      // exception thrown: ArrayIndexOutOfBoundsException
+      return nullptr;
+    }
+  }
+
+  std::vector<KVDK_NAMESPACE::StringView> key_views(key_strs.begin(),
+                                                    key_strs.end());
+  std::vector<std::string> values;
+  std::vector<KVDK_NAMESPACE::Status> statuses;
+  auto s = engine->MultiGet(key_views, &values, &statuses);
+  if (s != KVDK_NAMESPACE::Status::Ok) {
+    KVDK_NAMESPACE::KVDKExceptionJni::ThrowNew(env, s);
+    return nullptr;
+  }
+
+  jclass byte_array_clazz = env->FindClass("[B");
+  if (byte_array_clazz == nullptr) {
+    // exception occurred accessing class
+    return nullptr;
+  }
+  jobjectArray ret = env->NewObjectArray(num_keys, byte_array_clazz, nullptr);
+  env->DeleteLocalRef(byte_array_clazz);
+  if (ret == nullptr) {
+    // exception thrown: OutOfMemoryError
+    return nullptr;
+  }
+
+  for (jsize i = 0; i < num_keys; i++) {
+    if (statuses[i] == KVDK_NAMESPACE::Status::NotFound) {
+      // null for not found keys
+      continue;
+    }
+    if (statuses[i] != KVDK_NAMESPACE::Status::Ok) {
+      KVDK_NAMESPACE::KVDKExceptionJni::ThrowNew(env, statuses[i]);
+      env->DeleteLocalRef(ret);
+      return nullptr;
+    }
+    jbyteArray value = KVDK_NAMESPACE::JniUtil::createJavaByteArray(
+        env, values[i].c_str(), values[i].size());
+    if (value == nullptr) {
+      // exception thrown
+      env->DeleteLocalRef(ret);
+      return nullptr;
+    }
+    env->SetObjectArrayElement(ret, i, value);
+    env->DeleteLocalRef(value);
+  }
+
+  return ret;
+}
+
 /*
  * Class:     io_pmem_kvdk_Engine
  * Method:    delete
@@ -105,9 +105,9 @@ void Java_io_pmem_kvdk_Iterator_prev(JNIEnv*, jobject, jlong handle) {
 jbyteArray Java_io_pmem_kvdk_Iterator_key(JNIEnv* env, jobject, jlong handle) {
   auto* iterator = reinterpret_cast<KVDK_NAMESPACE::SortedIterator*>(handle);
 
-  std::string key = iterator->Key();
-  jbyteArray ret = KVDK_NAMESPACE::JniUtil::createJavaByteArray(
-      env, key.c_str(), key.size());
+  KVDK_NAMESPACE::StringView key = iterator->KeyView();
+  jbyteArray ret =
+      KVDK_NAMESPACE::JniUtil::createJavaByteArray(env, key.data(), key.size());
   return ret;
 }
 
@@ -120,8 +120,68 @@ jbyteArray Java_io_pmem_kvdk_Iterator_value(JNIEnv* env, jobject,
                                             jlong handle) {
   auto* iterator = reinterpret_cast<KVDK_NAMESPACE::SortedIterator*>(handle);
 
-  std::string value = iterator->Value();
+  KVDK_NAMESPACE::StringView value = iterator->ValueView();
   jbyteArray ret = KVDK_NAMESPACE::JniUtil::createJavaByteArray(
-      env, value.c_str(), value.size());
+      env, value.data(), value.size());
   return ret;
 }
+
+/*
+ * Class:     io_pmem_kvdk_Iterator
+ * Method:    keyDirect
+ * Signature: (JLjava/nio/ByteBuffer;II)I
+ */
+jint Java_io_pmem_kvdk_Iterator_keyDirect(JNIEnv* env, jobject, jlong handle,
+                                          jobject buffer, jint offset,
+                                          jint len) {
+  auto* iterator = reinterpret_cast<KVDK_NAMESPACE::SortedIterator*>(handle);
+
+  KVDK_NAMESPACE::StringView key = iterator->KeyView();
+  return KVDK_NAMESPACE::JniUtil::copyToDirectBuffer(
+      env, key.data(), key.size(), buffer, offset, len);
+}
+
+/*
+ * Class:     io_pmem_kvdk_Iterator
+ * Method:    keyByteArray
+ * Signature: (J[BII)I
+ */
+jint Java_io_pmem_kvdk_Iterator_keyByteArray(JNIEnv* env, jobject,
+                                             jlong handle, jbyteArray array,
+                                             jint offset, jint len) {
+  auto* iterator = reinterpret_cast<KVDK_NAMESPACE::SortedIterator*>(handle);
+
+  KVDK_NAMESPACE::StringView key = iterator->KeyView();
+  return KVDK_NAMESPACE::JniUtil::copyToByteArray(env, key.data(), key.size(),
+                                                  array, offset, len);
+}
+
+/*
+ * Class:     io_pmem_kvdk_Iterator
+ * Method:    valueDirect
+ * Signature: (JLjava/nio/ByteBuffer;II)I
+ */
+jint Java_io_pmem_kvdk_Iterator_valueDirect(JNIEnv* env, jobject, jlong handle,
+                                            jobject buffer, jint offset,
+                                            jint len) {
+  auto* iterator = reinterpret_cast<KVDK_NAMESPACE::SortedIterator*>(handle);
+
+  KVDK_NAMESPACE::StringView value = iterator->ValueView();
+  return KVDK_NAMESPACE::JniUtil::copyToDirectBuffer(
+      env, value.data(), value.size(), buffer, offset, len);
+}
+
+/*
+ * Class:     io_pmem_kvdk_Iterator
+ * Method:    valueByteArray
+ * Signature: (J[BII)I
+ */
+jint Java_io_pmem_kvdk_Iterator_valueByteArray(JNIEnv* env, jobject,
+                                               jlong handle, jbyteArray array,
+                                               jint offset, jint len) {
+  auto* iterator = reinterpret_cast<KVDK_NAMESPACE::SortedIterator*>(handle);
+
+  KVDK_NAMESPACE::StringView value = iterator->ValueView();
+  return KVDK_NAMESPACE::JniUtil::copyToByteArray(
+      env, value.data(), value.size(), array, offset, len);
+}
@@ -7,7 +7,9 @@
 
 #include <jni.h>
 #include <stdio.h>
+#include <string.h>
 
+#include <algorithm>
 #include <iostream>
 
 #include "kvdk/persistent/engine.hpp"
@@ -319,6 +321,39 @@ class JniUtil {
 
     return jbytes;
   }
+
+  // Copy at most "len" bytes of "bytes" to "buffer" from "offset", "buffer"
+  // should be a direct java.nio.ByteBuffer. Return "size" on success, or 0
+  // with an exception thrown.
+  static jint copyToDirectBuffer(JNIEnv* env, const char* bytes,
+                                 const size_t size, jobject buffer,
+                                 jint offset, jint len) {
+    char* addr = static_cast<char*>(env->GetDirectBufferAddress(buffer));
+    if (addr == nullptr || offset < 0 || len < 0 ||
+        env->GetDirectBufferCapacity(buffer) < offset + len) {
+      KVDK_NAMESPACE::KVDKExceptionJni::ThrowNew(
+          env, "Invalid direct ByteBuffer address or range");
+      return 0;
+    }
+    memcpy(addr + offset, bytes, std::min(size, static_cast<size_t>(len)));
+    return static_cast<jint>(size);
+  }
+
+  // Copy at most "len" bytes of "bytes" to "array" from "offset". Return
+  // "size" on success, or 0 with an exception thrown.
+  static jint copyToByteArray(JNIEnv* env, const char* bytes, const size_t size,
+                              jbyteArray array, jint offset, jint len) {
+    const jsize copy_len =
+        static_cast<jsize>(std::min(size, static_cast<size_t>(len)));
+    env->SetByteArrayRegion(
+        array, offset, copy_len,
+        const_cast<jbyte*>(reinterpret_cast<const jbyte*>(bytes)));
+    if (env->ExceptionCheck()) {
+      // exception thrown: ArrayIndexOutOfBoundsException
+      return 0;
+    }
+    return static_cast<jint>(size);
+  }
 };
 
 }  // namespace KVDK_NAMESPACE
@@ -144,6 +144,18 @@ public class Engine extends KVDKObject {
         return get(nativeHandle_, key, keyOffset, keyLength);
     }
 
+    /**
+     * Get values of a batch of keys, which is faster than calling get() for each key.
+     *
+     * @param keys
+     * @return Values as byte arrays in the same order of keys, an element is null if the
+     *     corresponding key doesn't exist.
+     * @throws KVDKException
+     */
+    public byte[][] multiGet(final byte[][] keys) throws KVDKException {
+        return multiGet(nativeHandle_, keys);
+    }
+
     public void delete(final byte[] key) throws KVDKException {
         delete(nativeHandle_, key, 0, key.length);
     }
@@ -302,6 +314,8 @@ public class Engine extends KVDKObject {
 
     private native byte[] get(long handle, byte[] key, int keyOffset, int keyLength);
 
+    private native byte[][] multiGet(long handle, byte[][] keys);
+
     private native void delete(long handle, byte[] key, int keyOffset, int keyLength);
 
     private native void sortedCreate(long engineHandle, long nameHandle, int nameLenth);
@@ -4,6 +4,8 @@
 
 package io.pmem.kvdk;
 
+import java.nio.ByteBuffer;
+
 /** Iterator to Key-Values in KVDK. */
 public class Iterator extends KVDKObject {
     static {
@@ -58,6 +60,45 @@ public class Iterator extends KVDKObject {
         return value(nativeHandle_);
     }
 
+    /**
+     * Copy the current key into {@code key} from its position, without allocating a Java array for
+     * it. The limit of {@code key} is set to the end of copied bytes, and the key is truncated if
+     * it is larger than the remaining space of {@code key}. The copy stays valid after the iterator
+     * moves or is closed.
+     *
+     * @param key Destination buffer, either direct or backed by an array.
+     * @return Size of the current key, larger than the copied size if the key is truncated.
+     */
+    public int key(final ByteBuffer key) {
+        int size;
+        if (key.isDirect()) {
+            size = keyDirect(nativeHandle_, key, key.position(), key.remaining());
+        } else {
+            int offset = key.arrayOffset() + key.position();
+            size = keyByteArray(nativeHandle_, key.array(), offset, key.remaining());
+        }
+        key.limit(Math.min(key.position() + size, key.limit()));
+        return size;
+    }
+
+    /**
+     * Copy the current value into {@code value}, same as {@link #key(ByteBuffer)}.
+     *
+     * @param value Destination buffer, either direct or backed by an array.
+     * @return Size of the current value, larger than the copied size if the value is truncated.
+     */
+    public int value(final ByteBuffer value) {
+        int size;
+        if (value.isDirect()) {
+            size = valueDirect(nativeHandle_, value, value.position(), value.remaining());
+        } else {
+            int offset = value.arrayOffset() + value.position();
+            size = valueByteArray(nativeHandle_, value.array(), offset, value.remaining());
+        }
+        value.limit(Math.min(value.position() + size, value.limit()));
+        return size;
+    }
+
     // Native methods
     protected native void closeInternal(long iteratorHandle, long engineHandle);
 
@@ -76,4 +117,12 @@ public class Iterator extends KVDKObject {
     private native byte[] key(long handle);
 
     private native byte[] value(long handle);
+
+    private native int keyDirect(long handle, ByteBuffer buffer, int offset, int len);
+
+    private native int keyByteArray(long handle, byte[] array, int offset, int len);
+
+    private native int valueDirect(long handle, ByteBuffer buffer, int offset, int len);
+
+    private native int valueByteArray(long handle, byte[] array, int offset, int len);
 }
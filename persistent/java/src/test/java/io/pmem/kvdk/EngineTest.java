@@ -40,6 +40,19 @@ public class EngineTest extends EngineTestBase {
         assertEquals(value3, new String(kvdkEngine.get(key.getBytes())));
     }
 
+    @Test
+    public void testMultiGet() throws KVDKException {
+        String key1 = "key1";
+        String key2 = "key2";
+        String value1 = "value1";
+
+        kvdkEngine.put(key1.getBytes(), value1.getBytes());
+        byte[][] values = kvdkEngine.multiGet(new byte[][] {key1.getBytes(), key2.getBytes()});
+        assertEquals(2, values.length);
+        assertEquals(value1, new String(values[0]));
+        assertEquals(null, values[1]);
+    }
+
     @Test
     public void testSortedCollection() throws KVDKException {
         String name = "collection\0\nname";
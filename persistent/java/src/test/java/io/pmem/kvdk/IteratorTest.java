@@ -8,6 +8,7 @@ import static org.junit.Assert.assertEquals;
 import static org.junit.Assert.assertFalse;
 import static org.junit.Assert.assertTrue;
 
+import java.nio.ByteBuffer;
 import org.junit.Test;
 
 public class IteratorTest extends EngineTestBase {
@@ -49,11 +50,35 @@ public class IteratorTest extends EngineTestBase {
         assertEquals(key2, new String(iter.key()));
         assertEquals(value2, new String(iter.value()));
 
+        // copy into direct buffers, which stay valid after the iterator moves
+        ByteBuffer keyBuffer = ByteBuffer.allocateDirect(64);
+        assertEquals(key2.length(), iter.key(keyBuffer));
+        ByteBuffer valueBuffer = ByteBuffer.allocateDirect(64);
+        valueBuffer.position(10);
+        assertEquals(value2.length(), iter.value(valueBuffer));
+        assertEquals(10, valueBuffer.position());
+        assertEquals(10 + value2.length(), valueBuffer.limit());
+
+        // copy into a heap buffer, truncated if it is too small
+        ByteBuffer smallBuffer = ByteBuffer.allocate(3);
+        assertEquals(value2.length(), iter.value(smallBuffer));
+        assertEquals(3, smallBuffer.remaining());
+
         iter.next();
         assertTrue(iter.isValid());
         assertEquals(key3, new String(iter.key()));
         assertEquals(value3, new String(iter.value()));
 
+        byte[] keyBytes = new byte[keyBuffer.remaining()];
+        keyBuffer.get(keyBytes);
+        assertEquals(key2, new String(keyBytes));
+        byte[] valueBytes = new byte[valueBuffer.remaining()];
+        valueBuffer.get(valueBytes);
+        assertEquals(value2, new String(valueBytes));
+        byte[] smallBytes = new byte[smallBuffer.remaining()];
+        smallBuffer.get(smallBytes);
+        assertEquals(value2.substring(0, 3), new String(smallBytes));
+
         iter.next();
         assertFalse(iter.isValid());
 
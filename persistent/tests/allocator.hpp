@@ -43,10 +43,10 @@ class PMemAllocatorWrapper : public AllocatorAdaptor {
  public:
   void InitPMemAllocator(const std::string& pmem_path, uint64_t pmem_size,
                          uint64_t num_segment_blocks, uint32_t block_size,
-                         uint32_t num_write_threads) {
+                         uint32_t num_write_threads, uint32_t slab_max_blocks) {
     pmem_alloc_ = PMEMAllocator::NewPMEMAllocator(
-        pmem_path, pmem_size, num_segment_blocks, block_size, num_write_threads,
-        true, false, nullptr);
+        {pmem_path}, pmem_size, 1, num_segment_blocks, block_size,
+        num_write_threads, slab_max_blocks, true, false, nullptr);
     kvdk_assert(pmem_alloc_ != nullptr, "New pmem allocator failed!");
     background.emplace_back(
         std::thread(&PMemAllocatorWrapper::BackGround, this));
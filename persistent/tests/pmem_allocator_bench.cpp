@@ -5,6 +5,8 @@
 #include <gflags/gflags.h>
 #include <sys/time.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <ctime>
 #include <future>
@@ -41,6 +43,17 @@ DEFINE_uint64(num_segment_blocks, 1024ULL, "PMem num blocks per segment");
 
 DEFINE_uint64(block_size, 16, "PMem block size");
 
+DEFINE_uint64(slab_max_blocks, 0,
+              "Max number of blocks allocated from size class slabs, 0 to "
+              "disable slabs");
+
+DEFINE_uint64(segment_alloc_num, 4096,
+              "Number of allocations per thread in segment scaling bench");
+
+DEFINE_uint64(max_scaling_threads, 0,
+              "Max number of threads in segment scaling bench, 0 for all "
+              "hardware threads");
+
 // Allocator Performance Class
 // TODO: add access_memory bench
 class AllocatorBench {
@@ -131,6 +144,49 @@ class AllocatorBench {
     }
   }
 
+  // Allocate half-segment sized space without free, so threads keep fetching
+  // new segments, report throughput of increasing number of threads
+  void SegmentScalingPerf(uint32_t max_thread, int64_t iter_num) {
+    uint64_t segment_size = FLAGS_num_segment_blocks * FLAGS_block_size;
+    uint64_t alloc_size = segment_size / 2;
+    std::vector<uint32_t> num_threads;
+    for (uint32_t num_thread = 1; num_thread < max_thread; num_thread *= 2) {
+      num_threads.push_back(num_thread);
+    }
+    num_threads.push_back(max_thread);
+    for (uint32_t num_thread : num_threads) {
+      uint64_t pmem_size =
+          (iter_num / 2 + kSegmentBatchSize + 1) * num_thread * segment_size;
+      // Start from an empty pool file
+      char cmd[1024];
+      sprintf(cmd, "rm -rf %s\n", FLAGS_pmem_path.c_str());
+      int res __attribute__((unused)) = system(cmd);
+      PMemAllocatorWrapper* pmem_allocator = new PMemAllocatorWrapper();
+      pmem_allocator->InitPMemAllocator(
+          FLAGS_pmem_path, pmem_size, FLAGS_num_segment_blocks,
+          FLAGS_block_size, num_thread, 0 /* slab_max_blocks */);
+      std::atomic<uint64_t> failed{0};
+      auto SegmentBench = [&](size_t) {
+        for (int64_t i = 0; i < iter_num; ++i) {
+          if (pmem_allocator->wrapped_malloc(alloc_size).entry.size == 0) {
+            failed++;
+          }
+        }
+      };
+      std::chrono::system_clock::time_point to_begin =
+          std::chrono::high_resolution_clock::now();
+      LaunchNThreads(num_thread, SegmentBench);
+      std::chrono::duration<double> elapsed_time =
+          std::chrono::high_resolution_clock::now() - to_begin;
+      std::cout << num_thread << " threads allocated " << iter_num * num_thread
+                << " half segments in " << std::fixed << std::setprecision(5)
+                << elapsed_time.count() << " seconds, "
+                << iter_num * num_thread / elapsed_time.count() / 1000000
+                << " Mops/s, failed " << failed.load() << std::endl;
+      delete pmem_allocator;
+    }
+  }
+
   AllocatorBench() {
     std::default_random_engine rand_engine{std::random_device()()};
     random_alloc_sizes.reserve(NUM_SIZES);
@@ -167,7 +223,7 @@ int main(int argc, char** argv) {
   PMemAllocatorWrapper* pmem_allocator = new PMemAllocatorWrapper();
   pmem_allocator->InitPMemAllocator(FLAGS_pmem_path, FLAGS_pmem_size,
                                     FLAGS_num_segment_blocks, FLAGS_block_size,
-                                    FLAGS_num_thread);
+                                    FLAGS_num_thread, FLAGS_slab_max_blocks);
 
   std::cout << "PMmem Allocator Performance: \n";
   allcator_bench.RandomSizePerf(FLAGS_num_thread, FLAGS_iter_num,
@@ -175,5 +231,12 @@ int main(int argc, char** argv) {
 
   delete pmem_allocator;
 
+  std::cout << "PMem Segment Allocation Scaling: \n";
+  uint32_t max_scaling_threads = FLAGS_max_scaling_threads > 0
+                                     ? FLAGS_max_scaling_threads
+                                     : std::thread::hardware_concurrency();
+  allcator_bench.SegmentScalingPerf(max_scaling_threads,
+                                    FLAGS_segment_alloc_num);
+
   return 0;
 }
@@ -4,6 +4,7 @@
 
 #include <sys/time.h>
 
+#include <algorithm>
 #include <chrono>
 #include <ctime>
 #include <deque>
@@ -33,14 +34,14 @@ class EnginePMemAllocatorTest : public testing::Test {
     pmem_path = "/mnt/pmem0/kvdk_pmem_allocator";
     GlobalLogger.Init(stdout, LogLevel::All);
     char cmd[1024];
-    sprintf(cmd, "rm -rf %s\n", pmem_path.c_str());
+    sprintf(cmd, "rm -rf %s*\n", pmem_path.c_str());
     int res __attribute__((unused)) = system(cmd);
   }
 
   void RemovePath() {
     // delete db_path.
     char cmd[1024];
-    sprintf(cmd, "rm -rf %s\n", pmem_path.c_str());
+    sprintf(cmd, "rm -rf %s*\n", pmem_path.c_str());
     int res __attribute__((unused)) = system(cmd);
   }
 
@@ -59,8 +60,8 @@ TEST_F(EnginePMemAllocatorTest, TestBasicAlloc) {
     for (auto block_size : block_sizes) {
       for (auto num_thread : num_threads) {
         PMEMAllocator* pmem_alloc = PMEMAllocator::NewPMEMAllocator(
-            pmem_path, pmem_size, num_segment_block, block_size, num_thread,
-            true, false, nullptr);
+            {pmem_path}, pmem_size, 1, num_segment_block, block_size,
+            num_thread, 0, true, false, nullptr);
         if (block_size * num_segment_block * num_thread > pmem_size) {
           ASSERT_EQ(pmem_alloc, nullptr);
           continue;
@@ -109,8 +110,8 @@ TEST_F(EnginePMemAllocatorTest, TestPMemFragmentation) {
   uint64_t block_size = 64;
   std::vector<uint64_t> alloc_size{8 * 64, 8 * 64, 16 * 64, 32 * 64};
   PMEMAllocator* pmem_alloc = PMEMAllocator::NewPMEMAllocator(
-      pmem_path, pmem_size, num_segment_block, block_size, num_thread, true,
-      false, nullptr);
+      {pmem_path}, pmem_size, 1, num_segment_block, block_size, num_thread, 0,
+      true, false, nullptr);
   ASSERT_NE(pmem_alloc, nullptr);
 
   /* Allocated pmem status (block nums):
@@ -146,6 +147,93 @@ TEST_F(EnginePMemAllocatorTest, TestPMemFragmentation) {
   delete pmem_alloc;
 }
 
+TEST_F(EnginePMemAllocatorTest, TestSlabAlloc) {
+  uint32_t num_thread = 4;
+  uint64_t num_segment_block = 1024;
+  uint64_t block_size = 64;
+  uint32_t slab_max_blocks = 4;
+  uint64_t pmem_size = 64 * num_segment_block * block_size;
+  PMEMAllocator* pmem_alloc = PMEMAllocator::NewPMEMAllocator(
+      {pmem_path}, pmem_size, 1, num_segment_block, block_size, num_thread,
+      slab_max_blocks, true, false, nullptr);
+  ASSERT_NE(pmem_alloc, nullptr);
+
+  uint64_t num_records = 2000;
+  std::vector<std::vector<SpaceEntry>> records(num_thread);
+  auto AllocRecords = [&](uint64_t id) {
+    for (uint64_t i = 0; i < num_records; i++) {
+      uint64_t b_size = i % slab_max_blocks + 1;
+      SpaceEntry space_entry = pmem_alloc->Allocate(b_size * block_size - 8);
+      ASSERT_EQ(space_entry.size, b_size * block_size);
+      records[id].push_back(space_entry);
+    }
+  };
+  auto FreeRecords = [&](uint64_t id) {
+    for (const SpaceEntry& space_entry : records[id]) {
+      pmem_alloc->Free(space_entry);
+    }
+    records[id].clear();
+  };
+  LaunchNThreads(num_thread, AllocRecords);
+  LaunchNThreads(num_thread, FreeRecords);
+  ASSERT_EQ(pmem_alloc->PMemUsageInBytes(), 0LL);
+
+  // Slots freed by a thread should be reused by the same class without
+  // fetching new segments
+  AllocRecords(0);
+  FreeRecords(0);
+  std::vector<PMemOffsetType> offset_heads = pmem_alloc->OffsetHeads();
+  AllocRecords(0);
+  ASSERT_EQ(pmem_alloc->OffsetHeads(), offset_heads);
+  FreeRecords(0);
+  ASSERT_EQ(pmem_alloc->PMemUsageInBytes(), 0LL);
+
+  // Cached slots of all classes can be reused by small records after PMem
+  // space exhausted
+  while ((uint64_t)pmem_alloc->PMemUsageInBytes() < pmem_size) {
+    SpaceEntry space_entry = pmem_alloc->Allocate(block_size);
+    ASSERT_NE(space_entry.size, 0);
+  }
+  ASSERT_EQ(pmem_alloc->Allocate(block_size).size, 0);
+  delete pmem_alloc;
+}
+
+TEST_F(EnginePMemAllocatorTest, TestSpaceMap) {
+  uint64_t num_blocks = 4 * kSpaceMapChunkBlocks;
+  SpaceMap space_map(num_blocks);
+  // Entries cross chunk boundary
+  uint64_t offset = kSpaceMapChunkBlocks - 100;
+  space_map.Set(offset, 30);
+  space_map.Set(offset + 30, 70);
+  space_map.Set(offset + 100, 1000);
+  ASSERT_EQ(space_map.Test(offset), 30);
+  ASSERT_EQ(space_map.Test(offset + 30), 70);
+  ASSERT_EQ(space_map.Test(offset + 100), 1000);
+  ASSERT_EQ(space_map.Test(offset + 1), 0);
+
+  // Clear with mismatched size or non-start offset fails
+  ASSERT_FALSE(space_map.TestAndClear(offset, 29));
+  ASSERT_FALSE(space_map.TestAndClear(offset, 31));
+  ASSERT_FALSE(space_map.TestAndClear(offset + 1, 29));
+
+  // Merge stops at merge limit
+  ASSERT_EQ(space_map.TryMerge(offset, 30, 50), 30);
+  // Merge stops at a far larger following space
+  ASSERT_EQ(space_map.TryMerge(offset, 30, 2 * kSpaceMapChunkBlocks), 100);
+  ASSERT_EQ(space_map.Test(offset), 100);
+  ASSERT_EQ(space_map.Test(offset + 30), 0);
+  ASSERT_EQ(space_map.Test(offset + 100), 1000);
+  // Merge with mismatched start size fails
+  ASSERT_EQ(space_map.TryMerge(offset, 30, 2 * kSpaceMapChunkBlocks), 0);
+
+  ASSERT_TRUE(space_map.TestAndClear(offset, 100));
+  ASSERT_TRUE(space_map.TestAndClear(offset + 100, 1000));
+  ASSERT_EQ(space_map.Test(offset), 0);
+  space_map.Set(offset, 2 * kSpaceMapChunkBlocks);
+  ASSERT_EQ(space_map.Test(offset), 2 * kSpaceMapChunkBlocks);
+  ASSERT_TRUE(space_map.TestAndClear(offset, 2 * kSpaceMapChunkBlocks));
+}
+
 // TODO: Add more cases
 TEST_F(EnginePMemAllocatorTest, TestPMemAllocFreeList) {
   uint32_t num_thread = 1;
@@ -154,8 +242,8 @@ TEST_F(EnginePMemAllocatorTest, TestPMemAllocFreeList) {
   uint64_t pmem_size = num_segment_block * block_size * num_thread;
   std::deque<SpaceEntry> records;
   PMEMAllocator* pmem_alloc = PMEMAllocator::NewPMEMAllocator(
-      pmem_path, pmem_size, num_segment_block, block_size, num_thread, true,
-      false, nullptr);
+      {pmem_path}, pmem_size, 1, num_segment_block, block_size, num_thread, 0,
+      true, false, nullptr);
   ASSERT_NE(pmem_alloc, nullptr);
 
   // allocate 1024 bytes
@@ -199,4 +287,201 @@ TEST_F(EnginePMemAllocatorTest, TestPMemAllocFreeList) {
   records.push_back(pmem_alloc->Allocate(1024ULL));
   ASSERT_EQ(pmem_alloc->PMemUsageInBytes(), pmem_size);
   delete pmem_alloc;
-}
\ No newline at end of file
+}
+TEST_F(EnginePMemAllocatorTest, TestSegmentCompaction) {
+  uint32_t num_thread = 1;
+  uint64_t num_segment_block = 32;
+  uint64_t block_size = 64;
+  uint64_t num_segments = 4;
+  uint64_t segment_size = num_segment_block * block_size;
+  uint64_t pmem_size = segment_size * num_segments;
+  uint64_t record_size = 4 * block_size;
+  uint64_t records_per_segment = segment_size / record_size;
+  PMEMAllocator* pmem_alloc = PMEMAllocator::NewPMEMAllocator(
+      {pmem_path}, pmem_size, 1, num_segment_block, block_size, num_thread, 0,
+      true, false, nullptr);
+  ASSERT_NE(pmem_alloc, nullptr);
+
+  // Pin a record in each segment and free others
+  std::vector<SpaceEntry> records;
+  for (uint64_t i = 0; i < num_segments * records_per_segment; i++) {
+    records.push_back(pmem_alloc->Allocate(record_size));
+    ASSERT_EQ(records.back().size, record_size);
+  }
+  std::vector<SpaceEntry> pinned;
+  for (uint64_t i = 0; i < records.size(); i++) {
+    if (i % records_per_segment == 0) {
+      pinned.push_back(records[i]);
+    } else {
+      pmem_alloc->Free(records[i]);
+    }
+  }
+  ASSERT_EQ(pmem_alloc->PMemUsageInBytes(), num_segments * record_size);
+  ASSERT_EQ(pmem_alloc->Allocate(segment_size).size, 0);
+
+  std::vector<PMemOffsetType> sparse_segments =
+      pmem_alloc->SparseSegments(0.25, 2);
+  ASSERT_EQ(sparse_segments.size(), 2);
+  pmem_alloc->DrainSegments(sparse_segments);
+  ASSERT_EQ(pmem_alloc->DrainingSegments().size(), 2);
+
+  // Relocate pinned records of draining segments, free space of draining
+  // segments should not be allocated
+  for (uint64_t i = 0; i < sparse_segments.size(); i++) {
+    SpaceEntry space_entry = pmem_alloc->Allocate(record_size);
+    ASSERT_EQ(space_entry.size, record_size);
+    ASSERT_EQ(std::count(sparse_segments.begin(), sparse_segments.end(),
+                         space_entry.offset / segment_size * segment_size),
+              0);
+    pmem_alloc->Free(pinned[i]);
+    pinned[i] = space_entry;
+  }
+
+  // Drained segments are reclaimed as whole free space
+  pmem_alloc->BackgroundWork();
+  ASSERT_EQ(pmem_alloc->DrainingSegments().size(), 0);
+  for (uint64_t i = 0; i < sparse_segments.size(); i++) {
+    SpaceEntry space_entry = pmem_alloc->Allocate(segment_size);
+    ASSERT_EQ(space_entry.size, segment_size);
+    ASSERT_EQ(space_entry.offset % segment_size, 0);
+  }
+  ASSERT_EQ(pmem_alloc->Allocate(segment_size).size, 0);
+  ASSERT_EQ(pmem_alloc->PMemUsageInBytes(),
+            sparse_segments.size() * segment_size +
+                num_segments * record_size);
+  delete pmem_alloc;
+}
+
+TEST_F(EnginePMemAllocatorTest, TestPoolFileGrowth) {
+  uint32_t num_thread = 1;
+  uint64_t num_segment_block = 512;
+  uint64_t block_size = 64;
+  uint64_t segment_size = num_segment_block * block_size;
+  uint64_t pool_file_size = 2ULL << 20;
+  uint32_t max_pool_files = 3;
+  uint64_t num_segments = pool_file_size * max_pool_files / segment_size;
+  PMEMAllocator* pmem_alloc = PMEMAllocator::NewPMEMAllocator(
+      {pmem_path}, pool_file_size, max_pool_files, num_segment_block,
+      block_size, num_thread, 0, true, false, nullptr);
+  ASSERT_NE(pmem_alloc, nullptr);
+  ASSERT_EQ(pmem_alloc->PMemSize(), pool_file_size);
+
+  // Pool files are added while space used up
+  std::vector<SpaceEntry> segments;
+  while (true) {
+    SpaceEntry space_entry = pmem_alloc->Allocate(segment_size);
+    if (space_entry.size == 0) {
+      break;
+    }
+    ASSERT_EQ(space_entry.size, segment_size);
+    memset(pmem_alloc->offset2addr_checked<char>(space_entry.offset) +
+               sizeof(DataEntry),
+           'a' + segments.size() % 26, segment_size - sizeof(DataEntry));
+    segments.push_back(space_entry);
+  }
+  ASSERT_EQ(segments.size(), num_segments);
+  ASSERT_EQ(pmem_alloc->PMemSize(), pool_file_size * max_pool_files);
+  for (uint32_t i = 1; i < max_pool_files; i++) {
+    ASSERT_TRUE(file_exist(pmem_path + "." + std::to_string(i)));
+  }
+  delete pmem_alloc;
+
+  // More pool files than max
+  ASSERT_EQ(PMEMAllocator::NewPMEMAllocator(
+                {pmem_path}, pool_file_size, max_pool_files - 1,
+                num_segment_block, block_size, num_thread, 0, true, false,
+                nullptr),
+            nullptr);
+
+  // All pool files are mapped and scanned after reopen
+  pmem_alloc = PMEMAllocator::NewPMEMAllocator(
+      {pmem_path}, pool_file_size, max_pool_files, num_segment_block,
+      block_size, num_thread, 0, true, false, nullptr);
+  ASSERT_NE(pmem_alloc, nullptr);
+  ASSERT_EQ(pmem_alloc->PMemSize(), pool_file_size * max_pool_files);
+  SpaceEntry segment;
+  uint64_t num_fetched = 0;
+  while (pmem_alloc->FetchSegment(&segment)) {
+    ASSERT_EQ(segment.offset, segments[num_fetched].offset);
+    char* data = pmem_alloc->offset2addr_checked<char>(segment.offset);
+    ASSERT_EQ(data[sizeof(DataEntry)], 'a' + num_fetched % 26);
+    ASSERT_EQ(data[segment_size - 1], 'a' + num_fetched % 26);
+    num_fetched++;
+  }
+  ASSERT_EQ(num_fetched, num_segments);
+  delete pmem_alloc;
+}
+
+TEST_F(EnginePMemAllocatorTest, TestNumaPools) {
+  uint32_t num_thread = 1;
+  uint64_t num_segment_block = 512;
+  uint64_t block_size = 64;
+  uint64_t segment_size = num_segment_block * block_size;
+  uint64_t pool_file_size = 2ULL << 20;
+  uint32_t max_pool_files = 2;
+  uint64_t pool_span = pool_file_size * max_pool_files;
+  std::vector<std::string> pmem_files{pmem_path, pmem_path + "_node1"};
+  PMEMAllocator* pmem_alloc = PMEMAllocator::NewPMEMAllocator(
+      pmem_files, pool_file_size, max_pool_files, num_segment_block,
+      block_size, num_thread, 0, true, false, nullptr);
+  ASSERT_NE(pmem_alloc, nullptr);
+  ASSERT_EQ(pmem_alloc->NumPools(), 2);
+  ASSERT_EQ(pmem_alloc->PMemSize(), pool_file_size * 2);
+
+  // Space of the local pool is used first, then other pools after the local
+  // one reached max pool files
+  std::vector<PMemOffsetType> segments;
+  uint64_t num_local = 0;
+  while (true) {
+    SpaceEntry space_entry = pmem_alloc->Allocate(segment_size);
+    if (space_entry.size == 0) {
+      break;
+    }
+    if (segments.empty() ||
+        space_entry.offset / pool_span == segments.front() / pool_span) {
+      ASSERT_EQ(num_local, segments.size());
+      num_local++;
+    }
+    *pmem_alloc->offset2addr_checked<uint64_t>(space_entry.offset +
+                                               sizeof(DataEntry)) =
+        space_entry.offset;
+    segments.push_back(space_entry.offset);
+  }
+  ASSERT_EQ(segments.size(), pool_span * 2 / segment_size);
+  ASSERT_EQ(num_local, pool_span / segment_size);
+  for (const std::string& pmem_file : pmem_files) {
+    ASSERT_TRUE(file_exist(pmem_file + ".1"));
+  }
+  std::vector<PMemOffsetType> offset_heads = pmem_alloc->OffsetHeads();
+  ASSERT_EQ(offset_heads.size(), 2);
+  ASSERT_TRUE(pmem_alloc->BeforeOffsetHead(pool_span - 1, offset_heads));
+  ASSERT_FALSE(pmem_alloc->BeforeOffsetHead(2 * pool_span, offset_heads));
+  delete pmem_alloc;
+
+  // Pool files of a configured pool missing
+  std::vector<std::string> more_files{pmem_files[0], pmem_files[1],
+                                      pmem_path + "_node2"};
+  ASSERT_EQ(PMEMAllocator::NewPMEMAllocator(
+                more_files, pool_file_size, max_pool_files, num_segment_block,
+                block_size, num_thread, 0, true, false, nullptr),
+            nullptr);
+
+  // Segments of all pools are fetched after reopen
+  pmem_alloc = PMEMAllocator::NewPMEMAllocator(
+      pmem_files, pool_file_size, max_pool_files, num_segment_block,
+      block_size, num_thread, 0, true, false, nullptr);
+  ASSERT_NE(pmem_alloc, nullptr);
+  std::sort(segments.begin(), segments.end());
+  SpaceEntry segment;
+  uint64_t num_fetched = 0;
+  while (pmem_alloc->FetchSegment(&segment)) {
+    ASSERT_EQ(segment.offset, segments[num_fetched]);
+    ASSERT_EQ(*pmem_alloc->offset2addr_checked<uint64_t>(segment.offset +
+                                                         sizeof(DataEntry)),
+              segment.offset);
+    num_fetched++;
+  }
+  ASSERT_EQ(num_fetched, segments.size());
+  ASSERT_EQ(pmem_alloc->OffsetHeads(), offset_heads);
+  delete pmem_alloc;
+}
@@ -4,6 +4,7 @@
 
 #include <gflags/gflags.h>
 #include <gtest/gtest.h>
+#include <sched.h>
 
 #include <future>
 #include <string>
@@ -13,6 +14,7 @@
 
 #include "../engine/kv_engine.hpp"
 #include "../engine/pmem_allocator/pmem_allocator.hpp"
+#include "../engine/sharded_engine.hpp"
 #include "../engine/utils/sync_point.hpp"
 #include "kvdk/persistent/engine.hpp"
 #include "test_util.h"
@@ -865,6 +867,62 @@ TEST_F(EngineBasicTest, TestStringModify) {
   delete engine;
 }
 
+TEST_F(EngineBasicTest, TestStringMultiGet) {
+  int num_threads = 16;
+  int num_keys = 1000;
+  // Few buckets so keys in a batch share buckets
+  configs.hash_bucket_num = 64;
+  configs.num_buckets_per_slot = 1;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+
+  std::string sorted_collection = "sorted_collection";
+  ASSERT_EQ(engine->SortedCreate(sorted_collection), Status::Ok);
+  for (int i = 0; i < num_keys; i++) {
+    std::string key = "key" + std::to_string(i);
+    if (i % 3 != 1) {
+      ASSERT_EQ(engine->Put(key, "value" + std::to_string(i)), Status::Ok);
+    }
+    if (i % 3 == 2) {
+      ASSERT_EQ(engine->Delete(key), Status::Ok);
+    }
+  }
+
+  auto MultiGet = [&](int tid) {
+    std::vector<std::string> key_strs;
+    for (int i = tid; i < num_keys; i += num_threads) {
+      key_strs.push_back("key" + std::to_string(i));
+    }
+    key_strs.push_back(sorted_collection);
+    std::vector<StringView> keys(key_strs.begin(), key_strs.end());
+    std::vector<std::string> values;
+    std::vector<Status> statuses;
+    ASSERT_EQ(engine->MultiGet(keys, &values, &statuses), Status::Ok);
+    ASSERT_EQ(values.size(), keys.size());
+    ASSERT_EQ(statuses.size(), keys.size());
+    for (size_t k = 0; k + 1 < keys.size(); k++) {
+      int i = tid + k * num_threads;
+      if (i % 3 == 0) {
+        ASSERT_EQ(statuses[k], Status::Ok);
+        ASSERT_EQ(values[k], "value" + std::to_string(i));
+      } else {
+        ASSERT_EQ(statuses[k], Status::NotFound);
+      }
+    }
+    ASSERT_EQ(statuses.back(), Status::WrongType);
+  };
+  LaunchNThreads(num_threads, MultiGet);
+
+  std::vector<std::string> values;
+  std::vector<Status> statuses;
+  ASSERT_EQ(engine->MultiGet({}, &values, &statuses), Status::Ok);
+  ASSERT_TRUE(values.empty() && statuses.empty());
+  std::string long_key(UINT16_MAX + 1, 'a');
+  ASSERT_EQ(engine->MultiGet({"key0", long_key}, &values, &statuses),
+            Status::InvalidDataSize);
+  delete engine;
+}
+
 TEST_F(BatchWriteTest, Sorted) {
   size_t num_threads = 1;
   for (int index_with_hashtable : {0, 1}) {
@@ -1016,6 +1074,156 @@ TEST_F(BatchWriteTest, String) {
   delete engine;
 }
 
+TEST_F(BatchWriteTest, LargeAndReusedBatch) {
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  std::string sorted_collection = "sorted";
+  ASSERT_EQ(engine->SortedCreate(sorted_collection), Status::Ok);
+  // Values of various sizes, including empty ones and ones larger than a
+  // block of the batch arena, large string values are stored in extents
+  std::vector<size_t> value_sizes{0, 10, 1000, 300 << 10, 3 << 20};
+  auto batch = engine->WriteBatchCreate();
+  for (size_t round = 0; round < 3; round++) {
+    std::map<std::string, std::string> kvs;
+    for (size_t i = 0; i < 200; i++) {
+      std::string key = "key" + std::to_string(i);
+      std::string value = GetRandomString(value_sizes[i % value_sizes.size()]);
+      batch->StringPut(key, GetRandomString(i));
+      batch->SortedPut(sorted_collection, key, value.substr(0, 1000));
+      batch->StringPut(key, value);
+      kvs[key] = value;
+    }
+    ASSERT_EQ(batch->Size(), 2 * kvs.size());
+    ASSERT_EQ(engine->BatchWrite(batch), Status::Ok);
+    batch->Clear();
+    ASSERT_EQ(batch->Size(), 0);
+
+    std::string got;
+    for (auto const& kv : kvs) {
+      ASSERT_EQ(engine->Get(kv.first, &got), Status::Ok);
+      ASSERT_EQ(got, kv.second);
+      ASSERT_EQ(engine->SortedGet(sorted_collection, kv.first, &got),
+                Status::Ok);
+      ASSERT_EQ(got, kv.second.substr(0, 1000));
+    }
+  }
+  delete engine;
+}
+
+TEST_F(BatchWriteTest, LookupInLargeBatch) {
+  WriteBatchImpl batch;
+  size_t num_keys = 100000;
+  for (size_t round = 0; round < 2; round++) {
+    for (size_t i = 0; i < num_keys; i++) {
+      std::string key = "key" + std::to_string(i);
+      std::string value = key + std::to_string(round);
+      batch.StringPut(key, value);
+      batch.SortedPut("sorted", key, value);
+      batch.HashPut("hash", key, value);
+      if (i % 2 == 1) {
+        batch.HashDelete("hash", key);
+      }
+    }
+    // Lookup before and after the lazy deduplication
+    for (size_t dedup = 0; dedup < 2; dedup++) {
+      for (size_t i = 0; i < num_keys; i++) {
+        std::string key = "key" + std::to_string(i);
+        std::string value = key + std::to_string(round);
+        auto string_op = batch.StringGet(key);
+        ASSERT_NE(string_op, nullptr);
+        ASSERT_EQ(string_view_2_string(string_op->value), value);
+        auto sorted_op = batch.SortedGet("sorted", key);
+        ASSERT_NE(sorted_op, nullptr);
+        ASSERT_EQ(string_view_2_string(sorted_op->value), value);
+        auto hash_op = batch.HashGet("hash", key);
+        ASSERT_NE(hash_op, nullptr);
+        ASSERT_EQ(hash_op->op, i % 2 == 1 ? WriteOp::Delete : WriteOp::Put);
+      }
+      ASSERT_EQ(batch.SortedGet("hash", "key0"), nullptr);
+      ASSERT_EQ(batch.StringGet("sorted"), nullptr);
+      ASSERT_EQ(batch.Size(), 3 * num_keys);
+    }
+  }
+  batch.Clear();
+  ASSERT_EQ(batch.StringGet("key0"), nullptr);
+  ASSERT_EQ(batch.Size(), 0);
+}
+
+TEST_F(BatchWriteTest, ConcurrentSmallBatches) {
+  // Small batches of concurrent threads are committed in groups
+  size_t num_threads = 16;
+  size_t num_batches = 1000;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  std::string hash_collection = "hash";
+  ASSERT_EQ(engine->HashCreate(hash_collection), Status::Ok);
+
+  auto BatchWrite = [&](size_t tid) {
+    auto batch = engine->WriteBatchCreate();
+    for (size_t i = 0; i < num_batches; i++) {
+      std::string key = std::to_string(tid) + "_" + std::to_string(i);
+      batch->StringPut(key, key);
+      batch->HashPut(hash_collection, key, key);
+      if (i % 3 == 0) {
+        batch->StringDelete(key);
+      }
+      ASSERT_EQ(engine->BatchWrite(batch), Status::Ok);
+      batch->Clear();
+    }
+  };
+
+  auto Check = [&](size_t tid) {
+    std::string got;
+    for (size_t i = 0; i < num_batches; i++) {
+      std::string key = std::to_string(tid) + "_" + std::to_string(i);
+      if (i % 3 == 0) {
+        ASSERT_EQ(engine->Get(key, &got), Status::NotFound);
+      } else {
+        ASSERT_EQ(engine->Get(key, &got), Status::Ok);
+        ASSERT_EQ(got, key);
+      }
+      ASSERT_EQ(engine->HashGet(hash_collection, key, &got), Status::Ok);
+      ASSERT_EQ(got, key);
+    }
+  };
+
+  LaunchNThreads(num_threads, BatchWrite);
+  LaunchNThreads(num_threads, Check);
+  Reboot();
+  LaunchNThreads(num_threads, Check);
+  size_t size;
+  ASSERT_EQ(engine->HashSize(hash_collection, &size), Status::Ok);
+  ASSERT_EQ(size, num_threads * num_batches);
+  delete engine;
+}
+
+TEST_F(BatchWriteTest, BatchLargerThanLogSpace) {
+  // Batch log space of a thread grows to hold a batch of millions ops
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  size_t num_keys = (1 << 20) + 1000;
+  auto batch = engine->WriteBatchCreate();
+  for (size_t i = 0; i < num_keys; i++) {
+    batch->StringPut("key" + std::to_string(i), std::to_string(i));
+  }
+  ASSERT_EQ(engine->BatchWrite(batch), Status::Ok);
+  ASSERT_EQ(engine->Put("small", "batch"), Status::Ok);
+
+  auto Check = [&]() {
+    std::string got;
+    for (size_t i = 0; i < num_keys; i += 997) {
+      ASSERT_EQ(engine->Get("key" + std::to_string(i), &got), Status::Ok);
+      ASSERT_EQ(got, std::to_string(i));
+    }
+    ASSERT_EQ(engine->Get("key" + std::to_string(num_keys - 1), &got),
+              Status::Ok);
+  };
+  Check();
+  Reboot();
+  Check();
+  delete engine;
+}
+
 TEST_F(BatchWriteTest, Hash) {
   size_t num_threads = 16;
   ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
@@ -1163,6 +1371,333 @@ TEST_F(EngineBasicTest, TestSeek) {
   delete engine;
 }
 
+TEST_F(EngineBasicTest, TestSortedIteratorBounds) {
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  std::string collection{"collection"};
+  ASSERT_EQ(engine->SortedCreate(collection), Status::Ok);
+  // a00 ~ a99, b00 ~ b99, with odd ones deleted
+  for (char c : {'a', 'b'}) {
+    for (int i = 0; i < 100; i++) {
+      std::string key = c + std::string(i < 10 ? "0" : "") + std::to_string(i);
+      ASSERT_EQ(engine->SortedPut(collection, key, key), Status::Ok);
+      if (i % 2 == 1) {
+        ASSERT_EQ(engine->SortedDelete(collection, key), Status::Ok);
+      }
+    }
+  }
+
+  auto scan = [&](const SortedIteratorOptions& options, bool forward) {
+    std::vector<std::string> keys;
+    auto iter = engine->SortedIteratorCreate(collection, nullptr, nullptr,
+                                             options);
+    EXPECT_NE(iter, nullptr);
+    if (forward) {
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        keys.push_back(iter->Key());
+      }
+    } else {
+      for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+        keys.push_back(iter->Key());
+      }
+    }
+    engine->SortedIteratorRelease(iter);
+    return keys;
+  };
+
+  SortedIteratorOptions options;
+  options.lower_bound = "a11";
+  options.upper_bound = "a20";
+  std::vector<std::string> expected{"a12", "a14", "a16", "a18"};
+  ASSERT_EQ(scan(options, true), expected);
+  std::reverse(expected.begin(), expected.end());
+  ASSERT_EQ(scan(options, false), expected);
+
+  options = SortedIteratorOptions();
+  options.prefix = "b9";
+  expected = {"b90", "b92", "b94", "b96", "b98"};
+  ASSERT_EQ(scan(options, true), expected);
+  std::reverse(expected.begin(), expected.end());
+  ASSERT_EQ(scan(options, false), expected);
+  options.upper_bound = "b95";
+  expected = {"b94", "b92", "b90"};
+  ASSERT_EQ(scan(options, false), expected);
+  options.prefix = "c";
+  ASSERT_TRUE(scan(options, true).empty());
+  ASSERT_TRUE(scan(options, false).empty());
+
+  options = SortedIteratorOptions();
+  options.lower_bound = "a50";
+  options.upper_bound = "b50";
+  auto iter =
+      engine->SortedIteratorCreate(collection, nullptr, nullptr, options);
+  ASSERT_NE(iter, nullptr);
+  // Seek and SeekForPrev on existing, deleted and out of bound keys
+  iter->Seek("a10");
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(iter->Key(), "a50");
+  iter->Seek("a51");
+  ASSERT_EQ(iter->Key(), "a52");
+  iter->Seek("b50");
+  ASSERT_FALSE(iter->Valid());
+  iter->SeekForPrev("a52");
+  ASSERT_EQ(iter->Key(), "a52");
+  iter->SeekForPrev("a53");
+  ASSERT_EQ(iter->Key(), "a52");
+  iter->Prev();
+  ASSERT_EQ(iter->Key(), "a50");
+  iter->Prev();
+  ASSERT_FALSE(iter->Valid());
+  iter->SeekForPrev("zzz");
+  ASSERT_EQ(iter->Key(), "b48");
+  iter->Next();
+  ASSERT_FALSE(iter->Valid());
+  iter->SeekForPrev("a49");
+  ASSERT_FALSE(iter->Valid());
+  engine->SortedIteratorRelease(iter);
+
+  // SeekForPrev without bounds
+  iter = engine->SortedIteratorCreate(collection);
+  ASSERT_NE(iter, nullptr);
+  iter->SeekForPrev("a");
+  ASSERT_FALSE(iter->Valid());
+  iter->SeekForPrev("a00");
+  ASSERT_EQ(iter->Key(), "a00");
+  iter->SeekForPrev("b");
+  ASSERT_EQ(iter->Key(), "a98");
+  iter->SeekForPrev("c");
+  ASSERT_EQ(iter->Key(), "b98");
+  engine->SortedIteratorRelease(iter);
+  delete engine;
+}
+
+TEST_F(EngineBasicTest, TestSortedIteratorBoundsCustomComparator) {
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  engine->registerComparator(
+      "reverse", [](const StringView& a, const StringView& b) -> int {
+        return compare_string_view(b, a);
+      });
+  std::string collection{"collection"};
+  SortedCollectionConfigs s_configs;
+  s_configs.comparator_name = "reverse";
+  ASSERT_EQ(engine->SortedCreate(collection, s_configs), Status::Ok);
+  // a00 ~ a99, b00 ~ b99, iterated from b99 to a00
+  for (char c : {'a', 'b'}) {
+    for (int i = 0; i < 100; i++) {
+      std::string key = c + std::string(i < 10 ? "0" : "") + std::to_string(i);
+      ASSERT_EQ(engine->SortedPut(collection, key, key), Status::Ok);
+    }
+  }
+
+  // Bounds are compared by the collection comparator
+  SortedIteratorOptions options;
+  options.lower_bound = "b02";
+  options.upper_bound = "a96";
+  std::vector<std::string> expected{"b02", "b01", "b00", "a99", "a98", "a97"};
+  std::vector<std::string> scanned;
+  auto iter =
+      engine->SortedIteratorCreate(collection, nullptr, nullptr, options);
+  ASSERT_NE(iter, nullptr);
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    scanned.push_back(iter->Key());
+  }
+  ASSERT_EQ(scanned, expected);
+  scanned.clear();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    scanned.push_back(iter->Key());
+  }
+  std::reverse(expected.begin(), expected.end());
+  ASSERT_EQ(scanned, expected);
+  iter->SeekForPrev("a00");
+  ASSERT_EQ(iter->Key(), "a97");
+  iter->SeekForPrev("b01");
+  ASSERT_EQ(iter->Key(), "b01");
+  iter->SeekForPrev("b50");
+  ASSERT_FALSE(iter->Valid());
+  engine->SortedIteratorRelease(iter);
+
+  std::vector<SortedIterator*> iters;
+  ASSERT_EQ(
+      engine->SortedPartitionIteratorsCreate(collection, 4, &iters, nullptr,
+                                             options),
+      Status::Ok);
+  scanned.clear();
+  for (SortedIterator* partition : iters) {
+    for (partition->SeekToFirst(); partition->Valid(); partition->Next()) {
+      scanned.push_back(partition->Key());
+    }
+    engine->SortedIteratorRelease(partition);
+  }
+  std::reverse(expected.begin(), expected.end());
+  ASSERT_EQ(scanned, expected);
+
+  // Keys with a prefix may not be adjacent in a custom order
+  options = SortedIteratorOptions();
+  options.prefix = "a";
+  Status s;
+  ASSERT_EQ(engine->SortedIteratorCreate(collection, nullptr, &s, options),
+            nullptr);
+  ASSERT_EQ(s, Status::InvalidArgument);
+  ASSERT_EQ(
+      engine->SortedPartitionIteratorsCreate(collection, 4, &iters, nullptr,
+                                             options),
+      Status::InvalidArgument);
+  ASSERT_TRUE(iters.empty());
+  delete engine;
+}
+
+TEST_F(EngineBasicTest, TestIteratorViews) {
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  std::string sorted{"sorted"};
+  std::string hash{"hash"};
+  std::string list{"list"};
+  ASSERT_EQ(engine->SortedCreate(sorted), Status::Ok);
+  ASSERT_EQ(engine->HashCreate(hash), Status::Ok);
+  ASSERT_EQ(engine->ListCreate(list), Status::Ok);
+  for (int i = 0; i < 10; i++) {
+    std::string key = "key" + std::to_string(i);
+    ASSERT_EQ(engine->SortedPut(sorted, key, "v" + key), Status::Ok);
+    ASSERT_EQ(engine->HashPut(hash, key, "v" + key), Status::Ok);
+    ASSERT_EQ(engine->ListPushBack(list, key), Status::Ok);
+  }
+
+  auto sorted_iter = engine->SortedIteratorCreate(sorted);
+  auto hash_iter = engine->HashIteratorCreate(hash);
+  auto list_iter = engine->ListIteratorCreate(list);
+  ASSERT_NE(sorted_iter, nullptr);
+  ASSERT_NE(hash_iter, nullptr);
+  ASSERT_NE(list_iter, nullptr);
+  sorted_iter->SeekToFirst();
+  hash_iter->SeekToFirst();
+  list_iter->SeekToFirst();
+  StringView sorted_value = sorted_iter->ValueView();
+  StringView hash_value = hash_iter->ValueView();
+  std::string hash_key = hash_iter->Key();
+  ASSERT_EQ(string_view_2_string(sorted_iter->KeyView()), "key0");
+  ASSERT_EQ(string_view_2_string(sorted_value), "vkey0");
+  ASSERT_EQ(string_view_2_string(hash_iter->KeyView()), hash_key);
+  ASSERT_EQ(string_view_2_string(hash_value), "v" + hash_key);
+  ASSERT_EQ(string_view_2_string(list_iter->ValueView()), "key0");
+
+  // Views are pinned by the iterator snapshot, not affected by updates
+  ASSERT_EQ(engine->SortedPut(sorted, "key0", "updated"), Status::Ok);
+  ASSERT_EQ(engine->HashPut(hash, hash_key, "updated"), Status::Ok);
+  ASSERT_EQ(string_view_2_string(sorted_value), "vkey0");
+  ASSERT_EQ(string_view_2_string(hash_value), "v" + hash_key);
+
+  int cnt = 0;
+  for (; sorted_iter->Valid(); sorted_iter->Next()) {
+    ASSERT_EQ(sorted_iter->Key(), string_view_2_string(sorted_iter->KeyView()));
+    ASSERT_EQ(sorted_iter->Value(),
+              string_view_2_string(sorted_iter->ValueView()));
+    cnt++;
+  }
+  ASSERT_EQ(cnt, 10);
+  cnt = 0;
+  for (; hash_iter->Valid(); hash_iter->Next()) {
+    ASSERT_EQ(hash_iter->Key(), string_view_2_string(hash_iter->KeyView()));
+    ASSERT_EQ(hash_iter->Value(), string_view_2_string(hash_iter->ValueView()));
+    cnt++;
+  }
+  ASSERT_EQ(cnt, 10);
+  cnt = 0;
+  for (; list_iter->Valid(); list_iter->Next()) {
+    ASSERT_EQ(list_iter->Value(), string_view_2_string(list_iter->ValueView()));
+    cnt++;
+  }
+  ASSERT_EQ(cnt, 10);
+  ASSERT_EQ(string_view_2_string(sorted_iter->KeyView()), "");
+
+  engine->SortedIteratorRelease(sorted_iter);
+  engine->HashIteratorRelease(hash_iter);
+  engine->ListIteratorRelease(list_iter);
+  delete engine;
+}
+
+TEST_F(EngineBasicTest, TestSortedPartitionIterators) {
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  std::string collection{"collection"};
+  std::vector<SortedIterator*> iters;
+  ASSERT_EQ(engine->SortedPartitionIteratorsCreate(collection, 4, &iters),
+            Status::NotFound);
+  ASSERT_EQ(engine->SortedCreate(collection), Status::Ok);
+  ASSERT_EQ(engine->SortedPartitionIteratorsCreate(collection, 0, &iters),
+            Status::InvalidArgument);
+
+  size_t num_keys = 20000;
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < num_keys; i++) {
+    std::string key = std::string(5 - std::to_string(i).size(), '0') +
+                      std::to_string(i);
+    ASSERT_EQ(engine->SortedPut(collection, key, key), Status::Ok);
+    if (i % 3 == 0) {
+      ASSERT_EQ(engine->SortedDelete(collection, key), Status::Ok);
+    } else {
+      keys.push_back(key);
+    }
+  }
+
+  size_t num_partitions = 8;
+  ASSERT_EQ(engine->SortedPartitionIteratorsCreate(collection, num_partitions,
+                                                   &iters),
+            Status::Ok);
+  ASSERT_GT(iters.size(), 1);
+  ASSERT_LE(iters.size(), num_partitions);
+  // Updates after creating iterators are not visible by them
+  ASSERT_EQ(engine->SortedPut(collection, "00000", "new"), Status::Ok);
+  ASSERT_EQ(engine->SortedDelete(collection, "00001"), Status::Ok);
+
+  std::vector<std::vector<std::string>> scanned(iters.size());
+  std::vector<std::thread> ths;
+  for (size_t i = 0; i < iters.size(); i++) {
+    ths.emplace_back([&, i]() {
+      for (iters[i]->SeekToFirst(); iters[i]->Valid(); iters[i]->Next()) {
+        scanned[i].push_back(iters[i]->Key());
+      }
+      // Release out of order, the snapshot is kept by the other iterators
+      engine->SortedIteratorRelease(iters[i]);
+    });
+  }
+  for (auto& t : ths) {
+    t.join();
+  }
+  std::vector<std::string> merged;
+  for (auto& partition : scanned) {
+    ASSERT_LT(partition.size(), keys.size());
+    merged.insert(merged.end(), partition.begin(), partition.end());
+  }
+  ASSERT_EQ(merged, keys);
+
+  // Split in bounds
+  SortedIteratorOptions options;
+  options.lower_bound = "05000";
+  options.upper_bound = "06000";
+  ASSERT_EQ(engine->SortedPartitionIteratorsCreate(collection, num_partitions,
+                                                   &iters, nullptr, options),
+            Status::Ok);
+  merged.clear();
+  for (size_t i = 0; i < iters.size(); i++) {
+    for (iters[i]->SeekToLast(); iters[i]->Valid(); iters[i]->Prev()) {
+      merged.push_back(iters[i]->Key());
+    }
+  }
+  for (SortedIterator* iter : iters) {
+    engine->SortedIteratorRelease(iter);
+  }
+  std::vector<std::string> expected;
+  for (const std::string& key : keys) {
+    if (key >= options.lower_bound && key < options.upper_bound) {
+      expected.push_back(key);
+    }
+  }
+  std::sort(merged.begin(), merged.end());
+  ASSERT_EQ(merged, expected);
+  delete engine;
+}
+
 TEST_F(EngineBasicTest, TestStringRestore) {
   size_t num_threads = 16;
   ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
@@ -1224,82 +1759,302 @@ TEST_F(EngineBasicTest, TestStringRestore) {
   delete engine;
 }
 
-TEST_F(EngineBasicTest, TestStringLargeValue) {
-  configs.pmem_block_size = (1UL << 6);
-  configs.pmem_segment_blocks = (1UL << 24);
+TEST_F(EngineBasicTest, TestIndexImageRestore) {
   ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
             Status::Ok);
-
-  for (size_t sz = 1024; sz < (1UL << 30); sz *= 2) {
-    std::string key{"large"};
-    std::string value(sz, 'a');
-    std::string sink;
-
-    ASSERT_EQ(engine->Put(key, value), Status::Ok);
-    ASSERT_EQ(engine->Get(key, &sink), Status::Ok);
-    ASSERT_EQ(value, sink);
+  std::string index_image = format_dir_path(db_path) + "index_image";
+  size_t count = 1000;
+  std::string sorted_collection{"sorted"};
+  std::string hash_collection{"hash"};
+  std::string list{"list"};
+  std::string destroyed_collection{"destroyed"};
+  ASSERT_EQ(engine->SortedCreate(sorted_collection), Status::Ok);
+  ASSERT_EQ(engine->HashCreate(hash_collection), Status::Ok);
+  ASSERT_EQ(engine->ListCreate(list), Status::Ok);
+  ASSERT_EQ(engine->SortedCreate(destroyed_collection), Status::Ok);
+  // Put keys, then update 1/3 of them and delete another 1/3
+  for (size_t i = 0; i < count; i++) {
+    std::string key = "key" + std::to_string(i);
+    std::string val = std::to_string(i);
+    ASSERT_EQ(engine->Put(key, val), Status::Ok);
+    ASSERT_EQ(engine->SortedPut(sorted_collection, key, val), Status::Ok);
+    ASSERT_EQ(engine->HashPut(hash_collection, key, val), Status::Ok);
+    ASSERT_EQ(engine->ListPushBack(list, val), Status::Ok);
+    ASSERT_EQ(engine->SortedPut(destroyed_collection, key, val), Status::Ok);
+    if (i % 3 == 0) {
+      ASSERT_EQ(engine->Put(key, val + "*"), Status::Ok);
+      ASSERT_EQ(engine->SortedPut(sorted_collection, key, val + "*"),
+                Status::Ok);
+      ASSERT_EQ(engine->HashPut(hash_collection, key, val + "*"), Status::Ok);
+    } else if (i % 3 == 1) {
+      ASSERT_EQ(engine->Delete(key), Status::Ok);
+      ASSERT_EQ(engine->SortedDelete(sorted_collection, key), Status::Ok);
+      ASSERT_EQ(engine->HashDelete(hash_collection, key), Status::Ok);
+    }
   }
-  delete engine;
-}
+  ASSERT_EQ(engine->SortedDestroy(destroyed_collection), Status::Ok);
 
-TEST_F(EngineBasicTest, TestSortedRestore) {
-  size_t num_threads = 16;
-  for (int opt_large_sorted_collection_recovery : {0, 1}) {
-    for (int index_with_hashtable : {0, 1}) {
-      SortedCollectionConfigs s_configs;
-      s_configs.index_with_hashtable = index_with_hashtable;
-      ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
-                Status::Ok);
-      // Test destroy a collction
-      std::string empty_skiplist("empty_skiplist");
-      size_t empty_skiplist_size;
-      ASSERT_EQ(engine->SortedCreate(empty_skiplist, s_configs), Status::Ok);
-      ASSERT_EQ(engine->SortedSize(empty_skiplist, &empty_skiplist_size),
+  auto Check = [&]() {
+    std::string got_val;
+    for (size_t i = 0; i < count; i++) {
+      std::string key = "key" + std::to_string(i);
+      std::string val = std::to_string(i);
+      if (i % 3 == 1) {
+        ASSERT_EQ(engine->Get(key, &got_val), Status::NotFound);
+        ASSERT_EQ(engine->SortedGet(sorted_collection, key, &got_val),
+                  Status::NotFound);
+        ASSERT_EQ(engine->HashGet(hash_collection, key, &got_val),
+                  Status::NotFound);
+        continue;
+      }
+      if (i % 3 == 0) {
+        val.append("*");
+      }
+      ASSERT_EQ(engine->Get(key, &got_val), Status::Ok);
+      ASSERT_EQ(got_val, val);
+      ASSERT_EQ(engine->SortedGet(sorted_collection, key, &got_val),
                 Status::Ok);
-      ASSERT_EQ(empty_skiplist_size, 0);
-      ASSERT_EQ(engine->SortedDestroy(empty_skiplist), Status::Ok);
-      ASSERT_EQ(engine->SortedSize(empty_skiplist, &empty_skiplist_size),
-                Status::NotFound);
-      // insert and delete some keys, then re-insert some deleted keys
-      int count = 100;
-      std::string global_skiplist =
-          std::to_string(index_with_hashtable) + "skiplist";
-      ASSERT_EQ(engine->SortedCreate(global_skiplist, s_configs), Status::Ok);
-      std::string thread_skiplist =
-          std::to_string(index_with_hashtable) + "t_skiplist";
-      auto PutupEngine = [&](uint32_t id) {
-        std::string key_prefix(id, 'a');
-        std::string got_val;
-        std::string t_skiplist(thread_skiplist + std::to_string(id));
-        ASSERT_EQ(engine->SortedCreate(t_skiplist, s_configs), Status::Ok);
-        for (int i = 1; i <= count; i++) {
-          auto key = key_prefix + std::to_string(i);
-          auto overall_val = std::to_string(i);
-          auto t_val = std::to_string(i * 2);
-          ASSERT_EQ(engine->SortedPut(global_skiplist, key, overall_val),
-                    Status::Ok);
-          ASSERT_EQ(engine->SortedPut(t_skiplist, key, t_val), Status::Ok);
-          ASSERT_EQ(engine->SortedGet(global_skiplist, key, &got_val),
-                    Status::Ok);
-          ASSERT_EQ(got_val, overall_val);
-          ASSERT_EQ(engine->SortedGet(t_skiplist, key, &got_val), Status::Ok);
-          ASSERT_EQ(got_val, t_val);
-          if (i % 2 == 1) {
-            ASSERT_EQ(engine->SortedDelete(global_skiplist, key), Status::Ok);
-            ASSERT_EQ(engine->SortedDelete(t_skiplist, key), Status::Ok);
-            ASSERT_EQ(engine->SortedGet(global_skiplist, key, &got_val),
-                      Status::NotFound);
-            ASSERT_EQ(engine->SortedGet(t_skiplist, key, &got_val),
-                      Status::NotFound);
-          }
-        }
-      };
+      ASSERT_EQ(got_val, val);
+      ASSERT_EQ(engine->HashGet(hash_collection, key, &got_val), Status::Ok);
+      ASSERT_EQ(got_val, val);
+    }
+    size_t list_size;
+    ASSERT_EQ(engine->ListSize(list, &list_size), Status::Ok);
+    ASSERT_EQ(list_size, count);
+    size_t sorted_size;
+    ASSERT_NE(engine->SortedSize(destroyed_collection, &sorted_size),
+              Status::Ok);
+  };
 
-      LaunchNThreads(num_threads, PutupEngine);
+  // Write new keys to space reused from the free list, and check they do not
+  // overwrite restored data
+  size_t round = 0;
+  auto WriteAndCheck = [&]() {
+    round++;
+    std::string got_val;
+    for (size_t i = 0; i < count; i++) {
+      std::string key = "new_key" + std::to_string(i);
+      ASSERT_EQ(engine->Put(key, std::to_string(round)), Status::Ok);
+    }
+    for (size_t i = 0; i < count; i++) {
+      std::string key = "new_key" + std::to_string(i);
+      ASSERT_EQ(engine->Get(key, &got_val), Status::Ok);
+      ASSERT_EQ(got_val, std::to_string(round));
+    }
+    Check();
+  };
 
-      delete engine;
+  Check();
+  delete engine;
+  // Restore from index image persisted on clean shutdown
+  ASSERT_TRUE(file_exist(index_image));
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  // Index image is discarded once opened
+  ASSERT_FALSE(file_exist(index_image));
+  Check();
+  WriteAndCheck();
 
-      GlobalLogger.Debug(
+  // Fall back to scan PMem if index image is missing
+  delete engine;
+  ASSERT_EQ(remove(index_image.c_str()), 0);
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  Check();
+  WriteAndCheck();
+
+  // Fall back to scan PMem if index image is corrupted
+  delete engine;
+  ASSERT_EQ(truncate(index_image.c_str(), sizeof(uint64_t) * 4), 0);
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  Check();
+  WriteAndCheck();
+
+  delete engine;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  WriteAndCheck();
+
+  // Refuse to open if the index image can't be removed, as it would be stale
+  // in next open
+  delete engine;
+  std::string blocker = index_image + "/blocker";
+  ASSERT_EQ(remove(index_image.c_str()), 0);
+  ASSERT_EQ(mkdir(index_image.c_str(), 0755), 0);
+  FILE* fp = fopen(blocker.c_str(), "w");
+  ASSERT_NE(fp, nullptr);
+  fclose(fp);
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::IOError);
+  ASSERT_EQ(system(("rm -rf " + index_image).c_str()), 0);
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  Check();
+  WriteAndCheck();
+  delete engine;
+}
+
+TEST_F(EngineBasicTest, TestLazyRecovery) {
+  configs.lazy_recovery_threads = 2;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  size_t count = 10000;
+  std::string sorted_collection{"sorted"};
+  ASSERT_EQ(engine->SortedCreate(sorted_collection), Status::Ok);
+  for (size_t i = 0; i < count; i++) {
+    std::string key = "key" + std::to_string(i);
+    ASSERT_EQ(engine->Put(key, key), Status::Ok);
+    ASSERT_EQ(engine->SortedPut(sorted_collection, key, key), Status::Ok);
+    if (i % 2 == 0) {
+      ASSERT_EQ(engine->Put(key, key + "*"), Status::Ok);
+    } else if (i % 3 == 0) {
+      ASSERT_EQ(engine->Delete(key), Status::Ok);
+    }
+  }
+
+  auto Check = [&]() {
+    std::string got_val;
+    for (size_t i = 0; i < count; i++) {
+      std::string key = "key" + std::to_string(i);
+      if (i % 2 != 0 && i % 3 == 0) {
+        ASSERT_EQ(engine->Get(key, &got_val), Status::NotFound);
+      } else {
+        ASSERT_EQ(engine->Get(key, &got_val), Status::Ok);
+        ASSERT_EQ(got_val, i % 2 == 0 ? key + "*" : key);
+      }
+      ASSERT_EQ(engine->SortedGet(sorted_collection, key, &got_val),
+                Status::Ok);
+      ASSERT_EQ(got_val, key);
+    }
+  };
+
+  // Hold background restoring, so keys are restored on demand by accessing
+  std::atomic<bool> hold{true};
+  SyncPoint::GetInstance()->SetCallBack(
+      "KVEngine::backgroundLazyRecovery::Start", [&](void*) {
+        while (hold) {
+          std::this_thread::yield();
+        }
+      });
+  SyncPoint::GetInstance()->EnableProcessing();
+
+  delete engine;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  // A written key should not be overwritten by restoring
+  ASSERT_EQ(engine->Put("key0", "key0*"), Status::Ok);
+  ASSERT_EQ(engine->Put("new_key", "new_val"), Status::Ok);
+  ASSERT_EQ(engine->SortedCreate(sorted_collection), Status::Existed);
+  Check();
+  hold = false;
+
+  delete engine;
+  SyncPoint::GetInstance()->DisableProcessing();
+  SyncPoint::GetInstance()->Reset();
+  // Restore lazily in background
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  Check();
+  std::string got_val;
+  ASSERT_EQ(engine->Get("new_key", &got_val), Status::Ok);
+  ASSERT_EQ(got_val, "new_val");
+  for (size_t i = 0; i < count; i++) {
+    ASSERT_EQ(engine->Put("new_key" + std::to_string(i), "new_val"),
+              Status::Ok);
+  }
+  Check();
+
+  // Restore eagerly
+  delete engine;
+  configs.lazy_recovery_threads = 0;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  Check();
+  for (size_t i = 0; i < count; i++) {
+    ASSERT_EQ(engine->Get("new_key" + std::to_string(i), &got_val),
+              Status::Ok);
+    ASSERT_EQ(got_val, "new_val");
+  }
+  delete engine;
+}
+
+TEST_F(EngineBasicTest, TestStringLargeValue) {
+  configs.pmem_block_size = (1UL << 6);
+  configs.pmem_segment_blocks = (1UL << 24);
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+
+  for (size_t sz = 1024; sz < (1UL << 30); sz *= 2) {
+    std::string key{"large"};
+    std::string value(sz, 'a');
+    std::string sink;
+
+    ASSERT_EQ(engine->Put(key, value), Status::Ok);
+    ASSERT_EQ(engine->Get(key, &sink), Status::Ok);
+    ASSERT_EQ(value, sink);
+  }
+  delete engine;
+}
+
+TEST_F(EngineBasicTest, TestSortedRestore) {
+  size_t num_threads = 16;
+  for (int opt_large_sorted_collection_recovery : {0, 1}) {
+    for (int index_with_hashtable : {0, 1}) {
+      SortedCollectionConfigs s_configs;
+      s_configs.index_with_hashtable = index_with_hashtable;
+      ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+                Status::Ok);
+      // Test destroy a collction
+      std::string empty_skiplist("empty_skiplist");
+      size_t empty_skiplist_size;
+      ASSERT_EQ(engine->SortedCreate(empty_skiplist, s_configs), Status::Ok);
+      ASSERT_EQ(engine->SortedSize(empty_skiplist, &empty_skiplist_size),
+                Status::Ok);
+      ASSERT_EQ(empty_skiplist_size, 0);
+      ASSERT_EQ(engine->SortedDestroy(empty_skiplist), Status::Ok);
+      ASSERT_EQ(engine->SortedSize(empty_skiplist, &empty_skiplist_size),
+                Status::NotFound);
+      // insert and delete some keys, then re-insert some deleted keys
+      int count = 100;
+      std::string global_skiplist =
+          std::to_string(index_with_hashtable) + "skiplist";
+      ASSERT_EQ(engine->SortedCreate(global_skiplist, s_configs), Status::Ok);
+      std::string thread_skiplist =
+          std::to_string(index_with_hashtable) + "t_skiplist";
+      auto PutupEngine = [&](uint32_t id) {
+        std::string key_prefix(id, 'a');
+        std::string got_val;
+        std::string t_skiplist(thread_skiplist + std::to_string(id));
+        ASSERT_EQ(engine->SortedCreate(t_skiplist, s_configs), Status::Ok);
+        for (int i = 1; i <= count; i++) {
+          auto key = key_prefix + std::to_string(i);
+          auto overall_val = std::to_string(i);
+          auto t_val = std::to_string(i * 2);
+          ASSERT_EQ(engine->SortedPut(global_skiplist, key, overall_val),
+                    Status::Ok);
+          ASSERT_EQ(engine->SortedPut(t_skiplist, key, t_val), Status::Ok);
+          ASSERT_EQ(engine->SortedGet(global_skiplist, key, &got_val),
+                    Status::Ok);
+          ASSERT_EQ(got_val, overall_val);
+          ASSERT_EQ(engine->SortedGet(t_skiplist, key, &got_val), Status::Ok);
+          ASSERT_EQ(got_val, t_val);
+          if (i % 2 == 1) {
+            ASSERT_EQ(engine->SortedDelete(global_skiplist, key), Status::Ok);
+            ASSERT_EQ(engine->SortedDelete(t_skiplist, key), Status::Ok);
+            ASSERT_EQ(engine->SortedGet(global_skiplist, key, &got_val),
+                      Status::NotFound);
+            ASSERT_EQ(engine->SortedGet(t_skiplist, key, &got_val),
+                      Status::NotFound);
+          }
+        }
+      };
+
+      LaunchNThreads(num_threads, PutupEngine);
+
+      delete engine;
+
+      GlobalLogger.Debug(
           "Restore with opt_large_sorted_collection_restore: %d\n",
           opt_large_sorted_collection_recovery);
       configs.opt_large_sorted_collection_recovery =
@@ -2058,129 +2813,949 @@ TEST_F(EngineBasicTest, TestSortedCustomCompareFunction) {
     } else {
       s = engine->SortedCreate(collections[i]);
     }
-    ASSERT_EQ(s, Status::Ok);
+    ASSERT_EQ(s, Status::Ok);
+  }
+  for (size_t i = 0; i < collections.size(); ++i) {
+    auto Write = [&](size_t) {
+      for (size_t j = 0; j < count; j++) {
+        ASSERT_EQ(engine->SortedPut(collections[i], key_values[j].first,
+                                    key_values[j].second),
+                  Status::Ok);
+      }
+    };
+    LaunchNThreads(num_threads, Write);
+  }
+
+  delete engine;
+  // Reopen engine error as the comparator is not registered in configs
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Abort);
+  ASSERT_TRUE(configs.comparator.RegisterComparator("collection0_cmp", cmp0));
+  ASSERT_TRUE(configs.comparator.RegisterComparator("collection1_cmp", cmp1));
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+
+  for (size_t i = 0; i < collections.size(); ++i) {
+    std::vector<kvpair> expected_res(dedup_kvs.begin(), dedup_kvs.end());
+    if (i == 0) {
+      std::sort(expected_res.begin(), expected_res.end(),
+                [&](const kvpair& a, const kvpair& b) -> bool {
+                  return cmp0(a.first, b.first) <= 0;
+                });
+
+    } else if (i == 1) {
+      std::sort(expected_res.begin(), expected_res.end(),
+                [&](const kvpair& a, const kvpair& b) -> bool {
+                  return cmp1(a.first, b.first) <= 0;
+                });
+    }
+    auto iter = engine->SortedIteratorCreate(collections[i]);
+    ASSERT_TRUE(iter != nullptr);
+    iter->SeekToFirst();
+    size_t cnt = 0;
+    while (iter->Valid()) {
+      std::string key = iter->Key();
+      std::string val = iter->Value();
+      ASSERT_EQ(key, expected_res[cnt].first);
+      ASSERT_EQ(val, expected_res[cnt].second);
+      iter->Next();
+      cnt++;
+    }
+    engine->SortedIteratorRelease(iter);
+  }
+  delete engine;
+}
+
+TEST_F(EngineBasicTest, TestHashTableIterator) {
+  size_t num_threads = 32;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  std::string collection_name = "sortedcollection";
+  engine->SortedCreate(collection_name);
+  auto MixedPut = [&](size_t id) {
+    if (id % 2 == 0) {
+      ASSERT_EQ(engine->Put("stringkey" + std::to_string(id), "stringval"),
+                Status::Ok);
+    } else {
+      ASSERT_EQ(
+          engine->SortedPut(collection_name, "sortedkey" + std::to_string(id),
+                            "sortedval"),
+          Status::Ok);
+    }
+  };
+  LaunchNThreads(num_threads, MixedPut);
+
+  auto test_kvengine = static_cast<KVEngine*>(engine);
+  auto hash_table = test_kvengine->GetHashTable();
+  size_t total_entry_num = 0;
+  // Hash Table Iterator
+  // scan hash table with locked slot.
+  {
+    auto hashtable_iter = hash_table->GetIterator(0, hash_table->GetSlotsNum());
+    while (hashtable_iter.Valid()) {
+      auto slot_iter = hashtable_iter.Slot();
+      while (slot_iter.Valid()) {
+        switch (slot_iter->GetIndexType()) {
+          case PointerType::StringRecord: {
+            total_entry_num++;
+            ASSERT_EQ(string_view_2_string(
+                          slot_iter->GetIndex().string_record->Value()),
+                      "stringval");
+            break;
+          }
+          case PointerType::Skiplist: {
+            total_entry_num++;
+            ASSERT_EQ(
+                string_view_2_string(slot_iter->GetIndex().skiplist->Name()),
+                collection_name);
+            break;
+          }
+          case PointerType::SkiplistNode: {
+            total_entry_num++;
+            ASSERT_EQ(string_view_2_string(
+                          slot_iter->GetIndex().skiplist_node->record->Value()),
+                      "sortedval");
+            break;
+          }
+          case PointerType::DLRecord: {
+            total_entry_num++;
+            ASSERT_EQ(
+                string_view_2_string(slot_iter->GetIndex().dl_record->Value()),
+                "sortedval");
+            break;
+          }
+          default:
+            ASSERT_EQ((slot_iter->GetIndexType() == PointerType::Invalid) ||
+                          (slot_iter->GetIndexType() == PointerType::Empty),
+                      true);
+            break;
+        }
+        slot_iter++;
+      }
+      hashtable_iter.Next();
+    }
+    ASSERT_EQ(total_entry_num, num_threads + 1);
+  }
+  delete engine;
+}
+
+TEST_F(EngineBasicTest, TestHashTableResize) {
+  size_t num_threads = 8;
+  size_t num_keys_per_thread = 5000;
+  configs.hash_table_max_load_factor = 1.0;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  auto hash_table = static_cast<KVEngine*>(engine)->GetHashTable();
+  uint64_t init_buckets_num = hash_table->GetBucketsNum();
+  ASSERT_EQ(init_buckets_num, configs.hash_bucket_num);
+
+  std::string collection_name = "sortedcollection";
+  std::string hash_collection = "hashcollection";
+  ASSERT_EQ(engine->SortedCreate(collection_name), Status::Ok);
+  ASSERT_EQ(engine->HashCreate(hash_collection), Status::Ok);
+  // Read and write while resizing, transactions also look up collections
+  // locklessly
+  auto PutAndGet = [&](size_t id) {
+    std::string value;
+    auto txn = engine->TransactionCreate();
+    TransactionOptions options;
+    options.optimistic = true;
+    auto optimistic_txn = engine->TransactionCreate(options);
+    for (size_t i = 0; i < num_keys_per_thread; i++) {
+      std::string key = std::to_string(id) + "key" + std::to_string(i);
+      if (i % 2 == 0) {
+        ASSERT_EQ(engine->Put(key, key), Status::Ok);
+        ASSERT_EQ(engine->Get(key, &value), Status::Ok);
+      } else {
+        ASSERT_EQ(engine->SortedPut(collection_name, key, key), Status::Ok);
+        ASSERT_EQ(engine->SortedGet(collection_name, key, &value), Status::Ok);
+      }
+      ASSERT_EQ(value, key);
+      if (i % 8 == 1) {
+        // Retry transactions that died on conflicts with older ones
+        Status s;
+        do {
+          txn->Rollback();
+          s = txn->HashPut(hash_collection, key, key);
+          if (s == Status::Ok) {
+            s = txn->SortedGet(collection_name, key, &value);
+          }
+          if (s == Status::Ok) {
+            s = txn->Commit();
+          }
+        } while (s == Status::Timeout);
+        ASSERT_EQ(s, Status::Ok);
+        do {
+          txn->Rollback();
+          s = txn->HashGet(hash_collection, key, &value);
+        } while (s == Status::Timeout);
+        ASSERT_EQ(s, Status::Ok);
+        ASSERT_EQ(value, key);
+        txn->Rollback();
+
+        ASSERT_EQ(optimistic_txn->SortedPut(collection_name, key, key),
+                  Status::Ok);
+        ASSERT_EQ(optimistic_txn->HashDelete(hash_collection, key),
+                  Status::Ok);
+        optimistic_txn->Rollback();
+      }
+    }
+  };
+  LaunchNThreads(num_threads, PutAndGet);
+
+  auto CheckKeys = [&](size_t id) {
+    std::string value;
+    for (size_t i = 0; i < num_keys_per_thread; i++) {
+      std::string key = std::to_string(id) + "key" + std::to_string(i);
+      if (i % 2 == 0) {
+        ASSERT_EQ(engine->Get(key, &value), Status::Ok);
+      } else {
+        ASSERT_EQ(engine->SortedGet(collection_name, key, &value), Status::Ok);
+      }
+      ASSERT_EQ(value, key);
+    }
+  };
+
+  // Wait background thread grows hash table to fit all keys
+  uint64_t expected_buckets_num = init_buckets_num;
+  while (expected_buckets_num < num_threads * num_keys_per_thread) {
+    expected_buckets_num *= 2;
+  }
+  for (int i = 0; i < 100; i++) {
+    if (hash_table->GetBucketsNum() >= expected_buckets_num &&
+        !hash_table->Resizing()) {
+      break;
+    }
+    LaunchNThreads(num_threads, CheckKeys);
+  }
+  ASSERT_GE(hash_table->GetBucketsNum(), expected_buckets_num);
+  LaunchNThreads(num_threads, CheckKeys);
+
+  // Hash table is rebuilt with initial size on recovery
+  Reboot();
+  LaunchNThreads(num_threads, CheckKeys);
+  delete engine;
+}
+
+TEST_F(EngineBasicTest, TestPMemCompaction) {
+  uint64_t segment_size = configs.pmem_block_size * configs.pmem_segment_blocks;
+  configs.pmem_file_size = 32 * segment_size;
+  configs.pmem_compaction_usage_ratio = 0.5;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  std::string sorted_collection = "sorted";
+  std::string hash_collection = "hash";
+  ASSERT_EQ(engine->SortedCreate(sorted_collection), Status::Ok);
+  ASSERT_EQ(engine->HashCreate(hash_collection), Status::Ok);
+
+  // Records of slab size classes
+  size_t num_keys = 10000;
+  std::string small_value(150, 'v');
+  for (size_t i = 0; i < num_keys; i++) {
+    std::string key = "key" + std::to_string(i);
+    ASSERT_EQ(engine->Put(key, small_value + key), Status::Ok);
+    ASSERT_EQ(engine->SortedPut(sorted_collection, key, small_value + key),
+              Status::Ok);
+    ASSERT_EQ(engine->HashPut(hash_collection, key, small_value + key),
+              Status::Ok);
+  }
+  // Leave pinned records scattered in segments
+  for (size_t i = 0; i < num_keys; i++) {
+    if (i % 8 != 0) {
+      std::string key = "key" + std::to_string(i);
+      ASSERT_EQ(engine->Delete(key), Status::Ok);
+      ASSERT_EQ(engine->SortedDelete(sorted_collection, key), Status::Ok);
+      ASSERT_EQ(engine->HashDelete(hash_collection, key), Status::Ok);
+    }
+  }
+
+  // Large records can't reuse space freed by small ones until the fragmented
+  // segments compacted
+  size_t num_large_keys = 80;
+  std::string large_value(100 << 10, 'l');
+  for (size_t i = 0; i < num_large_keys; i++) {
+    std::string key = "large" + std::to_string(i);
+    Status s;
+    for (int retry = 0; retry < 300; retry++) {
+      s = engine->Put(key, large_value + key);
+      if (s != Status::PmemOverflow) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_EQ(s, Status::Ok);
+  }
+
+  auto CheckKeys = [&]() {
+    std::string value;
+    for (size_t i = 0; i < num_keys; i++) {
+      std::string key = "key" + std::to_string(i);
+      if (i % 8 != 0) {
+        ASSERT_EQ(engine->Get(key, &value), Status::NotFound);
+        ASSERT_EQ(engine->SortedGet(sorted_collection, key, &value),
+                  Status::NotFound);
+        ASSERT_EQ(engine->HashGet(hash_collection, key, &value),
+                  Status::NotFound);
+        continue;
+      }
+      ASSERT_EQ(engine->Get(key, &value), Status::Ok);
+      ASSERT_EQ(value, small_value + key);
+      ASSERT_EQ(engine->SortedGet(sorted_collection, key, &value), Status::Ok);
+      ASSERT_EQ(value, small_value + key);
+      ASSERT_EQ(engine->HashGet(hash_collection, key, &value), Status::Ok);
+      ASSERT_EQ(value, small_value + key);
+    }
+    for (size_t i = 0; i < num_large_keys; i++) {
+      std::string key = "large" + std::to_string(i);
+      ASSERT_EQ(engine->Get(key, &value), Status::Ok);
+      ASSERT_EQ(value, large_value + key);
+    }
+    size_t sorted_size;
+    ASSERT_EQ(engine->SortedSize(sorted_collection, &sorted_size), Status::Ok);
+    ASSERT_EQ(sorted_size, num_keys / 8);
+  };
+  CheckKeys();
+
+  // Relocated records are recovered
+  Reboot();
+  CheckKeys();
+  delete engine;
+}
+
+TEST_F(EngineBasicTest, TestPMemPoolGrowth) {
+  uint64_t segment_size = configs.pmem_block_size * configs.pmem_segment_blocks;
+  configs.pmem_file_size = 16 * segment_size;
+  configs.pmem_max_file_num = 4;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  std::string sorted_collection = "sorted";
+  ASSERT_EQ(engine->SortedCreate(sorted_collection), Status::Ok);
+
+  // Write more data than a pool file
+  size_t num_keys = 200;
+  std::string value(100 << 10, 'v');
+  for (size_t i = 0; i < num_keys; i++) {
+    std::string key = "key" + std::to_string(i);
+    ASSERT_EQ(engine->Put(key, value + key), Status::Ok);
+    ASSERT_EQ(engine->SortedPut(sorted_collection, key, key), Status::Ok);
+  }
+  ASSERT_TRUE(file_exist(format_dir_path(db_path) + "data.1"));
+  ASSERT_TRUE(file_exist(format_dir_path(db_path) + "data.2"));
+
+  auto CheckKeys = [&]() {
+    std::string got;
+    for (size_t i = 0; i < num_keys; i++) {
+      std::string key = "key" + std::to_string(i);
+      ASSERT_EQ(engine->Get(key, &got), Status::Ok);
+      ASSERT_EQ(got, value + key);
+      ASSERT_EQ(engine->SortedGet(sorted_collection, key, &got), Status::Ok);
+      ASSERT_EQ(got, key);
+    }
+    size_t sorted_size;
+    ASSERT_EQ(engine->SortedSize(sorted_collection, &sorted_size), Status::Ok);
+    ASSERT_EQ(sorted_size, num_keys);
+  };
+  CheckKeys();
+
+  // Records in all pool files are recovered from index image or by scanning
+  Reboot();
+  CheckKeys();
+  configs.persist_index_image = false;
+  Reboot();
+  Reboot();
+  CheckKeys();
+  delete engine;
+
+  // Existing pool files exceed the max number
+  configs.pmem_max_file_num = 2;
+  ASSERT_NE(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+}
+
+TEST_F(EngineBasicTest, TestNumaPools) {
+  uint64_t segment_size = configs.pmem_block_size * configs.pmem_segment_blocks;
+  configs.pmem_file_size = 16 * segment_size;
+  configs.pmem_max_file_num = 2;
+  std::vector<std::string> numa_dirs{format_dir_path(db_path) + "node0",
+                                     format_dir_path(db_path) + "node1"};
+  configs.pmem_numa_dirs = numa_dirs;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  for (const std::string& dir : numa_dirs) {
+    ASSERT_TRUE(file_exist(format_dir_path(dir) + "data"));
+  }
+  std::string sorted_collection = "sorted";
+  ASSERT_EQ(engine->SortedCreate(sorted_collection), Status::Ok);
+
+  // Write more data than max pool files of a NUMA pool
+  size_t num_keys = 200;
+  std::string value(100 << 10, 'v');
+  for (size_t i = 0; i < num_keys; i++) {
+    std::string key = "key" + std::to_string(i);
+    ASSERT_EQ(engine->Put(key, value + key), Status::Ok);
+    ASSERT_EQ(engine->SortedPut(sorted_collection, key, key), Status::Ok);
+  }
+  ASSERT_TRUE(file_exist(format_dir_path(numa_dirs[0]) + "data.1") ||
+              file_exist(format_dir_path(numa_dirs[1]) + "data.1"));
+
+  auto CheckKeys = [&]() {
+    std::string got;
+    for (size_t i = 0; i < num_keys; i++) {
+      std::string key = "key" + std::to_string(i);
+      ASSERT_EQ(engine->Get(key, &got), Status::Ok);
+      ASSERT_EQ(got, value + key);
+      ASSERT_EQ(engine->SortedGet(sorted_collection, key, &got), Status::Ok);
+      ASSERT_EQ(got, key);
+    }
+  };
+  CheckKeys();
+
+  // Records in all NUMA pools are recovered from index image or by scanning
+  Reboot();
+  CheckKeys();
+  configs.persist_index_image = false;
+  Reboot();
+  Reboot();
+  CheckKeys();
+
+  // Max pool files are persisted with NUMA pools
+  configs.pmem_max_file_num = 4;
+  Reboot();
+  CheckKeys();
+  delete engine;
+  engine = nullptr;
+
+  // NUMA pools can't be changed after created
+  configs.pmem_numa_dirs.pop_back();
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::InvalidConfiguration);
+  configs.pmem_numa_dirs.clear();
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::InvalidConfiguration);
+}
+
+TEST_F(EngineBasicTest, TestShardedEngine) {
+  uint64_t segment_size = configs.pmem_block_size * configs.pmem_segment_blocks;
+  configs.pmem_file_size = 64 * segment_size;
+  uint32_t num_shards = 3;
+  configs.num_shards = num_shards;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  ShardedEngine* sharded = dynamic_cast<ShardedEngine*>(engine);
+  ASSERT_NE(sharded, nullptr);
+  for (uint32_t i = 0; i < num_shards; i++) {
+    ASSERT_TRUE(file_exist(format_dir_path(db_path) + "shard" +
+                           std::to_string(i) + "/data"));
+  }
+
+  // Strings are spread to all shards
+  size_t num_keys = 300;
+  std::vector<size_t> shard_keys(num_shards, 0);
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < num_keys; i++) {
+    keys.push_back("key" + std::to_string(i));
+    ASSERT_EQ(engine->Put(keys.back(), "value" + keys.back()), Status::Ok);
+    shard_keys[sharded->ShardIndex(keys.back())]++;
+  }
+  for (uint32_t i = 0; i < num_shards; i++) {
+    ASSERT_GT(shard_keys[i], 0);
+  }
+  keys.push_back("not existed");
+  std::vector<StringView> key_views(keys.begin(), keys.end());
+  std::vector<std::string> values;
+  std::vector<Status> statuses;
+  ASSERT_EQ(engine->MultiGet(key_views, &values, &statuses), Status::Ok);
+  for (size_t i = 0; i < num_keys; i++) {
+    ASSERT_EQ(statuses[i], Status::Ok);
+    ASSERT_EQ(values[i], "value" + keys[i]);
+  }
+  ASSERT_EQ(statuses[num_keys], Status::NotFound);
+
+  // Keys and collections with the same tag are in the same shard
+  std::string sorted = "{user}sorted";
+  std::string hash = "{user}hash";
+  std::string list = "{user}list";
+  std::string tagged_key = "{user}key";
+  ASSERT_EQ(sharded->ShardIndex(sorted), sharded->ShardIndex(tagged_key));
+  ASSERT_EQ(sharded->ShardIndex(sorted), sharded->ShardIndex("user"));
+  ASSERT_EQ(engine->SortedCreate(sorted), Status::Ok);
+  ASSERT_EQ(engine->HashCreate(hash), Status::Ok);
+  ASSERT_EQ(engine->ListCreate(list), Status::Ok);
+  std::string other_list;
+  for (size_t i = 0; other_list.empty(); i++) {
+    std::string name = "list" + std::to_string(i);
+    if (sharded->ShardIndex(name) != sharded->ShardIndex(list)) {
+      other_list = name;
+    }
+  }
+  ASSERT_EQ(engine->ListCreate(other_list), Status::Ok);
+  ASSERT_EQ(engine->ListPushBack(list, "elem"), Status::Ok);
+  std::string got;
+  ASSERT_EQ(engine->ListMove(list, ListPos::Front, other_list, ListPos::Back,
+                             &got),
+            Status::NotSupported);
+
+  // A transaction touching another shard fails and rollbacks on commit
+  auto txn = engine->TransactionCreate();
+  ASSERT_EQ(txn->StringPut(tagged_key, "txn"), Status::Ok);
+  ASSERT_EQ(txn->StringPut(other_list, "txn"), Status::NotSupported);
+  ASSERT_EQ(txn->HashPut(hash, "txn", "txn"), Status::NotSupported);
+  ASSERT_EQ(txn->InternalStatus(), Status::NotSupported);
+  ASSERT_EQ(txn->Commit(), Status::NotSupported);
+  ASSERT_EQ(engine->Get(tagged_key, &got), Status::NotFound);
+  ASSERT_EQ(engine->HashGet(hash, "txn", &got), Status::NotFound);
+
+  // A transaction on a single shard
+  ASSERT_EQ(txn->StringPut(tagged_key, "txn"), Status::Ok);
+  ASSERT_EQ(txn->SortedPut(sorted, "txn", "txn"), Status::Ok);
+  ASSERT_EQ(txn->HashPut(hash, "txn", "txn"), Status::Ok);
+  ASSERT_EQ(txn->Commit(), Status::Ok);
+  ASSERT_EQ(engine->Get(tagged_key, &got), Status::Ok);
+  ASSERT_EQ(got, "txn");
+  ASSERT_EQ(engine->HashGet(hash, "txn", &got), Status::Ok);
+  ASSERT_EQ(got, "txn");
+  ASSERT_EQ(engine->Get(other_list, &got), Status::WrongType);
+
+  // A batch across shards failed on a shard writes nothing on all shards
+  auto batch = engine->WriteBatchCreate();
+  for (size_t i = 0; i < num_keys; i++) {
+    batch->StringPut(keys[i], "batch" + keys[i]);
+    batch->SortedPut(sorted, keys[i], keys[i]);
+  }
+  batch->HashPut("not existed hash", "key", "value");
+  ASSERT_EQ(engine->BatchWrite(batch), Status::NotFound);
+  for (size_t i = 0; i < num_keys; i++) {
+    ASSERT_EQ(engine->Get(keys[i], &got), Status::Ok);
+    ASSERT_EQ(got, "value" + keys[i]);
+  }
+  size_t sorted_size;
+  ASSERT_EQ(engine->SortedSize(sorted, &sorted_size), Status::Ok);
+  ASSERT_EQ(sorted_size, 1);
+
+  // A batch across shards is committed on all shards
+  batch->Clear();
+  for (size_t i = 0; i < num_keys; i++) {
+    batch->StringPut(keys[i], "batch" + keys[i]);
+    batch->SortedPut(sorted, keys[i], keys[i]);
+  }
+  ASSERT_EQ(engine->BatchWrite(batch), Status::Ok);
+  for (size_t i = 0; i < num_keys; i++) {
+    ASSERT_EQ(engine->Get(keys[i], &got), Status::Ok);
+    ASSERT_EQ(got, "batch" + keys[i]);
+  }
+  ASSERT_EQ(engine->SortedSize(sorted, &sorted_size), Status::Ok);
+  ASSERT_EQ(sorted_size, num_keys + 1);
+
+  // A batch on a single shard
+  batch->Clear();
+  for (size_t i = 0; i < num_keys; i++) {
+    batch->StringPut("{user}" + keys[i], "batch" + keys[i]);
+    batch->SortedPut(sorted, keys[i], keys[i]);
+  }
+  batch->StringDelete("{user}" + keys[0]);
+  ASSERT_EQ(engine->BatchWrite(batch), Status::Ok);
+
+  auto CheckData = [&]() {
+    std::string value;
+    ASSERT_EQ(engine->Get("{user}" + keys[0], &value), Status::NotFound);
+    for (size_t i = 1; i < num_keys; i++) {
+      ASSERT_EQ(engine->Get("{user}" + keys[i], &value), Status::Ok);
+      ASSERT_EQ(value, "batch" + keys[i]);
+    }
+    size_t size;
+    ASSERT_EQ(engine->SortedSize(sorted, &size), Status::Ok);
+    ASSERT_EQ(size, num_keys + 1);
+  };
+  CheckData();
+
+  // Iterate and backup on a snapshot of all shards
+  Snapshot* snapshot = engine->GetSnapshot(false);
+  ASSERT_EQ(engine->SortedPut(sorted, "after snapshot", ""), Status::Ok);
+  SortedIterator* iter = engine->SortedIteratorCreate(sorted, snapshot);
+  ASSERT_NE(iter, nullptr);
+  size_t cnt = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    cnt++;
+  }
+  ASSERT_EQ(cnt, num_keys + 1);
+  engine->SortedIteratorRelease(iter);
+  ASSERT_EQ(engine->Backup(backup_log, snapshot), Status::Ok);
+  engine->ReleaseSnapshot(snapshot);
+  ASSERT_EQ(engine->SortedDelete(sorted, "after snapshot"), Status::Ok);
+
+  Reboot();
+  CheckData();
+  delete engine;
+  engine = nullptr;
+
+  Engine* restored = nullptr;
+  ASSERT_EQ(Engine::Restore(backup_path, backup_log, &restored, configs,
+                            stdout),
+            Status::Ok);
+  std::swap(engine, restored);
+  CheckData();
+  std::swap(engine, restored);
+  delete restored;
+  for (uint32_t i = 0; i < num_shards; i++) {
+    remove((backup_log + "." + std::to_string(i)).c_str());
+  }
+
+  // The number of shards can't be changed after created
+  configs.num_shards = 2;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::InvalidConfiguration);
+  configs.num_shards = 1;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::InvalidConfiguration);
+  Destroy();
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  delete engine;
+  engine = nullptr;
+  configs.num_shards = num_shards;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::InvalidConfiguration);
+}
+
+TEST_F(EngineBasicTest, TestShardCpus) {
+  uint64_t segment_size = configs.pmem_block_size * configs.pmem_segment_blocks;
+  configs.pmem_file_size = 64 * segment_size;
+  configs.num_shards = 2;
+  cpu_set_t allowed;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+  uint32_t cpu = 0;
+  while (!CPU_ISSET(cpu, &allowed)) {
+    cpu++;
+  }
+
+  // An entry for each shard is required
+  configs.shard_cpus = {{cpu}};
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::InvalidConfiguration);
+  configs.shard_cpus = {{cpu}, {}};
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::InvalidConfiguration);
+
+  configs.shard_cpus = {{cpu}, {cpu}};
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  ASSERT_EQ(engine->Put("key", "value"), Status::Ok);
+  Snapshot* snapshot = engine->GetSnapshot(false);
+  ASSERT_EQ(engine->Backup(backup_log, snapshot), Status::Ok);
+  engine->ReleaseSnapshot(snapshot);
+  for (uint32_t i = 0; i < configs.num_shards; i++) {
+    remove((backup_log + "." + std::to_string(i)).c_str());
+  }
+
+  // Shards are opened and backed up on their own threads, the caller is not
+  // bound
+  cpu_set_t current;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(current), &current), 0);
+  ASSERT_TRUE(CPU_EQUAL(&current, &allowed));
+  delete engine;
+  engine = nullptr;
+}
+
+TEST_F(EngineBasicTest, TestShardedSnapshot) {
+  uint64_t segment_size = configs.pmem_block_size * configs.pmem_segment_blocks;
+  configs.pmem_file_size = 64 * segment_size;
+  uint32_t num_shards = 3;
+  configs.num_shards = num_shards;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  ShardedEngine* sharded = dynamic_cast<ShardedEngine*>(engine);
+  ASSERT_NE(sharded, nullptr);
+
+  // A sorted collection on each shard, cross-shard batches put the same value
+  // to all of them
+  std::vector<std::string> collections(num_shards);
+  for (size_t i = 0, created = 0; created < num_shards; i++) {
+    std::string name = "sorted" + std::to_string(i);
+    std::string& collection = collections[sharded->ShardIndex(name)];
+    if (collection.empty()) {
+      collection = name;
+      ASSERT_EQ(engine->SortedCreate(collection), Status::Ok);
+      created++;
+    }
   }
-  for (size_t i = 0; i < collections.size(); ++i) {
-    auto Write = [&](size_t) {
-      for (size_t j = 0; j < count; j++) {
-        ASSERT_EQ(engine->SortedPut(collections[i], key_values[j].first,
-                                    key_values[j].second),
-                  Status::Ok);
+  auto BatchPut = [&](size_t value) {
+    auto batch = engine->WriteBatchCreate();
+    for (auto const& collection : collections) {
+      batch->SortedPut(collection, "key", std::to_string(value));
+    }
+    ASSERT_EQ(engine->BatchWrite(batch), Status::Ok);
+  };
+  BatchPut(0);
+
+  std::atomic<bool> stop{false};
+  std::atomic<size_t> next_value{1};
+  std::vector<std::thread> writers;
+  for (size_t i = 0; i < 4; i++) {
+    writers.emplace_back([&]() {
+      while (!stop.load()) {
+        BatchPut(next_value.fetch_add(1));
       }
-    };
-    LaunchNThreads(num_threads, Write);
+    });
   }
 
+  // Snapshots of all shards see the same batch
+  for (size_t round = 0; round < 5000; round++) {
+    Snapshot* snapshot = engine->GetSnapshot(false);
+    std::vector<std::string> values;
+    for (auto const& collection : collections) {
+      SortedIterator* iter =
+          engine->SortedIteratorCreate(collection, snapshot);
+      ASSERT_NE(iter, nullptr);
+      iter->SeekToFirst();
+      ASSERT_TRUE(iter->Valid());
+      values.push_back(iter->Value());
+      engine->SortedIteratorRelease(iter);
+    }
+    engine->ReleaseSnapshot(snapshot);
+    for (auto const& value : values) {
+      ASSERT_EQ(value, values[0]);
+    }
+  }
+  stop.store(true);
+  for (auto& writer : writers) {
+    writer.join();
+  }
   delete engine;
-  // Reopen engine error as the comparator is not registered in configs
+  engine = nullptr;
+}
+
+TEST_F(EngineBasicTest, TestLargeValue) {
+  uint64_t segment_size = configs.pmem_block_size * configs.pmem_segment_blocks;
+  configs.pmem_file_size = 256 * segment_size;
+  configs.large_value_threshold = 64 << 10;
   ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
-            Status::Abort);
-  ASSERT_TRUE(configs.comparator.RegisterComparator("collection0_cmp", cmp0));
-  ASSERT_TRUE(configs.comparator.RegisterComparator("collection1_cmp", cmp1));
+            Status::Ok);
+
+  // Values in a single extent, across several extents, and inline
+  std::map<std::string, std::string> kvs;
+  kvs["extent"] = GetRandomString(100 << 10);
+  kvs["extents"] = GetRandomString(3 * segment_size + 123);
+  kvs["inline"] = GetRandomString(1 << 10);
+  kvs["deleted"] = GetRandomString(segment_size);
+  kvs["overwritten"] = GetRandomString(2 * segment_size);
+  for (auto& kv : kvs) {
+    ASSERT_EQ(engine->Put(kv.first, kv.second), Status::Ok);
+  }
+  ASSERT_EQ(engine->Delete("deleted"), Status::Ok);
+  kvs.erase("deleted");
+  kvs["overwritten"] = GetRandomString(segment_size / 2);
+  ASSERT_EQ(engine->Put("overwritten", kvs["overwritten"]), Status::Ok);
+
+  auto batch = engine->WriteBatchCreate();
+  kvs["batch"] = GetRandomString(2 * segment_size);
+  batch->StringPut("batch", kvs["batch"]);
+  ASSERT_EQ(engine->BatchWrite(batch), Status::Ok);
+
+  std::string appended = GetRandomString(segment_size);
+  auto Append = [&](const std::string* old_value, std::string* new_value,
+                    void*) {
+    *new_value = *old_value + appended;
+    return ModifyOperation::Write;
+  };
+  ASSERT_EQ(engine->Modify("extent", Append, nullptr), Status::Ok);
+  kvs["extent"] += appended;
+
+  auto CheckKVs = [&]() {
+    std::string got;
+    for (auto& kv : kvs) {
+      ASSERT_EQ(engine->Get(kv.first, &got), Status::Ok);
+      ASSERT_EQ(got, kv.second);
+    }
+    ASSERT_EQ(engine->Get("deleted", &got), Status::NotFound);
+    std::vector<StringView> keys{"extents", "deleted", "inline"};
+    std::vector<std::string> values;
+    std::vector<Status> statuses;
+    ASSERT_EQ(engine->MultiGet(keys, &values, &statuses), Status::Ok);
+    ASSERT_EQ(statuses[0], Status::Ok);
+    ASSERT_EQ(values[0], kvs["extents"]);
+    ASSERT_EQ(statuses[1], Status::NotFound);
+    ASSERT_EQ(values[2], kvs["inline"]);
+  };
+  CheckKVs();
+
+  // Extents are restored with their records from index image or by scanning
+  Reboot();
+  CheckKVs();
+  configs.persist_index_image = false;
+  Reboot();
+  Reboot();
+  CheckKVs();
+
+  // Extents of outdated records are freed in recovery
+  delete engine;
+  engine = nullptr;
+  Destroy();
+  configs.pmem_file_size = 48 * segment_size;
   ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
             Status::Ok);
+  for (int i = 0; i < 20; i++) {
+    std::string value(3 * segment_size, 'a' + i);
+    ASSERT_EQ(engine->Put("key", value), Status::Ok);
+    Reboot();
+    std::string got;
+    ASSERT_EQ(engine->Get("key", &got), Status::Ok);
+    ASSERT_EQ(got, value);
+  }
+}
 
-  for (size_t i = 0; i < collections.size(); ++i) {
-    std::vector<kvpair> expected_res(dedup_kvs.begin(), dedup_kvs.end());
-    if (i == 0) {
-      std::sort(expected_res.begin(), expected_res.end(),
-                [&](const kvpair& a, const kvpair& b) -> bool {
-                  return cmp0(a.first, b.first) <= 0;
-                });
+TEST_F(EngineBasicTest, TestLargeValueExpire) {
+  uint64_t segment_size = configs.pmem_block_size * configs.pmem_segment_blocks;
+  configs.pmem_file_size = 48 * segment_size;
+  configs.large_value_threshold = 64 << 10;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
 
-    } else if (i == 1) {
-      std::sort(expected_res.begin(), expected_res.end(),
-                [&](const kvpair& a, const kvpair& b) -> bool {
-                  return cmp1(a.first, b.first) <= 0;
-                });
+  // Expire shares extents of the value, freeing outdated versions or deleting
+  // the key must keep or free them exactly once
+  std::string got;
+  for (int i = 0; i < 10; i++) {
+    std::string value(3 * segment_size, 'a' + i);
+    std::string other(3 * segment_size, 'z' - i);
+    ASSERT_EQ(engine->Put("key", value), Status::Ok);
+    ASSERT_EQ(engine->Put("other", other), Status::Ok);
+    for (int j = 0; j < 50; j++) {
+      ASSERT_EQ(engine->Expire("key", j % 2 ? INT32_MAX : kPersistTTL),
+                Status::Ok);
+      ASSERT_EQ(engine->Expire("other", INT32_MAX), Status::Ok);
     }
-    auto iter = engine->SortedIteratorCreate(collections[i]);
-    ASSERT_TRUE(iter != nullptr);
-    iter->SeekToFirst();
-    size_t cnt = 0;
-    while (iter->Valid()) {
-      std::string key = iter->Key();
-      std::string val = iter->Value();
-      ASSERT_EQ(key, expected_res[cnt].first);
-      ASSERT_EQ(val, expected_res[cnt].second);
-      iter->Next();
-      cnt++;
+    ASSERT_EQ(engine->Delete("other"), Status::Ok);
+    ASSERT_EQ(engine->Put("filler", std::string(3 * segment_size, 'A' + i)),
+              Status::Ok);
+    ASSERT_EQ(engine->Get("key", &got), Status::Ok);
+    ASSERT_EQ(got, value);
+    TTLType ttl;
+    ASSERT_EQ(engine->GetTTL("key", &ttl), Status::Ok);
+    ASSERT_GT(ttl, 0);
+
+    configs.persist_index_image = i % 2;
+    Reboot();
+    ASSERT_EQ(engine->Get("key", &got), Status::Ok);
+    ASSERT_EQ(got, value);
+    ASSERT_EQ(engine->Get("other", &got), Status::NotFound);
+  }
+
+  ASSERT_EQ(engine->Expire("key", -1), Status::Ok);
+  ASSERT_EQ(engine->Get("key", &got), Status::NotFound);
+  Reboot();
+  ASSERT_EQ(engine->Get("key", &got), Status::NotFound);
+}
+
+TEST_F(EngineBasicTest, TestHashCache) {
+  // All keys locate in a single slot
+  configs.num_buckets_per_slot = configs.hash_bucket_num;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  auto hash_table = static_cast<KVEngine*>(engine)->GetHashTable();
+  ASSERT_EQ(hash_table->GetSlotsNum(), 1);
+
+  size_t num_cold_keys = 100;
+  std::vector<std::string> hot_keys;
+  for (size_t i = 0; i < HashCache::kNumEntries; i++) {
+    hot_keys.push_back("hot_key" + std::to_string(i));
+    ASSERT_EQ(engine->Put(hot_keys.back(), hot_keys.back()), Status::Ok);
+  }
+  for (size_t i = 0; i < num_cold_keys; i++) {
+    std::string key = "cold_key" + std::to_string(i);
+    ASSERT_EQ(engine->Put(key, key), Status::Ok);
+  }
+
+  std::string value;
+  // Warm up cache
+  for (int i = 0; i < 2; i++) {
+    for (auto& key : hot_keys) {
+      ASSERT_EQ(engine->Get(key, &value), Status::Ok);
     }
-    engine->SortedIteratorRelease(iter);
   }
+
+  auto stats_before = hash_table->GetCacheStats();
+  size_t num_rounds = 1000;
+  for (size_t i = 0; i < num_rounds; i++) {
+    for (auto& key : hot_keys) {
+      ASSERT_EQ(engine->Get(key, &value), Status::Ok);
+      ASSERT_EQ(value, key);
+    }
+  }
+  auto stats_after = hash_table->GetCacheStats();
+  ASSERT_GE(stats_after.hits - stats_before.hits,
+            num_rounds * hot_keys.size());
+
+  // Cold keys are still readable
+  for (size_t i = 0; i < num_cold_keys; i++) {
+    std::string key = "cold_key" + std::to_string(i);
+    ASSERT_EQ(engine->Get(key, &value), Status::Ok);
+    ASSERT_EQ(value, key);
+  }
+  ASSERT_GT(hash_table->GetCacheStats().misses, stats_after.misses);
   delete engine;
 }
 
-TEST_F(EngineBasicTest, TestHashTableIterator) {
-  size_t num_threads = 32;
+TEST_F(EngineBasicTest, TestHashSlotOptimisticRead) {
+  // All keys locate in a single slot
+  configs.num_buckets_per_slot = configs.hash_bucket_num;
   ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
             Status::Ok);
-  std::string collection_name = "sortedcollection";
-  engine->SortedCreate(collection_name);
-  auto MixedPut = [&](size_t id) {
-    if (id % 2 == 0) {
-      ASSERT_EQ(engine->Put("stringkey" + std::to_string(id), "stringval"),
-                Status::Ok);
+  auto hash_table = static_cast<KVEngine*>(engine)->GetHashTable();
+  int num_writers = 4;
+  int num_readers = 4;
+  int num_writes = 10000;
+  TTLType ttl = 1000000;
+  std::string key = "key";
+  ASSERT_EQ(engine->Put(key, "value"), Status::Ok);
+
+  // Data written under slot lock should be read consistently
+  std::atomic<uint64_t> a{0};
+  std::atomic<uint64_t> b{0};
+  std::atomic<int> finished_writers{0};
+  auto WriteRead = [&](int tid) {
+    if (tid < num_writers) {
+      for (int i = 0; i < num_writes; i++) {
+        {
+          auto ul = hash_table->AcquireLock(key);
+          a.fetch_add(1);
+          b.fetch_add(1);
+        }
+        ASSERT_EQ(engine->Expire(key, i % 2 ? ttl : kPersistTTL), Status::Ok);
+      }
+      finished_writers++;
     } else {
-      ASSERT_EQ(
-          engine->SortedPut(collection_name, "sortedkey" + std::to_string(id),
-                            "sortedval"),
-          Status::Ok);
-    }
-  };
-  LaunchNThreads(num_threads, MixedPut);
+      while (finished_writers.load() < num_writers) {
+        uint64_t read_a, read_b;
+        hash_table->OptimisticRead(key, [&]() {
+          read_a = a.load();
+          read_b = b.load();
+        });
+        ASSERT_EQ(read_a, read_b);
 
-  auto test_kvengine = static_cast<KVEngine*>(engine);
-  auto hash_table = test_kvengine->GetHashTable();
-  size_t total_entry_num = 0;
-  // Hash Table Iterator
-  // scan hash table with locked slot.
-  {
-    auto hashtable_iter = hash_table->GetIterator(0, hash_table->GetSlotsNum());
-    while (hashtable_iter.Valid()) {
-      auto slot_iter = hashtable_iter.Slot();
-      while (slot_iter.Valid()) {
-        switch (slot_iter->GetIndexType()) {
-          case PointerType::StringRecord: {
-            total_entry_num++;
-            ASSERT_EQ(string_view_2_string(
-                          slot_iter->GetIndex().string_record->Value()),
-                      "stringval");
-            break;
-          }
-          case PointerType::Skiplist: {
-            total_entry_num++;
-            ASSERT_EQ(
-                string_view_2_string(slot_iter->GetIndex().skiplist->Name()),
-                collection_name);
-            break;
-          }
-          case PointerType::SkiplistNode: {
-            total_entry_num++;
-            ASSERT_EQ(string_view_2_string(
-                          slot_iter->GetIndex().skiplist_node->record->Value()),
-                      "sortedval");
-            break;
-          }
-          case PointerType::DLRecord: {
-            total_entry_num++;
-            ASSERT_EQ(
-                string_view_2_string(slot_iter->GetIndex().dl_record->Value()),
-                "sortedval");
-            break;
-          }
-          default:
-            ASSERT_EQ((slot_iter->GetIndexType() == PointerType::Invalid) ||
-                          (slot_iter->GetIndexType() == PointerType::Empty),
-                      true);
-            break;
-        }
-        slot_iter++;
+        TTLType ttl_time;
+        ASSERT_EQ(engine->GetTTL(key, &ttl_time), Status::Ok);
+        ASSERT_TRUE(ttl_time == kPersistTTL ||
+                    (ttl_time > 0 && ttl_time <= ttl));
       }
-      hashtable_iter.Next();
     }
-    ASSERT_EQ(total_entry_num, num_threads + 1);
-  }
+  };
+  LaunchNThreads(num_writers + num_readers, WriteRead);
+  ASSERT_EQ(a.load(), num_writers * num_writes);
+
+  // Optimistic lookup leaves hash cache untouched until the read is validated
+  auto accesses = [&]() {
+    auto stats = hash_table->GetCacheStats();
+    return stats.hits + stats.misses;
+  };
+  uint64_t accesses_before = accesses();
+  auto res = hash_table->OptimisticLookup(key, PrimaryRecordType);
+  ASSERT_EQ(res.s, Status::Ok);
+  ASSERT_EQ(accesses(), accesses_before);
+  hash_table->UpdateCache(res);
+  ASSERT_EQ(accesses(), accesses_before + 1);
+  uint64_t hits_before = hash_table->GetCacheStats().hits;
+  TTLType ttl_time;
+  ASSERT_EQ(engine->GetTTL(key, &ttl_time), Status::Ok);
+  ASSERT_EQ(hash_table->GetCacheStats().hits, hits_before + 1);
   delete engine;
 }
 
@@ -2801,6 +4376,213 @@ TEST_F(TrasactionTest, Conflict) {
   delete engine;
 }
 
+TEST_F(TrasactionTest, WaitDie) {
+  configs.max_access_threads = 4;
+  ASSERT_EQ(Engine::Open(db_path, &engine, configs, stdout), Status::Ok);
+  std::string key1{"key1"};
+  std::string key2{"key2"};
+  std::string val{"val"};
+
+  auto older = engine->TransactionCreate();
+  auto younger = engine->TransactionCreate();
+  ASSERT_EQ(older->StringPut(key1, val), Status::Ok);
+  ASSERT_EQ(younger->StringPut(key2, val), Status::Ok);
+
+  // Younger transaction fails immediately on lock held by older one
+  ASSERT_EQ(younger->StringPut(key1, val), Status::Timeout);
+  ASSERT_EQ(younger->LockStats().conflicts, 1U);
+  ASSERT_EQ(younger->LockStats().waits, 0U);
+
+  // Older transaction waits for lock held by younger one
+  std::atomic<bool> locked{false};
+  std::thread waiter([&]() {
+    ASSERT_EQ(older->StringPut(key2, "older_val"), Status::Ok);
+    locked = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_FALSE(locked);
+  younger->Rollback();
+  waiter.join();
+  ASSERT_TRUE(locked);
+  ASSERT_GE(older->LockStats().waits, 1U);
+  ASSERT_EQ(older->LockStats().conflicts, 0U);
+
+  // The failed transaction keeps its age after rollback, so it's still
+  // younger and fails again
+  ASSERT_EQ(younger->StringPut(key1, val), Status::Timeout);
+  ASSERT_EQ(younger->LockStats().conflicts, 2U);
+  younger->Rollback();
+
+  ASSERT_EQ(older->Commit(), Status::Ok);
+  ASSERT_EQ(younger->StringPut(key1, val), Status::Ok);
+  ASSERT_EQ(younger->Commit(), Status::Ok);
+  std::string got;
+  ASSERT_EQ(engine->Get(key1, &got), Status::Ok);
+  ASSERT_EQ(got, val);
+  ASSERT_EQ(engine->Get(key2, &got), Status::Ok);
+  ASSERT_EQ(got, "older_val");
+
+  delete engine;
+}
+
+TEST_F(TrasactionTest, OptimisticConflict) {
+  configs.max_access_threads = 3;
+  ASSERT_EQ(Engine::Open(db_path, &engine, configs, stdout), Status::Ok);
+  std::string sorted_collection{"sorted_collection"};
+  std::string hash_collection{"hash_collection"};
+  std::string key{"key"};
+  std::string val("val");
+  ASSERT_EQ(engine->SortedCreate(sorted_collection), Status::Ok);
+  ASSERT_EQ(engine->HashCreate(hash_collection), Status::Ok);
+  TransactionOptions options;
+  options.optimistic = true;
+
+  // Operations take no locks, so they never time out
+  auto write_thread = [&](size_t) {
+    auto txn = engine->TransactionCreate(options);
+    ASSERT_EQ(txn->StringPut(key, val), Status::Ok);
+    ASSERT_EQ(txn->SortedPut(sorted_collection, key, val), Status::Ok);
+    ASSERT_EQ(txn->HashPut(hash_collection, key, val), Status::Ok);
+    ASSERT_EQ(txn->Commit(), Status::Ok);
+  };
+
+  std::string got_val;
+  auto txn = engine->TransactionCreate(options);
+  ASSERT_EQ(txn->SortedPut("not exist", key, val), Status::NotFound);
+  ASSERT_EQ(txn->HashPut("not exist", key, val), Status::NotFound);
+
+  // Blind writes do not conflict
+  ASSERT_EQ(txn->StringPut(key, val), Status::Ok);
+  LaunchNThreads(1, write_thread);
+  ASSERT_EQ(txn->Commit(), Status::Ok);
+
+  // Each kind of read is invalidated by a concurrent write
+  for (int i = 0; i < 3; i++) {
+    if (i == 0) {
+      ASSERT_EQ(txn->StringGet(key, &got_val), Status::Ok);
+    } else if (i == 1) {
+      ASSERT_EQ(txn->SortedGet(sorted_collection, key, &got_val), Status::Ok);
+    } else {
+      ASSERT_EQ(txn->HashGet(hash_collection, key, &got_val), Status::Ok);
+    }
+    ASSERT_EQ(got_val, val);
+    ASSERT_EQ(txn->StringPut("another_key", val), Status::Ok);
+    LaunchNThreads(1, write_thread);
+    ASSERT_EQ(txn->Commit(), Status::Abort);
+    ASSERT_EQ(txn->InternalStatus(), Status::Abort);
+    ASSERT_EQ(engine->Get("another_key", &got_val), Status::NotFound);
+  }
+
+  // Reads of not existed keys are validated as well
+  ASSERT_EQ(engine->Delete(key), Status::Ok);
+  ASSERT_EQ(txn->StringGet(key, &got_val), Status::NotFound);
+  ASSERT_EQ(txn->StringPut("another_key", val), Status::Ok);
+  LaunchNThreads(1, write_thread);
+  ASSERT_EQ(txn->Commit(), Status::Abort);
+
+  // Commit succeeds without concurrent writes, and reads its own writes
+  ASSERT_EQ(txn->StringGet(key, &got_val), Status::Ok);
+  ASSERT_EQ(txn->StringDelete(key), Status::Ok);
+  ASSERT_EQ(txn->StringGet(key, &got_val), Status::NotFound);
+  ASSERT_EQ(txn->SortedGet(sorted_collection, key, &got_val), Status::Ok);
+  ASSERT_EQ(txn->SortedDelete(sorted_collection, key), Status::Ok);
+  ASSERT_EQ(txn->HashGet(hash_collection, key, &got_val), Status::Ok);
+  ASSERT_EQ(txn->HashPut(hash_collection, key, "new_val"), Status::Ok);
+  ASSERT_EQ(txn->HashGet(hash_collection, key, &got_val), Status::Ok);
+  ASSERT_EQ(got_val, "new_val");
+  ASSERT_EQ(txn->Commit(), Status::Ok);
+  ASSERT_EQ(engine->Get(key, &got_val), Status::NotFound);
+  ASSERT_EQ(engine->SortedGet(sorted_collection, key, &got_val),
+            Status::NotFound);
+  ASSERT_EQ(engine->HashGet(hash_collection, key, &got_val), Status::Ok);
+  ASSERT_EQ(got_val, "new_val");
+
+  // Rollback drops buffered writes
+  ASSERT_EQ(txn->StringPut(key, val), Status::Ok);
+  txn->Rollback();
+  ASSERT_EQ(txn->Commit(), Status::Ok);
+  ASSERT_EQ(engine->Get(key, &got_val), Status::NotFound);
+
+  delete engine;
+}
+
+TEST_F(TrasactionTest, OptimisticTransfer) {
+  size_t num_threads = 16;
+  configs.max_access_threads = num_threads;
+  ASSERT_EQ(Engine::Open(db_path, &engine, configs, stdout), Status::Ok);
+  TransactionOptions options;
+  options.optimistic = true;
+  int amount = 1000;
+  int round = 5000;
+  std::vector<std::string> accounts{"Jack", "Tom", "Lucy"};
+  std::string hash_bank{"hash_bank"};
+  ASSERT_EQ(engine->HashCreate(hash_bank), Status::Ok);
+  for (auto const& account : accounts) {
+    ASSERT_EQ(engine->Put(account, std::to_string(amount)), Status::Ok);
+    ASSERT_EQ(engine->HashPut(hash_bank, account, std::to_string(amount)),
+              Status::Ok);
+  }
+
+  std::atomic<int> aborted{0};
+  auto transfer = [&](size_t) {
+    int cnt = round;
+    while (cnt--) {
+      auto payer = accounts[fast_random_64() % accounts.size()];
+      auto receiver = accounts[fast_random_64() % accounts.size()];
+      bool in_hash = fast_random_64() % 2 == 0;
+      auto txn = engine->TransactionCreate(options);
+      while (true) {
+        std::string payer_balance;
+        std::string receiver_balance;
+        if (in_hash) {
+          ASSERT_EQ(txn->HashGet(hash_bank, payer, &payer_balance), Status::Ok);
+          ASSERT_EQ(txn->HashPut(hash_bank, payer,
+                                 std::to_string(std::stoi(payer_balance) - 1)),
+                    Status::Ok);
+          ASSERT_EQ(txn->HashGet(hash_bank, receiver, &receiver_balance),
+                    Status::Ok);
+          ASSERT_EQ(
+              txn->HashPut(hash_bank, receiver,
+                           std::to_string(std::stoi(receiver_balance) + 1)),
+              Status::Ok);
+        } else {
+          ASSERT_EQ(txn->StringGet(payer, &payer_balance), Status::Ok);
+          ASSERT_EQ(txn->StringPut(
+                        payer, std::to_string(std::stoi(payer_balance) - 1)),
+                    Status::Ok);
+          ASSERT_EQ(txn->StringGet(receiver, &receiver_balance), Status::Ok);
+          ASSERT_EQ(
+              txn->StringPut(receiver,
+                             std::to_string(std::stoi(receiver_balance) + 1)),
+              Status::Ok);
+        }
+        Status s = txn->Commit();
+        if (s == Status::Ok) {
+          break;
+        }
+        ASSERT_EQ(s, Status::Abort);
+        aborted++;
+      }
+    }
+  };
+  LaunchNThreads(num_threads, transfer);
+  GlobalLogger.Info("%d optimistic transactions aborted\n", aborted.load());
+
+  int string_total = 0;
+  int hash_total = 0;
+  for (auto const& account : accounts) {
+    std::string balance;
+    ASSERT_EQ(engine->Get(account, &balance), Status::Ok);
+    string_total += std::stoi(balance);
+    ASSERT_EQ(engine->HashGet(hash_bank, account, &balance), Status::Ok);
+    hash_total += std::stoi(balance);
+  }
+  ASSERT_EQ(string_total, amount * (int)accounts.size());
+  ASSERT_EQ(hash_total, amount * (int)accounts.size());
+
+  delete engine;
+}
+
 // ========================= Sync Point ======================================
 
 #if KVDK_DEBUG_LEVEL > 0
@@ -3195,6 +4977,48 @@ TEST_F(BatchWriteTest, ListBatchOperationRollback) {
   delete engine;
 }
 
+TEST_F(BatchWriteTest, CrossShardRollback) {
+  uint64_t segment_size = configs.pmem_block_size * configs.pmem_segment_blocks;
+  configs.pmem_file_size = 64 * segment_size;
+  configs.num_shards = 3;
+  size_t num_keys = 100;
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < num_keys; i++) {
+    keys.push_back("key" + std::to_string(i));
+  }
+
+  // A batch across shards crashed before committed is rolled back on all
+  // shards, and a committed one is kept on all shards even if no shard
+  // finished it
+  for (bool committed : {false, true}) {
+    ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+              Status::Ok);
+    for (auto const& key : keys) {
+      ASSERT_EQ(engine->Put(key, "old"), Status::Ok);
+    }
+    SyncPoint::GetInstance()->EnableCrashPoint(
+        committed ? "ShardedEngine::crossShardBatchWrite::AfterCommit"
+                  : "ShardedEngine::crossShardBatchWrite::BeforeCommit");
+    SyncPoint::GetInstance()->EnableProcessing();
+    auto batch = engine->WriteBatchCreate();
+    for (auto const& key : keys) {
+      batch->StringPut(key, "new");
+    }
+    ASSERT_THROW(engine->BatchWrite(batch), SyncPoint::CrashPoint);
+    SyncPoint::GetInstance()->DisableProcessing();
+    SyncPoint::GetInstance()->Reset();
+
+    Reboot();
+    std::string got;
+    for (auto const& key : keys) {
+      ASSERT_EQ(engine->Get(key, &got), Status::Ok);
+      ASSERT_EQ(got, committed ? "new" : "old");
+    }
+    delete engine;
+    engine = nullptr;
+  }
+}
+
 // Example Case One:
 //         A <-> C <-> D
 // Insert B, but crashes half way, Now the state is:
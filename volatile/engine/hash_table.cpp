@@ -12,6 +12,7 @@
 namespace KVDK_NAMESPACE {
 HashTable* HashTable::NewHashTable(uint64_t hash_bucket_num,
                                    uint32_t num_buckets_per_slot,
+                                   uint64_t max_hash_bucket_num,
                                    const Allocator* kv_allocator,
                                    Allocator* new_bucket_allocator,
                                    uint32_t max_access_threads) {
@@ -19,7 +20,8 @@ HashTable* HashTable::NewHashTable(uint64_t hash_bucket_num,
   // We catch exception here as we may need to allocate large memory for hash
   // table here
   try {
-    table = new HashTable(hash_bucket_num, num_buckets_per_slot, kv_allocator,
+    table = new HashTable(hash_bucket_num, num_buckets_per_slot,
+                          max_hash_bucket_num, kv_allocator,
                           new_bucket_allocator, max_access_threads);
   } catch (std::bad_alloc& b) {
     GlobalLogger.Error("No enough dram to create global hash table: b\n",
@@ -30,6 +32,12 @@ HashTable* HashTable::NewHashTable(uint64_t hash_bucket_num,
   return table;
 }
 
+HashTable::~HashTable() {
+  for (auto& bucket_array : bucket_arrays_) {
+    delete bucket_array.load();
+  }
+}
+
 bool HashEntry::Match(const StringView& key, uint32_t hash_k_prefix,
                       uint8_t target_type, DataEntry* data_entry_metadata) {
   if ((target_type & header_.record_type) &&
@@ -37,48 +45,8 @@ bool HashEntry::Match(const StringView& key, uint32_t hash_k_prefix,
     void* data_record = nullptr;
     StringView data_entry_key;
 
-    switch (header_.index_type) {
-      case PointerType::Empty:
-      case PointerType::Allocated: {
-        return false;
-      }
-      case PointerType::StringRecord: {
-        data_record = index_.string_record;
-        data_entry_key = index_.string_record->Key();
-        break;
-      }
-      case PointerType::HashElem:
-      case PointerType::DLRecord: {
-        data_record = index_.dl_record;
-        data_entry_key = index_.dl_record->Key();
-        break;
-      }
-      case PointerType::List: {
-        data_entry_key = index_.list->Name();
-        break;
-      }
-      case PointerType::HashList: {
-        data_entry_key = index_.hlist->Name();
-        break;
-      }
-      case PointerType::SkiplistNode: {
-        SkiplistNode* dram_node = index_.skiplist_node;
-        data_record = dram_node->record;
-        data_entry_key = dram_node->record->Key();
-        break;
-      }
-      case PointerType::Skiplist: {
-        Skiplist* skiplist = index_.skiplist;
-        data_record = skiplist->HeaderRecord();
-        data_entry_key = skiplist->Name();
-        break;
-      }
-      default: {
-        GlobalLogger.Error("Not supported hash index type: %u\n",
-                           header_.index_type);
-        assert(false && "Trying to use invalid PointerType!");
-        return false;
-      }
+    if (!fetchKey(&data_entry_key, &data_record)) {
+      return false;
     }
 
     if (data_entry_metadata != nullptr) {
@@ -92,43 +60,187 @@ bool HashEntry::Match(const StringView& key, uint32_t hash_k_prefix,
   return false;
 }
 
+bool HashEntry::fetchKey(StringView* key, void** data_record) const {
+  switch (header_.index_type) {
+    case PointerType::Empty:
+    case PointerType::Allocated: {
+      return false;
+    }
+    case PointerType::StringRecord: {
+      *data_record = index_.string_record;
+      *key = index_.string_record->Key();
+      break;
+    }
+    case PointerType::HashElem:
+    case PointerType::DLRecord: {
+      *data_record = index_.dl_record;
+      *key = index_.dl_record->Key();
+      break;
+    }
+    case PointerType::List: {
+      *data_record = nullptr;
+      *key = index_.list->Name();
+      break;
+    }
+    case PointerType::HashList: {
+      *data_record = nullptr;
+      *key = index_.hlist->Name();
+      break;
+    }
+    case PointerType::SkiplistNode: {
+      SkiplistNode* dram_node = index_.skiplist_node;
+      *data_record = dram_node->record;
+      *key = dram_node->record->Key();
+      break;
+    }
+    case PointerType::Skiplist: {
+      Skiplist* skiplist = index_.skiplist;
+      *data_record = skiplist->HeaderRecord();
+      *key = skiplist->Name();
+      break;
+    }
+    default: {
+      GlobalLogger.Error("Not supported hash index type: %u\n",
+                         header_.index_type);
+      assert(false && "Trying to use invalid PointerType!");
+      return false;
+    }
+  }
+  return true;
+}
+
 template <bool may_insert>
 HashTable::LookupResult HashTable::Lookup(const StringView& key,
                                           uint8_t type_mask) {
+  return lookupImpl<may_insert>(key, getHint(key), type_mask);
+}
+
+template HashTable::LookupResult HashTable::Lookup<true>(const StringView&,
+                                                         uint8_t);
+template HashTable::LookupResult HashTable::Lookup<false>(const StringView&,
+                                                          uint8_t);
+
+void HashTable::MultiLookup(const std::vector<StringView>& keys,
+                            uint8_t type_mask,
+                            std::vector<LookupResult>* results) {
+  size_t num_keys = keys.size();
+  std::vector<KeyHashHint> hints(num_keys);
+  results->resize(num_keys);
+
+  // Stage 1: hash all keys and prefetch their slots
+  for (size_t i = 0; i < num_keys; i++) {
+    hints[i] = getHint(keys[i]);
+    _mm_prefetch(&slots_[hints[i].slot], _MM_HINT_T0);
+  }
+
+  // Stage 2: locate and prefetch the first bucket of each key
+  std::vector<HashBucket*> buckets(num_keys);
+  for (size_t i = 0; i < num_keys; i++) {
+    HashBucketArray* bucket_array = slotBuckets(slots_[hints[i].slot]);
+    buckets[i] = &bucket_array->buckets[get_bucket_num(hints[i].key_hash_value,
+                                                       bucket_array)];
+    _mm_prefetch(buckets[i], _MM_HINT_T0);
+  }
+
+  // Stage 3: prefetch data indexed by hash entries with the same tag of key,
+  // which will be compared with key while searching. The index is read
+  // without synchronization as it's only a prefetch hint
+  for (size_t i = 0; i < num_keys; i++) {
+    HashBucket* bucket_ptr = buckets[i];
+    uint32_t num_entries =
+        bucket_ptr->num_entries.load(std::memory_order_acquire);
+    uint32_t candidates =
+        bucket_ptr->MatchTag(get_tag(hints[i].key_hash_prefix)) &
+        ((1U << num_entries) - 1);
+    while (candidates != 0) {
+      uint32_t entry_idx = __builtin_ctz(candidates);
+      candidates &= candidates - 1;
+      _mm_prefetch(bucket_ptr->hash_entries[entry_idx].index_.ptr,
+                   _MM_HINT_T0);
+    }
+  }
+
+  // Stage 4: search keys, their cache lines should have been arrived
+  for (size_t i = 0; i < num_keys; i++) {
+    (*results)[i] = lookupImpl<false>(keys[i], hints[i], type_mask);
+  }
+}
+
+template <bool may_insert>
+HashTable::LookupResult HashTable::lookupImpl(const StringView& key,
+                                              const KeyHashHint& hint,
+                                              uint8_t type_mask) {
   LookupResult ret;
-  HashEntry* empty_entry = nullptr;
-  auto hint = getHint(key);
   ret.key_hash_prefix = hint.key_hash_prefix;
 
-  HashBucket* bucket_ptr = &hash_buckets_[hint.bucket];
+  Slot& slot = slots_[hint.slot];
+  uint32_t epoch = slot.epoch.load(std::memory_order_acquire);
+  HashBucketArray* bucket_array =
+      bucket_arrays_[epoch & 1].load(std::memory_order_acquire);
+  uint64_t bucket = get_bucket_num(hint.key_hash_value, bucket_array);
+
+  HashBucket* bucket_ptr = &bucket_array->buckets[bucket];
   _mm_prefetch(bucket_ptr, _MM_HINT_T0);
 
+  uint8_t tag = get_tag(hint.key_hash_prefix);
+
   // search cache
-  ret.entry_ptr = slots_[hint.slot].hash_cache.entry_ptr;
-  if (ret.entry_ptr != nullptr) {
-    atomic_load_16(&ret.entry, ret.entry_ptr);
-    if (ret.entry.Match(key, hint.key_hash_prefix, type_mask, nullptr)) {
-      return ret;
+  for (size_t i = 0; i < HashCache::kNumEntries; i++) {
+    ret.entry_ptr = slot.hash_cache.Get(i, tag, epoch);
+    if (ret.entry_ptr != nullptr) {
+      atomic_load_16(&ret.entry, ret.entry_ptr);
+      if (ret.entry.Match(key, hint.key_hash_prefix, type_mask, nullptr)) {
+        slot.hash_cache.Touch(i);
+        recordCacheAccess(true);
+        return ret;
+      }
     }
   }
+  recordCacheAccess(false);
 
-  // iterate hash entries in the bucket
-  HashBucketIterator iter(this, hint.bucket);
-  while (iter.Valid()) {
-    ret.entry_ptr = &*iter;
-    atomic_load_16(&ret.entry, ret.entry_ptr);
-    if (ret.entry.Match(key, hint.key_hash_prefix, type_mask, nullptr)) {
-      slots_[hint.slot].hash_cache.entry_ptr = ret.entry_ptr;
-      return ret;
+  // search hash entries in the bucket, only entries with the same tag of key
+  // are compared with the key
+  HashEntry* empty_entry = nullptr;
+  uint8_t* empty_entry_tag = nullptr;
+  uint32_t num_entries;
+  while (true) {
+    num_entries = bucket_ptr->num_entries.load(std::memory_order_acquire);
+    uint32_t candidates =
+        bucket_ptr->MatchTag(tag) & ((1U << num_entries) - 1);
+    while (candidates != 0) {
+      uint32_t entry_idx = __builtin_ctz(candidates);
+      candidates &= candidates - 1;
+      ret.entry_ptr = &bucket_ptr->hash_entries[entry_idx];
+      atomic_load_16(&ret.entry, ret.entry_ptr);
+      if (ret.entry.Match(key, hint.key_hash_prefix, type_mask, nullptr)) {
+        slot.hash_cache.Set(ret.entry_ptr, tag, epoch);
+        return ret;
+      }
+    }
+
+    if (may_insert && empty_entry == nullptr) {
+      for (uint32_t i = 0; i < num_entries; i++) {
+        if (bucket_ptr->hash_entries[i].Empty()) {
+          empty_entry = &bucket_ptr->hash_entries[i];
+          empty_entry_tag = &bucket_ptr->tags[i];
+          break;
+        }
+      }
     }
-    if (ret.entry_ptr->Empty()) {
-      empty_entry = ret.entry_ptr;
+
+    if (num_entries < kNumEntryPerBucket || bucket_ptr->next == nullptr) {
+      break;
     }
-    iter++;
+    bucket_ptr = bucket_ptr->next;
+    _mm_prefetch(bucket_ptr, _MM_HINT_T0);
   }
 
   if (may_insert) {
     if (empty_entry == nullptr) {
+      // Allocate a new entry at end of the bucket
+      HashBucketIterator iter(bucket_array, bucket);
+      iter.bucket_ptr_ = bucket_ptr;
+      iter.entry_idx_ = num_entries;
       ret.s = allocateEntry(iter);
       if (ret.s != Status::Ok) {
         kvdk_assert(ret.s == Status::MemoryOverflow, "");
@@ -139,8 +251,10 @@ HashTable::LookupResult HashTable::Lookup(const StringView& key,
           "HashBucketIterator should be valid after allocate new entry");
       kvdk_assert(iter->Empty(), "newly allocated hash entry should be empty");
       ret.entry_ptr = &(*iter);
+      ret.tag_ptr = &iter.bucket_ptr_->tags[iter.entry_idx_];
     } else {
       ret.entry_ptr = empty_entry;
+      ret.tag_ptr = empty_entry_tag;
     }
   }
 
@@ -151,16 +265,16 @@ HashTable::LookupResult HashTable::Lookup(const StringView& key,
   return ret;
 }
 
-template HashTable::LookupResult HashTable::Lookup<true>(const StringView&,
-                                                         uint8_t);
-template HashTable::LookupResult HashTable::Lookup<false>(const StringView&,
-                                                          uint8_t);
-
 void HashTable::Insert(const LookupResult& insert_position, RecordType type,
                        RecordStatus status, void* index,
                        PointerType index_type) {
   HashEntry new_hash_entry(insert_position.key_hash_prefix, type, status, index,
                            index_type);
+  // Update tag before the entry, so a lockless reader never miss the entry
+  // after it's visible
+  if (insert_position.tag_ptr != nullptr) {
+    *insert_position.tag_ptr = get_tag(insert_position.key_hash_prefix);
+  }
   atomic_store_16(insert_position.entry_ptr, &new_hash_entry);
 }
 
@@ -175,28 +289,184 @@ HashTable::LookupResult HashTable::Insert(const StringView& key,
 }
 
 Status HashTable::allocateEntry(HashBucketIterator& bucket_iter) {
-  kvdk_assert(bucket_iter.hash_table_ == this, "");
-  kvdk_assert(
-      bucket_iter.entry_idx_ == hash_bucket_entries_[bucket_iter.bucket_idx_],
-      "Only allocate new hash entry at end of hash bucket");
-  kvdk_assert(bucket_iter.bucket_ptr_ != nullptr, "");
-  if (hash_bucket_entries_[bucket_iter.bucket_idx_] > 0 &&
-      hash_bucket_entries_[bucket_iter.bucket_idx_] % kNumEntryPerBucket == 0) {
-    auto space = chunk_based_bucket_allocator_.Allocate(kHashBucketSize);
+  HashBucketArray* bucket_array = bucket_iter.bucket_array_;
+  HashBucket* bucket_ptr = bucket_iter.bucket_ptr_;
+  kvdk_assert(bucket_ptr != nullptr, "");
+  kvdk_assert(bucket_iter.entry_idx_ == bucket_ptr->num_entries.load() &&
+                  bucket_ptr->next == nullptr,
+              "Only allocate new hash entry at end of hash bucket");
+  if (bucket_iter.entry_idx_ == kNumEntryPerBucket) {
+    auto space = bucket_array->overflow_allocator.Allocate(kHashBucketSize);
     if (space.size == 0) {
       GlobalLogger.Error("MemoryOverflow!\n");
       return Status::MemoryOverflow;
     }
-    bucket_iter.bucket_ptr_->next =
-        chunk_based_bucket_allocator_.offset2addr<HashBucket>(space.offset);
-    bucket_iter.bucket_ptr_ = bucket_iter.bucket_ptr_->next;
+    HashBucket* new_bucket = new (
+        bucket_array->overflow_allocator.offset2addr<HashBucket>(space.offset))
+        HashBucket();
+    // Lockless readers should see an initialized bucket
+    std::atomic_thread_fence(std::memory_order_release);
+    bucket_ptr->next = new_bucket;
+    bucket_ptr = new_bucket;
+    bucket_iter.bucket_ptr_ = new_bucket;
+    bucket_iter.entry_idx_ = 0;
   }
-  bucket_iter.entry_idx_ = hash_bucket_entries_[bucket_iter.bucket_idx_]++;
   bucket_iter->Clear();
+  bucket_ptr->num_entries.store(bucket_iter.entry_idx_ + 1,
+                                std::memory_order_release);
+  bucket_array
+      ->entry_counters[ThreadManager::ThreadID() %
+                       bucket_array->entry_counters.size()]
+      .num_entries.fetch_add(1, std::memory_order_relaxed);
   kvdk_assert(bucket_iter.Valid(), "");
   return Status::Ok;
 }
 
+bool HashTable::NeedResize(double max_load_factor) {
+  if (max_load_factor <= 0 || resizing_ || retired_buckets_ != nullptr) {
+    return false;
+  }
+  HashBucketArray* bucket_array =
+      bucket_arrays_[epoch_.load(std::memory_order_acquire) & 1].load(
+          std::memory_order_acquire);
+  return bucket_array->num_buckets * 2 <= max_hash_bucket_num_ &&
+         bucket_array->NumEntries() >
+             max_load_factor * bucket_array->num_buckets;
+}
+
+Status HashTable::StartResize() {
+  if (resizing_ || retired_buckets_ != nullptr) {
+    return Status::Abort;
+  }
+  uint32_t epoch = epoch_.load(std::memory_order_relaxed);
+  HashBucketArray* old_buckets =
+      bucket_arrays_[epoch & 1].load(std::memory_order_relaxed);
+  uint64_t new_bucket_num = old_buckets->num_buckets * 2;
+  if (new_bucket_num > max_hash_bucket_num_) {
+    return Status::Abort;
+  }
+
+  HashBucketArray* new_buckets;
+  try {
+    new_buckets = new HashBucketArray(new_bucket_num, max_access_threads_,
+                                      new_bucket_allocator_);
+  } catch (std::bad_alloc& b) {
+    GlobalLogger.Error("No enough dram to resize hash table: %s\n", b.what());
+    return Status::MemoryOverflow;
+  }
+  GlobalLogger.Info("Resize hash table from %lu buckets to %lu buckets\n",
+                    old_buckets->num_buckets, new_bucket_num);
+  // Publish the new bucket array before any slot refers to it
+  bucket_arrays_[(epoch + 1) & 1].store(new_buckets, std::memory_order_release);
+  epoch_.store(epoch + 1, std::memory_order_release);
+  resizing_ = true;
+  return Status::Ok;
+}
+
+void HashTable::MigrateSlots(uint64_t start_slot_idx, uint64_t end_slot_idx) {
+  kvdk_assert(resizing_, "Migrate slots while hash table not resizing");
+  end_slot_idx = std::min<uint64_t>(end_slot_idx, slots_.size());
+  for (uint64_t slot_idx = start_slot_idx; slot_idx < end_slot_idx;
+       slot_idx++) {
+    migrateSlot(slot_idx);
+  }
+}
+
+void HashTable::migrateSlot(uint64_t slot_idx) {
+  Slot& slot = slots_[slot_idx];
+  std::lock_guard<SeqSpinMutex> lg(slot.spin);
+  uint32_t new_epoch = epoch_.load(std::memory_order_relaxed);
+  if (slot.epoch.load(std::memory_order_relaxed) == new_epoch) {
+    return;
+  }
+  HashBucketArray* old_buckets =
+      bucket_arrays_[(new_epoch - 1) & 1].load(std::memory_order_relaxed);
+  HashBucketArray* new_buckets =
+      bucket_arrays_[new_epoch & 1].load(std::memory_order_relaxed);
+
+  // Entries of an old bucket are split into two new buckets by one more bit of
+  // key hash value. The old buckets are kept intact for lockless readers
+  for (uint64_t bucket = slot_idx; bucket < old_buckets->num_buckets;
+       bucket += slots_.size()) {
+    HashBucketIterator old_iter(old_buckets, bucket);
+    while (old_iter.Valid()) {
+      HashEntry entry(*old_iter);
+      old_iter++;
+      StringView key;
+      void* data_record;
+      // Allocated but not inserted entry is left by a failed write, just drop
+      // it
+      if (!entry.fetchKey(&key, &data_record)) {
+        continue;
+      }
+      uint64_t new_bucket =
+          get_bucket_num(hash_str(key.data(), key.size()), new_buckets);
+      kvdk_assert(get_slot_num(new_bucket) == slot_idx,
+                  "key should be in same slot after resize");
+      HashBucketIterator new_iter(new_buckets, new_bucket);
+      while (new_iter.Valid()) {
+        new_iter++;
+      }
+      // There is no writer of new_buckets but us as we hold the slot lock,
+      // and lockless readers can't access it before slot epoch updated
+      Status s = allocateEntry(new_iter);
+      if (s != Status::Ok) {
+        // Overflow buckets are small, if we can't allocate them we are not
+        // able to do anything
+        GlobalLogger.Error("Allocate hash entry failed while resizing\n");
+        std::abort();
+      }
+      new_iter.bucket_ptr_->tags[new_iter.entry_idx_] =
+          get_tag(entry.header_.key_prefix);
+      atomic_store_16(&*new_iter, &entry);
+    }
+  }
+
+  slot.hash_cache.Reset();
+  slot.epoch.store(new_epoch, std::memory_order_release);
+}
+
+void HashTable::FinishResize() {
+  kvdk_assert(resizing_, "Finish resize while hash table not resizing");
+  uint32_t epoch = epoch_.load(std::memory_order_relaxed);
+  for (uint64_t i = 0; i < slots_.size(); i++) {
+    kvdk_assert(slots_[i].epoch.load() == epoch,
+                "All slots should be migrated before finish resizing");
+  }
+  retired_buckets_ = bucket_arrays_[(epoch - 1) & 1].load();
+  resizing_ = false;
+}
+
+void HashTable::ReleaseRetiredBuckets() {
+  if (retired_buckets_ != nullptr) {
+    uint32_t epoch = epoch_.load(std::memory_order_relaxed);
+    kvdk_assert(bucket_arrays_[(epoch - 1) & 1].load() == retired_buckets_,
+                "");
+    bucket_arrays_[(epoch - 1) & 1].store(nullptr);
+    delete retired_buckets_;
+    retired_buckets_ = nullptr;
+  }
+}
+
+void HashTable::recordCacheAccess(bool hit) {
+  // Counters are shared by threads with same id modulo, lost update is
+  // acceptable for statistics
+  auto& counter =
+      cache_counters_[ThreadManager::ThreadID() % cache_counters_.size()];
+  auto& count = hit ? counter.hits : counter.misses;
+  count.store(count.load(std::memory_order_relaxed) + 1,
+              std::memory_order_relaxed);
+}
+
+HashCacheStats HashTable::GetCacheStats() {
+  HashCacheStats stats;
+  for (uint64_t i = 0; i < cache_counters_.size(); i++) {
+    stats.hits += cache_counters_[i].hits.load(std::memory_order_relaxed);
+    stats.misses += cache_counters_[i].misses.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
 HashTableIterator HashTable::GetIterator(uint64_t start_slot_idx,
                                          uint64_t end_slot_idx) {
   return HashTableIterator{this, start_slot_idx, end_slot_idx};
@@ -10,8 +10,8 @@
 #include <vector>
 
 #include "alias.hpp"
-#include "allocator.hpp"
 #include "data_record.hpp"
+#include "allocator.hpp"
 #include "dram_allocator.hpp"
 #include "kvdk/volatile/engine.hpp"
 #include "structures.hpp"
@@ -77,6 +77,11 @@ struct alignas(16) HashEntry {
              DataEntry* data_entry_metadata);
 
  private:
+  // Fetch key of data indexed by "this" to "key", and its data record to
+  // "data_record" (nullptr if the index is a list or hash list). Return false
+  // if nothing indexed
+  bool fetchKey(StringView* key, void** data_record) const;
+
   struct EntryHeader {
     uint32_t key_prefix;
     RecordType record_type;
@@ -91,28 +96,164 @@ static_assert(sizeof(HashEntry) == 16);
 
 // Size of each hash bucket
 //
-// It should be larger than hans entry size (which is 16) plus 8 (the pointer
-// to next bucket). It is recommended to set it align to cache line
+// It should be larger than hash entry size (which is 16) plus 16 (the bucket
+// header and the pointer to next bucket). It is recommended to set it align to
+// cache line
 constexpr size_t kHashBucketSize = 128;
+constexpr size_t kHashBucketHeaderSize = 8;
 constexpr size_t kNumEntryPerBucket =
-    (kHashBucketSize - sizeof(void*)) / sizeof(HashEntry);
+    (kHashBucketSize - kHashBucketHeaderSize - sizeof(void*)) /
+    sizeof(HashEntry);
+// A hash bucket is a chain of 128 bytes buckets, new hash entries are always
+// appended to the last bucket of the chain
 struct HashBucket {
-  HashBucket() {
+  HashBucket() : num_entries(0), next(nullptr) {
+    memset(tags, 0, sizeof(tags));
     memset(hash_entries, 0, sizeof(HashEntry) * kNumEntryPerBucket);
   }
+
+  // Return a bit mask of hash entries with tag "tag" in this bucket, check
+  // all tags in one SIMD instruction
+  uint32_t MatchTag(uint8_t tag) {
+    // The header is loaded as a whole so the number of entries is compared
+    // as well, it's masked by caller
+    __m128i header = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(tags));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(header, _mm_set1_epi8(tag)));
+  }
+
+  // Fingerprints of hash entries for fast filtering, a tag is the highest byte
+  // of key hash value
+  uint8_t tags[kNumEntryPerBucket];
+  // Number of allocated hash entries in this bucket
+  std::atomic<uint8_t> num_entries;
+  HashBucket* next;
   HashEntry hash_entries[kNumEntryPerBucket];
-  HashBucket* next{nullptr};
-  char padding[kHashBucketSize - sizeof(hash_entries) - sizeof(next)];
 };
 static_assert(sizeof(HashBucket) == kHashBucketSize);
+static_assert(sizeof(HashBucket::tags) + sizeof(HashBucket::num_entries) ==
+              kHashBucketHeaderSize);
 
+// Cache of hot hash entries of a slot, so lookup of a hot key costs no bucket
+// walking. Cached entries are replaced in CLOCK order: a hit marks an entry
+// referenced, and the clock hand evicts the first entry not referenced since
+// its last pass.
+//
+// Each cached entry is a hash entry pointer tagged with:
+// * bit 0: parity of resize epoch of the bucket array it located in, so a
+// lockless reader that looked up a slot before it's migrated can not pollute
+// cache of the migrated slot
+// * bit 1: reference bit of CLOCK
+// * bit 56-63: tag of the key, so a cache miss costs no hash entry access
 struct HashCache {
-  HashEntry* entry_ptr = nullptr;
+  static constexpr size_t kNumEntries = 4;
+
+  HashCache() { Reset(); }
+
+  // Return the cached entry of "idx" if it may index key with "tag"
+  HashEntry* Get(size_t idx, uint8_t tag, uint32_t epoch) {
+    uint64_t tagged = entries_[idx].load(std::memory_order_relaxed);
+    if ((tagged >> kTagShift) != tag ||
+        (tagged & kEpochMask) != (epoch & kEpochMask)) {
+      return nullptr;
+    }
+    return reinterpret_cast<HashEntry*>(tagged & kPointerMask);
+  }
+
+  // Mark cached entry of "idx" referenced after hit
+  void Touch(size_t idx) {
+    uint64_t tagged = entries_[idx].load(std::memory_order_relaxed);
+    if ((tagged & kReferencedMask) == 0) {
+      // Do not resurrect an entry replaced by other threads
+      entries_[idx].compare_exchange_strong(tagged, tagged | kReferencedMask,
+                                            std::memory_order_relaxed);
+    }
+  }
+
+  void Set(HashEntry* entry_ptr, uint8_t tag, uint32_t epoch) {
+    uint64_t new_tagged = reinterpret_cast<uint64_t>(entry_ptr) |
+                          (static_cast<uint64_t>(tag) << kTagShift) |
+                          (epoch & kEpochMask);
+    // Every entry is evictable in the second pass, concurrent setting may
+    // fail, which is fine for a cache
+    for (size_t i = 0; i < 2 * kNumEntries; i++) {
+      size_t idx = clock_hand_++ % kNumEntries;
+      uint64_t tagged = entries_[idx].load(std::memory_order_relaxed);
+      if ((tagged & kReferencedMask) &&
+          (tagged & kEpochMask) == (epoch & kEpochMask)) {
+        entries_[idx].compare_exchange_strong(tagged, tagged & ~kReferencedMask,
+                                              std::memory_order_relaxed);
+        continue;
+      }
+      entries_[idx].store(new_tagged, std::memory_order_relaxed);
+      return;
+    }
+  }
+
+  void Reset() {
+    for (size_t i = 0; i < kNumEntries; i++) {
+      entries_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  static constexpr uint64_t kEpochMask = 1;
+  static constexpr uint64_t kReferencedMask = 2;
+  static constexpr uint64_t kTagShift = 56;
+  // Hash entries are 16 bytes aligned and user space address is less than
+  // 2^56
+  static constexpr uint64_t kPointerMask =
+      ((1ULL << kTagShift) - 1) & ~(kEpochMask | kReferencedMask);
+
+  std::atomic<uint64_t> entries_[kNumEntries];
+  uint8_t clock_hand_ = 0;
+};
+
+// Hit and miss counts of hash caches of all slots
+struct HashCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
 };
 
 struct Slot {
   HashCache hash_cache;
-  SpinMutex spin;
+  // Writers lock the slot, while readers may read the slot optimistically and
+  // validate by sequence number of the lock, see HashTable::OptimisticRead()
+  SeqSpinMutex spin;
+  // Resize epoch of the bucket array that holds hash entries of this slot, the
+  // slot is migrated to the newest bucket array if it equals to epoch of the
+  // hash table
+  std::atomic<uint32_t> epoch{0};
+};
+
+// Hash buckets of a hash table at a certain size, including the main buckets
+// and the allocator of overflow buckets chained after the main buckets.
+//
+// The hash table may be backed by two bucket arrays while it's resizing.
+struct HashBucketArray {
+  HashBucketArray(uint64_t _num_buckets, uint32_t max_access_threads,
+                  Allocator* new_bucket_allocator)
+      : num_buckets(_num_buckets),
+        buckets(_num_buckets),
+        overflow_allocator(max_access_threads, new_bucket_allocator),
+        entry_counters(max_access_threads) {}
+
+  // Number of hash entries allocated in this bucket array
+  uint64_t NumEntries() {
+    uint64_t ret = 0;
+    for (uint64_t i = 0; i < entry_counters.size(); i++) {
+      ret += entry_counters[i].num_entries.load(std::memory_order_relaxed);
+    }
+    return ret;
+  }
+
+  struct alignas(64) EntryCounter {
+    std::atomic<uint64_t> num_entries{0};
+  };
+
+  const uint64_t num_buckets;
+  Array<HashBucket> buckets;
+  ChunkBasedAllocator overflow_allocator;
+  Array<EntryCounter> entry_counters;
 };
 
 struct HashTableIterator;
@@ -133,20 +274,32 @@ class HashTable {
       memcpy_16(&entry, &other.entry);
       entry_ptr = other.entry_ptr;
       key_hash_prefix = other.key_hash_prefix;
+      tag_ptr = other.tag_ptr;
       return *this;
     }
 
    private:
     friend class HashTable;
     uint32_t key_hash_prefix;
+    // Tag of the free-to-write hash entry, this is set only if may_insert and
+    // key not found
+    uint8_t* tag_ptr{nullptr};
   };
 
+  // Create a hash table with "hash_bucket_num" buckets
+  //
+  // The number of hash slots (hash_bucket_num / num_buckets_per_slot) is fixed
+  // during the lifetime of the hash table, while the buckets can be doubled
+  // online up to "max_hash_bucket_num", see Resize()
   static HashTable* NewHashTable(uint64_t hash_bucket_num,
                                  uint32_t num_buckets_per_slot,
+                                 uint64_t max_hash_bucket_num,
                                  const Allocator* kv_allocator,
                                  Allocator* new_bucket_allocator,
                                  uint32_t max_access_threads);
 
+  ~HashTable();
+
   // Look up key in hashtable
   // Store a copy of hash entry in LookupResult::entry, and a pointer to the
   // hash entry on hash table in LookupResult::entry_ptr
@@ -165,6 +318,15 @@ class HashTable {
   template <bool may_insert>
   LookupResult Lookup(const StringView& key, uint8_t type_mask);
 
+  // Look up a batch of keys in hashtable, store lookup result of keys[i] in
+  // (*results)[i] as Lookup<false>() does
+  //
+  // The keys are processed stage by stage: hash all keys, then prefetch their
+  // slots, buckets and indexed records before searching any of them, so cache
+  // misses of different keys overlap instead of being serialized
+  void MultiLookup(const std::vector<StringView>& keys, uint8_t type_mask,
+                   std::vector<LookupResult>* results);
+
   // Insert a hash entry to hash table
   // * insert_position: indicate the the postion to insert new entry, it should
   // be return of Lookup of the inserting key
@@ -181,26 +343,87 @@ class HashTable {
     entry_ptr->Clear();
   }
 
-  std::unique_lock<SpinMutex> AcquireLock(StringView const& key) {
-    return std::unique_lock<SpinMutex>{*getHint(key).spin};
+  std::unique_lock<SeqSpinMutex> AcquireLock(StringView const& key) {
+    return std::unique_lock<SeqSpinMutex>{*getHint(key).spin};
+  }
+
+  // Read hash entries of key without locking its slot
+  //
+  // "read_func" is called until no writer locked the slot during the call, so
+  // it should have no side effects other than overwriting its outputs, and
+  // should tolerate inconsistent data of a failed try. To avoid starving under
+  // write contention, read_func is called with slot locked after several
+  // failed tries.
+  //
+  // Notice: caller should hold a snapshot so data accessed by read_func won't
+  // be freed
+  template <typename ReadFunc>
+  void OptimisticRead(StringView const& key, ReadFunc read_func) {
+    optimisticRead(getHint(key).spin, read_func);
   }
 
   HashTableIterator GetIterator(uint64_t start_slot_idx, uint64_t end_slot_idx);
 
   size_t GetSlotsNum() { return slots_.size(); }
 
+  HashCacheStats GetCacheStats();
+
+  // Number of main buckets of the newest bucket array
+  uint64_t GetBucketsNum() {
+    return bucket_arrays_[epoch_.load(std::memory_order_acquire) & 1]
+        .load(std::memory_order_acquire)
+        ->num_buckets;
+  }
+
+  // Return true if average hash entries per bucket exceeds "max_load_factor"
+  // and the hash table is able to be doubled
+  bool NeedResize(double max_load_factor);
+
+  // Online resizing of hash table
+  //
+  // The hash buckets are doubled by StartResize(), then hash entries are
+  // migrated slot by slot under the slot lock by MigrateSlots(), so reads and
+  // writes to the hash table continue during resizing. After all slots
+  // migrated, FinishResize() retires the old buckets. As lockless readers may
+  // still access the retired buckets, caller should call
+  // ReleaseRetiredBuckets() after all readers began before FinishResize()
+  // finished.
+  //
+  // Notice: resizing functions should be called by a single thread
+
+  // Allocate the doubled bucket array
+  //
+  // Return Status::Ok on success, Status::Abort if last resizing not finished,
+  // its retired buckets not released or the hash table already reached max
+  // size, Status::MemoryOverflow if failed to allocate new buckets
+  Status StartResize();
+
+  // Migrate hash entries of slots in [start_slot_idx, end_slot_idx) to the new
+  // bucket array
+  void MigrateSlots(uint64_t start_slot_idx, uint64_t end_slot_idx);
+
+  // Retire the old bucket array after all slots migrated
+  void FinishResize();
+
+  bool Resizing() { return resizing_; }
+
+  bool HasRetiredBuckets() { return retired_buckets_ != nullptr; }
+
+  // Free the bucket array retired by last resizing
+  void ReleaseRetiredBuckets();
+
   // StringAlike is std::string or StringView
   template <typename StringAlike>
-  std::vector<std::unique_lock<SpinMutex>> RangeLock(
+  std::vector<std::unique_lock<SeqSpinMutex>> RangeLock(
       std::vector<StringAlike> const& keys) {
-    std::vector<SpinMutex*> spins;
+    std::vector<SeqSpinMutex*> spins;
     for (auto const& key : keys) {
       spins.push_back(getHint(key).spin);
     }
     std::sort(spins.begin(), spins.end());
     auto end = std::unique(spins.begin(), spins.end());
 
-    std::vector<std::unique_lock<SpinMutex>> guard;
+    std::vector<std::unique_lock<SeqSpinMutex>> guard;
     for (auto iter = spins.begin(); iter != end; ++iter) {
       guard.emplace_back(**iter);
     }
@@ -209,65 +432,109 @@ class HashTable {
 
  private:
   HashTable(uint64_t hash_bucket_num, uint32_t num_buckets_per_slot,
-            const Allocator* kv_allocator, Allocator* new_bucket_allocator,
-            uint32_t max_access_threads)
-      : num_hash_buckets_(hash_bucket_num),
-        num_buckets_per_slot_(num_buckets_per_slot),
+            uint64_t max_hash_bucket_num, const Allocator* kv_allocator,
+            Allocator* new_bucket_allocator, uint32_t max_access_threads)
+      : max_hash_bucket_num_(max_hash_bucket_num),
+        max_access_threads_(max_access_threads),
         kv_allocator_(kv_allocator),
-        chunk_based_bucket_allocator_{max_access_threads, new_bucket_allocator},
+        new_bucket_allocator_(new_bucket_allocator),
         slots_(hash_bucket_num / num_buckets_per_slot),
-        hash_bucket_entries_(hash_bucket_num, 0),
-        hash_buckets_(num_hash_buckets_) {}
+        cache_counters_(max_access_threads) {
+    bucket_arrays_[0].store(new HashBucketArray(
+        hash_bucket_num, max_access_threads, new_bucket_allocator));
+    bucket_arrays_[1].store(nullptr);
+  }
 
   struct KeyHashHint {
-    uint32_t bucket;
+    uint64_t key_hash_value;
     uint32_t slot;
     // hash value stored on hash entry
     uint32_t key_hash_prefix;
-    SpinMutex* spin;
+    SeqSpinMutex* spin;
   };
 
   KeyHashHint getHint(const StringView& key) {
     KeyHashHint hint;
-    uint64_t hash_val = hash_str(key.data(), key.size());
-    hint.key_hash_prefix = hash_val >> 32;
-    hint.bucket = get_bucket_num(hash_val);
-    hint.slot = get_slot_num(hint.bucket);
+    hint.key_hash_value = hash_str(key.data(), key.size());
+    hint.key_hash_prefix = hint.key_hash_value >> 32;
+    hint.slot = get_slot_num(hint.key_hash_value);
     hint.spin = &slots_[hint.slot].spin;
     return hint;
   }
 
-  inline uint32_t get_bucket_num(uint64_t key_hash_value) {
-    return key_hash_value & (num_hash_buckets_ - 1);
+  template <typename ReadFunc>
+  static void optimisticRead(SeqSpinMutex* spin, ReadFunc& read_func) {
+    constexpr int kMaxOptimisticReadTries = 8;
+    for (int i = 0; i < kMaxOptimisticReadTries; i++) {
+      uint32_t seq = spin->ReadBegin();
+      read_func();
+      if (spin->ReadValidate(seq)) {
+        return;
+      }
+    }
+    std::lock_guard<SeqSpinMutex> lg(*spin);
+    read_func();
   }
 
-  inline uint32_t get_slot_num(uint32_t bucket) {
-    return bucket / num_buckets_per_slot_;
+  template <bool may_insert>
+  LookupResult lookupImpl(const StringView& key, const KeyHashHint& hint,
+                          uint8_t type_mask);
+
+  // A slot contains every bucket with the same low bits as its index, so a key
+  // always belongs to the same slot while the buckets grows
+  inline uint32_t get_slot_num(uint64_t key_hash_value) {
+    return key_hash_value & (slots_.size() - 1);
+  }
+
+  inline uint64_t get_bucket_num(uint64_t key_hash_value,
+                                 HashBucketArray* bucket_array) {
+    return key_hash_value & (bucket_array->num_buckets - 1);
+  }
+
+  inline static uint8_t get_tag(uint32_t key_hash_prefix) {
+    return key_hash_prefix >> 24;
   }
 
+  // Bucket array holding hash entries of "slot", caller should either lock the
+  // slot or be protected from the bucket array being released
+  HashBucketArray* slotBuckets(Slot& slot) {
+    return bucket_arrays_[slot.epoch.load(std::memory_order_acquire) & 1].load(
+        std::memory_order_acquire);
+  }
+
+  // Move hash entries of a slot to the newest bucket array
+  void migrateSlot(uint64_t slot_idx);
+
   Status allocateEntry(HashBucketIterator& bucket_iter);
 
-  const uint64_t num_hash_buckets_;
-  const uint32_t num_buckets_per_slot_;
+  void recordCacheAccess(bool hit);
+
+  struct alignas(64) CacheCounter {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+  };
+
+  const uint64_t max_hash_bucket_num_;
+  const uint32_t max_access_threads_;
   const Allocator* kv_allocator_;
-  ChunkBasedAllocator chunk_based_bucket_allocator_;
+  Allocator* new_bucket_allocator_;
   Array<Slot> slots_;
-  std::vector<uint64_t> hash_bucket_entries_;
-  Array<HashBucket> hash_buckets_;
-  void* main_buckets_;
+  // Bucket array of resize epoch e is stored in bucket_arrays_[e % 2]
+  std::atomic<HashBucketArray*> bucket_arrays_[2];
+  std::atomic<uint32_t> epoch_{0};
+  bool resizing_{false};
+  HashBucketArray* retired_buckets_{nullptr};
+  Array<CacheCounter> cache_counters_;
 };
 
 // Iterator all hash entries in a hash table bucket
 class HashBucketIterator {
  public:
-  HashBucketIterator(HashTable* hash_table /* should be non-null */,
+  HashBucketIterator(HashBucketArray* bucket_array /* should be non-null */,
                      uint64_t bucket_idx)
-      : hash_table_(hash_table),
-        bucket_idx_(bucket_idx),
-        entry_idx_(0),
-        bucket_ptr_(nullptr) {
-    if (bucket_idx_ < hash_table_->hash_buckets_.size()) {
-      bucket_ptr_ = &hash_table_->hash_buckets_[bucket_idx_];
+      : bucket_array_(bucket_array), entry_idx_(0), bucket_ptr_(nullptr) {
+    if (bucket_idx < bucket_array_->num_buckets) {
+      bucket_ptr_ = &bucket_array_->buckets[bucket_idx];
       _mm_prefetch(bucket_ptr_, _MM_HINT_T0);
     }
   }
@@ -276,12 +543,11 @@ class HashBucketIterator {
 
   bool Valid() {
     return bucket_ptr_ != nullptr &&
-           entry_idx_ < hash_table_->hash_bucket_entries_[bucket_idx_];
+           entry_idx_ <
+               bucket_ptr_->num_entries.load(std::memory_order_acquire);
   }
 
-  HashEntry& operator*() {
-    return bucket_ptr_->hash_entries[entry_idx_ % kNumEntryPerBucket];
-  }
+  HashEntry& operator*() { return bucket_ptr_->hash_entries[entry_idx_]; }
 
   HashEntry* operator->() { return &operator*(); }
 
@@ -302,29 +568,32 @@ class HashBucketIterator {
   void next() {
     if (Valid()) {
       entry_idx_++;
-      if (entry_idx_ % kNumEntryPerBucket == 0 && Valid()) {
+      if (entry_idx_ == kNumEntryPerBucket && bucket_ptr_->next != nullptr) {
         bucket_ptr_ = bucket_ptr_->next;
+        entry_idx_ = 0;
         _mm_prefetch(bucket_ptr_, _MM_HINT_T0);
       }
     }
   }
 
-  HashTable* hash_table_;
-  uint64_t bucket_idx_;
+  HashBucketArray* bucket_array_;
+  // Index of current entry in the current 128 bytes bucket
   uint64_t entry_idx_;
   HashBucket* bucket_ptr_;
 };
 
 // Iterator all hash entries in a hash table slot
+//
+// Notice: the slot should be locked, otherwise it may be migrated by
+// HashTable::Resize() during iterating
 class HashSlotIterator {
  public:
   HashSlotIterator(HashTable* hash_table /* should be non null */,
                    uint64_t slot_idx)
-      : hash_table_(hash_table),
-        start_bucket_(hash_table_->num_buckets_per_slot_ * slot_idx),
-        end_bucket_(start_bucket_ + hash_table_->num_buckets_per_slot_),
-        current_bucket_(start_bucket_),
-        bucket_iter_(hash_table_, current_bucket_) {
+      : bucket_array_(hash_table->slotBuckets(hash_table->slots_[slot_idx])),
+        bucket_step_(hash_table->slots_.size()),
+        current_bucket_(slot_idx),
+        bucket_iter_(bucket_array_, current_bucket_) {
     getBucket();
   }
 
@@ -344,21 +613,20 @@ class HashSlotIterator {
   }
 
   bool Valid() {
-    return bucket_iter_.Valid() && current_bucket_ < end_bucket_ &&
-           current_bucket_ >= start_bucket_;
+    return bucket_iter_.Valid() && current_bucket_ < bucket_array_->num_buckets;
   }
 
  private:
   // Locate to bucket with hash entries from current
   void getBucket() {
     if (!bucket_iter_.Valid()) {
-      current_bucket_++;
-      while (current_bucket_ < end_bucket_) {
-        bucket_iter_ = HashBucketIterator(hash_table_, current_bucket_);
+      current_bucket_ += bucket_step_;
+      while (current_bucket_ < bucket_array_->num_buckets) {
+        bucket_iter_ = HashBucketIterator(bucket_array_, current_bucket_);
         if (bucket_iter_.Valid()) {
           return;
         }
-        current_bucket_++;
+        current_bucket_ += bucket_step_;
       }
     }
   }
@@ -372,9 +640,9 @@ class HashSlotIterator {
     }
   }
 
-  HashTable* hash_table_;
-  uint64_t start_bucket_;
-  uint64_t end_bucket_;
+  HashBucketArray* bucket_array_;
+  // Buckets of a slot are interleaved by the number of slots
+  uint64_t bucket_step_;
   uint64_t current_bucket_;
   HashBucketIterator bucket_iter_;
 };
@@ -388,9 +656,15 @@ struct HashTableIterator {
         current_slot_idx_(start_slot_idx),
         end_slot_idx_(end_slot_idx) {}
 
-  std::unique_lock<SpinMutex> AcquireSlotLock() {
-    SpinMutex* slot_lock = GetSlotLock();
-    return std::unique_lock<SpinMutex>(*slot_lock);
+  std::unique_lock<SeqSpinMutex> AcquireSlotLock() {
+    SeqSpinMutex* slot_lock = GetSlotLock();
+    return std::unique_lock<SeqSpinMutex>(*slot_lock);
+  }
+
+  // Read current slot without locking it, see HashTable::OptimisticRead()
+  template <typename ReadFunc>
+  void OptimisticReadSlot(ReadFunc read_func) {
+    HashTable::optimisticRead(GetSlotLock(), read_func);
   }
 
   void Next() {
@@ -405,13 +679,13 @@ struct HashTableIterator {
     return HashSlotIterator{hash_table_, current_slot_idx_};
   }
 
-  SpinMutex* GetSlotLock() {
+  SeqSpinMutex* GetSlotLock() {
     return &hash_table_->slots_[current_slot_idx_].spin;
   }
 
  private:
   // lock current access slot
-  std::unique_lock<SpinMutex> iter_lock_slot_;
+  std::unique_lock<SeqSpinMutex> iter_lock_slot_;
   // current slot id
   HashTable* hash_table_;
   uint64_t current_slot_idx_;
@@ -125,6 +125,7 @@ void KVEngine::startBackgroundWorks() {
   std::unique_lock<SpinMutex> ul(bg_work_signals_.terminating_lock);
   bg_work_signals_.terminating = false;
   bg_threads_.emplace_back(&KVEngine::backgroundMemoryUsageReporter, this);
+  bg_threads_.emplace_back(&KVEngine::backgroundHashTableResizer, this);
 
   bool close_reclaimer = false;
   TEST_SYNC_POINT_CALLBACK("KVEngine::backgroundCleaner::NothingToDo",
@@ -141,6 +142,7 @@ void KVEngine::terminateBackgroundWorks() {
     bg_work_signals_.terminating = true;
     bg_work_signals_.dram_cleaner_cv.notify_all();
     bg_work_signals_.memory_usage_reporter_cv.notify_all();
+    bg_work_signals_.hash_table_resizer_cv.notify_all();
   }
   for (auto& t : bg_threads_) {
     t.join();
@@ -183,8 +185,8 @@ Status KVEngine::init(const std::string& name, const Configs& configs) {
 
   hash_table_.reset(HashTable::NewHashTable(
       configs_.hash_bucket_num, configs_.num_buckets_per_slot,
-      kv_allocator_.get(), hashtable_new_bucket_allocator,
-      configs_.max_access_threads));
+      configs_.max_hash_bucket_num, kv_allocator_.get(),
+      hashtable_new_bucket_allocator, configs_.max_access_threads));
   dllist_locks_.reset(new LockTable{1UL << 20});
 
   if (kv_allocator_ == nullptr || hash_table_ == nullptr ||
@@ -210,13 +212,26 @@ Status KVEngine::Backup(const pmem::obj::string_view backup_log,
       static_cast<const SnapshotImpl*>(snapshot)->GetTimestamp();
   auto hashtable_iterator =
       hash_table_->GetIterator(0, hash_table_->GetSlotsNum());
+  std::vector<HashEntry> slot_entries;
   while (hashtable_iterator.Valid()) {
-    auto ul = hashtable_iterator.AcquireSlotLock();
-    auto slot_iter = hashtable_iterator.Slot();
-    while (slot_iter.Valid()) {
-      switch (slot_iter->GetRecordType()) {
+    // Copy hash entries of the slot without locking it, so writers to the slot
+    // are not blocked while we backup data indexed by these entries, which is
+    // protected by the backup snapshot
+    hashtable_iterator.OptimisticReadSlot([&]() {
+      slot_entries.clear();
+      auto slot_iter = hashtable_iterator.Slot();
+      while (slot_iter.Valid()) {
+        HashEntry entry(*slot_iter);
+        if (!entry.Empty() && !entry.Allocated()) {
+          slot_entries.push_back(entry);
+        }
+        slot_iter++;
+      }
+    });
+    for (const HashEntry& entry : slot_entries) {
+      switch (entry.GetRecordType()) {
         case RecordType::String: {
-          StringRecord* record = slot_iter->GetIndex().string_record;
+          StringRecord* record = entry.GetIndex().string_record;
           while (record != nullptr && record->GetTimestamp() > backup_ts) {
             record =
                 kv_allocator_->offset2addr<StringRecord>(record->old_version);
@@ -229,7 +244,7 @@ Status KVEngine::Backup(const pmem::obj::string_view backup_log,
           break;
         }
         case RecordType::SortedHeader: {
-          DLRecord* header = slot_iter->GetIndex().skiplist->HeaderRecord();
+          DLRecord* header = entry.GetIndex().skiplist->HeaderRecord();
           while (header != nullptr && header->GetTimestamp() > backup_ts) {
             header = kv_allocator_->offset2addr<DLRecord>(header->old_version);
           }
@@ -258,7 +273,7 @@ Status KVEngine::Backup(const pmem::obj::string_view backup_log,
           break;
         }
         case RecordType::HashHeader: {
-          DLRecord* header = slot_iter->GetIndex().hlist->HeaderRecord();
+          DLRecord* header = entry.GetIndex().hlist->HeaderRecord();
           while (header != nullptr && header->GetTimestamp() > backup_ts) {
             header = kv_allocator_->offset2addr<DLRecord>(header->old_version);
           }
@@ -286,7 +301,7 @@ Status KVEngine::Backup(const pmem::obj::string_view backup_log,
           break;
         }
         case RecordType::ListHeader: {
-          DLRecord* header = slot_iter->GetIndex().list->HeaderRecord();
+          DLRecord* header = entry.GetIndex().list->HeaderRecord();
           while (header != nullptr && header->GetTimestamp() > backup_ts) {
             header = kv_allocator_->offset2addr<DLRecord>(header->old_version);
           }
@@ -321,7 +336,6 @@ Status KVEngine::Backup(const pmem::obj::string_view backup_log,
         backup.Destroy();
         return s;
       }
-      slot_iter++;
     }
     hashtable_iterator.Next();
   }
@@ -541,6 +555,20 @@ Status KVEngine::checkGeneralConfigs(const Configs& configs) {
     return Status::InvalidConfiguration;
   }
 
+  if (!is_2pown(configs.max_hash_bucket_num) ||
+      configs.max_hash_bucket_num >= ((uint64_t)1 << 32) ||
+      configs.max_hash_bucket_num < configs.hash_bucket_num) {
+    GlobalLogger.Error(
+        "max_hash_bucket_num should be 2^n, smaller than 2^32 and not smaller "
+        "than hash_bucket_num\n");
+    return Status::InvalidConfiguration;
+  }
+
+  if (configs.hash_table_max_load_factor < 0) {
+    GlobalLogger.Error("hash_table_max_load_factor should not be negative\n");
+    return Status::InvalidConfiguration;
+  }
+
   return Status::Ok;
 }
 
@@ -804,32 +832,40 @@ Status KVEngine::batchWriteImpl(WriteBatchImpl const& batch) {
 
 Status KVEngine::GetTTL(const StringView key, TTLType* ttl_time) {
   *ttl_time = kInvalidTTL;
-  auto ul = hash_table_->AcquireLock(key);
-  auto res = lookupKey<false>(key, ExpirableRecordType);
-
-  if (res.s == Status::Ok) {
-    ExpireTimeType expire_time;
-    switch (res.entry_ptr->GetIndexType()) {
+  auto thread_holder = AcquireAccessThread();
+  // Hold a snapshot so data we read optimistically won't be freed
+  auto snapshot_holder = version_controller_.GetLocalSnapshotHolder();
+  HashTable::LookupResult res;
+  ExpireTimeType expire_time;
+  hash_table_->OptimisticRead(key, [&]() {
+    res = lookupKey<false>(key, ExpirableRecordType);
+    if (res.s != Status::Ok) {
+      return;
+    }
+    switch (res.entry.GetIndexType()) {
       case PointerType::Skiplist: {
-        expire_time = res.entry_ptr->GetIndex().skiplist->GetExpireTime();
+        expire_time = res.entry.GetIndex().skiplist->GetExpireTime();
         break;
       }
       case PointerType::List: {
-        expire_time = res.entry_ptr->GetIndex().list->GetExpireTime();
+        expire_time = res.entry.GetIndex().list->GetExpireTime();
         break;
       }
       case PointerType::HashList: {
-        expire_time = res.entry_ptr->GetIndex().hlist->GetExpireTime();
+        expire_time = res.entry.GetIndex().hlist->GetExpireTime();
         break;
       }
       case PointerType::StringRecord: {
-        expire_time = res.entry_ptr->GetIndex().string_record->GetExpireTime();
+        expire_time = res.entry.GetIndex().string_record->GetExpireTime();
         break;
       }
       default: {
-        return Status::NotSupported;
+        res.s = Status::NotSupported;
       }
     }
+  });
+
+  if (res.s == Status::Ok) {
     // return ttl time
     *ttl_time = TimeUtils::ExpireTimeToTTL(expire_time);
   }
@@ -837,6 +873,9 @@ Status KVEngine::GetTTL(const StringView key, TTLType* ttl_time) {
 }
 
 Status KVEngine::TypeOf(StringView key, ValueType* type) {
+  auto thread_holder = AcquireAccessThread();
+  // Hold a snapshot so the hash buckets we access won't be freed by resizing
+  auto snapshot_holder = version_controller_.GetLocalSnapshotHolder();
   auto res = lookupKey<false>(key, ExpirableRecordType);
 
   if (res.s == Status::Ok) {
@@ -948,44 +987,51 @@ template HashTable::LookupResult KVEngine::lookupElem<false>(StringView,
 template <bool may_insert>
 HashTable::LookupResult KVEngine::lookupKey(StringView key, uint8_t type_mask) {
   auto result = hash_table_->Lookup<may_insert>(key, PrimaryRecordType);
+  checkKeyLookupResult(&result, type_mask);
+  return result;
+}
 
-  if (result.s != Status::Ok) {
+void KVEngine::checkKeyLookupResult(HashTable::LookupResult* result,
+                                    uint8_t type_mask) {
+  if (result->s != Status::Ok) {
     kvdk_assert(
-        result.s == Status::NotFound || result.s == Status::MemoryOverflow, "");
-    return result;
+        result->s == Status::NotFound || result->s == Status::MemoryOverflow,
+        "");
+    return;
   }
 
-  RecordType type = result.entry.GetRecordType();
-  RecordStatus record_status = result.entry.GetRecordStatus();
+  RecordType type = result->entry.GetRecordType();
+  RecordStatus record_status = result->entry.GetRecordStatus();
   bool type_match = type_mask & type;
 
   // TODO: fix mvcc of different type keys
   if (!type_match) {
-    result.s = Status::WrongType;
+    result->s = Status::WrongType;
   } else if (record_status == RecordStatus::Outdated) {
-    result.s = Status::Outdated;
+    result->s = Status::Outdated;
   } else {
     switch (type) {
       case RecordType::String: {
-        result.s = result.entry.GetIndex().string_record->HasExpired()
-                       ? Status::Outdated
-                       : Status::Ok;
+        result->s = result->entry.GetIndex().string_record->HasExpired()
+                        ? Status::Outdated
+                        : Status::Ok;
         break;
       }
       case RecordType::SortedHeader:
-        result.s = result.entry.GetIndex().skiplist->HasExpired()
-                       ? Status::Outdated
-                       : Status::Ok;
+        result->s = result->entry.GetIndex().skiplist->HasExpired()
+                        ? Status::Outdated
+                        : Status::Ok;
 
         break;
       case RecordType::ListHeader:
-        result.s = result.entry.GetIndex().list->HasExpired() ? Status::Outdated
-                                                              : Status::Ok;
+        result->s = result->entry.GetIndex().list->HasExpired()
+                        ? Status::Outdated
+                        : Status::Ok;
         break;
       case RecordType::HashHeader: {
-        result.s = result.entry.GetIndex().hlist->HasExpired()
-                       ? Status::Outdated
-                       : Status::Ok;
+        result->s = result->entry.GetIndex().hlist->HasExpired()
+                        ? Status::Outdated
+                        : Status::Ok;
         break;
       }
       default: {
@@ -994,7 +1040,6 @@ HashTable::LookupResult KVEngine::lookupKey(StringView key, uint8_t type_mask) {
       }
     }
   }
-  return result;
 }
 
 template HashTable::LookupResult KVEngine::lookupKey<true>(StringView, uint8_t);
@@ -1058,6 +1103,54 @@ void KVEngine::backgroundMemoryUsageReporter() {
     }
     ReportMemoryUsage();
     GlobalLogger.Info("Cleaner Thread Num: %ld\n", cleaner_.ActiveThreadNum());
+    auto cache_stats = hash_table_->GetCacheStats();
+    GlobalLogger.Info("Hash Cache Hits: %lu, Misses: %lu\n", cache_stats.hits,
+                      cache_stats.misses);
+  }
+}
+
+void KVEngine::backgroundHashTableResizer() {
+  // Number of slots migrated per access thread acquiring
+  constexpr uint64_t kMigrateSlotsUnit = 1024;
+  auto interval = std::chrono::milliseconds{
+      static_cast<std::uint64_t>(configs_.background_work_interval * 1000)};
+  TimestampType retire_ts = 0;
+  while (!bg_work_signals_.terminating) {
+    {
+      std::unique_lock<SpinMutex> ul(bg_work_signals_.terminating_lock);
+      if (!bg_work_signals_.terminating) {
+        bg_work_signals_.hash_table_resizer_cv.wait_for(ul, interval);
+      }
+    }
+
+    if (hash_table_->HasRetiredBuckets()) {
+      version_controller_.UpdateLocalOldestSnapshot();
+      if (retire_ts < std::min(version_controller_.LocalOldestSnapshotTS(),
+                               version_controller_.GlobalOldestSnapshotTs())) {
+        hash_table_->ReleaseRetiredBuckets();
+      }
+    }
+
+    if (!hash_table_->NeedResize(configs_.hash_table_max_load_factor) ||
+        hash_table_->StartResize() != Status::Ok) {
+      continue;
+    }
+
+    uint64_t slot_idx = 0;
+    while (slot_idx < hash_table_->GetSlotsNum() &&
+           !bg_work_signals_.terminating) {
+      // Overflow buckets are allocated from per-access-thread cache
+      auto thread_holder = AcquireAccessThread();
+      hash_table_->MigrateSlots(slot_idx, slot_idx + kMigrateSlotsUnit);
+      slot_idx += kMigrateSlotsUnit;
+    }
+
+    if (slot_idx >= hash_table_->GetSlotsNum()) {
+      hash_table_->FinishResize();
+      retire_ts = version_controller_.GetCurrentTimestamp();
+      GlobalLogger.Info("Hash table resized to %lu buckets\n",
+                        hash_table_->GetBucketsNum());
+    }
   }
 }
 
@@ -78,6 +78,9 @@ class KVEngine : public Engine {
 
   // String
   Status Get(const StringView key, std::string* value) override;
+  Status MultiGet(const std::vector<StringView>& keys,
+                  std::vector<std::string>* values,
+                  std::vector<Status>* statuses) override;
   Status Put(const StringView key, const StringView value,
              const WriteOptions& write_options) override;
   Status Delete(const StringView key) override;
@@ -284,6 +287,11 @@ class KVEngine : public Engine {
   template <bool may_insert>
   HashTable::LookupResult lookupKey(StringView key, uint8_t type_mask);
 
+  // Check type and status of a key found by hash table lookup, and update
+  // result->s as the return status of lookupKey
+  void checkKeyLookupResult(HashTable::LookupResult* result,
+                            uint8_t type_mask);
+
   // Look up a collection element in hash table
   //
   // Store a copy of hash entry in LookupResult::entry, and a pointer to the
@@ -524,6 +532,10 @@ class KVEngine : public Engine {
   // Run in background to report DRAM/PMem usage regularly
   void backgroundMemoryUsageReporter();
 
+  // Run in background to grow hash table if it's overloaded, and release
+  // retired hash buckets after no reader accessing them
+  void backgroundHashTableResizer();
+
   /* functions for cleaner thread cache */
   // Remove old version records from version chain of new_record and cache it
   template <typename T>
@@ -591,6 +603,7 @@ class KVEngine : public Engine {
 
     std::condition_variable_any memory_usage_reporter_cv;
     std::condition_variable_any dram_cleaner_cv;
+    std::condition_variable_any hash_table_resizer_cv;
 
     SpinMutex terminating_lock;
     bool terminating = false;
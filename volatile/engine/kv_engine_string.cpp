@@ -131,6 +131,52 @@ Status KVEngine::Get(const StringView key, std::string* value) {
   }
 }
 
+Status KVEngine::MultiGet(const std::vector<StringView>& keys,
+                          std::vector<std::string>* values,
+                          std::vector<Status>* statuses) {
+  auto thread_holder = AcquireAccessThread();
+
+  for (const StringView& key : keys) {
+    if (!checkKeySize(key)) {
+      return Status::InvalidDataSize;
+    }
+  }
+  values->resize(keys.size());
+  statuses->resize(keys.size());
+
+  auto holder = version_controller_.GetLocalSnapshotHolder();
+  std::vector<HashTable::LookupResult> results;
+  hash_table_->MultiLookup(keys, PrimaryRecordType, &results);
+
+  // Check all found keys and prefetch their values before copying any of them
+  for (auto& ret : results) {
+    checkKeyLookupResult(&ret, RecordType::String);
+    if (ret.s == Status::Ok) {
+      _mm_prefetch(ret.entry.GetIndex().string_record->Value().data(),
+                   _MM_HINT_T0);
+    }
+  }
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto& ret = results[i];
+    if (ret.s == Status::Ok) {
+      StringRecord* string_record = ret.entry.GetIndex().string_record;
+      kvdk_assert(
+          string_record->GetRecordType() == RecordType::String &&
+              string_record->GetRecordStatus() != RecordStatus::Outdated,
+          "Got wrong data type in string get");
+      kvdk_assert(string_record->ValidOrDirty(), "Corrupted data in string get");
+      (*values)[i].assign(string_record->Value().data(),
+                          string_record->Value().size());
+      (*statuses)[i] = Status::Ok;
+    } else {
+      (*values)[i].clear();
+      (*statuses)[i] = ret.s == Status::Outdated ? Status::NotFound : ret.s;
+    }
+  }
+  return Status::Ok;
+}
+
 Status KVEngine::Delete(const StringView key) {
   auto thread_holder = AcquireAccessThread();
 
@@ -197,6 +197,57 @@ class SpinMutex {
   SpinMutex& operator=(const SpinMutex& s) = delete;
 };
 
+// A spin mutex with a sequence number, which is odd while locked and increased
+// by both lock() and unlock(). Besides locking, readers can read data protected
+// by it optimistically: begin with ReadBegin(), read data, then the read data
+// is consistent if ReadValidate() returns true, otherwise retry.
+class SeqSpinMutex {
+ private:
+  std::atomic<uint32_t> seq_{0};
+
+ public:
+  SeqSpinMutex() = default;
+
+  void lock() {
+    while (!try_lock()) {
+      for (size_t i = 0; i != 64; ++i) {
+        _mm_pause();
+      }
+    }
+  }
+
+  void unlock() {
+    seq_.store(seq_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+
+  bool try_lock() {
+    uint32_t seq = seq_.load(std::memory_order_relaxed);
+    return (seq & 1) == 0 &&
+           seq_.compare_exchange_strong(seq, seq + 1,
+                                        std::memory_order_acquire);
+  }
+
+  // Wait until unlocked and return the sequence number
+  uint32_t ReadBegin() const {
+    uint32_t seq;
+    while ((seq = seq_.load(std::memory_order_acquire)) & 1) {
+      _mm_pause();
+    }
+    return seq;
+  }
+
+  // Return true if no writer locked the mutex since ReadBegin() returned "seq"
+  bool ReadValidate(uint32_t seq) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return seq_.load(std::memory_order_relaxed) == seq;
+  }
+
+  SeqSpinMutex(const SeqSpinMutex& s) = delete;
+  SeqSpinMutex(SeqSpinMutex&& s) = delete;
+  SeqSpinMutex& operator=(const SeqSpinMutex& s) = delete;
+};
+
 template <typename SharedMutex>
 class SharedLock {
  public:
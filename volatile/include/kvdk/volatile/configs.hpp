@@ -54,6 +54,19 @@ struct Configs {
   // contentions and more memory consumption
   uint32_t num_buckets_per_slot = 1;
 
+  // Max average number of hash entries per bucket
+  //
+  // A background thread doubles hash buckets online while the average hash
+  // entries per bucket exceeds this, so the hash table can start small and
+  // grow with the data set. Set it to 0 to disable resizing
+  double hash_table_max_load_factor = 4.0;
+
+  // The max number of hash buckets the hash table can grow to
+  //
+  // It should be 2^n, should smaller than 2^32 and not smaller than
+  // hash_bucket_num
+  uint64_t max_hash_bucket_num = (1ULL << 31);
+
   // Time interval to do background work in seconds
   //
   // In KVDK, a background thread will regularly organize free space,
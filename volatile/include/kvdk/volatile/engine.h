@@ -99,6 +99,13 @@ extern KVDKStatus KVDKBatchWrite(KVDKEngine* engine,
 // For Anonymous Global Collection
 extern KVDKStatus KVDKGet(KVDKEngine* engine, const char* key, size_t key_len,
                           size_t* val_len, char** val);
+// Get values of "num_keys" keys in one batch, value and status of keys[i] are
+// stored to vals[i], val_lens[i] and statuses[i]. vals[i] is set to NULL if
+// keys[i] is not found, otherwise it should be freed by caller
+extern KVDKStatus KVDKMultiGet(KVDKEngine* engine, size_t num_keys,
+                               const char** keys, const size_t* key_lens,
+                               char** vals, size_t* val_lens,
+                               KVDKStatus* statuses);
 extern KVDKStatus KVDKPut(KVDKEngine* engine, const char* key, size_t key_len,
                           const char* val, size_t val_len,
                           const KVDKWriteOptions* write_option);
@@ -79,6 +79,23 @@ class Engine {
   // Return Status::NotFound if the "key" does not exist.
   virtual Status Get(const StringView key, std::string* value) = 0;
 
+  // Search a batch of STRING-type KVs of "keys" in the kvdk instance on a
+  // consistent snapshot. Cache misses of different keys are overlapped, so
+  // this is faster than calling Get() for each key.
+  //
+  // Args:
+  // * values: store value of keys[i] to (*values)[i], resized to keys.size()
+  // * statuses: store status of keys[i] to (*statuses)[i] as Get() returns,
+  // resized to keys.size()
+  //
+  // Return:
+  // Return Status::Ok if all keys searched, check "statuses" for result of
+  // each key.
+  // Return Status::InvalidDataSize if any key is too long.
+  virtual Status MultiGet(const std::vector<StringView>& keys,
+                          std::vector<std::string>* values,
+                          std::vector<Status>* statuses) = 0;
+
   // Remove STRING-type KV of "key".
   //
   // Return:
@@ -848,6 +848,62 @@ TEST_F(EngineBasicTest, TestStringModify) {
   delete engine;
 }
 
+TEST_F(EngineBasicTest, TestStringMultiGet) {
+  int num_threads = 16;
+  int num_keys = 1000;
+  // Few buckets so keys in a batch share buckets
+  configs.hash_bucket_num = 64;
+  configs.num_buckets_per_slot = 1;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+
+  std::string sorted_collection = "sorted_collection";
+  ASSERT_EQ(engine->SortedCreate(sorted_collection), Status::Ok);
+  for (int i = 0; i < num_keys; i++) {
+    std::string key = "key" + std::to_string(i);
+    if (i % 3 != 1) {
+      ASSERT_EQ(engine->Put(key, "value" + std::to_string(i)), Status::Ok);
+    }
+    if (i % 3 == 2) {
+      ASSERT_EQ(engine->Delete(key), Status::Ok);
+    }
+  }
+
+  auto MultiGet = [&](int tid) {
+    std::vector<std::string> key_strs;
+    for (int i = tid; i < num_keys; i += num_threads) {
+      key_strs.push_back("key" + std::to_string(i));
+    }
+    key_strs.push_back(sorted_collection);
+    std::vector<StringView> keys(key_strs.begin(), key_strs.end());
+    std::vector<std::string> values;
+    std::vector<Status> statuses;
+    ASSERT_EQ(engine->MultiGet(keys, &values, &statuses), Status::Ok);
+    ASSERT_EQ(values.size(), keys.size());
+    ASSERT_EQ(statuses.size(), keys.size());
+    for (size_t k = 0; k + 1 < keys.size(); k++) {
+      int i = tid + k * num_threads;
+      if (i % 3 == 0) {
+        ASSERT_EQ(statuses[k], Status::Ok);
+        ASSERT_EQ(values[k], "value" + std::to_string(i));
+      } else {
+        ASSERT_EQ(statuses[k], Status::NotFound);
+      }
+    }
+    ASSERT_EQ(statuses.back(), Status::WrongType);
+  };
+  LaunchNThreads(num_threads, MultiGet);
+
+  std::vector<std::string> values;
+  std::vector<Status> statuses;
+  ASSERT_EQ(engine->MultiGet({}, &values, &statuses), Status::Ok);
+  ASSERT_TRUE(values.empty() && statuses.empty());
+  std::string long_key(UINT16_MAX + 1, 'a');
+  ASSERT_EQ(engine->MultiGet({"key0", long_key}, &values, &statuses),
+            Status::InvalidDataSize);
+  delete engine;
+}
+
 TEST_F(BatchWriteTest, Sorted) {
   size_t num_threads = 1;
   for (int index_with_hashtable : {0, 1}) {
@@ -1856,6 +1912,163 @@ TEST_F(EngineBasicTest, TestHashTableIterator) {
   delete engine;
 }
 
+TEST_F(EngineBasicTest, TestHashTableResize) {
+  size_t num_threads = 8;
+  size_t num_keys_per_thread = 5000;
+  configs.hash_table_max_load_factor = 1.0;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  auto hash_table = static_cast<KVEngine*>(engine)->GetHashTable();
+  uint64_t init_buckets_num = hash_table->GetBucketsNum();
+  ASSERT_EQ(init_buckets_num, configs.hash_bucket_num);
+
+  std::string collection_name = "sortedcollection";
+  ASSERT_EQ(engine->SortedCreate(collection_name), Status::Ok);
+  // Read and write while resizing
+  auto PutAndGet = [&](size_t id) {
+    std::string value;
+    for (size_t i = 0; i < num_keys_per_thread; i++) {
+      std::string key = std::to_string(id) + "key" + std::to_string(i);
+      if (i % 2 == 0) {
+        ASSERT_EQ(engine->Put(key, key), Status::Ok);
+        ASSERT_EQ(engine->Get(key, &value), Status::Ok);
+      } else {
+        ASSERT_EQ(engine->SortedPut(collection_name, key, key), Status::Ok);
+        ASSERT_EQ(engine->SortedGet(collection_name, key, &value), Status::Ok);
+      }
+      ASSERT_EQ(value, key);
+    }
+  };
+  LaunchNThreads(num_threads, PutAndGet);
+
+  auto CheckKeys = [&](size_t id) {
+    std::string value;
+    for (size_t i = 0; i < num_keys_per_thread; i++) {
+      std::string key = std::to_string(id) + "key" + std::to_string(i);
+      if (i % 2 == 0) {
+        ASSERT_EQ(engine->Get(key, &value), Status::Ok);
+      } else {
+        ASSERT_EQ(engine->SortedGet(collection_name, key, &value), Status::Ok);
+      }
+      ASSERT_EQ(value, key);
+    }
+  };
+
+  // Wait background thread grows hash table to fit all keys
+  uint64_t expected_buckets_num = init_buckets_num;
+  while (expected_buckets_num < num_threads * num_keys_per_thread) {
+    expected_buckets_num *= 2;
+  }
+  for (int i = 0; i < 100; i++) {
+    if (hash_table->GetBucketsNum() >= expected_buckets_num &&
+        !hash_table->Resizing()) {
+      break;
+    }
+    LaunchNThreads(num_threads, CheckKeys);
+  }
+  ASSERT_GE(hash_table->GetBucketsNum(), expected_buckets_num);
+  LaunchNThreads(num_threads, CheckKeys);
+  delete engine;
+}
+
+TEST_F(EngineBasicTest, TestHashCache) {
+  // All keys locate in a single slot
+  configs.num_buckets_per_slot = configs.hash_bucket_num;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  auto hash_table = static_cast<KVEngine*>(engine)->GetHashTable();
+  ASSERT_EQ(hash_table->GetSlotsNum(), 1);
+
+  size_t num_cold_keys = 100;
+  std::vector<std::string> hot_keys;
+  for (size_t i = 0; i < HashCache::kNumEntries; i++) {
+    hot_keys.push_back("hot_key" + std::to_string(i));
+    ASSERT_EQ(engine->Put(hot_keys.back(), hot_keys.back()), Status::Ok);
+  }
+  for (size_t i = 0; i < num_cold_keys; i++) {
+    std::string key = "cold_key" + std::to_string(i);
+    ASSERT_EQ(engine->Put(key, key), Status::Ok);
+  }
+
+  std::string value;
+  // Warm up cache
+  for (int i = 0; i < 2; i++) {
+    for (auto& key : hot_keys) {
+      ASSERT_EQ(engine->Get(key, &value), Status::Ok);
+    }
+  }
+
+  auto stats_before = hash_table->GetCacheStats();
+  size_t num_rounds = 1000;
+  for (size_t i = 0; i < num_rounds; i++) {
+    for (auto& key : hot_keys) {
+      ASSERT_EQ(engine->Get(key, &value), Status::Ok);
+      ASSERT_EQ(value, key);
+    }
+  }
+  auto stats_after = hash_table->GetCacheStats();
+  ASSERT_GE(stats_after.hits - stats_before.hits,
+            num_rounds * hot_keys.size());
+
+  // Cold keys are still readable
+  for (size_t i = 0; i < num_cold_keys; i++) {
+    std::string key = "cold_key" + std::to_string(i);
+    ASSERT_EQ(engine->Get(key, &value), Status::Ok);
+    ASSERT_EQ(value, key);
+  }
+  ASSERT_GT(hash_table->GetCacheStats().misses, stats_after.misses);
+  delete engine;
+}
+
+TEST_F(EngineBasicTest, TestHashSlotOptimisticRead) {
+  // All keys locate in a single slot
+  configs.num_buckets_per_slot = configs.hash_bucket_num;
+  ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
+            Status::Ok);
+  auto hash_table = static_cast<KVEngine*>(engine)->GetHashTable();
+  int num_writers = 4;
+  int num_readers = 4;
+  int num_writes = 10000;
+  TTLType ttl = 1000000;
+  std::string key = "key";
+  ASSERT_EQ(engine->Put(key, "value"), Status::Ok);
+
+  // Data written under slot lock should be read consistently
+  std::atomic<uint64_t> a{0};
+  std::atomic<uint64_t> b{0};
+  std::atomic<int> finished_writers{0};
+  auto WriteRead = [&](int tid) {
+    if (tid < num_writers) {
+      for (int i = 0; i < num_writes; i++) {
+        {
+          auto ul = hash_table->AcquireLock(key);
+          a.fetch_add(1);
+          b.fetch_add(1);
+        }
+        ASSERT_EQ(engine->Expire(key, i % 2 ? ttl : kPersistTTL), Status::Ok);
+      }
+      finished_writers++;
+    } else {
+      while (finished_writers.load() < num_writers) {
+        uint64_t read_a, read_b;
+        hash_table->OptimisticRead(key, [&]() {
+          read_a = a.load();
+          read_b = b.load();
+        });
+        ASSERT_EQ(read_a, read_b);
+
+        TTLType ttl_time;
+        ASSERT_EQ(engine->GetTTL(key, &ttl_time), Status::Ok);
+        ASSERT_TRUE(ttl_time == kPersistTTL ||
+                    (ttl_time > 0 && ttl_time <= ttl));
+      }
+    }
+  };
+  LaunchNThreads(num_writers + num_readers, WriteRead);
+  ASSERT_EQ(a.load(), num_writers * num_writes);
+  delete engine;
+}
+
 TEST_F(EngineBasicTest, TestExpireAPI) {
   ASSERT_EQ(Engine::Open(db_path.c_str(), &engine, configs, stdout),
             Status::Ok);